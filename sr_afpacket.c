@@ -0,0 +1,572 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_afpacket.c
+ *
+ * Description:
+ *
+ * AF_PACKET TPACKET_V3 data plane; see sr_afpacket.h.
+ *
+ * The receive ring is a ring of blocks. The kernel packs as many frames
+ * into a block as fit and flips it over to us when it is full or has been
+ * open SR_AFP_RETIRE_MS; we walk every frame in it and flip it back. The
+ * transmit ring is a ring of fixed SR_AFP_FRAME_SZ slots that we fill and
+ * mark for sending; sendto() with no data then sends whatever is marked.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "sr_afpacket.h"
+#include "sr_router.h"
+#include "sr_if.h"
+#include "sr_loop.h"
+#include "sr_transport.h"
+
+#ifdef _LINUX_
+
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <linux/if_packet.h>
+#include <linux/if_ether.h>
+
+#define AFP_HDRLEN  TPACKET_ALIGN(sizeof(struct tpacket3_hdr))
+
+/*---------------------------------------------------------------------
+ * Method: afp_kick(..)
+ * Scope:  Local
+ *
+ * Send everything marked in port's transmit ring. Caller holds tx_lock.
+ *
+ *---------------------------------------------------------------------*/
+
+static void afp_kick(struct sr_afp_port* port, int flags)
+{
+    if(port->tx_pending == 0)
+    { return; }
+
+    if(sendto(port->fd, 0, 0, flags, 0, 0) < 0 && errno != EAGAIN)
+    { perror("sendto(..):sr_afpacket.c::afp_kick"); }
+    port->stats.tx_kicks++;
+    port->tx_pending = 0;
+} /* -- afp_kick -- */
+
+/*---------------------------------------------------------------------
+ * Method: afp_port_open(..)
+ * Scope:  Local
+ *
+ * Open the packet socket and rings for one interface, and find its MAC
+ * and (unless we were given one) IPv4 address.
+ *
+ *---------------------------------------------------------------------*/
+
+static int afp_port_open(struct sr_afp_port* port, unsigned char* mac,
+        uint32_t* ip)
+{
+    struct tpacket_req3 req;
+    struct sockaddr_ll sll;
+    size_t rx_sz, tx_sz;
+    int v = TPACKET_V3;
+
+    port->fd = socket(AF_PACKET, SOCK_RAW | SOCK_CLOEXEC, htons(ETH_P_ALL));
+    if(port->fd < 0)
+    {
+        perror("socket(..):sr_afpacket.c::afp_port_open");
+        return -1;
+    }
+
+    if(sr_if_from_host(port->name, &port->ifindex, mac, ip) < 0)
+    { return -1; }
+
+    /* -- rings -- */
+    if(setsockopt(port->fd, SOL_PACKET, PACKET_VERSION, &v, sizeof(v)) < 0)
+    {
+        perror("setsockopt(PACKET_VERSION):sr_afpacket.c::afp_port_open");
+        return -1;
+    }
+
+    memset(&req, 0, sizeof(req));
+    req.tp_block_size = SR_AFP_BLOCK_SZ;
+    req.tp_block_nr   = SR_AFP_RX_BLOCKS;
+    req.tp_frame_size = SR_AFP_FRAME_SZ;
+    req.tp_frame_nr   = SR_AFP_BLOCK_SZ / SR_AFP_FRAME_SZ * SR_AFP_RX_BLOCKS;
+    req.tp_retire_blk_tov = SR_AFP_RETIRE_MS;
+    if(setsockopt(port->fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) < 0)
+    {
+        perror("setsockopt(PACKET_RX_RING):sr_afpacket.c::afp_port_open");
+        return -1;
+    }
+
+    memset(&req, 0, sizeof(req));
+    req.tp_block_size = SR_AFP_BLOCK_SZ;
+    req.tp_block_nr   = SR_AFP_TX_BLOCKS;
+    req.tp_frame_size = SR_AFP_FRAME_SZ;
+    req.tp_frame_nr   = SR_AFP_BLOCK_SZ / SR_AFP_FRAME_SZ * SR_AFP_TX_BLOCKS;
+    if(setsockopt(port->fd, SOL_PACKET, PACKET_TX_RING, &req, sizeof(req)) < 0)
+    {
+        perror("setsockopt(PACKET_TX_RING):sr_afpacket.c::afp_port_open");
+        return -1;
+    }
+
+    rx_sz = (size_t)SR_AFP_BLOCK_SZ * SR_AFP_RX_BLOCKS;
+    tx_sz = (size_t)SR_AFP_BLOCK_SZ * SR_AFP_TX_BLOCKS;
+    port->map_sz = rx_sz + tx_sz;
+    port->map = (uint8_t*)mmap(0, port->map_sz, PROT_READ | PROT_WRITE,
+                               MAP_SHARED | MAP_LOCKED, port->fd, 0);
+    if(port->map == MAP_FAILED)
+    {
+        /* -- MAP_LOCKED needs RLIMIT_MEMLOCK to allow it -- */
+        port->map = (uint8_t*)mmap(0, port->map_sz, PROT_READ | PROT_WRITE,
+                                   MAP_SHARED, port->fd, 0);
+    }
+    if(port->map == MAP_FAILED)
+    {
+        port->map = 0;
+        perror("mmap(..):sr_afpacket.c::afp_port_open");
+        return -1;
+    }
+    port->rx = port->map;
+    port->tx = port->map + rx_sz;
+
+#ifdef PACKET_IGNORE_OUTGOING
+    /* -- don't show us our own transmits; we also check below -- */
+    v = 1;
+    setsockopt(port->fd, SOL_PACKET, PACKET_IGNORE_OUTGOING, &v, sizeof(v));
+#endif
+
+    memset(&sll, 0, sizeof(sll));
+    sll.sll_family   = AF_PACKET;
+    sll.sll_protocol = htons(ETH_P_ALL);
+    sll.sll_ifindex  = port->ifindex;
+    if(bind(port->fd, (struct sockaddr*)&sll, sizeof(sll)) < 0)
+    {
+        perror("bind(..):sr_afpacket.c::afp_port_open");
+        return -1;
+    }
+
+    return 0;
+} /* -- afp_port_open -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_afpacket_open(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+struct sr_afpacket* sr_afpacket_open(struct sr_instance* sr, const char* spec)
+{
+    struct sr_afpacket* afp;
+    struct sr_afp_port* port;
+    unsigned char mac[ETHER_ADDR_LEN];
+    struct in_addr addr;
+    char* list;
+    char* name;
+    char* eq;
+    char* save = 0;
+
+    /* REQUIRES */
+    assert(sr);
+    assert(spec);
+
+    afp = (struct sr_afpacket*)calloc(1, sizeof(struct sr_afpacket));
+    assert(afp);
+    afp->sr = sr;
+
+    list = strdup(spec);
+    for(name = strtok_r(list, ",", &save); name; name = strtok_r(0, ",", &save))
+    {
+        if(afp->nports == SR_AFP_PORTS_MAX)
+        {
+            fprintf(stderr, "Error: at most %d interfaces\n", SR_AFP_PORTS_MAX);
+            break;
+        }
+
+        addr.s_addr = 0;
+        if((eq = strchr(name, '=')) != 0)
+        {
+            *eq = 0;
+            if(inet_aton(eq + 1, &addr) == 0)
+            {
+                fprintf(stderr, "Error: bad address %s for %s\n", eq + 1, name);
+                break;
+            }
+        }
+
+        port = &afp->ports[afp->nports++];
+        port->fd = -1;
+        pthread_mutex_init(&port->tx_lock, 0);
+        strncpy(port->name, name, sr_IFACE_NAMELEN - 1);
+        if(afp_port_open(port, mac, &addr.s_addr) < 0)
+        { break; }
+
+        /* -- as sr_handle_hwinfo does for interfaces the server tells us of -- */
+        sr_add_interface(sr, port->name);
+        sr_get_interface(sr, port->name)->port = port;
+        sr_set_ether_addr(sr, mac);
+        sr_set_ether_ip(sr, addr.s_addr);
+    }
+    free(list);
+
+    if(name || afp->nports == 0)
+    {
+        sr_afpacket_close(afp);
+        return 0;
+    }
+
+    printf("Router interfaces:\n");
+    sr_print_if_list(sr);
+
+    return afp;
+} /* -- sr_afpacket_open -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_afpacket_close(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_afpacket_close(struct sr_afpacket* afp)
+{
+    struct sr_afp_port* port;
+    int i;
+
+    if(!afp)
+    { return; }
+
+    for(i = 0; i < afp->nports; i++)
+    {
+        port = &afp->ports[i];
+        if(port->map)
+        {
+            pthread_mutex_lock(&port->tx_lock);
+            afp_kick(port, 0);
+            pthread_mutex_unlock(&port->tx_lock);
+            munmap(port->map, port->map_sz);
+        }
+        if(port->fd >= 0)
+        { close(port->fd); }
+        pthread_mutex_destroy(&port->tx_lock);
+    }
+    free(afp);
+} /* -- sr_afpacket_close -- */
+
+/*---------------------------------------------------------------------
+ * Method: afp_flush(..)
+ * Scope:  Local
+ *
+ *---------------------------------------------------------------------*/
+
+static void afp_flush(struct sr_afpacket* afp)
+{
+    struct sr_afp_port* port;
+    int i;
+
+    for(i = 0; i < afp->nports; i++)
+    {
+        port = &afp->ports[i];
+        if(port->tx_pending == 0)
+        { continue; }
+        pthread_mutex_lock(&port->tx_lock);
+        afp_kick(port, MSG_DONTWAIT);
+        pthread_mutex_unlock(&port->tx_lock);
+    }
+} /* -- afp_flush -- */
+
+/*---------------------------------------------------------------------
+ * Method: afp_rx(..)
+ * Scope:  Local
+ *
+ * Handle every block the kernel has handed us on port.
+ *
+ *---------------------------------------------------------------------*/
+
+static void afp_rx(struct sr_afpacket* afp, struct sr_afp_port* port)
+{
+    struct tpacket_block_desc* bd;
+    struct tpacket3_hdr* ppd;
+    struct sockaddr_ll* sll;
+    unsigned int i, n;
+
+    __atomic_add_fetch(&afp->corked, 1, __ATOMIC_SEQ_CST);
+    while(1)
+    {
+        bd = (struct tpacket_block_desc*)(port->rx +
+                (size_t)port->rx_block * SR_AFP_BLOCK_SZ);
+        if(!(__atomic_load_n(&bd->hdr.bh1.block_status, __ATOMIC_ACQUIRE) &
+                    TP_STATUS_USER))
+        { break; }
+
+        n = bd->hdr.bh1.num_pkts;
+        ppd = (struct tpacket3_hdr*)((uint8_t*)bd + bd->hdr.bh1.offset_to_first_pkt);
+        for(i = 0; i < n; i++)
+        {
+            sll = (struct sockaddr_ll*)((uint8_t*)ppd + AFP_HDRLEN);
+            if(sll->sll_pkttype == PACKET_OUTGOING ||
+               sll->sll_pkttype == PACKET_OTHERHOST)
+            { port->stats.rx_ignored++; }
+            else
+            {
+                port->stats.rx_packets++;
+                port->stats.rx_bytes += ppd->tp_snaplen;
+                sr_receive_packet(afp->sr, (uint8_t*)ppd + ppd->tp_mac,
+                                  ppd->tp_snaplen, port->name);
+            }
+            ppd = (struct tpacket3_hdr*)((uint8_t*)ppd + ppd->tp_next_offset);
+        }
+
+        port->stats.rx_blocks++;
+        __atomic_store_n(&bd->hdr.bh1.block_status, TP_STATUS_KERNEL,
+                         __ATOMIC_RELEASE);
+        port->rx_block = (port->rx_block + 1) % SR_AFP_RX_BLOCKS;
+    }
+    __atomic_sub_fetch(&afp->corked, 1, __ATOMIC_SEQ_CST);
+
+    /* -- whatever the frames we just handled made us send -- */
+    afp_flush(afp);
+} /* -- afp_rx -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_afpacket_watch(..), sr_afpacket_poll(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+static void afp_ready(struct sr_loop* loop, int fd, void* arg)
+{
+    struct sr_afp_port* port = (struct sr_afp_port*)arg;
+
+    afp_rx((struct sr_afpacket*)loop->sr->transport->state, port);
+} /* -- afp_ready -- */
+
+int sr_afpacket_watch(struct sr_afpacket* afp, struct sr_loop* loop)
+{
+    int i;
+
+    for(i = 0; i < afp->nports; i++)
+    {
+        if(sr_loop_add_fd(loop, afp->ports[i].fd, afp_ready, &afp->ports[i]) < 0)
+        { return -1; }
+    }
+    return 0;
+} /* -- sr_afpacket_watch -- */
+
+int sr_afpacket_poll(struct sr_afpacket* afp, int timeout_ms)
+{
+    struct pollfd pfd[SR_AFP_PORTS_MAX];
+    int i, n;
+
+    for(i = 0; i < afp->nports; i++)
+    {
+        pfd[i].fd = afp->ports[i].fd;
+        pfd[i].events = POLLIN;
+        pfd[i].revents = 0;
+    }
+
+    if((n = poll(pfd, afp->nports, timeout_ms)) < 0)
+    {
+        if(errno == EINTR)
+        { return 1; }
+        perror("poll(..):sr_afpacket.c::sr_afpacket_poll");
+        return -1;
+    }
+
+    for(i = 0; i < afp->nports && n > 0; i++)
+    {
+        if(pfd[i].revents)
+        { afp_rx(afp, &afp->ports[i]); }
+    }
+    return 1;
+} /* -- sr_afpacket_poll -- */
+
+/*---------------------------------------------------------------------
+ * Method: afp_queue(..)
+ * Scope:  Local
+ *
+ * Put one frame on its interface's transmit ring. It goes out at
+ * the next kick.
+ *
+ *---------------------------------------------------------------------*/
+
+static int afp_queue(const uint8_t* buf, unsigned int len,
+        const struct sr_if* iface)
+{
+    struct sr_afp_port* port = 0;
+    struct tpacket3_hdr* hdr;
+    unsigned int status;
+
+    if((port = (struct sr_afp_port*)iface->port) == 0)
+    {
+        fprintf(stderr, "Error: no interface %s to send on\n", iface->name);
+        return -1;
+    }
+    if(len > SR_AFP_FRAME_SZ - AFP_HDRLEN)
+    {
+        fprintf(stderr, "Error: %u byte frame too big for %s\n", len, iface->name);
+        return -1;
+    }
+
+    pthread_mutex_lock(&port->tx_lock);
+
+    hdr = (struct tpacket3_hdr*)(port->tx +
+            (size_t)port->tx_head * SR_AFP_FRAME_SZ);
+    status = __atomic_load_n(&hdr->tp_status, __ATOMIC_ACQUIRE);
+    if(status & (TP_STATUS_SEND_REQUEST | TP_STATUS_SENDING))
+    {
+        /* -- ring is full: send it all, and wait until it is gone -- */
+        port->stats.tx_full++;
+        port->tx_pending++;
+        afp_kick(port, 0);
+        status = __atomic_load_n(&hdr->tp_status, __ATOMIC_ACQUIRE);
+        if(status & (TP_STATUS_SEND_REQUEST | TP_STATUS_SENDING))
+        {
+            port->stats.tx_errors++;
+            pthread_mutex_unlock(&port->tx_lock);
+            return -1;
+        }
+    }
+    if(status & TP_STATUS_WRONG_FORMAT)
+    { port->stats.tx_errors++; }
+
+    memcpy((uint8_t*)hdr + AFP_HDRLEN, buf, len);
+    hdr->tp_len = len;
+    hdr->tp_snaplen = len;
+    hdr->tp_next_offset = 0;
+    __atomic_store_n(&hdr->tp_status, TP_STATUS_SEND_REQUEST, __ATOMIC_RELEASE);
+
+    port->tx_head = (port->tx_head + 1) %
+        (SR_AFP_BLOCK_SZ / SR_AFP_FRAME_SZ * SR_AFP_TX_BLOCKS);
+    port->tx_pending++;
+    port->stats.tx_packets++;
+    port->stats.tx_bytes += len;
+
+    if(port->tx_pending >= SR_AFP_TX_BATCH)
+    { afp_kick(port, MSG_DONTWAIT); }
+
+    pthread_mutex_unlock(&port->tx_lock);
+    return 0;
+} /* -- afp_queue -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_afpacket_send(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_afpacket_send(struct sr_afpacket* afp, const struct sr_frame* frames,
+        int n)
+{
+    int i;
+
+    for(i = 0; i < n; i++)
+    {
+        if(afp_queue(frames[i].buf, frames[i].len, frames[i].iface) < 0)
+        { break; }
+    }
+
+    /* -- while a receive block is handled, afp_rx flushes at the end -- */
+    if(__atomic_load_n(&afp->corked, __ATOMIC_SEQ_CST) == 0)
+    { afp_flush(afp); }
+
+    return i;
+} /* -- sr_afpacket_send -- */
+
+void sr_afpacket_print_stats(struct sr_afpacket* afp, FILE* fp)
+{
+    struct sr_afp_stats* st;
+    int i;
+
+    for(i = 0; i < afp->nports; i++)
+    {
+        st = &afp->ports[i].stats;
+        fprintf(fp, "AF_PACKET %s: received %lu frames (%lu bytes) in %lu "
+                "blocks, %lu ignored; sent %lu frames (%lu bytes) in %lu "
+                "sendto calls, %lu ring full, %lu errors\n", afp->ports[i].name,
+                st->rx_packets, st->rx_bytes, st->rx_blocks, st->rx_ignored,
+                st->tx_packets, st->tx_bytes, st->tx_kicks, st->tx_full,
+                st->tx_errors);
+    }
+} /* -- sr_afpacket_print_stats -- */
+
+#else /* -- no AF_PACKET -- */
+
+struct sr_afpacket* sr_afpacket_open(struct sr_instance* sr, const char* spec)
+{
+    fprintf(stderr, "AF_PACKET is only available on Linux\n");
+    return 0;
+}
+void sr_afpacket_close(struct sr_afpacket* afp)
+{ }
+int sr_afpacket_watch(struct sr_afpacket* afp, struct sr_loop* loop)
+{ return -1; }
+int sr_afpacket_poll(struct sr_afpacket* afp, int timeout_ms)
+{ return -1; }
+int sr_afpacket_send(struct sr_afpacket* afp, const struct sr_frame* frames,
+        int n)
+{ return 0; }
+void sr_afpacket_print_stats(struct sr_afpacket* afp, FILE* fp)
+{ }
+
+#endif /* _LINUX_ */
+
+/*---------------------------------------------------------------------
+ * The AF_PACKET transport (sr_transport.h); spec is the interface list.
+ *---------------------------------------------------------------------*/
+
+static int afp_connect(struct sr_instance* sr, const char* spec)
+{
+    return (sr->transport->state = sr_afpacket_open(sr, spec)) != 0 ? 0 : -1;
+} /* -- afp_connect -- */
+
+static int afp_interfaces(struct sr_instance* sr)
+{
+    /* -- sr_afpacket_open added them -- */
+    return 1;
+} /* -- afp_interfaces -- */
+
+static int afp_watch(struct sr_instance* sr, struct sr_loop* loop)
+{
+    return sr_afpacket_watch(sr->transport->state, loop);
+} /* -- afp_watch -- */
+
+static int afp_recv_burst(struct sr_instance* sr, int wait)
+{
+    return sr_afpacket_poll(sr->transport->state, wait ? -1 : 0);
+} /* -- afp_recv_burst -- */
+
+static int afp_send_burst(struct sr_instance* sr,
+        const struct sr_frame* frames, int n)
+{
+    return sr_afpacket_send(sr->transport->state, frames, n);
+} /* -- afp_send_burst -- */
+
+static void afp_print_stats(struct sr_instance* sr, FILE* fp)
+{
+    sr_afpacket_print_stats(sr->transport->state, fp);
+} /* -- afp_print_stats -- */
+
+static void afp_close(struct sr_instance* sr)
+{
+    if(sr->transport->state)
+    {
+        sr_afpacket_print_stats(sr->transport->state, stderr);
+        sr_afpacket_close(sr->transport->state);
+        sr->transport->state = 0;
+    }
+} /* -- afp_close -- */
+
+const struct sr_transport sr_afpacket_transport =
+{
+    "packet",
+    afp_connect,
+    afp_interfaces,
+    afp_watch,
+    afp_recv_burst,
+    afp_send_burst,
+    afp_print_stats,
+    afp_close
+};
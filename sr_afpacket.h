@@ -0,0 +1,104 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_afpacket.h
+ *
+ * Description:
+ *
+ * AF_PACKET data plane: attach the router straight to Linux interfaces
+ * (veth pairs, bridge ports, NICs) instead of tunnelling every frame
+ * through the VNS server (-i packet:ifname[=ip],...).
+ *
+ * Each interface gets a packet socket with TPACKET_V3 receive and transmit
+ * rings mapped into our address space. Received frames are handed to
+ * sr_handlepacket where they lie in the ring, a whole block of them per
+ * wakeup, and the block only goes back to the kernel afterwards. Frames
+ * sent while a block is being handled are staged in the transmit ring and
+ * go out with one sendto() at the end of it.
+ *
+ * The router uses each interface's own MAC. Its IP comes from the
+ * interface unless one is given after '='. Leave the kernel without an
+ * address on these interfaces (or with arp_ignore and forwarding off) if
+ * it shouldn't answer or forward alongside us.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_AFPACKET_H
+#define SR_AFPACKET_H
+
+#include <stdio.h>
+#include <pthread.h>
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#include "sr_protocol.h"
+
+#define SR_AFP_PORTS_MAX   8
+#define SR_AFP_BLOCK_SZ    (1 << 16)    /* ring block, multiple of the page size */
+#define SR_AFP_RX_BLOCKS   32
+#define SR_AFP_TX_BLOCKS   8
+#define SR_AFP_FRAME_SZ    2048         /* transmit slot */
+#define SR_AFP_RETIRE_MS   1            /* hand over a partly filled block after */
+#define SR_AFP_TX_BATCH    32           /* kick the kernel after this many */
+
+struct sr_instance;
+struct sr_loop;
+struct sr_frame;
+
+struct sr_afp_stats
+{
+    unsigned long rx_packets;
+    unsigned long rx_bytes;
+    unsigned long rx_blocks;    /* blocks handled */
+    unsigned long rx_ignored;   /* our own or other hosts' frames */
+    unsigned long tx_packets;
+    unsigned long tx_bytes;
+    unsigned long tx_kicks;     /* sendto() calls that sent them */
+    unsigned long tx_full;      /* times we waited for a slot */
+    unsigned long tx_errors;    /* frames the kernel wouldn't send */
+};
+
+struct sr_afp_port
+{
+    char name[sr_IFACE_NAMELEN];
+    int fd;
+    int ifindex;
+    uint8_t* map;               /* receive ring, then transmit ring */
+    size_t map_sz;
+    uint8_t* rx;
+    unsigned int rx_block;      /* next block to look at */
+    uint8_t* tx;
+    unsigned int tx_head;       /* next slot to fill */
+    unsigned int tx_pending;    /* filled since the last kick */
+    pthread_mutex_t tx_lock;    /* the ARP thread may send too */
+    struct sr_afp_stats stats;
+};
+
+struct sr_afpacket
+{
+    struct sr_instance* sr;
+    int corked;                 /* > 0 while a receive block is handled */
+    int nports;
+    struct sr_afp_port ports[SR_AFP_PORTS_MAX];
+};
+
+/* Open every interface in spec ("veth0,veth1=10.0.1.1") and add it to the
+   router's interface list. Returns 0 on error. */
+struct sr_afpacket* sr_afpacket_open(struct sr_instance* sr, const char* spec);
+void sr_afpacket_close(struct sr_afpacket* afp);
+
+/* Have the event loop watch every interface. */
+int sr_afpacket_watch(struct sr_afpacket* afp, struct sr_loop* loop);
+
+/* Without an event loop: wait up to timeout_ms for frames on any interface
+   and handle them. Returns 1 to keep going, -1 on error. */
+int sr_afpacket_poll(struct sr_afpacket* afp, int timeout_ms);
+
+/* Send n frames, each out of its interface, with one sendto() per
+   interface (or per SR_AFP_TX_BATCH frames). Returns the number sent. */
+int sr_afpacket_send(struct sr_afpacket* afp, const struct sr_frame* frames,
+                     int n);
+
+void sr_afpacket_print_stats(struct sr_afpacket* afp, FILE* fp);
+
+#endif /* -- SR_AFPACKET_H -- */
@@ -6,129 +6,223 @@
 #include <pthread.h>
 #include <sched.h>
 #include <string.h>
+#include <arpa/inet.h>
 #include "sr_arpcache.h"
 #include "sr_router.h"
 #include "sr_if.h"
+#include "sr_rt.h"
 #include "sr_protocol.h"
+#include "sr_utils.h"
+#include "sr_rxring.h"
+#include "sr_clock.h"
+#include "sr_pktbuf.h"
+#include "sr_pkt.h"
 
-void handle_arpreq(struct sr_instance *sr, struct sr_arpreq* request){
-/*    printf("HANDLING ARPREQ\n");*/
-    time_t now;
-    time(&now);
-    if(difftime(now, request->sent) > 1.0){
-    if(request->times_sent >= 5){
-        /*Things that need to be changed:dest mac, src mac,  src ip, dest ip*/
-        struct sr_packet* current = request->packets;
-       while(current != 0){ 
-        
-       int eth_head_len = sizeof(sr_ethernet_hdr_t);   
-       int ip_head_len = sizeof(sr_ip_hdr_t);
-       sr_ethernet_hdr_t* init_eth = (sr_ethernet_hdr_t*) (current->buf);
-       sr_ip_hdr_t* init_ip =  (sr_ip_hdr_t*) (current->buf + eth_head_len);
-
-       uint8_t *icmp_message = calloc(eth_head_len + ip_head_len + sizeof(sr_icmp_t3_hdr_t), sizeof(uint8_t));
-       sr_ethernet_hdr_t * eth_head_icmp = (sr_ethernet_hdr_t*) icmp_message;
-       sr_ip_hdr_t * ip_head_icmp = (sr_ip_hdr_t*)(icmp_message + eth_head_len);
-       sr_icmp_t3_hdr_t * icmp_head_icmp = (sr_icmp_t3_hdr_t*)(icmp_message + eth_head_len + ip_head_len);
-            
-        eth_head_icmp->ether_type = ntohs(ethertype_ip);
-        memcpy(eth_head_icmp->ether_dhost, init_eth->ether_shost, ETHER_ADDR_LEN);
-        memcpy(eth_head_icmp->ether_shost, sr_get_interface(sr,current->iface)->addr, ETHER_ADDR_LEN);
-            
-        ip_head_icmp->ip_hl = 5; /*number of 4 byte in the header*/
-        ip_head_icmp->ip_v = 4;
-	ip_head_icmp->ip_tos = htonl(0);
-	ip_head_icmp->ip_len = htons(ip_head_len + sizeof(sr_icmp_t3_hdr_t));
-	ip_head_icmp->ip_id = 0;
-	ip_head_icmp->ip_off = 0;
-        ip_head_icmp->ip_ttl = 255; /*big ttl*/
-        ip_head_icmp->ip_p = 0x01;
-        ip_head_icmp->ip_src = sr_get_interface(sr, current->iface)->ip; /* check this */
-        ip_head_icmp->ip_dst = init_ip->ip_src;
-	ip_head_icmp->ip_sum = cksum(ip_head_icmp, ip_head_icmp->ip_hl*4);  
-       
-	 icmp_head_icmp->icmp_type = 0x03;
-        icmp_head_icmp->icmp_code = 0x01;
-        memcpy(icmp_head_icmp->data, init_ip, init_ip->ip_hl*4 + 8);
-
-  
-	icmp_head_icmp->icmp_sum = cksum(icmp_head_icmp, sizeof(sr_icmp_t3_hdr_t));
-        /* + copy over data if any?*/
-
-        sr_send_packet(sr, icmp_message, eth_head_len + ip_head_len + sizeof(sr_icmp_t3_hdr_t), current->iface);
-        current = current->next;
-        }
-        /*send icmp host unreachable to source addr of all pkts waiting */
-             
-        sr_arpreq_destroy(&(sr->cache), request);
+/* The cache is shared with the timeout thread unless everything runs on the
+   event loop's one thread (see sr_loop.c), in which case there is nobody to
+   lock against. */
+#define arpcache_lock(cache) \
+    do { if(!(cache)->single_threaded) pthread_mutex_lock(&((cache)->lock)); } while(0)
+#define arpcache_unlock(cache) \
+    do { if(!(cache)->single_threaded) pthread_mutex_unlock(&((cache)->lock)); } while(0)
+
+/* What a pending ARP request needs on this sweep. */
+enum arpreq_action {
+    arpreq_wait,                /* sent less than SR_ARPREQ_RETRY_MS ago */
+    arpreq_resend,              /* send (another) ARP request */
+    arpreq_give_up              /* tried SR_ARPREQ_TRIES times, send host
+                                   unreachable */
+};
+
+static void arpreq_free(struct sr_arpreq *entry);
+static void arpreq_unlink(struct sr_arpcache *cache, struct sr_arpreq *entry);
+
+/* Notes that something falls due at due, and if that is sooner than the
+   cache last said, tells whoever runs the tick (see cache->wake). Caller
+   must hold the cache lock. */
+static void arpcache_due(struct sr_arpcache *cache, unsigned long due,
+                         unsigned long now)
+{
+    if(cache->due != 0 && cache->due <= due){
+        return;
     }
-    else{
+    cache->due = due;
+    if(cache->wake){
+        cache->wake(cache->wake_arg, due > now ? due - now : 0);
+    }
+}
+
+/* Decides what request needs and updates its bookkeeping. A request we give
+   up on is unlinked from the queue and now belongs to the caller. Caller must
+   hold the cache lock; nothing is sent here. */
+static enum arpreq_action arpreq_next_action(struct sr_arpcache *cache,
+                                             struct sr_arpreq *request,
+                                             unsigned long now)
+{
+    if(request->times_sent > 0 && now - request->sent < SR_ARPREQ_RETRY_MS){
+        arpcache_due(cache, request->sent + SR_ARPREQ_RETRY_MS, now);
+        return arpreq_wait;
+    }
+    if(request->times_sent >= SR_ARPREQ_TRIES){
+        arpreq_unlink(cache, request);
+        return arpreq_give_up;
+    }
+    request->sent = now;
+    request->times_sent++;
+    arpcache_due(cache, now + SR_ARPREQ_RETRY_MS, now);
+    return arpreq_resend;
+}
+
+/* Broadcasts an ARP request for ip out of every interface. */
+static void send_arp_request(struct sr_instance *sr, uint32_t ip){
 /*      ip addresses are in little endian make sure to print them
         send arp request to all interfaces*/
         struct sr_if * iface_pt = sr->if_list;
-        uint8_t * arp_request = calloc(sizeof(sr_ethernet_hdr_t) + sizeof(sr_arp_hdr_t),sizeof(uint8_t));
+        struct sr_pktbuf * pb = sr_pktbuf_alloc(sizeof(sr_ethernet_hdr_t) + sizeof(sr_arp_hdr_t));
+        if(pb == 0){
+        return;
+        }
+        uint8_t * arp_request = pb->data;
         sr_ethernet_hdr_t * eth_head_request = (sr_ethernet_hdr_t*) arp_request;
         sr_arp_hdr_t * arp_head_request = (sr_arp_hdr_t *) (arp_request + sizeof(sr_ethernet_hdr_t)); 
 
         eth_head_request->ether_type = ntohs(ethertype_arp); 
-        unsigned long floodAddr = 0xFFFFFFFFFFFF; 
-        memcpy(eth_head_request->ether_dhost, &floodAddr, ETHER_ADDR_LEN);
+        memset(eth_head_request->ether_dhost, 0xFF, ETHER_ADDR_LEN);
 
-            arp_head_request->ar_hrd = ntohs(arp_hrd_ethernet);
+        arp_head_request->ar_hrd = ntohs(arp_hrd_ethernet);
         arp_head_request->ar_pro = ntohs(ethertype_ip);
         arp_head_request->ar_hln = 6;
         arp_head_request->ar_pln = 4;
         arp_head_request->ar_op = ntohs(arp_op_request);
-        arp_head_request->ar_tip = request->ip;
-        memcpy(arp_head_request->ar_tha, &floodAddr, ETHER_ADDR_LEN);
+        arp_head_request->ar_tip = ip;
+        memset(arp_head_request->ar_tha, 0xFF, ETHER_ADDR_LEN);
 
-            while(iface_pt != 0){
+        while(iface_pt != 0){
         memcpy(eth_head_request->ether_shost, iface_pt->addr, ETHER_ADDR_LEN);
         memcpy(arp_head_request->ar_sha, eth_head_request->ether_shost, ETHER_ADDR_LEN);
         arp_head_request->ar_sip = iface_pt->ip;
-        /*printf("-------\n SENDING ARP REQUEST: \n");
-        printf("Looking for: \n");
-        print_addr_ip_int(ntohl(arp_head_request->ar_tip));
-        printf("From: \n");
-        print_addr_ip_int(ntohl(arp_head_request->ar_sip));
-        printf("Mac Flood Addr:\n");
-        print_addr_eth(eth_head_request->ether_dhost);
-        printf("------\n");*/
-        sr_send_packet(sr, arp_request, sizeof(sr_ethernet_hdr_t) + sizeof(sr_arp_hdr_t), iface_pt->name);
-    /*  printf("Sending Succeeded\n"); */
+        sr_send_packet_if(sr, arp_request, sizeof(sr_ethernet_hdr_t) + sizeof(sr_arp_hdr_t), iface_pt);
         iface_pt = iface_pt->next;
         }
-       /*printf("Done With Interfaces\n");*/
-        request->sent = now;
-        request->times_sent++;
+        sr_pktbuf_free(pb);
+}
+
+/* Sends ICMP host unreachable back to the source of every packet waiting on
+   request. */
+static void send_host_unreachable(struct sr_instance *sr, struct sr_arpreq *request){
+    struct sr_packet *current;
+    struct sr_pkt pkt;
+
+    for (current = request->packets; current != NULL; current = current->next) {
+        sr_pkt_parse_if(sr, &pkt, current->buf, current->len, current->in);
+        if (pkt.flags & SR_PKT_IP) {
+            sr_send_icmp_error(sr, &pkt, dest_unreachable, host_unreachable,
+                               current->in->ip, 0);
+        }
+    }
+}
+
+void handle_arpreq(struct sr_instance *sr, struct sr_arpreq* request){
+    enum arpreq_action action;
+    uint32_t ip;
+
+    arpcache_lock(&(sr->cache));
+    action = arpreq_next_action(&(sr->cache), request, sr_clock_now_ms());
+    ip = request->ip;
+    arpcache_unlock(&(sr->cache));
+
+    if(action == arpreq_resend){
+        send_arp_request(sr, ip);
     }
+    else if(action == arpreq_give_up){
+        send_host_unreachable(sr, request);
+        arpreq_free(request);
     }
 }
 /* 
-  This function gets called every second. For each request sent out, we keep
+  This function gets called from the tick. For each request sent out, we keep
   checking whether we should resend an request or destroy the arp request.
-  See the comments in the header file for an idea of what it should look like.
+
+  The decisions are made under the cache lock, but the requests to give up on
+  are detached and the IPs to re-ARP are copied out first, so that building
+  and sending packets happens after the lock is dropped and the forwarding
+  path never waits behind a write to the server.
 */
 void sr_arpcache_sweepreqs(struct sr_instance *sr) { 
-    /* Fill this in */
-    struct sr_arpreq *current;
-    struct sr_arpreq *nextSav;
-   
-    current = sr->cache.requests; 
-    if(current == 0){
-    return;
+    struct sr_arpcache *cache = &(sr->cache);
+    struct sr_arpreq *current, *nextSav;
+    struct sr_arpreq *failed = 0;
+    uint32_t *resend = 0;
+    int n_resend = 0, n_reqs = 0, i;
+    unsigned long now = sr_clock_now_ms();
+
+    arpcache_lock(cache);
+    for(current = cache->requests; current != 0; current = current->next){
+        n_reqs++;
     }
-    nextSav = current->next;
-    while(current != 0){
-    handle_arpreq(sr, current);
-    if(nextSav == 0){
-        break;
+    if(n_reqs > 0){
+        resend = (uint32_t *) malloc(n_reqs * sizeof(uint32_t));
     }
-    current = nextSav;
-    nextSav = current->next;
+    for(current = cache->requests; current != 0; current = nextSav){
+        /* a request we give up on is unlinked, so save the next pointer first */
+        nextSav = current->next;
+        switch(arpreq_next_action(cache, current, now)){
+        case arpreq_resend:
+            resend[n_resend++] = current->ip;
+            break;
+        case arpreq_give_up:
+            current->next = failed;
+            failed = current;
+            break;
+        default:
+            break;
+        }
+    }
+    arpcache_unlock(cache);
+
+    for(i = 0; i < n_resend; i++){
+        send_arp_request(sr, resend[i]);
     }
-    /*for each request on sr->cache.requests
-    handle_arpreq */
+    for(current = failed; current != 0; current = nextSav){
+        nextSav = current->next;
+        send_host_unreachable(sr, current);
+        arpreq_free(current);
+    }
+    free(resend);
+}
+
+/*
+  Walk the routing table and start ARP resolution for every distinct gateway
+  we don't already have a mapping for, so adjacencies are ready before data
+  traffic shows up. Call after the interface list is known and again whenever
+  the routing table is (re)loaded.
+*/
+void sr_arpcache_prime(struct sr_instance *sr) {
+    struct sr_rt *rt_walker;
+    struct sr_arpentry *entry;
+    int primed = 0;
+
+    if(sr->if_list == 0){
+        return;
+    }
+
+    for(rt_walker = sr->routing_table; rt_walker != 0; rt_walker = rt_walker->next){
+        uint32_t gw = rt_walker->gw.s_addr;
+        if(gw == 0){
+            continue;
+        }
+        entry = sr_arpcache_lookup(&(sr->cache), gw);
+        if(entry != 0){
+            free(entry);
+            continue;
+        }
+        /* queuereq hands back the existing request for a repeated gateway, and
+           handle_arpreq won't resend one that went out within SR_ARPREQ_RETRY_MS */
+        handle_arpreq(sr, sr_arpcache_queuereq(&(sr->cache), gw, NULL, 0, NULL));
+        primed++;
+    }
+
+    printf("Resolving %d gateway(s) from the routing table\n", primed);
 }
 
 /* You should not need to touch the rest of this code. */
@@ -136,9 +230,22 @@ void sr_arpcache_sweepreqs(struct sr_instance *sr) {
 /* Checks if an IP->MAC mapping is in the cache. IP is in network byte order.
    You must free the returned structure if it is not NULL. */
 struct sr_arpentry *sr_arpcache_lookup(struct sr_arpcache *cache, uint32_t ip) {
-    pthread_mutex_lock(&(cache->lock));
+    struct sr_arpentry entry, *copy = NULL;
+    
+    if (sr_arpcache_lookup_copy(cache, ip, &entry)) {
+        copy = (struct sr_arpentry *) malloc(sizeof(struct sr_arpentry));
+        memcpy(copy, &entry, sizeof(struct sr_arpentry));
+    }
     
-    struct sr_arpentry *entry = NULL, *copy = NULL;
+    return copy;
+}
+
+/* Copies the mapping for ip into *copy. Returns 1 if there was one. */
+int sr_arpcache_lookup_copy(struct sr_arpcache *cache, uint32_t ip,
+                            struct sr_arpentry *copy) {
+    arpcache_lock(cache);
+    
+    struct sr_arpentry *entry = NULL;
     
     int i;
     for (i = 0; i < SR_ARPCACHE_SZ; i++) {
@@ -147,16 +254,18 @@ struct sr_arpentry *sr_arpcache_lookup(struct sr_arpcache *cache, uint32_t ip) {
         }
     }
     
-    /* Must return a copy b/c another thread could jump in and modify
+    /* Mark it used so the CLOCK hand passes over it once. */
+    if (entry)
+        entry->referenced = 1;
+    
+    /* Must be a copy b/c another thread could jump in and modify
        table after we return. */
-    if (entry) {
-        copy = (struct sr_arpentry *) malloc(sizeof(struct sr_arpentry));
+    if (entry)
         memcpy(copy, entry, sizeof(struct sr_arpentry));
-    }
         
-    pthread_mutex_unlock(&(cache->lock));
+    arpcache_unlock(cache);
     
-    return copy;
+    return entry != NULL;
 }
 
 /* Adds an ARP request to the ARP request queue. If the request is already on
@@ -169,9 +278,22 @@ struct sr_arpreq *sr_arpcache_queuereq(struct sr_arpcache *cache,
                                        uint32_t ip,
                                        uint8_t *packet,           /* borrowed */
                                        unsigned int packet_len,
-                                       char *iface)
+                                       struct sr_if *in)
+{
+    return sr_arpcache_queuereq_held(cache, ip, packet, packet_len, in, NULL);
+}
+
+/* As sr_arpcache_queuereq, but if slab is not NULL the packet is kept where
+   it is rather than copied, and the queue takes over the caller's reference
+   on the receive slab it lives in. */
+struct sr_arpreq *sr_arpcache_queuereq_held(struct sr_arpcache *cache,
+                                            uint32_t ip,
+                                            uint8_t *packet,
+                                            unsigned int packet_len,
+                                            struct sr_if *in,
+                                            struct sr_rxslab *slab)
 {
-    pthread_mutex_lock(&(cache->lock));
+    arpcache_lock(cache);
     
     struct sr_arpreq *req;
     for (req = cache->requests; req != NULL; req = req->next) {
@@ -180,32 +302,120 @@ struct sr_arpreq *sr_arpcache_queuereq(struct sr_arpcache *cache,
         }
     }
     
-    /* If the IP wasn't found, add it */
+    /* If the IP wasn't found, add it; its first request is due now */
     if (!req) {
+        unsigned long now = sr_clock_now_ms();
         req = (struct sr_arpreq *) calloc(1, sizeof(struct sr_arpreq));
         req->ip = ip;
         req->next = cache->requests;
         cache->requests = req;
+        arpcache_due(cache, now, now);
     }
     
     /* Add the packet to the list of packets for this request */
-    if (packet && packet_len && iface) {
+    if (packet && packet_len && in) {
         struct sr_packet *new_pkt = (struct sr_packet *)malloc(sizeof(struct sr_packet));
         
-        new_pkt->buf = (uint8_t *)malloc(packet_len);
-        memcpy(new_pkt->buf, packet, packet_len);
+        new_pkt->pb = NULL;
+        if (slab) {
+            new_pkt->buf = packet;
+        }
+        else if ((new_pkt->pb = sr_pktbuf_alloc(packet_len)) != NULL) {
+            new_pkt->buf = new_pkt->pb->data;
+            memcpy(new_pkt->buf, packet, packet_len);
+        }
+        else {
+            new_pkt->buf = (uint8_t *)malloc(packet_len);
+            memcpy(new_pkt->buf, packet, packet_len);
+        }
+        new_pkt->slab = slab;
         new_pkt->len = packet_len;
-        new_pkt->iface = (char *)malloc(sr_IFACE_NAMELEN);
-        strncpy(new_pkt->iface, iface, sr_IFACE_NAMELEN);
+        new_pkt->in = in;
         new_pkt->next = req->packets;
         req->packets = new_pkt;
     }
+    else if (slab) {
+        sr_rxslab_put(slab);
+    }
     
-    pthread_mutex_unlock(&(cache->lock));
+    arpcache_unlock(cache);
     
     return req;
 }
 
+/* Picks a victim slot when every entry is valid, using CLOCK: the hand
+   sweeps the table, giving each recently used entry a second chance by
+   clearing its referenced bit, and evicts the first entry found without one.
+   Permanent entries are never evicted. Returns the freed slot, or -1 (and
+   counts an insert failure) if every entry is permanent. Caller must hold
+   the cache lock. */
+static int arpcache_evict(struct sr_arpcache *cache) {
+    int step;
+    for (step = 0; step < 2 * SR_ARPCACHE_SZ; step++) {
+        struct sr_arpentry *cur = &(cache->entries[cache->hand]);
+        int slot = cache->hand;
+        
+        cache->hand = (cache->hand + 1) % SR_ARPCACHE_SZ;
+        if (cur->permanent)
+            continue;
+        if (cur->referenced) {
+            cur->referenced = 0;
+            continue;
+        }
+        
+        cur->valid = 0;
+        cache->evictions++;
+        return slot;
+    }
+    
+    cache->insert_failures++;
+    return -1;
+}
+
+/* Stores an IP->MAC mapping in the cache. An existing mapping for the IP is
+   refreshed in place rather than duplicated, and a permanent (static) mapping
+   is never overwritten by a dynamic one. When the cache is full a victim is
+   chosen by arpcache_evict. Returns the slot used, or -1 if nothing could be
+   evicted. Caller must hold the cache lock. */
+static int arpcache_store(struct sr_arpcache *cache,
+                          unsigned char *mac,
+                          uint32_t ip,
+                          unsigned long added,
+                          int permanent)
+{
+    int i;
+    for (i = 0; i < SR_ARPCACHE_SZ; i++) {
+        if ((cache->entries[i].valid) && (cache->entries[i].ip == ip))
+            break;
+    }
+    
+    if (i != SR_ARPCACHE_SZ && cache->entries[i].permanent && !permanent)
+        return i;
+    
+    if (i == SR_ARPCACHE_SZ) {
+        for (i = 0; i < SR_ARPCACHE_SZ; i++) {
+            if (!(cache->entries[i].valid))
+                break;
+        }
+    }
+    
+    if (i == SR_ARPCACHE_SZ) {
+        if ((i = arpcache_evict(cache)) < 0)
+            return -1;
+    }
+    
+    memcpy(cache->entries[i].mac, mac, 6);
+    cache->entries[i].ip = ip;
+    cache->entries[i].added = added;
+    cache->entries[i].permanent = permanent;
+    cache->entries[i].referenced = 1;
+    cache->entries[i].valid = 1;
+    if (!permanent)
+        arpcache_due(cache, added + SR_ARPCACHE_TO_MS, sr_clock_now_ms());
+    
+    return i;
+}
+
 /* This method performs two functions:
    1) Looks up this IP in the request queue. If it is found, returns a pointer
       to the sr_arpreq with this IP. Otherwise, returns NULL.
@@ -214,7 +424,7 @@ struct sr_arpreq *sr_arpcache_insert(struct sr_arpcache *cache,
                                      unsigned char *mac,
                                      uint32_t ip)
 {
-    pthread_mutex_lock(&(cache->lock));
+    arpcache_lock(cache);
     
     struct sr_arpreq *req, *prev = NULL, *next = NULL; 
     for (req = cache->requests; req != NULL; req = req->next) {
@@ -233,87 +443,258 @@ struct sr_arpreq *sr_arpcache_insert(struct sr_arpcache *cache,
         prev = req;
     }
     
-    int i;
+    arpcache_store(cache, mac, ip, sr_clock_now_ms(), 0);
+    
+    arpcache_unlock(cache);
+    
+    return req;
+}
+
+/* Updates the MAC of an IP->MAC mapping only if the IP is already in the
+   cache (the RFC 826 "merge" step). Returns 1 if an entry was refreshed. */
+int sr_arpcache_refresh(struct sr_arpcache *cache,
+                        unsigned char *mac,
+                        uint32_t ip)
+{
+    arpcache_lock(cache);
+    
+    unsigned long now = sr_clock_now_ms();
+    int i, found = 0;
     for (i = 0; i < SR_ARPCACHE_SZ; i++) {
-        if (!(cache->entries[i].valid))
-            break;
+        if ((cache->entries[i].valid) && (cache->entries[i].ip == ip) &&
+            !(cache->entries[i].permanent)) {
+            memcpy(cache->entries[i].mac, mac, 6);
+            cache->entries[i].added = now;
+            arpcache_due(cache, now + SR_ARPCACHE_TO_MS, now);
+            found = 1;
+        }
     }
     
-    if (i != SR_ARPCACHE_SZ) {
-        memcpy(cache->entries[i].mac, mac, 6);
-        cache->entries[i].ip = ip;
-        cache->entries[i].added = time(NULL);
-        cache->entries[i].valid = 1;
+    arpcache_unlock(cache);
+    
+    return found;
+}
+
+/* Removes entry from the request queue if it is on it. Caller must hold the
+   cache lock. */
+static void arpreq_unlink(struct sr_arpcache *cache, struct sr_arpreq *entry) {
+    struct sr_arpreq *req, *prev = NULL, *next = NULL; 
+    for (req = cache->requests; req != NULL; req = req->next) {
+        if (req == entry) {                
+            if (prev) {
+                next = req->next;
+                prev->next = next;
+            } 
+            else {
+                next = req->next;
+                cache->requests = next;
+            }
+            
+            break;
+        }
+        prev = req;
     }
+}
+
+/* Frees an arp request entry that is no longer on the queue, along with the
+   packets waiting on it. Needs no lock. */
+static void arpreq_free(struct sr_arpreq *entry) {
+    struct sr_packet *pkt, *nxt;
     
-    pthread_mutex_unlock(&(cache->lock));
+    for (pkt = entry->packets; pkt; pkt = nxt) {
+        nxt = pkt->next;
+        if (pkt->slab)
+            sr_rxslab_put(pkt->slab);
+        else if (pkt->pb)
+            sr_pktbuf_free(pkt->pb);
+        else if (pkt->buf)
+            free(pkt->buf);
+        free(pkt);
+    }
     
-    return req;
+    free(entry);
 }
 
 /* Frees all memory associated with this arp request entry. If this arp request
    entry is on the arp request queue, it is removed from the queue. */
 void sr_arpreq_destroy(struct sr_arpcache *cache, struct sr_arpreq *entry) {
-    pthread_mutex_lock(&(cache->lock));
-    
-    if (entry) {
-        struct sr_arpreq *req, *prev = NULL, *next = NULL; 
-        for (req = cache->requests; req != NULL; req = req->next) {
-            if (req == entry) {                
-                if (prev) {
-                    next = req->next;
-                    prev->next = next;
-                } 
-                else {
-                    next = req->next;
-                    cache->requests = next;
-                }
-                
-                break;
-            }
-            prev = req;
+    if (!entry)
+        return;
+    
+    arpcache_lock(cache);
+    arpreq_unlink(cache, entry);
+    arpcache_unlock(cache);
+    
+    arpreq_free(entry);
+}
+
+/* Parses "a.b.c.d xx:xx:xx:xx:xx:xx" from the start of line. Returns 1 on
+   success. */
+static int arpcache_parse(const char *line, uint32_t *ip, unsigned char *mac,
+                          const char **rest)
+{
+    char ip_str[32];
+    unsigned int m[6];
+    struct in_addr addr;
+    int n = 0, i;
+    
+    if (sscanf(line, "%31s %x:%x:%x:%x:%x:%x%n", ip_str,
+               &m[0], &m[1], &m[2], &m[3], &m[4], &m[5], &n) != 7)
+        return 0;
+    if (inet_aton(ip_str, &addr) == 0)
+        return 0;
+    
+    *ip = addr.s_addr;
+    for (i = 0; i < 6; i++)
+        mac[i] = (unsigned char) m[i];
+    if (rest)
+        *rest = line + n;
+    return 1;
+}
+
+/* Loads permanent IP->MAC mappings from filename, one "ip mac" pair per
+   line. Blank lines and lines starting with '#' are skipped. Returns the
+   number of entries loaded, or -1 on error. */
+int sr_arpcache_load_static(struct sr_arpcache *cache, const char *filename) {
+    FILE *fp;
+    char line[BUFSIZ];
+    unsigned char mac[6];
+    uint32_t ip;
+    int loaded = 0;
+    
+    if ((fp = fopen(filename, "r")) == NULL) {
+        perror("fopen(..):sr_arpcache_load_static");
+        return -1;
+    }
+    
+    arpcache_lock(cache);
+    while (fgets(line, BUFSIZ, fp) != NULL) {
+        if (line[0] == '#' || line[0] == '\n')
+            continue;
+        if (!arpcache_parse(line, &ip, mac, NULL)) {
+            fprintf(stderr, "Error loading static ARP entries, bad line: %s", line);
+            loaded = -1;
+            break;
         }
-        
-        struct sr_packet *pkt, *nxt;
-        
-        for (pkt = entry->packets; pkt; pkt = nxt) {
-            nxt = pkt->next;
-            if (pkt->buf)
-                free(pkt->buf);
-            if (pkt->iface)
-                free(pkt->iface);
-            free(pkt);
+        if (arpcache_store(cache, mac, ip, sr_clock_now_ms(), 1) < 0) {
+            fprintf(stderr, "Error loading static ARP entries, cache full\n");
+            loaded = -1;
+            break;
         }
-        
-        free(entry);
+        loaded++;
     }
+    arpcache_unlock(cache);
     
-    pthread_mutex_unlock(&(cache->lock));
+    fclose(fp);
+    return loaded;
+}
+
+/* Writes every valid dynamic entry to filename as "ip mac added" so the next
+   run can pick them up with sr_arpcache_restore. The cache's times only mean
+   something to this process, so added is written as time() seconds. Returns
+   0 on success. */
+int sr_arpcache_save(struct sr_arpcache *cache, const char *filename) {
+    FILE *fp;
+    time_t wall = sr_clock_now();
+    unsigned long now = sr_clock_now_ms();
+    int i;
+    
+    if ((fp = fopen(filename, "w")) == NULL) {
+        perror("fopen(..):sr_arpcache_save");
+        return -1;
+    }
+    
+    arpcache_lock(cache);
+    for (i = 0; i < SR_ARPCACHE_SZ; i++) {
+        struct sr_arpentry *cur = &(cache->entries[i]);
+        struct in_addr addr;
+        if (!(cur->valid) || cur->permanent)
+            continue;
+        addr.s_addr = cur->ip;
+        fprintf(fp, "%s %02x:%02x:%02x:%02x:%02x:%02x %ld\n", inet_ntoa(addr),
+                cur->mac[0], cur->mac[1], cur->mac[2],
+                cur->mac[3], cur->mac[4], cur->mac[5],
+                (long) wall - (long) ((now - cur->added) / 1000));
+    }
+    arpcache_unlock(cache);
+    
+    return fclose(fp) == 0 ? 0 : -1;
+}
+
+/* Reloads entries written by sr_arpcache_save. Entries keep their original
+   timestamp, so anything older than SR_ARPCACHE_TO_MS is dropped and the rest
+   expire on schedule. A missing file is not an error. Returns the number of
+   entries restored, or -1 on error. */
+int sr_arpcache_restore(struct sr_arpcache *cache, const char *filename) {
+    FILE *fp;
+    char line[BUFSIZ];
+    const char *rest;
+    unsigned char mac[6];
+    uint32_t ip;
+    long added;
+    time_t wall = sr_clock_now();
+    unsigned long now = sr_clock_now_ms(), age;
+    int restored = 0;
+    
+    if ((fp = fopen(filename, "r")) == NULL)
+        return 0;
+    
+    arpcache_lock(cache);
+    while (fgets(line, BUFSIZ, fp) != NULL) {
+        if (!arpcache_parse(line, &ip, mac, &rest) ||
+            sscanf(rest, "%ld", &added) != 1) {
+            fprintf(stderr, "Ignoring bad ARP snapshot line: %s", line);
+            continue;
+        }
+        if (added > (long) wall)
+            continue;
+        age = (unsigned long) ((long) wall - added) * 1000;
+        if (age >= SR_ARPCACHE_TO_MS || age > now)
+            continue;
+        if (arpcache_store(cache, mac, ip, now - age, 0) >= 0)
+            restored++;
+    }
+    arpcache_unlock(cache);
+    
+    fclose(fp);
+    return restored;
 }
 
 /* Prints out the ARP table. */
-void sr_arpcache_dump(struct sr_arpcache *cache) {
-    fprintf(stderr, "\nMAC            IP         ADDED                      VALID\n");
-    fprintf(stderr, "-----------------------------------------------------------\n");
+void sr_arpcache_fdump(struct sr_arpcache *cache, FILE *fp) {
+    unsigned long now = sr_clock_now_ms();
+    
+    fprintf(fp, "\nMAC            IP         AGE (ms)     VALID STATIC\n");
+    fprintf(fp, "----------------------------------------------------\n");
     
     int i;
     for (i = 0; i < SR_ARPCACHE_SZ; i++) {
         struct sr_arpentry *cur = &(cache->entries[i]);
         unsigned char *mac = cur->mac;
-        fprintf(stderr, "%.1x%.1x%.1x%.1x%.1x%.1x   %.8x   %.24s   %d\n", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5], ntohl(cur->ip), ctime(&(cur->added)), cur->valid);
+        fprintf(fp, "%.1x%.1x%.1x%.1x%.1x%.1x   %.8x   %-10lu   %d     %d\n", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5], ntohl(cur->ip), cur->valid ? now - cur->added : 0UL, cur->valid, cur->permanent);
     }
     
-    fprintf(stderr, "\n");
+    fprintf(fp, "evictions: %lu   insert failures: %lu\n",
+            cache->evictions, cache->insert_failures);
+    fprintf(fp, "\n");
+}
+
+void sr_arpcache_dump(struct sr_arpcache *cache) {
+    sr_arpcache_fdump(cache, stderr);
 }
 
 /* Initialize table + table lock. Returns 0 on success. */
 int sr_arpcache_init(struct sr_arpcache *cache) {  
-    /* Seed RNG to kick out a random entry if all entries full. */
-    srand(time(NULL));
-    
-    /* Invalidate all entries */
+    /* Invalidate all entries; the CLOCK hand starts at slot 0. */
     memset(cache->entries, 0, sizeof(cache->entries));
     cache->requests = NULL;
+    cache->hand = 0;
+    cache->evictions = 0;
+    cache->insert_failures = 0;
+    cache->single_threaded = 0;
+    cache->due = 0;
+    cache->wake = NULL;
+    cache->wake_arg = NULL;
     
     /* Acquire mutex lock */
     pthread_mutexattr_init(&(cache->attr));
@@ -328,29 +709,48 @@ int sr_arpcache_destroy(struct sr_arpcache *cache) {
     return pthread_mutex_destroy(&(cache->lock)) && pthread_mutexattr_destroy(&(cache->attr));
 }
 
-/* Thread which sweeps through the cache and invalidates entries that were added
-   more than SR_ARPCACHE_TO seconds ago. */
+/* Times out entries that were added SR_ARPCACHE_TO_MS or more ago
+   (permanent entries never expire), then sweeps the pending requests. The
+   next deadline is worked out afresh as it goes, and handed to wake. */
+void sr_arpcache_tick(struct sr_instance *sr) {
+    struct sr_arpcache *cache = &(sr->cache);
+    
+    arpcache_lock(cache);
+    
+    unsigned long curtime = sr_clock_now_ms();
+    
+    cache->due = 0;
+    int i;    
+    for (i = 0; i < SR_ARPCACHE_SZ; i++) {
+        struct sr_arpentry *cur = &(cache->entries[i]);
+        if (!(cur->valid) || cur->permanent)
+            continue;
+        if (curtime - cur->added >= SR_ARPCACHE_TO_MS)
+            cur->valid = 0;
+        else
+            arpcache_due(cache, cur->added + SR_ARPCACHE_TO_MS, curtime);
+    }
+    
+    arpcache_unlock(cache);
+    
+    /* takes the lock itself, and sends with it released */
+    sr_arpcache_sweepreqs(sr);
+}
+
+/* Thread which calls sr_arpcache_tick whenever something has fallen due. */
 void *sr_arpcache_timeout(void *sr_ptr) {
     struct sr_instance *sr = sr_ptr;
-    struct sr_arpcache *cache = &(sr->cache);
+    unsigned long due;
     
     while (1) {
-        sleep(1.0);
+        sr_clock_sleep_ms(SR_ARPCACHE_POLL_MS);
         
-        pthread_mutex_lock(&(cache->lock));
-    
-        time_t curtime = time(NULL);
+        arpcache_lock(&(sr->cache));
+        due = sr->cache.due;
+        arpcache_unlock(&(sr->cache));
         
-        int i;    
-        for (i = 0; i < SR_ARPCACHE_SZ; i++) {
-            if ((cache->entries[i].valid) && (difftime(curtime,cache->entries[i].added) > SR_ARPCACHE_TO)) {
-                cache->entries[i].valid = 0;
-            }
-        }
-        
-        sr_arpcache_sweepreqs(sr);
-
-        pthread_mutex_unlock(&(cache->lock));
+        if (due != 0 && sr_clock_now_ms() >= due)
+            sr_arpcache_tick(sr);
     }
     
     return NULL;
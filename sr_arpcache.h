@@ -2,7 +2,7 @@
    request queue, and ARP cache entries. The ARP request queue holds data about
    an outgoing ARP cache request and the packets that are waiting on a reply
    to that ARP cache request. The ARP cache entries hold IP->MAC mappings and
-   are timed out every SR_ARPCACHE_TO seconds.
+   are timed out SR_ARPCACHE_TO_MS milliseconds after they are learned.
 
    Pseudocode for use of these structures follows.
 
@@ -67,32 +67,45 @@
 #define SR_ARPCACHE_H
 
 #include <inttypes.h>
+#include <stdio.h>
 #include <time.h>
 #include <pthread.h>
 #include "sr_if.h"
 
 #define SR_ARPCACHE_SZ    100  
-#define SR_ARPCACHE_TO    15.0
+#define SR_ARPCACHE_TO_MS   15000 /* how long a learned mapping is kept */
+#define SR_ARPREQ_RETRY_MS  1000  /* between ARP requests for one IP */
+#define SR_ARPREQ_TRIES     5     /* requests sent before giving up */
+#define SR_ARPCACHE_POLL_MS 100   /* how often the thread looks for work */
+
+struct sr_rxslab;
+struct sr_pktbuf;
 
 struct sr_packet {
     uint8_t *buf;               /* A raw Ethernet frame, presumably with the dest MAC empty */
     unsigned int len;           /* Length of raw Ethernet frame */
-    char *iface;                /* The outgoing interface */
+    struct sr_if *in;           /* The interface it came in on */
+    struct sr_rxslab *slab;     /* Receive slab buf lives in, or NULL if buf
+                                   is our own copy */
+    struct sr_pktbuf *pb;       /* Packet buffer our copy is in, or NULL if
+                                   it was too big for one and malloc'd */
     struct sr_packet *next;
 };
 
 struct sr_arpentry {
     unsigned char mac[6]; 
     uint32_t ip;                /* IP addr in network byte order */
-    time_t added;         
+    unsigned long added;        /* sr_clock_now_ms() when learned */
     int valid;
+    int permanent;              /* static entry, never times out */
+    int referenced;             /* used since the CLOCK hand last passed */
 };
 
 struct sr_arpreq {
     uint32_t ip;
-    time_t sent;                /* Last time this ARP request was sent. You 
-                                   should update this. If the ARP request was 
-                                   never sent, will be 0. */
+    unsigned long sent;         /* sr_clock_now_ms() when this ARP request
+                                   was last sent. Only meaningful once
+                                   times_sent is above 0. */
     uint32_t times_sent;        /* Number of times this request was sent. You 
                                    should update this. */
     struct sr_packet *packets;  /* List of pkts waiting on this req to finish */
@@ -104,12 +117,25 @@ struct sr_arpcache {
     struct sr_arpreq *requests;
     pthread_mutex_t lock;
     pthread_mutexattr_t attr;
+    int hand;                        /* CLOCK eviction hand */
+    unsigned long evictions;         /* entries replaced because cache was full */
+    unsigned long insert_failures;   /* inserts dropped, nothing evictable */
+    int single_threaded;             /* no timeout thread, so no locking */
+    unsigned long due;               /* earliest deadline wake was told of,
+                                        0 if none */
+    void (*wake)(void *arg, unsigned long delay_ms); /* see below */
+    void *wake_arg;
 };
 
 /* Checks if an IP->MAC mapping is in the cache. IP is in network byte order. 
    You must free the returned structure if it is not NULL. */
 struct sr_arpentry *sr_arpcache_lookup(struct sr_arpcache *cache, uint32_t ip);
 
+/* Same, but copies the mapping into *entry instead of allocating one.
+   Returns 1 if there was one. */
+int sr_arpcache_lookup_copy(struct sr_arpcache *cache, uint32_t ip,
+                            struct sr_arpentry *entry);
+
 /* Adds an ARP request to the ARP request queue. If the request is already on
    the queue, adds the packet to the linked list of packets for this sr_arpreq
    that corresponds to this ARP request. The packet argument should not be
@@ -121,30 +147,82 @@ struct sr_arpreq *sr_arpcache_queuereq(struct sr_arpcache *cache,
                          uint32_t ip,
                          uint8_t *packet,               /* borrowed */
                          unsigned int packet_len,
-                         char *iface);
+                         struct sr_if *in);
+
+/* Same as sr_arpcache_queuereq, except that when slab is not NULL the packet
+   is queued in place instead of being copied. The queue takes over the
+   caller's reference on slab (see sr_rxring_hold) and drops it once the
+   packet has been sent or given up on. */
+struct sr_arpreq *sr_arpcache_queuereq_held(struct sr_arpcache *cache,
+                         uint32_t ip,
+                         uint8_t *packet,               /* held */
+                         unsigned int packet_len,
+                         struct sr_if *in,
+                         struct sr_rxslab *slab);
 
 /* This method performs two functions:
    1) Looks up this IP in the request queue. If it is found, returns a pointer
       to the sr_arpreq with this IP. Otherwise, returns NULL.
-   2) Inserts this IP to MAC mapping in the cache, and marks it valid. */
+   2) Inserts this IP to MAC mapping in the cache, and marks it valid. An
+      existing mapping for this IP is updated in place. If the cache is full,
+      a least recently used entry is evicted (CLOCK approximation). */
 struct sr_arpreq *sr_arpcache_insert(struct sr_arpcache *cache,
                                      unsigned char *mac,
                                      uint32_t ip);
 
+/* Updates the MAC of an IP->MAC mapping that is already in the cache, e.g.
+   from a gratuitous ARP. Unknown IPs are not added. Returns 1 if an entry was
+   refreshed, 0 otherwise. */
+int sr_arpcache_refresh(struct sr_arpcache *cache,
+                        unsigned char *mac,
+                        uint32_t ip);
+
 /* Frees all memory associated with this arp request entry. If this arp request
    entry is on the arp request queue, it is removed from the queue. */
 void sr_arpreq_destroy(struct sr_arpcache *cache, struct sr_arpreq *entry);
 
-/* Prints out the ARP table. */
+/* Sends (or resends, if SR_ARPREQ_RETRY_MS have passed) the ARP request for
+   this entry, or gives up and sends ICMP host unreachable for its packets
+   after SR_ARPREQ_TRIES tries. The decision is made under the cache lock, but packets are
+   only sent once it has been released, so call this without holding it. */
+void handle_arpreq(struct sr_instance *sr, struct sr_arpreq *request);
+
+/* Starts ARP resolution for every gateway in the routing table that isn't
+   already cached. Call once the interfaces are known and after the routing
+   table changes. */
+void sr_arpcache_prime(struct sr_instance *sr);
+
+/* Loads permanent IP->MAC mappings, one "ip mac" pair per line (e.g.
+   "10.0.1.1 0a:2d:eb:6e:0e:29"). Returns the number loaded or -1 on error. */
+int sr_arpcache_load_static(struct sr_arpcache *cache, const char *filename);
+
+/* Snapshots the dynamic entries to filename, and reloads them on the next
+   start. Restored entries keep their original age, so stale ones are skipped
+   and the rest expire as they would have. */
+int sr_arpcache_save(struct sr_arpcache *cache, const char *filename);
+int sr_arpcache_restore(struct sr_arpcache *cache, const char *filename);
+
+/* Prints out the ARP table, to stderr or to fp. */
 void sr_arpcache_dump(struct sr_arpcache *cache);
+void sr_arpcache_fdump(struct sr_arpcache *cache, FILE *fp);
 
 /* You shouldn't have to call these methods--they're already called in the
    starter code for you. The init call is a constructor, the destroy call is
-   a destructor, and a cleanup thread times out cache entries every 15
-   seconds. */
+   a destructor, and the tick times out cache entries and resends or gives
+   up on ARP requests.
+
+   Every time kept in the cache is in milliseconds from sr_clock_now_ms, so
+   a harness can run them on a virtual clock. Whenever the cache sets a
+   deadline sooner than the last one it reported (a new request, a retry, a
+   newly learned entry), it calls wake with how long from now that is, and
+   the tick should run then; the event loop uses this to arm its timer for
+   the next deadline rather than ticking on a fixed period. Without wake,
+   the cleanup thread looks every SR_ARPCACHE_POLL_MS and ticks when
+   something is due. */
 
 int   sr_arpcache_init(struct sr_arpcache *cache);
 int   sr_arpcache_destroy(struct sr_arpcache *cache);
+void  sr_arpcache_tick(struct sr_instance *sr);
 void *sr_arpcache_timeout(void *cache_ptr);
 
 #endif
@@ -0,0 +1,1120 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_bench.c
+ *
+ * Description:
+ *
+ * In-process benchmark of sr_handlepacket, one traffic class at a time
+ * and then as a weighted mix (make bench), and a soak test of the same
+ * traffic that fails if the router's memory grows with it (make soak).
+ *
+ * The router is set up as on the INSTRUCTIONS topology, with no server:
+ * frames go straight to sr_handlepacket on eth3 and whatever it sends is
+ * counted and dropped by a do-nothing transport. The classes are
+ *
+ *   forward   echo request from the gateway to server1 (next hop cached)
+ *   echo      echo request to the router's own eth3 address
+ *   ttl       forward with TTL 1, answered with time exceeded
+ *   noroute   forward to an address with no route, net unreachable
+ *   arpmiss   forward to server2, whose next hop isn't cached, so it is
+ *             queued for the ARP tick to ask for; when timing, the request
+ *             is dropped again (untimed) so every packet misses
+ *
+ * Each call is timed on its own. pps and ns/pkt are worked out from the
+ * time spent inside sr_handlepacket, so they are what the router could
+ * sustain on one core with free I/O. The router's own printing (stdout
+ * and stderr) is sent to /dev/null unless -v is given, and is part of what
+ * is measured; on a terminal it would cost a good deal more.
+ *
+ * With -s nothing is timed. Each class, and the mix, is run for tens of
+ * millions of packets while the heap in use (from the allocator) and RSS
+ * are sampled. After a warmup a leak-free router allocates only what it
+ * frees again, so any growth in the heap over the run is a leak and the
+ * soak fails. RSS is reported alongside but not judged, as it moves in
+ * pages and with the allocator's trimming, unless there are no allocator
+ * stats to go on. The packet buffer pools are watched too: the router
+ * takes its buffers from them (buf/p is how many a packet used), and once
+ * warmed up they should not have to malloc any more (grows), and every
+ * buffer taken should have been given back (held).
+ *
+ * The soak runs on a virtual clock, with the cached hosts made static so
+ * they stay cached. Packets that miss in the ARP cache are left queued:
+ * every SOAK_TICK packets the clock moves on SR_ARPREQ_RETRY_MS and the ARP
+ * tick runs, so each request is resent and then given up on, with a host
+ * unreachable for each packet that waited, all through the router's own
+ * code. Before each measurement the tick runs until nothing is waiting,
+ * so a request caught half way isn't taken for a leak.
+ *
+ * With -a the router runs on a virtual clock (sr_clock.h) for as many
+ * simulated seconds as given, to check its ARP timing without waiting for
+ * it. Each simulated second server1 is sent a few packets and server2 one,
+ * and the ARP tick runs. server1 answers ARP requests, so its entry should
+ * be learned, expire and be learned again at a steady pace. server2 never
+ * answers, so each of its requests should be retried and then given up on,
+ * with a host unreachable for every packet that waited. The run fails if
+ * any packet goes unaccounted for or the pace isn't steady.
+ *
+ * With -u it times the primitives sr_handlepacket is built from instead,
+ * each on its own: checksums, parsing a frame, interface, route and ARP
+ * cache lookups, queueing a packet for ARP, building an ICMP error and
+ * sr_send_packet to a VNS connection that is a socketpair drained by
+ * another thread. The thread is pinned to one CPU (-C, or wherever it
+ * started) and each primitive is warmed up, then run in batches; the
+ * cheapest and the median batch are reported in TSC cycles per call, and
+ * the median in ns too. "nothing" is the cost of the calling loop itself.
+ * The ARP cache is single threaded, as on the event loop, so takes no
+ * locks.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/socket.h>
+
+#ifdef _LINUX_
+#include <getopt.h>
+#endif /* _LINUX_ */
+
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+#include <malloc.h>
+#define BENCH_HAVE_MALLINFO
+#endif
+
+#include "sr_protocol.h"
+#include "sr_router.h"
+#include "sr_if.h"
+#include "sr_rt.h"
+#include "sr_arpcache.h"
+#include "sr_transport.h"
+#include "sr_utils.h"
+#include "sr_clock.h"
+#include "sr_txq.h"
+#include "sr_pktbuf.h"
+#include "sr_pkt.h"
+
+#define BENCH_PACKETS    200000     /* per class, and for the mix */
+#define BENCH_WARMUP     1000
+#define BENCH_DATA       56         /* ICMP data bytes, as ping sends */
+#define BENCH_FRAME_MAX  128
+
+#define SOAK_PACKETS     10000000   /* per class, and for the mix */
+#define SOAK_WARMUP      100000
+#define SOAK_SAMPLES     10
+#define SOAK_TICK        8          /* packets between ARP ticks */
+
+#define SIM_START        1000000000 /* virtual time the simulation starts at */
+#define SIM_RATE         10         /* packets a second to server1 */
+#define SIM_RETRIES      5          /* ARP requests before giving up */
+
+#define MICRO_OPS        100000     /* calls per batch */
+#define MICRO_WARMUP     10000
+#define MICRO_RUNS       15         /* batches per primitive */
+
+enum bench_kind
+{
+    BENCH_FORWARD,
+    BENCH_ECHO,
+    BENCH_TTL,
+    BENCH_NOROUTE,
+    BENCH_ARPMISS,
+    BENCH_CLASSES
+};
+
+struct bench_class
+{
+    const char* name;
+    const char* dst;                /* destination address */
+    uint8_t ttl;
+    unsigned int weight;            /* share of the mix */
+    uint8_t frame[BENCH_FRAME_MAX];
+    unsigned int len;
+};
+
+static struct bench_class bench_classes[BENCH_CLASSES] =
+{
+    { "forward", "192.168.2.2", 64, 80 },
+    { "echo",    "10.0.1.1",    64, 5 },
+    { "ttl",     "192.168.2.2", 1,  5 },
+    { "noroute", "8.8.8.8",     64, 5 },
+    { "arpmiss", "172.64.3.10", 64, 5 }
+};
+
+/* The INSTRUCTIONS topology, as sr_emu plays it */
+static const struct
+{
+    const char* name;
+    const char* mac;
+    const char* ip;
+} bench_ifs[] =
+{
+    { "eth3", "0a:00:00:00:00:03", "10.0.1.1" },
+    { "eth1", "0a:00:00:00:00:01", "192.168.2.1" },
+    { "eth2", "0a:00:00:00:00:02", "172.64.3.1" }
+};
+
+static const struct
+{
+    const char* ip;
+    const char* mac;                /* 0 if not in the ARP cache */
+    const char* iface;
+} bench_hosts[] =
+{
+    { "10.0.1.100",  "0a:11:11:11:11:11", "eth3" },
+    { "192.168.2.2", "0a:22:22:22:22:22", "eth1" },
+    { "172.64.3.10", 0,                   "eth2" }
+};
+
+static struct sr_instance sr;
+static unsigned long bench_sent;
+static int bench_out = -1, bench_err = -1;
+
+/* What the ARP simulation has seen the router send */
+struct bench_sim
+{
+    int on;
+    uint32_t answers;               /* server1, who answers ARP */
+    uint32_t silent;                /* server2, who doesn't */
+    int asked;                      /* server1 is waiting to answer */
+    unsigned long requests[2];      /* for server1, server2 */
+    time_t last_asked;              /* server1's last request */
+    time_t min_gap, max_gap;        /* between server1's requests */
+    unsigned long forwarded;        /* to server1 */
+    unsigned long unreachable;      /* host unreachables back */
+    unsigned long give_ups;         /* ticks that sent some */
+    time_t last_unreachable;
+};
+
+static struct bench_sim bench_sim;
+
+/* What the primitives work on, and somewhere for their results to go so
+   the calls aren't optimised away */
+static uint8_t micro_frame[BENCH_FRAME_MAX];
+static unsigned int micro_len;
+static uint32_t micro_hit, micro_miss;
+static struct sr_if* micro_in;
+static volatile unsigned long micro_sink;
+
+struct bench_micro
+{
+    const char* name;
+    void (*op)(void);
+};
+
+/* Heap in use and resident set, in bytes */
+struct bench_mem
+{
+    size_t heap;
+    size_t rss;
+};
+
+/*---------------------------------------------------------------------
+ * Method: bench_sim_saw(..)
+ * Scope:  Local
+ *
+ * Account for a frame the router sent during the ARP simulation. An ARP
+ * request counts once, on the link of the host it asks for.
+ *
+ *---------------------------------------------------------------------*/
+
+static void bench_sim_saw(const struct sr_frame* f)
+{
+    struct bench_sim* sim = &bench_sim;
+    const sr_ethernet_hdr_t* eth = (const sr_ethernet_hdr_t*)f->buf;
+    const sr_arp_hdr_t* arp = (const sr_arp_hdr_t*)(eth + 1);
+    const sr_ip_hdr_t* ip = (const sr_ip_hdr_t*)(eth + 1);
+    const uint8_t* icmp = (const uint8_t*)(ip + 1);
+    time_t now = sr_clock_now();
+
+    if(f->len < sizeof(sr_ethernet_hdr_t) + sizeof(sr_arp_hdr_t))
+    { return; }
+
+    if(ntohs(eth->ether_type) == ethertype_arp &&
+       ntohs(arp->ar_op) == arp_op_request)
+    {
+        if(arp->ar_tip == sim->answers && strcmp(f->iface->name, "eth1") == 0)
+        {
+            if(sim->requests[0]++ > 0)
+            {
+                if(sim->min_gap == 0 || now - sim->last_asked < sim->min_gap)
+                { sim->min_gap = now - sim->last_asked; }
+                if(now - sim->last_asked > sim->max_gap)
+                { sim->max_gap = now - sim->last_asked; }
+            }
+            sim->last_asked = now;
+            sim->asked = 1;
+        }
+        else if(arp->ar_tip == sim->silent && strcmp(f->iface->name, "eth2") == 0)
+        { sim->requests[1]++; }
+    }
+    else if(ntohs(eth->ether_type) == ethertype_ip)
+    {
+        if(ip->ip_dst == sim->answers)
+        { sim->forwarded++; }
+        else if(ip->ip_p == ip_protocol_icmp && icmp[0] == 3 && icmp[1] == 1)
+        {
+            if(sim->unreachable++ == 0 || now != sim->last_unreachable)
+            { sim->give_ups++; }
+            sim->last_unreachable = now;
+        }
+    }
+} /* -- bench_sim_saw -- */
+
+static int bench_send_burst(struct sr_instance* sr,
+        const struct sr_frame* frames, int n)
+{
+    int i;
+
+    bench_sent += n;
+    for(i = 0; bench_sim.on && i < n; i++)
+    { bench_sim_saw(&frames[i]); }
+    return n;
+} /* -- bench_send_burst -- */
+
+/* Only sending is ever asked of it */
+static struct sr_transport bench_transport =
+{
+    "bench", 0, 0, 0, 0, bench_send_burst, 0, 0
+};
+
+static void usage(char* argv0)
+{
+    printf("In-process benchmark of sr_handlepacket\n");
+    printf("Format: %s [-h] [-v] [-s | -a seconds | -u [-C cpu]] "
+           "[-n packets] [-m class=weight,...]\n", argv0);
+    printf("   -s     soak: check memory use instead of timing\n");
+    printf("   -a     simulate this many seconds of ARP on a virtual clock\n");
+    printf("   -u     time the primitives one by one (per batch with -n)\n");
+    printf("   -C     pin to this CPU for -u\n");
+    printf("   -n     packets per class and for the mix (default %d, "
+           "or %d with -s)\n", BENCH_PACKETS, SOAK_PACKETS);
+    printf("   -m     weights of the mix, e.g. forward=90,arpmiss=10\n");
+    printf("   -v     let the router print\n");
+    printf("   classes: forward echo ttl noroute arpmiss\n");
+} /* -- usage -- */
+
+static uint64_t bench_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+} /* -- bench_now_ns -- */
+
+static void bench_mac(const char* s, unsigned char* mac)
+{
+    unsigned int m[ETHER_ADDR_LEN];
+    int i;
+
+    assert(sscanf(s, "%x:%x:%x:%x:%x:%x", &m[0], &m[1], &m[2], &m[3],
+                  &m[4], &m[5]) == 6);
+    for(i = 0; i < ETHER_ADDR_LEN; i++)
+    { mac[i] = (unsigned char)m[i]; }
+} /* -- bench_mac -- */
+
+/*---------------------------------------------------------------------
+ * Method: bench_router(..)
+ * Scope:  Local
+ *
+ * Interfaces, host routes and a warm ARP cache, as the router would have
+ * them a while after connecting. Everything runs on this thread, as with
+ * the event loop, but the ARP tick never runs.
+ *
+ *---------------------------------------------------------------------*/
+
+static void bench_router(void)
+{
+    unsigned char mac[ETHER_ADDR_LEN];
+    struct in_addr dest, mask;
+    unsigned int i;
+
+    memset(&sr, 0, sizeof(sr));
+    sr.sockfd = -1;
+    sr.transport = &bench_transport;
+
+    for(i = 0; i < sizeof(bench_ifs) / sizeof(bench_ifs[0]); i++)
+    {
+        sr_add_interface(&sr, bench_ifs[i].name);
+        bench_mac(bench_ifs[i].mac, mac);
+        sr_set_ether_addr(&sr, mac);
+        inet_aton(bench_ifs[i].ip, &dest);
+        sr_set_ether_ip(&sr, dest.s_addr);
+    }
+
+    sr_arpcache_init(&sr.cache);
+    sr.cache.single_threaded = 1;
+
+    inet_aton("255.255.255.255", &mask);
+    for(i = 0; i < sizeof(bench_hosts) / sizeof(bench_hosts[0]); i++)
+    {
+        inet_aton(bench_hosts[i].ip, &dest);
+        sr_add_rt_entry(&sr, dest, dest, mask, (char*)bench_hosts[i].iface);
+        if(bench_hosts[i].mac)
+        {
+            bench_mac(bench_hosts[i].mac, mac);
+            sr_arpcache_insert(&sr.cache, mac, dest.s_addr);
+        }
+    }
+    assert(sr_verify_routing_table(&sr) == 0);
+} /* -- bench_router -- */
+
+/*---------------------------------------------------------------------
+ * Method: bench_frame(..)
+ * Scope:  Local
+ *
+ * An echo request from the gateway, addressed to the router's eth3.
+ *
+ *---------------------------------------------------------------------*/
+
+static void bench_frame(struct bench_class* c)
+{
+    sr_ethernet_hdr_t* eth = (sr_ethernet_hdr_t*)c->frame;
+    sr_ip_hdr_t* ip = (sr_ip_hdr_t*)(eth + 1);
+    uint8_t* icmp = (uint8_t*)(ip + 1);
+    unsigned int icmp_len = 8 + BENCH_DATA;
+    struct in_addr addr;
+    uint16_t sum;
+    unsigned int i;
+
+    memset(c->frame, 0, sizeof(c->frame));
+    bench_mac(bench_ifs[0].mac, eth->ether_dhost);
+    bench_mac(bench_hosts[0].mac, eth->ether_shost);
+    eth->ether_type = htons(ethertype_ip);
+
+    ip->ip_v = 4;
+    ip->ip_hl = sizeof(sr_ip_hdr_t) / 4;
+    ip->ip_len = htons(sizeof(sr_ip_hdr_t) + icmp_len);
+    ip->ip_id = htons(1);
+    ip->ip_ttl = c->ttl;
+    ip->ip_p = ip_protocol_icmp;
+    inet_aton(bench_hosts[0].ip, &addr);
+    ip->ip_src = addr.s_addr;
+    inet_aton(c->dst, &addr);
+    ip->ip_dst = addr.s_addr;
+    ip->ip_sum = cksum(ip, sizeof(sr_ip_hdr_t));
+
+    icmp[0] = 8;
+    icmp[5] = 1;                    /* id 1, seq 0 */
+    for(i = 8; i < icmp_len; i++)
+    { icmp[i] = (uint8_t)i; }
+    sum = cksum(icmp, icmp_len);
+    memcpy(icmp + 2, &sum, 2);
+
+    c->len = sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t) + icmp_len;
+} /* -- bench_frame -- */
+
+/*---------------------------------------------------------------------
+ * Method: bench_one(..)
+ * Scope:  Local
+ *
+ * Hand the router one packet of class c. Returns the ns it took.
+ *
+ *---------------------------------------------------------------------*/
+
+static uint32_t bench_one(int c)
+{
+    uint8_t frame[BENCH_FRAME_MAX];
+    uint64_t t0, t1;
+
+    /* -- the router rewrites it in place -- */
+    memcpy(frame, bench_classes[c].frame, bench_classes[c].len);
+    t0 = bench_now_ns();
+    sr_handlepacket(&sr, frame, bench_classes[c].len, (char*)bench_ifs[0].name);
+    t1 = bench_now_ns();
+
+    if(c == BENCH_ARPMISS)
+    { sr_arpreq_destroy(&sr.cache, sr.cache.requests); }
+    return t1 - t0 > 0xffffffffULL ? 0xffffffff : (uint32_t)(t1 - t0);
+} /* -- bench_one -- */
+
+static int bench_cmp32(const void* a, const void* b)
+{
+    uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+    return x < y ? -1 : x > y;
+} /* -- bench_cmp32 -- */
+
+static void bench_report(const char* name, uint32_t* lat, unsigned long n,
+        unsigned long sent)
+{
+    uint64_t sum = 0;
+    unsigned long i;
+
+    for(i = 0; i < n; i++)
+    { sum += lat[i]; }
+    qsort(lat, n, sizeof(uint32_t), bench_cmp32);
+    printf("%-8s %10.0f %9.1f %8u %8u %8u %8u %8.2f\n", name,
+           sum ? n / (sum / 1e9) : 0, (double)sum / n, lat[n / 2],
+           lat[n * 99 / 100], lat[n * 999 / 1000], lat[n - 1],
+           (double)sent / n);
+} /* -- bench_report -- */
+
+/*---------------------------------------------------------------------
+ * Method: bench_quiet(..)
+ * Scope:  Local
+ *
+ * Send the router's stdout and stderr to /dev/null while it runs (on),
+ * and bring them back afterwards (off).
+ *
+ *---------------------------------------------------------------------*/
+
+static void bench_quiet(int on)
+{
+    int null;
+
+    fflush(stdout);
+    fflush(stderr);
+    if(on)
+    {
+        bench_out = dup(1);
+        bench_err = dup(2);
+        null = open("/dev/null", O_WRONLY);
+        dup2(null, 1);
+        dup2(null, 2);
+        close(null);
+    }
+    else
+    {
+        dup2(bench_out, 1);
+        dup2(bench_err, 2);
+        close(bench_out);
+        close(bench_err);
+    }
+} /* -- bench_quiet -- */
+
+static void bench_mem(struct bench_mem* m)
+{
+    unsigned long size = 0, resident = 0;
+    FILE* fp;
+#ifdef BENCH_HAVE_MALLINFO
+    struct mallinfo2 mi = mallinfo2();
+
+    m->heap = mi.uordblks + mi.hblkhd;
+#else
+    m->heap = 0;
+#endif
+
+    if((fp = fopen("/proc/self/statm", "r")) != 0)
+    {
+        if(fscanf(fp, "%lu %lu", &size, &resident) != 2)
+        { resident = 0; }
+        fclose(fp);
+    }
+    m->rss = resident * sysconf(_SC_PAGESIZE);
+} /* -- bench_mem -- */
+
+/*---------------------------------------------------------------------
+ * Method: bench_soak_tick(..), bench_soak_one(..), bench_soak_drain(..)
+ * Scope:  Local
+ *
+ * A soak hands the router packet i of class c with bench_soak_one, which
+ * moves the clock on and ticks every SOAK_TICK packets. bench_soak_drain
+ * ticks until no request is left waiting.
+ *
+ *---------------------------------------------------------------------*/
+
+static void bench_soak_tick(void)
+{
+    sr_clock_advance_ms(SR_ARPREQ_RETRY_MS);
+    sr_arpcache_tick(&sr);
+} /* -- bench_soak_tick -- */
+
+static void bench_soak_one(int c, unsigned long i)
+{
+    uint8_t frame[BENCH_FRAME_MAX];
+
+    memcpy(frame, bench_classes[c].frame, bench_classes[c].len);
+    sr_handlepacket(&sr, frame, bench_classes[c].len, (char*)bench_ifs[0].name);
+    if(i % SOAK_TICK == SOAK_TICK - 1)
+    { bench_soak_tick(); }
+} /* -- bench_soak_one -- */
+
+static void bench_soak_drain(void)
+{
+    while(sr.cache.requests)
+    { bench_soak_tick(); }
+} /* -- bench_soak_drain -- */
+
+/*---------------------------------------------------------------------
+ * Method: bench_soak(..)
+ * Scope:  Local
+ *
+ * Run n packets of class c (or of the mix, for BENCH_CLASSES) and report
+ * how memory moved over them. Returns 0 if it didn't grow.
+ *
+ *---------------------------------------------------------------------*/
+
+static int bench_soak(int c, const int* order, unsigned int total,
+        unsigned long n, int verbose)
+{
+    struct bench_mem base, now, peak;
+    struct sr_pktbuf_stats buf0, buf1;
+    unsigned long i, s, done = 0, step = n / SOAK_SAMPLES;
+    double heap_pp, rss_pp;
+    long held;
+    int grew;
+
+    if(!verbose)
+    { bench_quiet(1); }
+
+    for(i = 0; i < SOAK_WARMUP; i++)
+    { bench_soak_one(c < BENCH_CLASSES ? c : order[i % total], i); }
+    bench_soak_drain();
+    /* -- twice, as stdio keeps a little of the first fopen for good -- */
+    bench_mem(&base);
+    bench_mem(&base);
+    peak = base;
+    sr_pktbuf_get_stats(&buf0);
+
+    for(s = 0; s < SOAK_SAMPLES; s++)
+    {
+        for(i = 0; i < step; i++, done++)
+        { bench_soak_one(c < BENCH_CLASSES ? c : order[done % total], done); }
+        if(s == SOAK_SAMPLES - 1)
+        { bench_soak_drain(); }
+        bench_mem(&now);
+        if(now.heap > peak.heap)
+        { peak.heap = now.heap; }
+        if(now.rss > peak.rss)
+        { peak.rss = now.rss; }
+    }
+
+    sr_pktbuf_get_stats(&buf1);
+    if(!verbose)
+    { bench_quiet(0); }
+
+    heap_pp = ((double)now.heap - (double)base.heap) / done;
+    rss_pp = ((double)now.rss - (double)base.rss) / done;
+#ifdef BENCH_HAVE_MALLINFO
+    grew = now.heap > base.heap;
+#else
+    grew = now.rss > base.rss;
+#endif
+    held = (long)(buf1.allocs - buf1.frees) - (long)(buf0.allocs - buf0.frees);
+    grew |= buf1.grows > buf0.grows || held != 0;
+
+    printf("%-8s %10lu %10lu %10lu %9.4f %9lu %9lu %9.4f %6.2f %6lu %6ld  %s\n",
+           c < BENCH_CLASSES ? bench_classes[c].name : "mix", done,
+           (unsigned long)base.heap, (unsigned long)peak.heap, heap_pp,
+           (unsigned long)(base.rss / 1024), (unsigned long)(peak.rss / 1024),
+           rss_pp, (double)(buf1.allocs - buf0.allocs) / done,
+           buf1.grows - buf0.grows, held, grew ? "LEAK" : "ok");
+    fflush(stdout);
+    return grew;
+} /* -- bench_soak -- */
+
+/*---------------------------------------------------------------------
+ * Method: bench_sim_answer(..)
+ * Scope:  Local
+ *
+ * server1 answers the router's ARP request, on eth1.
+ *
+ *---------------------------------------------------------------------*/
+
+static void bench_sim_answer(void)
+{
+    uint8_t frame[sizeof(sr_ethernet_hdr_t) + sizeof(sr_arp_hdr_t)];
+    sr_ethernet_hdr_t* eth = (sr_ethernet_hdr_t*)frame;
+    sr_arp_hdr_t* arp = (sr_arp_hdr_t*)(eth + 1);
+    struct in_addr addr;
+
+    memset(frame, 0, sizeof(frame));
+    bench_mac(bench_ifs[1].mac, eth->ether_dhost);
+    bench_mac(bench_hosts[1].mac, eth->ether_shost);
+    eth->ether_type = htons(ethertype_arp);
+    arp->ar_hrd = htons(arp_hrd_ethernet);
+    arp->ar_pro = htons(ethertype_ip);
+    arp->ar_hln = ETHER_ADDR_LEN;
+    arp->ar_pln = 4;
+    arp->ar_op = htons(arp_op_reply);
+    memcpy(arp->ar_sha, eth->ether_shost, ETHER_ADDR_LEN);
+    arp->ar_sip = bench_sim.answers;
+    memcpy(arp->ar_tha, eth->ether_dhost, ETHER_ADDR_LEN);
+    inet_aton(bench_ifs[1].ip, &addr);
+    arp->ar_tip = addr.s_addr;
+
+    sr_handlepacket(&sr, frame, sizeof(frame), (char*)bench_ifs[1].name);
+} /* -- bench_sim_answer -- */
+
+/*---------------------------------------------------------------------
+ * Method: bench_sim_run(..)
+ * Scope:  Local
+ *
+ * Run secs simulated seconds of ARP. Returns 0 if the router kept time.
+ *
+ *---------------------------------------------------------------------*/
+
+static int bench_sim_run(unsigned long secs, int verbose)
+{
+    struct bench_sim* sim = &bench_sim;
+    struct sr_arpreq* req;
+    struct sr_packet* pkt;
+    unsigned long t, sent[2] = { 0, 0 }, pending = 0, pending_asks = 0;
+    uint8_t frame[BENCH_FRAME_MAX];
+    uint64_t start = bench_now_ns();
+    double wall;
+    int i, ok;
+
+    if(!verbose)
+    { bench_quiet(1); }
+    for(t = 0; t < secs; t++)
+    {
+        for(i = 0; i < SIM_RATE; i++, sent[0]++)
+        {
+            memcpy(frame, bench_classes[BENCH_FORWARD].frame,
+                   bench_classes[BENCH_FORWARD].len);
+            sr_handlepacket(&sr, frame, bench_classes[BENCH_FORWARD].len,
+                            (char*)bench_ifs[0].name);
+        }
+        memcpy(frame, bench_classes[BENCH_ARPMISS].frame,
+               bench_classes[BENCH_ARPMISS].len);
+        sr_handlepacket(&sr, frame, bench_classes[BENCH_ARPMISS].len,
+                        (char*)bench_ifs[0].name);
+        sent[1]++;
+
+        sr_clock_advance_ms(1000);
+        sr_arpcache_tick(&sr);
+        if(sim->asked)
+        {
+            sim->asked = 0;
+            bench_sim_answer();
+        }
+    }
+    wall = (bench_now_ns() - start) / 1e9;
+    if(!verbose)
+    { bench_quiet(0); }
+
+    /* -- what is still waiting for server2 -- */
+    for(req = sr.cache.requests; req; req = req->next)
+    {
+        if(req->ip != sim->silent)
+        { continue; }
+        pending_asks = req->times_sent;
+        for(pkt = req->packets; pkt; pkt = pkt->next)
+        { pending++; }
+    }
+
+    ok = sim->forwarded == sent[0] &&
+        sim->unreachable + pending == sent[1] &&
+        sim->requests[1] == sim->give_ups * SIM_RETRIES + pending_asks &&
+        sim->requests[0] > 1 && sim->min_gap == sim->max_gap &&
+        sim->min_gap * 1000 > SR_ARPCACHE_TO_MS;
+
+    printf("simulated %lus (%.1f hours) in %.2fs, %.0fx\n", secs,
+           secs / 3600.0, wall, wall > 0 ? secs / wall : 0);
+    printf("server1: %lu sent, %lu forwarded, %lu ARP requests, "
+           "re-learned every %ld-%lds\n", sent[0], sim->forwarded,
+           sim->requests[0], (long)sim->min_gap, (long)sim->max_gap);
+    printf("server2: %lu sent, %lu host unreachable, %lu still waiting; "
+           "%lu ARP requests, %lu given up on\n", sent[1], sim->unreachable,
+           pending, sim->requests[1], sim->give_ups);
+    printf("%s\n", ok ? "ok" : "FAILED");
+    return !ok;
+} /* -- bench_sim_run -- */
+
+static uint64_t bench_cycles(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    uint32_t lo, hi;
+
+    __asm__ __volatile__("lfence; rdtsc" : "=a"(lo), "=d"(hi) : : "memory");
+    return ((uint64_t)hi << 32) | lo;
+#else
+    return bench_now_ns();
+#endif
+} /* -- bench_cycles -- */
+
+static void micro_nothing(void)
+{
+} /* -- micro_nothing -- */
+
+static void micro_cksum_ip(void)
+{
+    micro_sink += cksum(micro_frame + sizeof(sr_ethernet_hdr_t),
+                        sizeof(sr_ip_hdr_t));
+} /* -- micro_cksum_ip -- */
+
+static void micro_cksum_icmp(void)
+{
+    unsigned int off = sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t);
+
+    micro_sink += cksum(micro_frame + off, micro_len - off);
+} /* -- micro_cksum_icmp -- */
+
+static void micro_pkt_parse(void)
+{
+    struct sr_pkt pkt;
+
+    sr_pkt_parse(&sr, &pkt, micro_frame, micro_len, "eth3");
+    micro_sink += pkt.flags;
+} /* -- micro_pkt_parse -- */
+
+static void micro_get_interface(void)
+{
+    micro_sink += (unsigned long)sr_get_interface(&sr, "eth2");
+} /* -- micro_get_interface -- */
+
+static void micro_to_router_hit(void)
+{
+    micro_sink += to_router(&sr, sr.if_list->next->next->ip);
+} /* -- micro_to_router_hit -- */
+
+static void micro_to_router_miss(void)
+{
+    micro_sink += to_router(&sr, micro_hit);
+} /* -- micro_to_router_miss -- */
+
+static void micro_resolve_rt(void)
+{
+    micro_sink += resolve_rt(&sr, micro_hit);
+} /* -- micro_resolve_rt -- */
+
+static void micro_lookup_hit(void)
+{
+    struct sr_arpentry* entry = sr_arpcache_lookup(&sr.cache, micro_hit);
+
+    micro_sink += entry->mac[0];
+    free(entry);
+} /* -- micro_lookup_hit -- */
+
+static void micro_lookup_miss(void)
+{
+    micro_sink += (unsigned long)sr_arpcache_lookup(&sr.cache, micro_miss);
+} /* -- micro_lookup_miss -- */
+
+static void micro_queuereq(void)
+{
+    sr_arpreq_destroy(&sr.cache, sr_arpcache_queuereq(&sr.cache, micro_miss,
+                      micro_frame, micro_len, micro_in));
+} /* -- micro_queuereq -- */
+
+static void micro_send_icmp(void)
+{
+    sr_ethernet_hdr_t* eth = (sr_ethernet_hdr_t*)micro_frame;
+    sr_ip_hdr_t* ip = (sr_ip_hdr_t*)(eth + 1);
+    struct sr_pktbuf* pb = send_icmp(0, 11, sr.if_list->ip, eth->ether_dhost,
+                                     ip->ip_src, eth->ether_shost);
+
+    micro_sink += pb->data[0];
+    sr_pktbuf_free(pb);
+} /* -- micro_send_icmp -- */
+
+static void micro_send_packet(void)
+{
+    micro_sink += sr_send_packet(&sr, micro_frame, micro_len, "eth1");
+} /* -- micro_send_packet -- */
+
+static const struct bench_micro bench_micros[] =
+{
+    { "nothing",             micro_nothing },
+    { "cksum ip header",     micro_cksum_ip },
+    { "cksum icmp 64B",      micro_cksum_icmp },
+    { "sr_pkt_parse",        micro_pkt_parse },
+    { "sr_get_interface",    micro_get_interface },
+    { "to_router hit",       micro_to_router_hit },
+    { "to_router miss",      micro_to_router_miss },
+    { "resolve_rt",          micro_resolve_rt },
+    { "arpcache_lookup hit", micro_lookup_hit },
+    { "arpcache_lookup miss", micro_lookup_miss },
+    { "arpcache_queuereq",   micro_queuereq },
+    { "send_icmp",           micro_send_icmp },
+    { "sr_send_packet",      micro_send_packet },
+    { 0, 0 }
+};
+
+/* The VNS server's end of the socketpair: read and forget */
+static void* micro_drain(void* arg)
+{
+    int fd = *(int*)arg;
+    char buf[65536];
+
+    while(read(fd, buf, sizeof(buf)) > 0);
+    return 0;
+} /* -- micro_drain -- */
+
+static int micro_pin(pthread_t thread, int cpu)
+{
+    cpu_set_t set;
+
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(thread, sizeof(set), &set);
+} /* -- micro_pin -- */
+
+/*---------------------------------------------------------------------
+ * Method: bench_micro_run(..)
+ * Scope:  Local
+ *
+ * Time each primitive in turn, n calls to a batch.
+ *
+ *---------------------------------------------------------------------*/
+
+static void bench_micro_run(unsigned long n, int cpu, int verbose)
+{
+    struct sr_transport* transport = sr.transport;
+    struct sr_transport vns = sr_vns_transport;
+    const struct bench_micro* m;
+    uint64_t runs[MICRO_RUNS], c0, t0, c1, t1, k;
+    double per_ns;
+    unsigned long i;
+    pthread_t drain;
+    struct in_addr addr;
+    sr_ethernet_hdr_t* eth = (sr_ethernet_hdr_t*)micro_frame;
+    int fds[2], r, j, ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+    if(cpu < 0)
+    { cpu = sched_getcpu(); }
+    if(micro_pin(pthread_self(), cpu) != 0)
+    { fprintf(stderr, "Couldn't pin to CPU %d, running unpinned\n", cpu); }
+
+    /* -- a forward to server1 as it would leave eth1 -- */
+    micro_len = bench_classes[BENCH_FORWARD].len;
+    memcpy(micro_frame, bench_classes[BENCH_FORWARD].frame, micro_len);
+    bench_mac(bench_hosts[1].mac, eth->ether_dhost);
+    bench_mac(bench_ifs[1].mac, eth->ether_shost);
+    inet_aton(bench_hosts[1].ip, &addr);
+    micro_hit = addr.s_addr;
+    inet_aton(bench_hosts[2].ip, &addr);
+    micro_miss = addr.s_addr;
+    micro_in = sr_get_interface(&sr, "eth3");
+
+    /* -- sr_send_packet goes to a VNS connection on a socketpair -- */
+    assert(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    sr.sockfd = fds[0];
+    sr.txq = sr_txq_create(fds[0]);
+    sr.transport = &vns;
+    assert(pthread_create(&drain, 0, micro_drain, &fds[1]) == 0);
+    if(ncpus > 1)
+    { micro_pin(drain, (cpu + 1) % ncpus); }
+
+    /* -- how many TSC ticks to the ns -- */
+    c0 = bench_cycles();
+    t0 = bench_now_ns();
+    do
+    { t1 = bench_now_ns(); }
+    while(t1 - t0 < 50000000);
+    c1 = bench_cycles();
+    per_ns = (double)(c1 - c0) / (t1 - t0);
+
+    printf("pinned to CPU %d, %.3f cycles/ns, %lu calls a batch, best and "
+           "median of %d\n", cpu, per_ns, n, MICRO_RUNS);
+    printf("%-22s %10s %10s %10s\n", "primitive", "min cyc", "med cyc",
+           "med ns");
+    fflush(stdout);
+
+    for(m = bench_micros; m->name; m++)
+    {
+        if(!verbose)
+        { bench_quiet(1); }
+        for(i = 0; i < MICRO_WARMUP; i++)
+        { m->op(); }
+        for(r = 0; r < MICRO_RUNS; r++)
+        {
+            c0 = bench_cycles();
+            for(i = 0; i < n; i++)
+            { m->op(); }
+            runs[r] = bench_cycles() - c0;
+        }
+
+        /* -- a handful, so insertion sort -- */
+        for(r = 1; r < MICRO_RUNS; r++)
+        {
+            k = runs[r];
+            for(j = r - 1; j >= 0 && runs[j] > k; j--)
+            { runs[j + 1] = runs[j]; }
+            runs[j + 1] = k;
+        }
+
+        if(!verbose)
+        { bench_quiet(0); }
+        printf("%-22s %10.1f %10.1f %10.1f\n", m->name,
+               (double)runs[0] / n, (double)runs[MICRO_RUNS / 2] / n,
+               runs[MICRO_RUNS / 2] / per_ns / n);
+        fflush(stdout);
+    }
+
+    sr_txq_destroy(sr.txq);
+    sr.txq = 0;
+    sr.transport = transport;
+    close(fds[0]);
+    pthread_join(drain, 0);
+    close(fds[1]);
+} /* -- bench_micro_run -- */
+
+/*---------------------------------------------------------------------
+ * Method: bench_weights(..)
+ * Scope:  Local
+ *
+ * Parse -m. Classes it doesn't name get no share of the mix.
+ *
+ *---------------------------------------------------------------------*/
+
+static int bench_weights(char* spec)
+{
+    char* arg;
+    char* eq;
+    char* save = 0;
+    int c;
+
+    for(c = 0; c < BENCH_CLASSES; c++)
+    { bench_classes[c].weight = 0; }
+
+    for(arg = strtok_r(spec, ",", &save); arg; arg = strtok_r(0, ",", &save))
+    {
+        if((eq = strchr(arg, '=')) == 0)
+        { return -1; }
+        *eq = 0;
+        for(c = 0; c < BENCH_CLASSES; c++)
+        {
+            if(strcmp(bench_classes[c].name, arg) == 0)
+            { break; }
+        }
+        if(c == BENCH_CLASSES)
+        { return -1; }
+        bench_classes[c].weight = atoi(eq + 1);
+    }
+    return 0;
+} /* -- bench_weights -- */
+
+/*-----------------------------------------------------------------------------
+ *---------------------------------------------------------------------------*/
+
+int main(int argc, char** argv)
+{
+    unsigned long n = 0, i, sent;
+    unsigned int total = 0, w;
+    uint32_t* lat = 0;
+    int* order;
+    unsigned long sim_secs = 0;
+    int c, opt, verbose = 0, soak = 0, micro = 0, cpu = -1, failed = 0;
+
+    while((opt = getopt(argc, argv, "hvsuC:a:n:m:")) != EOF)
+    {
+        switch(opt)
+        {
+            case 'v': verbose = 1; break;
+            case 's': soak = 1; break;
+            case 'a': sim_secs = strtoul(optarg, 0, 10); break;
+            case 'u': micro = 1; break;
+            case 'C': cpu = atoi(optarg); break;
+            case 'n': n = strtoul(optarg, 0, 10); break;
+            case 'm':
+                if(bench_weights(optarg) == 0)
+                { break; }
+                fprintf(stderr, "Error: bad mix %s\n", optarg);
+                exit(1);
+            default:
+                usage(argv[0]);
+                exit(opt == 'h' ? 0 : 1);
+        }
+    }
+    if(n == 0)
+    { n = soak ? SOAK_PACKETS : micro ? MICRO_OPS : BENCH_PACKETS; }
+    for(c = 0; c < BENCH_CLASSES; c++)
+    { total += bench_classes[c].weight; }
+    if(n < 1000 || total == 0)
+    {
+        fprintf(stderr, "Error: need at least 1000 packets and some mix\n");
+        exit(1);
+    }
+
+    if(!soak && !micro)
+    {
+        lat = (uint32_t*)malloc(n * sizeof(uint32_t));
+        assert(lat);
+    }
+    order = (int*)malloc(total * sizeof(int));
+    assert(order);
+
+    /* -- the clock has to be virtual before the ARP cache is filled -- */
+    if(sim_secs || soak)
+    { sr_clock_virtual(SIM_START); }
+    bench_router();
+    if(soak)
+    {
+        /* -- hours of ticks go by, and the cached hosts have to stay -- */
+        for(i = 0; i < SR_ARPCACHE_SZ; i++)
+        { sr.cache.entries[i].permanent = sr.cache.entries[i].valid; }
+    }
+    for(c = 0; c < BENCH_CLASSES; c++)
+    { bench_frame(&bench_classes[c]); }
+
+    if(sim_secs)
+    {
+        bench_sim.on = 1;
+        inet_aton(bench_hosts[1].ip, (struct in_addr*)&bench_sim.answers);
+        inet_aton(bench_hosts[2].ip, (struct in_addr*)&bench_sim.silent);
+        failed = bench_sim_run(sim_secs, verbose);
+        free(order);
+        return failed;
+    }
+
+    if(micro)
+    {
+        bench_micro_run(n, cpu, verbose);
+        free(order);
+        return 0;
+    }
+
+    /* -- the mix, spread out so no class comes in long runs -- */
+    srand(1);
+    for(c = 0, i = 0; c < BENCH_CLASSES; c++)
+    {
+        for(w = 0; w < bench_classes[c].weight; w++)
+        { order[i++] = c; }
+    }
+    for(i = total - 1; i > 0; i--)
+    {
+        w = rand() % (i + 1);
+        c = order[i];
+        order[i] = order[w];
+        order[w] = c;
+    }
+
+    if(soak)
+    {
+        printf("%lu packets per run, %u byte frames, heap in bytes, "
+               "RSS in KB\n", n, bench_classes[0].len);
+        printf("%-8s %10s %10s %10s %9s %9s %9s %9s %6s %6s %6s\n", "class",
+               "packets", "heap", "heap max", "heap B/p", "rss", "rss max",
+               "rss B/p", "buf/p", "grows", "held");
+        fflush(stdout);
+        for(c = 0; c <= BENCH_CLASSES; c++)
+        { failed |= bench_soak(c, order, total, n, verbose); }
+        free(order);
+        return failed;
+    }
+
+    printf("%lu packets per run, %u byte frames\n", n, bench_classes[0].len);
+    printf("%-8s %10s %9s %8s %8s %8s %8s %8s\n", "class", "pps", "ns/pkt",
+           "p50", "p99", "p99.9", "max", "out/pkt");
+    fflush(stdout);
+
+    for(c = 0; c <= BENCH_CLASSES; c++)
+    {
+        /* -- the router's chatter goes to /dev/null while it runs -- */
+        if(!verbose)
+        { bench_quiet(1); }
+
+        for(i = 0; i < BENCH_WARMUP; i++)
+        { bench_one(c < BENCH_CLASSES ? c : order[i % total]); }
+        sent = bench_sent;
+        for(i = 0; i < n; i++)
+        { lat[i] = bench_one(c < BENCH_CLASSES ? c : order[i % total]); }
+        sent = bench_sent - sent;
+
+        if(!verbose)
+        { bench_quiet(0); }
+        bench_report(c < BENCH_CLASSES ? bench_classes[c].name : "mix", lat,
+                     n, sent);
+        fflush(stdout);
+    }
+
+    free(lat);
+    free(order);
+    return 0;
+} /* -- main -- */
@@ -0,0 +1,115 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_clock.c
+ *
+ * Description:
+ *
+ * Wall or virtual clock for the ARP cache; see sr_clock.h.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "sr_clock.h"
+
+static int clock_virtual;
+static unsigned long clock_now_ms;     /* virtual time, start * 1000 on */
+static pthread_mutex_t clock_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t clock_moved = PTHREAD_COND_INITIALIZER;
+
+/*---------------------------------------------------------------------
+ * Method: sr_clock_now(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+time_t sr_clock_now(void)
+{
+    if(!clock_virtual)
+    { return time(NULL); }
+    return (time_t)(sr_clock_now_ms() / 1000);
+} /* -- sr_clock_now -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_clock_now_ms(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+unsigned long sr_clock_now_ms(void)
+{
+    struct timespec ts;
+    unsigned long now;
+
+    if(!clock_virtual)
+    {
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (unsigned long)ts.tv_sec * 1000UL + ts.tv_nsec / 1000000L;
+    }
+
+    pthread_mutex_lock(&clock_lock);
+    now = clock_now_ms;
+    pthread_mutex_unlock(&clock_lock);
+    return now;
+} /* -- sr_clock_now_ms -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_clock_sleep_ms(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_clock_sleep_ms(unsigned long ms)
+{
+    struct timespec ts;
+    unsigned long until;
+
+    if(!clock_virtual)
+    {
+        ts.tv_sec  = ms / 1000;
+        ts.tv_nsec = (ms % 1000) * 1000000L;
+        while(nanosleep(&ts, &ts) < 0 && errno == EINTR)
+        { }
+        return;
+    }
+
+    pthread_mutex_lock(&clock_lock);
+    until = clock_now_ms + ms;
+    while(clock_now_ms < until)
+    { pthread_cond_wait(&clock_moved, &clock_lock); }
+    pthread_mutex_unlock(&clock_lock);
+} /* -- sr_clock_sleep_ms -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_clock_virtual(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_clock_virtual(time_t start)
+{
+    pthread_mutex_lock(&clock_lock);
+    clock_now_ms = (unsigned long)start * 1000UL;
+    clock_virtual = 1;
+    pthread_mutex_unlock(&clock_lock);
+} /* -- sr_clock_virtual -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_clock_advance_ms(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_clock_advance_ms(unsigned long ms)
+{
+    pthread_mutex_lock(&clock_lock);
+    clock_now_ms += ms;
+    pthread_cond_broadcast(&clock_moved);
+    pthread_mutex_unlock(&clock_lock);
+} /* -- sr_clock_advance_ms -- */
+
+int sr_clock_is_virtual(void)
+{
+    return clock_virtual;
+} /* -- sr_clock_is_virtual -- */
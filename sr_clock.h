@@ -0,0 +1,42 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_clock.h
+ *
+ * Description:
+ *
+ * The router's idea of the time, for the ARP cache's expiry and retries.
+ *
+ * Normally it is the system's: time() for timestamps and CLOCK_MONOTONIC
+ * for intervals, so a jump in the wall clock can't expire or retry anything
+ * early. A harness can switch it to a virtual
+ * clock instead (sr_clock_virtual), which only moves when told to
+ * (sr_clock_advance_ms): hours of ARP expiry and retries can then be run in
+ * seconds, and come out the same every time. A thread waiting in
+ * sr_clock_sleep_ms on the virtual clock wakes when the harness advances it
+ * past the time it wants.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_CLOCK_H
+#define SR_CLOCK_H
+
+#include <time.h>
+
+/* Now, in seconds as time(); for timestamps that outlive the process */
+time_t sr_clock_now(void);
+
+/* Now, in milliseconds on a clock that never goes back; for intervals */
+unsigned long sr_clock_now_ms(void);
+
+/* Sleep for ms, on whichever clock is in use */
+void sr_clock_sleep_ms(unsigned long ms);
+
+/* Switch to a virtual clock standing at start. Call before anything reads
+   the clock; there is no going back. */
+void sr_clock_virtual(time_t start);
+
+/* Move the virtual clock on by ms, waking anyone it is now time for. */
+void sr_clock_advance_ms(unsigned long ms);
+
+int sr_clock_is_virtual(void);
+
+#endif /* -- SR_CLOCK_H -- */
@@ -0,0 +1,1750 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_emu.c
+ *
+ * Description:
+ *
+ * Local stand-in for the VNS server and the hosts around the router, for
+ * running and timing the router without Mininet or a network.
+ *
+ * By default the emulator owns the shared-memory segment (sr_shmring.h)
+ * and waits on a unix socket for the router to attach with -i shm:path.
+ * With -p it is a VNS server instead, and the router connects to it over
+ * TCP as it would to the real one (sr -s localhost -p port): it asks for
+ * authentication (checked against an auth_key with -k), answers VNSOPEN
+ * with the interfaces in a VNSHWINFO, VNS_OPEN_TEMPLATE with a VNS_RTABLE
+ * made from the topology too, and trades frames in VNSPACKETs.
+ *
+ * Either way it plays every host in the topology: they answer the
+ * router's ARP requests and pings, and one of them can send a run of
+ * probes to another host (through the router) or to one of the router's
+ * own interfaces, with a window of probes in flight and optionally at a
+ * fixed rate. With -P the run takes turns between kinds of probe:
+ *
+ *   echo   an echo request
+ *   ttl    an echo request with TTL 1, which the router answers with
+ *          time exceeded unless it is for the router itself
+ *   udp    a UDP datagram, to a port nobody listens on: the router, or
+ *          the host it is for, answers with port unreachable
+ *
+ * Whatever comes back is matched to its probe by sequence number (for an
+ * ICMP error, the one in the header it quotes) and its round-trip time
+ * goes in a histogram for its kind of answer: an echo reply or port
+ * unreachable the router forwarded from a host, or one of the router's
+ * own echo replies, time exceededs, port unreachables, host unreachables
+ * and other unreachables. A probe with no answer after EMU_PROBE_TIMEOUT
+ * is counted lost; that is longer than the router takes to give up on ARP
+ * and send host unreachable, so a probe to a missing host is answered
+ * rather than lost. When done it reports rates and, for each kind of
+ * answer, the count and percentiles of its round trips, and with -H the
+ * histograms themselves. With -x it also fails unless some probe got each
+ * of the given kinds of answer.
+ *
+ * The topology file has one line per router interface and per host:
+ *
+ *   router eth3 0a:00:00:00:00:03 10.0.1.1
+ *   host   gateway eth3 0a:11:11:11:11:11 10.0.1.100
+ *
+ * Hosts take the router's MAC from the file instead of ARPing for it.
+ * Without -t the topology from INSTRUCTIONS is used, with the addresses
+ * from the rtable that ships with the router.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#ifdef _LINUX_
+#include <getopt.h>
+#endif /* _LINUX_ */
+
+#include "sr_protocol.h"
+#include "sr_shmring.h"
+#include "sr_utils.h"
+#include "sha1.h"
+#include "vnscommand.h"
+
+#define EMU_DEFAULT_SOCK  "/tmp/sr_emu.sock"
+#define EMU_HOSTS_MAX     16
+#define EMU_SPIN          4096      /* empty polls before sleeping */
+#define EMU_ICMP_HDR      8         /* type, code, sum, id, seq */
+#define EMU_PING_DATA     56
+#define EMU_VNS_BUF       (256 * 1024)  /* each way, over TCP */
+#define EMU_VNS_SALT      16
+#define EMU_AUTH_KEY_LEN  64
+#define EMU_UDP_HDR       8
+#define EMU_UDP_PORT      33434     /* as traceroute; seq is the source */
+#define EMU_SEQS          65536     /* probes told apart by a 16 bit seq */
+#define EMU_PROBE_TIMEOUT 7000000000ULL /* ns before a probe is lost; more
+                                           than the router's 5 s ARP give-up */
+#define EMU_PROBE_KINDS   8         /* turns a run takes, at most */
+#define EMU_HIST_SUB      16        /* histogram buckets per power of two */
+#define EMU_HIST_BUCKETS  (64 * EMU_HIST_SUB)
+
+static const char* emu_default_topology[] =
+{
+    "router eth3 0a:00:00:00:00:03 10.0.1.1",
+    "router eth1 0a:00:00:00:00:01 192.168.2.1",
+    "router eth2 0a:00:00:00:00:02 172.64.3.1",
+    "host   gateway eth3 0a:11:11:11:11:11 10.0.1.100",
+    "host   server1 eth1 0a:22:22:22:22:22 192.168.2.2",
+    "host   server2 eth2 0a:33:33:33:33:33 172.64.3.10",
+    0
+};
+
+struct emu_host
+{
+    char name[32];
+    int port;                       /* index of the router interface */
+    unsigned char addr[ETHER_ADDR_LEN];
+    uint32_t ip;
+};
+
+struct emu_stats
+{
+    unsigned long rx_frames;        /* from the router */
+    unsigned long tx_frames;        /* to the router */
+    unsigned long arp_replies;
+    unsigned long echo_replies;     /* pings the hosts answered */
+    unsigned long port_unreachables; /* UDP datagrams they answered */
+    unsigned long unclaimed;        /* frames no host wanted */
+    unsigned long doorbells;        /* times we woke the router */
+    unsigned long sleeps;
+    unsigned long writes;           /* over TCP */
+};
+
+enum emu_probe
+{
+    EMU_PROBE_ECHO,
+    EMU_PROBE_TTL,
+    EMU_PROBE_UDP
+};
+
+static const char* emu_probe_names[] = { "echo", "ttl", "udp", 0 };
+
+/* What came back for a probe */
+enum emu_answer
+{
+    EMU_ANSWER_FORWARDED,           /* echo reply from a host */
+    EMU_ANSWER_ECHO,                /* the router's own echo reply */
+    EMU_ANSWER_TTL,                 /* time exceeded */
+    EMU_ANSWER_PORT,                /* port unreachable */
+    EMU_ANSWER_HOST_PORT,           /* port unreachable from a host */
+    EMU_ANSWER_HOST_UNREACH,        /* host unreachable, ARP gave up */
+    EMU_ANSWER_UNREACH,             /* net or other unreachable */
+    EMU_ANSWERS
+};
+
+/* What -x calls them */
+static const char* emu_answer_keys[] =
+{ "forwarded", "echo", "ttl", "port", "hostport", "host", "unreach", 0 };
+
+static const char* emu_answer_names[] =
+{
+    "forwarded echo reply",
+    "router echo reply",
+    "router time exceeded",
+    "router port unreachable",
+    "host port unreachable",
+    "router host unreachable",
+    "router unreachable"
+};
+
+/* Round trips in ns, log-linear: EMU_HIST_SUB buckets per power of two */
+struct emu_hist
+{
+    unsigned long count;
+    uint64_t min, max, sum;
+    unsigned long bucket[EMU_HIST_BUCKETS];
+};
+
+struct emu_ping
+{
+    int from;                       /* host index, -1 for none */
+    uint32_t dst;
+    unsigned long count;
+    unsigned int window;            /* in flight at once */
+    unsigned int size;              /* ICMP or UDP data bytes */
+    unsigned long rate;             /* probes/s, 0 for as fast as replies */
+    int kinds[EMU_PROBE_KINDS];     /* taken in turn */
+    int nkinds;
+    int histograms;                 /* print them in full */
+    unsigned int expect;            /* 1 << answer for each -x */
+    unsigned long sent;
+    unsigned long sent_bytes;
+    unsigned long received;         /* echo replies */
+    unsigned long errors;           /* ICMP errors back instead */
+    unsigned long lost;             /* given up on after EMU_PROBE_TIMEOUT */
+    unsigned long oldest;           /* first probe that may be unanswered */
+    int done;                       /* every probe answered or lost */
+    uint64_t* sent_ns;              /* by seq, 0 once answered or lost */
+    struct emu_hist rtt[EMU_ANSWERS];
+    uint64_t start_ns, last_ns;
+};
+
+/* A VNS session: messages in both directions, buffered */
+struct emu_vns
+{
+    uint8_t in[EMU_VNS_BUF];
+    unsigned int in_len;
+    uint8_t out[EMU_VNS_BUF];
+    unsigned int out_len;
+    const char* keyfile;            /* check the router's auth reply */
+};
+
+struct emu
+{
+    int sock;                       /* doorbell, or the VNS session */
+    struct sr_shm_seg* seg;         /* shared memory, or 0 */
+    struct emu_vns* vns;            /* TCP, or 0 */
+    int closed;                     /* the router went away */
+    uint32_t tx_head;               /* to_router: ours */
+    uint32_t rx_tail;               /* from_router: ours */
+    unsigned int nifs;              /* the router's interfaces */
+    struct sr_shm_if ifs[SR_SHM_IFS_MAX];
+    int nhosts;
+    struct emu_host hosts[EMU_HOSTS_MAX];
+    struct emu_ping ping;
+    struct emu_stats stats;
+};
+
+static volatile sig_atomic_t emu_running = 1;
+
+static void usage(char* argv0)
+{
+    printf("Local VNS stand-in for sr -i shm:socket, or sr -p port\n");
+    printf("Format: %s [-h] [-s socket | -p port [-k auth_key]] [-t topology]\n",
+           argv0);
+    printf("           [-f host -d dest ip [-c count] [-w window] [-r rate]\n");
+    printf("            [-z size] [-P kind,...] [-H] [-x answer,...]]\n");
+    printf("   -p     be a VNS server on this TCP port instead\n");
+    printf("   -k     only accept a router with this auth_key\n");
+    printf("   -f/-d  probe dest ip from the named host once the router is up\n");
+    printf("   -c     number of probes (default 10)\n");
+    printf("   -w     probes in flight at once (default 1)\n");
+    printf("   -r     probes per second (default as fast as the window allows)\n");
+    printf("   -z     ICMP or UDP data bytes (default %d)\n", EMU_PING_DATA);
+    printf("   -P     kinds of probe to take turns with: echo (default), "
+           "ttl, udp\n");
+    printf("   -H     print the round trip histograms in full\n");
+    printf("   -x     fail unless some probe was answered with each of: "
+           "forwarded,\n          echo, ttl, port, hostport, host "
+           "(unreachable), unreach\n");
+    printf("   defaults socket=%s, topology from INSTRUCTIONS\n",
+           EMU_DEFAULT_SOCK);
+} /* -- usage -- */
+
+static void emu_stop(int sig)
+{
+    emu_running = 0;
+} /* -- emu_stop -- */
+
+static uint64_t emu_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+} /* -- emu_now_ns -- */
+
+/*---------------------------------------------------------------------
+ * Method: emu_parse_line(..)
+ * Scope:  Local
+ *
+ * One line of topology. Returns -1 if it is malformed.
+ *
+ *---------------------------------------------------------------------*/
+
+static int emu_parse_line(struct emu* emu, const char* line)
+{
+    char kind[16], name[32], iface[32], mac[32], ip[32];
+    unsigned int m[ETHER_ADDR_LEN];
+    struct in_addr addr;
+    struct sr_shm_if* sif;
+    struct emu_host* host;
+    int i, port;
+
+    if(sscanf(line, "%15s", kind) != 1 || kind[0] == '#')
+    { return 0; }
+
+    if(strcmp(kind, "router") == 0 &&
+       sscanf(line, "%*s %31s %31s %31s", iface, mac, ip) == 3)
+    { strcpy(name, iface); }
+    else if(strcmp(kind, "host") != 0 ||
+            sscanf(line, "%*s %31s %31s %31s %31s", name, iface, mac, ip) != 4)
+    { return -1; }
+
+    if(sscanf(mac, "%x:%x:%x:%x:%x:%x", &m[0], &m[1], &m[2], &m[3], &m[4],
+              &m[5]) != 6 || inet_aton(ip, &addr) == 0 ||
+       strlen(iface) >= sizeof(((c_packet_header*)0)->mInterfaceName))
+    { return -1; }
+
+    if(kind[0] == 'r')
+    {
+        if(emu->nifs == SR_SHM_IFS_MAX)
+        { return -1; }
+        sif = &emu->ifs[emu->nifs++];
+        strncpy(sif->name, iface, sr_IFACE_NAMELEN - 1);
+        for(i = 0; i < ETHER_ADDR_LEN; i++)
+        { sif->addr[i] = (unsigned char)m[i]; }
+        sif->ip = addr.s_addr;
+        return 0;
+    }
+
+    for(port = 0; port < (int)emu->nifs; port++)
+    {
+        if(strcmp(emu->ifs[port].name, iface) == 0)
+        { break; }
+    }
+    if(port == (int)emu->nifs || emu->nhosts == EMU_HOSTS_MAX)
+    { return -1; }
+
+    host = &emu->hosts[emu->nhosts++];
+    strncpy(host->name, name, sizeof(host->name) - 1);
+    host->port = port;
+    for(i = 0; i < ETHER_ADDR_LEN; i++)
+    { host->addr[i] = (unsigned char)m[i]; }
+    host->ip = addr.s_addr;
+    return 0;
+} /* -- emu_parse_line -- */
+
+static int emu_load_topology(struct emu* emu, const char* file)
+{
+    char line[256];
+    FILE* fp;
+    int i, lineno = 0;
+
+    if(!file)
+    {
+        for(i = 0; emu_default_topology[i]; i++)
+        { assert(emu_parse_line(emu, emu_default_topology[i]) == 0); }
+        return 0;
+    }
+
+    if((fp = fopen(file, "r")) == 0)
+    {
+        perror("fopen(..):sr_emu.c::emu_load_topology");
+        return -1;
+    }
+    while(fgets(line, sizeof(line), fp))
+    {
+        lineno++;
+        if(emu_parse_line(emu, line) < 0)
+        {
+            fprintf(stderr, "%s:%d: can't make sense of this line\n",
+                    file, lineno);
+            fclose(fp);
+            return -1;
+        }
+    }
+    fclose(fp);
+    return 0;
+} /* -- emu_load_topology -- */
+
+/*---------------------------------------------------------------------
+ * Method: emu_vns_fill(..)
+ * Scope:  Local
+ *
+ * Read whatever the router has sent into the input buffer. Returns the
+ * number of bytes read, or -1 once the session is gone.
+ *
+ *---------------------------------------------------------------------*/
+
+static int emu_vns_fill(struct emu* emu)
+{
+    struct emu_vns* vns = emu->vns;
+    int n;
+
+    if(vns->in_len == sizeof(vns->in))
+    { return 0; }
+    n = read(emu->sock, vns->in + vns->in_len, sizeof(vns->in) - vns->in_len);
+    if(n > 0)
+    {
+        vns->in_len += n;
+        return n;
+    }
+    if(n < 0 && (errno == EAGAIN || errno == EINTR))
+    { return 0; }
+    emu->closed = 1;
+    return -1;
+} /* -- emu_vns_fill -- */
+
+/*---------------------------------------------------------------------
+ * Method: emu_vns_flush(..)
+ * Scope:  Local
+ *
+ * Write out everything queued for the router. While the router isn't
+ * taking it we keep reading from it, so that neither side can end up
+ * blocked on a full socket waiting for the other.
+ *
+ *---------------------------------------------------------------------*/
+
+static int emu_vns_flush(struct emu* emu)
+{
+    struct emu_vns* vns = emu->vns;
+    struct pollfd pfd;
+    unsigned int done = 0;
+    int n;
+
+    while(done < vns->out_len && !emu->closed)
+    {
+        n = write(emu->sock, vns->out + done, vns->out_len - done);
+        if(n > 0)
+        {
+            done += n;
+            emu->stats.writes++;
+            continue;
+        }
+        if(n < 0 && errno != EAGAIN && errno != EINTR)
+        {
+            emu->closed = 1;
+            break;
+        }
+        pfd.fd = emu->sock;
+        pfd.events = POLLIN | POLLOUT;
+        pfd.revents = 0;
+        if(poll(&pfd, 1, 100) > 0 && (pfd.revents & POLLIN))
+        { emu_vns_fill(emu); }
+    }
+    vns->out_len = 0;
+    return emu->closed ? -1 : 0;
+} /* -- emu_vns_flush -- */
+
+static void emu_vns_put(struct emu* emu, const void* buf, unsigned int len)
+{
+    struct emu_vns* vns = emu->vns;
+
+    assert(len <= sizeof(vns->out));
+    if(vns->out_len + len > sizeof(vns->out))
+    { emu_vns_flush(emu); }
+    memcpy(vns->out + vns->out_len, buf, len);
+    vns->out_len += len;
+} /* -- emu_vns_put -- */
+
+/*---------------------------------------------------------------------
+ * Method: emu_send(..)
+ * Scope:  Local
+ *
+ * Queue a frame to the router on its interface port. It is published
+ * (or written) with the rest of the burst by emu_publish.
+ *
+ *---------------------------------------------------------------------*/
+
+static void emu_send(struct emu* emu, int port, const uint8_t* frame,
+        unsigned int len)
+{
+    struct sr_shm_ring* ring;
+    c_packet_header hdr;
+
+    emu->stats.tx_frames++;
+    if(emu->vns)
+    {
+        hdr.mLen = htonl(sizeof(hdr) + len);
+        hdr.mType = htonl(VNSPACKET);
+        strncpy(hdr.mInterfaceName, emu->ifs[port].name,
+                sizeof(hdr.mInterfaceName));
+        emu_vns_put(emu, &hdr, sizeof(hdr));
+        emu_vns_put(emu, frame, len);
+        return;
+    }
+
+    ring = &emu->seg->to_router;
+    while(sr_shmring_space(ring, emu->tx_head) == 0 && emu_running)
+    {
+        /* -- the router is behind; let it at what we have and wait -- */
+        if(sr_shmring_publish(ring, emu->tx_head, emu->sock))
+        { emu->stats.doorbells++; }
+    }
+    sr_shmring_put(sr_shmring_slot(ring, emu->tx_head), frame, len,
+                   emu->ifs[port].name);
+    emu->tx_head++;
+} /* -- emu_send -- */
+
+static void emu_publish(struct emu* emu)
+{
+    if(emu->vns)
+    { emu_vns_flush(emu); }
+    else if(sr_shmring_publish(&emu->seg->to_router, emu->tx_head, emu->sock))
+    { emu->stats.doorbells++; }
+} /* -- emu_publish -- */
+
+/*---------------------------------------------------------------------
+ * Method: emu_ip_header(..)
+ * Scope:  Local
+ *
+ *---------------------------------------------------------------------*/
+
+static void emu_ip_header(sr_ip_hdr_t* ip, uint32_t src, uint32_t dst,
+        unsigned int payload)
+{
+    memset(ip, 0, sizeof(sr_ip_hdr_t));
+    ip->ip_v   = 4;
+    ip->ip_hl  = sizeof(sr_ip_hdr_t) / 4;
+    ip->ip_len = htons(sizeof(sr_ip_hdr_t) + payload);
+    ip->ip_ttl = 64;
+    ip->ip_p   = ip_protocol_icmp;
+    ip->ip_src = src;
+    ip->ip_dst = dst;
+    ip->ip_sum = cksum(ip, sizeof(sr_ip_hdr_t));
+} /* -- emu_ip_header -- */
+
+/*---------------------------------------------------------------------
+ * Method: emu_hist_add(..)
+ * Scope:  Local
+ *
+ *---------------------------------------------------------------------*/
+
+static void emu_hist_add(struct emu_hist* h, uint64_t ns)
+{
+    unsigned int shift = 0;
+    uint64_t v = ns;
+
+    /* -- the power of two above the sub-buckets, then which of them -- */
+    while(v >= 2 * EMU_HIST_SUB)
+    {
+        v >>= 1;
+        shift++;
+    }
+    if(ns < EMU_HIST_SUB)
+    { h->bucket[ns]++; }
+    else
+    { h->bucket[(shift + 1) * EMU_HIST_SUB + (v - EMU_HIST_SUB)]++; }
+
+    if(h->count == 0 || ns < h->min)
+    { h->min = ns; }
+    if(ns > h->max)
+    { h->max = ns; }
+    h->sum += ns;
+    h->count++;
+} /* -- emu_hist_add -- */
+
+/* The least round trip that goes in bucket i */
+static uint64_t emu_hist_floor(unsigned int i)
+{
+    if(i < EMU_HIST_SUB)
+    { return i; }
+    return (uint64_t)(EMU_HIST_SUB + i % EMU_HIST_SUB) <<
+        (i / EMU_HIST_SUB - 1);
+} /* -- emu_hist_floor -- */
+
+/* The round trip that fraction q of them took at most, to the bucket */
+static uint64_t emu_hist_quantile(const struct emu_hist* h, double q)
+{
+    unsigned long want = (unsigned long)(q * h->count), seen = 0;
+    uint64_t top;
+    unsigned int i;
+
+    for(i = 0; i < EMU_HIST_BUCKETS; i++)
+    {
+        seen += h->bucket[i];
+        if(seen > want)
+        {
+            top = emu_hist_floor(i + 1) - 1;
+            return top < h->max ? top : h->max;
+        }
+    }
+    return h->max;
+} /* -- emu_hist_quantile -- */
+
+/*---------------------------------------------------------------------
+ * Method: emu_ping_send(..)
+ * Scope:  Local
+ *
+ * Send the next probe of the run, of the kind whose turn it is. The
+ * sequence number goes where an ICMP error will quote it: the echo
+ * header, or the UDP source port.
+ *
+ *---------------------------------------------------------------------*/
+
+static void emu_ping_send(struct emu* emu)
+{
+    struct emu_ping* ping = &emu->ping;
+    struct emu_host* host = &emu->hosts[ping->from];
+    uint8_t frame[SR_SHM_SLOT_SZ];
+    sr_ethernet_hdr_t* eth = (sr_ethernet_hdr_t*)frame;
+    sr_ip_hdr_t* ip = (sr_ip_hdr_t*)(eth + 1);
+    uint8_t* l4 = (uint8_t*)(ip + 1);
+    int kind = ping->kinds[ping->sent % ping->nkinds];
+    unsigned int seq = ping->sent % EMU_SEQS;
+    unsigned int len;
+    uint16_t id = htons((uint16_t)getpid());
+    uint16_t seq16 = htons((uint16_t)seq);
+    uint16_t port = htons(EMU_UDP_PORT);
+    uint16_t sum;
+    uint16_t ulen;
+
+    memcpy(eth->ether_dhost, emu->ifs[host->port].addr, ETHER_ADDR_LEN);
+    memcpy(eth->ether_shost, host->addr, ETHER_ADDR_LEN);
+    eth->ether_type = htons(ethertype_ip);
+
+    if(kind == EMU_PROBE_UDP)
+    {
+        /* -- no UDP checksum, which IPv4 allows -- */
+        len = EMU_UDP_HDR + ping->size;
+        ulen = htons((uint16_t)len);
+        memset(l4, 0, len);
+        memcpy(l4, &seq16, 2);
+        memcpy(l4 + 2, &port, 2);
+        memcpy(l4 + 4, &ulen, 2);
+        emu_ip_header(ip, host->ip, ping->dst, len);
+        ip->ip_p = ip_protocol_udp;
+    }
+    else
+    {
+        len = EMU_ICMP_HDR + ping->size;
+        memset(l4, 0, len);
+        l4[0] = 8;
+        memcpy(l4 + 4, &id, 2);
+        memcpy(l4 + 6, &seq16, 2);
+        sum = cksum(l4, len);
+        memcpy(l4 + 2, &sum, 2);
+        emu_ip_header(ip, host->ip, ping->dst, len);
+        if(kind == EMU_PROBE_TTL)
+        { ip->ip_ttl = 1; }
+    }
+    ip->ip_sum = 0;
+    ip->ip_sum = cksum(ip, sizeof(sr_ip_hdr_t));
+
+    len += sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t);
+    ping->sent_ns[seq] = emu_now_ns();
+    emu_send(emu, host->port, frame, len);
+    ping->last_ns = ping->sent_ns[seq];
+    ping->sent_bytes += len;
+    ping->sent++;
+} /* -- emu_ping_send -- */
+
+/*---------------------------------------------------------------------
+ * Method: emu_ping_answer(..)
+ * Scope:  Local
+ *
+ * Time the probe seq and file the round trip under answer. Returns 0 if
+ * seq isn't one of ours waiting for an answer.
+ *
+ *---------------------------------------------------------------------*/
+
+static int emu_ping_answer(struct emu* emu, unsigned int seq, int answer)
+{
+    struct emu_ping* ping = &emu->ping;
+    uint64_t sent = ping->sent_ns[seq];
+
+    if(sent == 0)
+    {
+        emu->stats.unclaimed++;
+        return 0;
+    }
+    ping->sent_ns[seq] = 0;
+    emu_hist_add(&ping->rtt[answer], emu_now_ns() - sent);
+    return 1;
+} /* -- emu_ping_answer -- */
+
+/*---------------------------------------------------------------------
+ * Method: emu_ping_expire(..)
+ * Scope:  Local
+ *
+ * Give up on probes that have gone unanswered for EMU_PROBE_TIMEOUT, so
+ * their places in the window go to new ones. Probes are sent in order, so
+ * the walk stops at the first one still in time. An answer that turns up
+ * later is unclaimed.
+ *
+ *---------------------------------------------------------------------*/
+
+static void emu_ping_expire(struct emu* emu, uint64_t now)
+{
+    struct emu_ping* ping = &emu->ping;
+    uint64_t* sent;
+
+    for(; ping->oldest < ping->sent; ping->oldest++)
+    {
+        sent = &ping->sent_ns[ping->oldest % EMU_SEQS];
+        if(*sent == 0)
+        { continue; }
+        if(now - *sent < EMU_PROBE_TIMEOUT)
+        { break; }
+        *sent = 0;
+        ping->lost++;
+    }
+} /* -- emu_ping_expire -- */
+
+/*---------------------------------------------------------------------
+ * Method: emu_ping_reply(..)
+ * Scope:  Local
+ *
+ *---------------------------------------------------------------------*/
+
+static void emu_ping_reply(struct emu* emu, const sr_ip_hdr_t* ip,
+        const uint8_t* icmp)
+{
+    uint16_t id, seq;
+    unsigned int i;
+    int answer = EMU_ANSWER_FORWARDED;
+
+    memcpy(&id, icmp + 4, 2);
+    memcpy(&seq, icmp + 6, 2);
+    if(ntohs(id) != (uint16_t)getpid())
+    {
+        emu->stats.unclaimed++;
+        return;
+    }
+    for(i = 0; i < emu->nifs; i++)
+    {
+        if(emu->ifs[i].ip == ip->ip_src)
+        { answer = EMU_ANSWER_ECHO; }
+    }
+    if(emu_ping_answer(emu, ntohs(seq), answer))
+    { emu->ping.received++; }
+} /* -- emu_ping_reply -- */
+
+/*---------------------------------------------------------------------
+ * Method: emu_ping_error(..)
+ * Scope:  Local
+ *
+ * An ICMP error: find the probe in the header it quotes.
+ *
+ *---------------------------------------------------------------------*/
+
+static void emu_ping_error(struct emu* emu, const sr_ip_hdr_t* ip,
+        const uint8_t* icmp, unsigned int len)
+{
+    const sr_ip_hdr_t* quoted = (const sr_ip_hdr_t*)(icmp + EMU_ICMP_HDR);
+    const uint8_t* l4;
+    uint16_t id, seq, port;
+    unsigned int i;
+    int answer;
+
+    if(len < EMU_ICMP_HDR + sizeof(sr_ip_hdr_t) + 8 ||
+       len < EMU_ICMP_HDR + quoted->ip_hl * 4 + 8)
+    {
+        emu->stats.unclaimed++;
+        return;
+    }
+    l4 = (const uint8_t*)quoted + quoted->ip_hl * 4;
+
+    if(icmp[0] == 11)
+    { answer = EMU_ANSWER_TTL; }
+    else if(icmp[1] == 3)
+    {
+        answer = EMU_ANSWER_HOST_PORT;
+        for(i = 0; i < emu->nifs; i++)
+        {
+            if(emu->ifs[i].ip == ip->ip_src)
+            { answer = EMU_ANSWER_PORT; }
+        }
+    }
+    else if(icmp[0] == 3 && icmp[1] == 1)
+    { answer = EMU_ANSWER_HOST_UNREACH; }
+    else
+    { answer = EMU_ANSWER_UNREACH; }
+
+    if(quoted->ip_p == ip_protocol_icmp)
+    {
+        memcpy(&id, l4 + 4, 2);
+        memcpy(&seq, l4 + 6, 2);
+        if(l4[0] != 8 || ntohs(id) != (uint16_t)getpid())
+        {
+            emu->stats.unclaimed++;
+            return;
+        }
+    }
+    else if(quoted->ip_p == ip_protocol_udp)
+    {
+        memcpy(&seq, l4, 2);
+        memcpy(&port, l4 + 2, 2);
+        if(ntohs(port) != EMU_UDP_PORT)
+        {
+            emu->stats.unclaimed++;
+            return;
+        }
+    }
+    else
+    {
+        emu->stats.unclaimed++;
+        return;
+    }
+    if(emu_ping_answer(emu, ntohs(seq), answer))
+    { emu->ping.errors++; }
+} /* -- emu_ping_error -- */
+
+/*---------------------------------------------------------------------
+ * Method: emu_host_udp(..)
+ * Scope:  Local
+ *
+ * A UDP datagram for host, which listens on no ports: answer with port
+ * unreachable, quoting the IP header and the UDP header after it, as a
+ * real host would.
+ *
+ *---------------------------------------------------------------------*/
+
+static void emu_host_udp(struct emu* emu, struct emu_host* host,
+        const uint8_t* frame)
+{
+    const sr_ethernet_hdr_t* eth = (const sr_ethernet_hdr_t*)frame;
+    const sr_ip_hdr_t* quoted = (const sr_ip_hdr_t*)(eth + 1);
+    unsigned int quote = quoted->ip_hl * 4 + EMU_UDP_HDR;
+    uint8_t reply[sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t) +
+                  EMU_ICMP_HDR + 60 + EMU_UDP_HDR];
+    sr_ethernet_hdr_t* reth = (sr_ethernet_hdr_t*)reply;
+    sr_ip_hdr_t* rip = (sr_ip_hdr_t*)(reth + 1);
+    uint8_t* icmp = (uint8_t*)(rip + 1);
+    uint16_t sum;
+
+    memcpy(reth->ether_dhost, eth->ether_shost, ETHER_ADDR_LEN);
+    memcpy(reth->ether_shost, host->addr, ETHER_ADDR_LEN);
+    reth->ether_type = htons(ethertype_ip);
+    emu_ip_header(rip, host->ip, quoted->ip_src, EMU_ICMP_HDR + quote);
+
+    memset(icmp, 0, EMU_ICMP_HDR);
+    icmp[0] = 3;
+    icmp[1] = 3;
+    memcpy(icmp + EMU_ICMP_HDR, quoted, quote);
+    sum = cksum(icmp, EMU_ICMP_HDR + quote);
+    memcpy(icmp + 2, &sum, 2);
+
+    emu_send(emu, host->port, reply, sizeof(sr_ethernet_hdr_t) +
+             sizeof(sr_ip_hdr_t) + EMU_ICMP_HDR + quote);
+    emu->stats.port_unreachables++;
+} /* -- emu_host_udp -- */
+
+/*---------------------------------------------------------------------
+ * Method: emu_host_ip(..)
+ * Scope:  Local
+ *
+ * An IP packet for host. Answer pings and UDP, and collect replies and
+ * errors for our own.
+ *
+ *---------------------------------------------------------------------*/
+
+static void emu_host_ip(struct emu* emu, struct emu_host* host,
+        uint8_t* frame, unsigned int len)
+{
+    sr_ethernet_hdr_t* eth = (sr_ethernet_hdr_t*)frame;
+    sr_ip_hdr_t* ip = (sr_ip_hdr_t*)(eth + 1);
+    uint8_t* icmp = (uint8_t*)ip + ip->ip_hl * 4;
+    unsigned int icmp_len;
+    uint16_t sum;
+    uint32_t src;
+
+    if(len < sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t) ||
+       len < sizeof(sr_ethernet_hdr_t) + ntohs(ip->ip_len) ||
+       ntohs(ip->ip_len) < ip->ip_hl * 4 + EMU_ICMP_HDR)
+    {
+        emu->stats.unclaimed++;
+        return;
+    }
+    if(ip->ip_p == ip_protocol_udp)
+    {
+        emu_host_udp(emu, host, frame);
+        return;
+    }
+    if(ip->ip_p != ip_protocol_icmp)
+    {
+        emu->stats.unclaimed++;
+        return;
+    }
+    icmp_len = ntohs(ip->ip_len) - ip->ip_hl * 4;
+
+    switch(icmp[0])
+    {
+        case 8:
+            /* -- echo request: turn it around where it lies -- */
+            memcpy(eth->ether_dhost, eth->ether_shost, ETHER_ADDR_LEN);
+            memcpy(eth->ether_shost, host->addr, ETHER_ADDR_LEN);
+            src = ip->ip_src;
+            emu_ip_header(ip, host->ip, src, icmp_len);
+            icmp[0] = 0;
+            icmp[2] = icmp[3] = 0;
+            sum = cksum(icmp, icmp_len);
+            memcpy(icmp + 2, &sum, 2);
+            emu_send(emu, host->port, frame, sizeof(sr_ethernet_hdr_t) +
+                     ntohs(ip->ip_len));
+            emu->stats.echo_replies++;
+            break;
+        case 0:
+            emu_ping_reply(emu, ip, icmp);
+            break;
+        case 3:
+        case 11:
+            emu_ping_error(emu, ip, icmp, icmp_len);
+            break;
+        default:
+            emu->stats.unclaimed++;
+    }
+} /* -- emu_host_ip -- */
+
+/*---------------------------------------------------------------------
+ * Method: emu_host_arp(..)
+ * Scope:  Local
+ *
+ *---------------------------------------------------------------------*/
+
+static void emu_host_arp(struct emu* emu, struct emu_host* host,
+        uint8_t* frame, unsigned int len)
+{
+    sr_ethernet_hdr_t* eth = (sr_ethernet_hdr_t*)frame;
+    sr_arp_hdr_t* arp = (sr_arp_hdr_t*)(eth + 1);
+
+    if(len < sizeof(sr_ethernet_hdr_t) + sizeof(sr_arp_hdr_t) ||
+       ntohs(arp->ar_op) != arp_op_request || arp->ar_tip != host->ip)
+    { return; }
+
+    memcpy(eth->ether_dhost, arp->ar_sha, ETHER_ADDR_LEN);
+    memcpy(eth->ether_shost, host->addr, ETHER_ADDR_LEN);
+    arp->ar_op = htons(arp_op_reply);
+    memcpy(arp->ar_tha, arp->ar_sha, ETHER_ADDR_LEN);
+    arp->ar_tip = arp->ar_sip;
+    memcpy(arp->ar_sha, host->addr, ETHER_ADDR_LEN);
+    arp->ar_sip = host->ip;
+    emu_send(emu, host->port, frame, sizeof(sr_ethernet_hdr_t) +
+             sizeof(sr_arp_hdr_t));
+    emu->stats.arp_replies++;
+} /* -- emu_host_arp -- */
+
+/*---------------------------------------------------------------------
+ * Method: emu_deliver(..)
+ * Scope:  Local
+ *
+ * The router sent a frame out of port: hand it to whichever host on that
+ * link it is for.
+ *
+ *---------------------------------------------------------------------*/
+
+static void emu_deliver(struct emu* emu, int port, uint8_t* frame,
+        unsigned int len)
+{
+    static const unsigned char bcast[ETHER_ADDR_LEN] =
+        { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff };
+    sr_ethernet_hdr_t* eth = (sr_ethernet_hdr_t*)frame;
+    struct emu_host* host;
+    int i, claimed = 0;
+
+    for(i = 0; i < emu->nhosts; i++)
+    {
+        host = &emu->hosts[i];
+        if(host->port != port)
+        { continue; }
+
+        if(ntohs(eth->ether_type) == ethertype_arp &&
+           (memcmp(eth->ether_dhost, bcast, ETHER_ADDR_LEN) == 0 ||
+            memcmp(eth->ether_dhost, host->addr, ETHER_ADDR_LEN) == 0))
+        {
+            emu_host_arp(emu, host, frame, len);
+            claimed = 1;
+        }
+        else if(ntohs(eth->ether_type) == ethertype_ip &&
+                memcmp(eth->ether_dhost, host->addr, ETHER_ADDR_LEN) == 0)
+        {
+            emu_host_ip(emu, host, frame, len);
+            claimed = 1;
+            break;
+        }
+    }
+    if(!claimed)
+    { emu->stats.unclaimed++; }
+} /* -- emu_deliver -- */
+
+/*---------------------------------------------------------------------
+ * Method: emu_frame(..)
+ * Scope:  Local
+ *
+ *---------------------------------------------------------------------*/
+
+static void emu_frame(struct emu* emu, const char* iface, uint8_t* frame,
+        int len)
+{
+    unsigned int port;
+
+    emu->stats.rx_frames++;
+    for(port = 0; port < emu->nifs; port++)
+    {
+        if(strcmp(emu->ifs[port].name, iface) == 0)
+        { break; }
+    }
+    if(len < (int)sizeof(sr_ethernet_hdr_t) || port == emu->nifs)
+    {
+        emu->stats.unclaimed++;
+        return;
+    }
+    emu_deliver(emu, port, frame, len);
+} /* -- emu_frame -- */
+
+/*---------------------------------------------------------------------
+ * Method: emu_vns_rx(..)
+ * Scope:  Local
+ *
+ * Handle every whole message the router has sent over TCP. Returns the
+ * number of frames.
+ *
+ *---------------------------------------------------------------------*/
+
+static unsigned int emu_vns_rx(struct emu* emu)
+{
+    struct emu_vns* vns = emu->vns;
+    char iface[sizeof(((c_packet_header*)0)->mInterfaceName) + 1];
+    c_packet_header* hdr;
+    unsigned int off = 0, total = 0;
+    uint32_t mlen;
+
+    emu_vns_fill(emu);
+    while(vns->in_len - off >= sizeof(c_base))
+    {
+        hdr = (c_packet_header*)(vns->in + off);
+        mlen = ntohl(hdr->mLen);
+        if(mlen < sizeof(c_base) || mlen > sizeof(vns->in))
+        {
+            fprintf(stderr, "Garbled message from the router\n");
+            emu->closed = 1;
+            break;
+        }
+        if(vns->in_len - off < mlen)
+        { break; }
+
+        if(ntohl(hdr->mType) == VNSPACKET && mlen >= sizeof(c_packet_header))
+        {
+            memcpy(iface, hdr->mInterfaceName, sizeof(iface) - 1);
+            iface[sizeof(iface) - 1] = 0;
+            emu_frame(emu, iface, (uint8_t*)(hdr + 1),
+                      mlen - sizeof(c_packet_header));
+            total++;
+        }
+        off += mlen;
+    }
+    memmove(vns->in, vns->in + off, vns->in_len - off);
+    vns->in_len -= off;
+    return total;
+} /* -- emu_vns_rx -- */
+
+/*---------------------------------------------------------------------
+ * Method: emu_rx(..)
+ * Scope:  Local
+ *
+ * Take everything the router has sent. Returns the number of frames.
+ *
+ *---------------------------------------------------------------------*/
+
+static unsigned int emu_rx(struct emu* emu)
+{
+    struct sr_shm_ring* ring;
+    char iface[sizeof(((c_packet_header*)0)->mInterfaceName) + 1];
+    uint8_t* frame;
+    uint32_t n, total = 0;
+    int len;
+
+    if(emu->vns)
+    { return emu_vns_rx(emu); }
+
+    ring = &emu->seg->from_router;
+    while((n = sr_shmring_ready(ring, emu->rx_tail)) > 0)
+    {
+        total += n;
+        for(; n > 0; n--, emu->rx_tail++)
+        {
+            len = sr_shmring_get(sr_shmring_slot(ring, emu->rx_tail),
+                                 &frame, iface);
+            emu_frame(emu, iface, frame, len);
+        }
+        sr_shmring_release(ring, emu->rx_tail);
+    }
+    return total;
+} /* -- emu_rx -- */
+
+/*---------------------------------------------------------------------
+ * Method: emu_wait(..)
+ * Scope:  Local
+ *
+ * Nothing to do: sleep on the doorbell (or the session) for up to
+ * timeout_ms. Returns 0 if the router hung up.
+ *
+ *---------------------------------------------------------------------*/
+
+static int emu_wait(struct emu* emu, int timeout_ms)
+{
+    struct pollfd pfd;
+    char bells[64];
+    int n;
+
+    pfd.fd = emu->sock;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    if(emu->vns)
+    {
+        emu->stats.sleeps++;
+        poll(&pfd, 1, timeout_ms);
+        return !emu->closed;
+    }
+
+    if(!sr_shmring_sleep(&emu->seg->from_router, emu->rx_tail))
+    { return 1; }
+    emu->stats.sleeps++;
+
+    if(poll(&pfd, 1, timeout_ms) <= 0)
+    { return 1; }
+
+    while((n = read(emu->sock, bells, sizeof(bells))) > 0)
+    { }
+    return !(n == 0 || (errno != EAGAIN && errno != EINTR));
+} /* -- emu_wait -- */
+
+/*---------------------------------------------------------------------
+ * Method: emu_run(..)
+ * Scope:  Local
+ *
+ * Serve the router until it goes away, or the ping run (if any) is done.
+ * A paced run spins rather than sleeping between pings. Probes that get
+ * no answer are given up on after EMU_PROBE_TIMEOUT, so losses cost a
+ * second of a window slot rather than stalling the run.
+ *
+ *---------------------------------------------------------------------*/
+
+static void emu_run(struct emu* emu)
+{
+    struct emu_ping* ping = &emu->ping;
+    unsigned long outstanding, due = 0;
+    int spin = 0;
+
+    ping->start_ns = emu_now_ns();
+    while(emu_running && !emu->closed)
+    {
+        if(emu_rx(emu) > 0)
+        { spin = 0; }
+
+        if(ping->from >= 0)
+        {
+            if(ping->rate)
+            {
+                due = (emu_now_ns() - ping->start_ns) / 1000 * ping->rate /
+                    1000000 + 1;
+            }
+            emu_ping_expire(emu, emu_now_ns());
+            outstanding = ping->sent - ping->received - ping->errors -
+                ping->lost;
+            while(ping->sent < ping->count && outstanding < ping->window &&
+                  (!ping->rate || ping->sent < due))
+            {
+                emu_ping_send(emu);
+                outstanding++;
+                spin = 0;
+            }
+
+            /* -- done: every probe answered or given up on -- */
+            if(ping->sent == ping->count && outstanding == 0)
+            {
+                ping->done = 1;
+                break;
+            }
+        }
+        emu_publish(emu);
+
+        if(++spin < EMU_SPIN ||
+           (ping->rate && ping->from >= 0 && ping->sent < ping->count))
+        { continue; }
+        if(!emu_wait(emu, 100))
+        { break; }
+        spin = 0;
+    }
+    if(emu->closed)
+    { fprintf(stderr, "Router closed the session\n"); }
+} /* -- emu_run -- */
+
+/*---------------------------------------------------------------------
+ * Method: emu_report(..)
+ * Scope:  Local
+ *
+ *---------------------------------------------------------------------*/
+
+static void emu_report(struct emu* emu)
+{
+    struct emu_ping* ping = &emu->ping;
+    struct emu_stats* st = &emu->stats;
+    struct emu_hist* h;
+    double secs = (ping->last_ns - ping->start_ns) / 1e9;
+    unsigned long seen;
+    unsigned int i;
+    int a;
+
+    if(ping->from >= 0)
+    {
+        printf("%lu probes from %s to %s: %lu echo replies, %lu ICMP "
+               "errors, %lu lost\n", ping->sent, emu->hosts[ping->from].name,
+               inet_ntoa(*(struct in_addr*)&ping->dst), ping->received,
+               ping->errors, ping->lost);
+        if(secs > 0)
+        {
+            printf("%.0f probes/s, %.2f Mbit/s out\n", ping->sent / secs,
+                   ping->sent_bytes * 8 / secs / 1e6);
+        }
+
+        printf("%-24s %9s %9s %9s %9s %9s %9s %9s %9s\n", "rtt (us)",
+               "count", "min", "avg", "p50", "p90", "p99", "p99.9", "max");
+        for(a = 0; a < EMU_ANSWERS; a++)
+        {
+            h = &ping->rtt[a];
+            if(h->count == 0)
+            { continue; }
+            printf("%-24s %9lu %9.1f %9.1f %9.1f %9.1f %9.1f %9.1f %9.1f\n",
+                   emu_answer_names[a], h->count, h->min / 1e3,
+                   h->sum / 1e3 / h->count,
+                   emu_hist_quantile(h, 0.5) / 1e3,
+                   emu_hist_quantile(h, 0.9) / 1e3,
+                   emu_hist_quantile(h, 0.99) / 1e3,
+                   emu_hist_quantile(h, 0.999) / 1e3, h->max / 1e3);
+        }
+
+        for(a = 0; ping->histograms && a < EMU_ANSWERS; a++)
+        {
+            h = &ping->rtt[a];
+            if(h->count == 0)
+            { continue; }
+            printf("\n%s: us from, count, cumulative %%\n",
+                   emu_answer_names[a]);
+            for(i = 0, seen = 0; i < EMU_HIST_BUCKETS; i++)
+            {
+                if(h->bucket[i] == 0)
+                { continue; }
+                seen += h->bucket[i];
+                printf("%12.3f %9lu %8.3f\n", emu_hist_floor(i) / 1e3,
+                       h->bucket[i], 100.0 * seen / h->count);
+            }
+        }
+    }
+    printf("%lu frames from the router, %lu to it; answered %lu ARP "
+           "requests, %lu pings and %lu UDP datagrams; %lu unclaimed\n",
+           st->rx_frames, st->tx_frames, st->arp_replies, st->echo_replies,
+           st->port_unreachables, st->unclaimed);
+    if(emu->vns)
+    { printf("%lu writes, slept %lu times\n", st->writes, st->sleeps); }
+    else
+    {
+        printf("rang the router %lu times, slept %lu times\n", st->doorbells,
+               st->sleeps);
+    }
+} /* -- emu_report -- */
+
+/*---------------------------------------------------------------------
+ * Method: emu_shm_listen(..)
+ * Scope:  Local
+ *
+ * Create the segment and wait for the router to attach to it.
+ *
+ *---------------------------------------------------------------------*/
+
+static int emu_shm_listen(struct emu* emu, const char* path)
+{
+    struct sockaddr_un addr;
+    int lfd, segfd;
+
+    if(strlen(path) >= sizeof(addr.sun_path))
+    {
+        fprintf(stderr, "Error: socket path %s too long\n", path);
+        return -1;
+    }
+
+    /* -- the segment, which the router maps too -- */
+    segfd = memfd_create("sr_emu", 0);
+    if(segfd < 0 || ftruncate(segfd, sizeof(struct sr_shm_seg)) < 0)
+    {
+        perror("memfd_create(..):sr_emu.c::emu_shm_listen");
+        return -1;
+    }
+    emu->seg = (struct sr_shm_seg*)mmap(0, sizeof(struct sr_shm_seg),
+            PROT_READ | PROT_WRITE, MAP_SHARED, segfd, 0);
+    if(emu->seg == MAP_FAILED)
+    {
+        perror("mmap(..):sr_emu.c::emu_shm_listen");
+        close(segfd);
+        return -1;
+    }
+    emu->seg->nifs = emu->nifs;
+    memcpy(emu->seg->ifs, emu->ifs, sizeof(emu->ifs));
+    /* -- the router isn't listening yet, so ring it for the first frame -- */
+    emu->seg->to_router.sleeping = 1;
+    emu->seg->magic = SR_SHM_MAGIC;
+
+    if((lfd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+    {
+        perror("socket(..):sr_emu.c::emu_shm_listen");
+        close(segfd);
+        return -1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    unlink(path);
+    if(bind(lfd, (struct sockaddr*)&addr, sizeof(addr)) < 0 ||
+       listen(lfd, 1) < 0)
+    {
+        perror("bind(..):sr_emu.c::emu_shm_listen");
+        close(lfd);
+        close(segfd);
+        return -1;
+    }
+
+    printf("Waiting for the router on %s\n", path);
+    emu->sock = accept(lfd, 0, 0);
+    close(lfd);
+    unlink(path);
+    if(emu->sock < 0)
+    {
+        perror("accept(..):sr_emu.c::emu_shm_listen");
+        close(segfd);
+        return -1;
+    }
+    if(sr_shm_send_fd(emu->sock, segfd) < 0)
+    {
+        close(segfd);
+        return -1;
+    }
+    close(segfd);
+    fcntl(emu->sock, F_SETFL, fcntl(emu->sock, F_GETFL) | O_NONBLOCK);
+    return 0;
+} /* -- emu_shm_listen -- */
+
+/*---------------------------------------------------------------------
+ * Method: emu_vns_expect(..)
+ * Scope:  Local
+ *
+ * Wait for the router's next message, which must be of type (or of any
+ * type if type is 0). Returns it in place at the front of the input
+ * buffer; emu_vns_consume drops it once handled.
+ *
+ *---------------------------------------------------------------------*/
+
+static uint8_t* emu_vns_expect(struct emu* emu, uint32_t type,
+        uint32_t* len)
+{
+    struct emu_vns* vns = emu->vns;
+    struct pollfd pfd;
+    c_base base;
+
+    while(!emu->closed)
+    {
+        if(vns->in_len >= sizeof(base))
+        {
+            memcpy(&base, vns->in, sizeof(base));
+            *len = ntohl(base.mLen);
+            if(*len < sizeof(base) || *len > sizeof(vns->in))
+            { break; }
+            if(vns->in_len >= *len)
+            {
+                if(type && ntohl(base.mType) != type)
+                {
+                    fprintf(stderr, "Error: expected command %u but got %u\n",
+                            type, ntohl(base.mType));
+                    return 0;
+                }
+                return vns->in;
+            }
+        }
+        pfd.fd = emu->sock;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        poll(&pfd, 1, 1000);
+        emu_vns_fill(emu);
+    }
+    fprintf(stderr, "Router went away during the handshake\n");
+    return 0;
+} /* -- emu_vns_expect -- */
+
+static void emu_vns_consume(struct emu* emu, uint32_t len)
+{
+    struct emu_vns* vns = emu->vns;
+
+    memmove(vns->in, vns->in + len, vns->in_len - len);
+    vns->in_len -= len;
+} /* -- emu_vns_consume -- */
+
+/*---------------------------------------------------------------------
+ * Method: emu_vns_auth(..)
+ * Scope:  Local
+ *
+ * Check the router's VNS_AUTH_REPLY: the SHA1 of our salt and its
+ * auth_key, worked out the way sr_handle_auth_request does.
+ *
+ *---------------------------------------------------------------------*/
+
+static int emu_vns_auth(struct emu* emu, const uint8_t* salt,
+        const c_auth_reply* ar, uint32_t len)
+{
+    char key[EMU_AUTH_KEY_LEN + 1];
+    uint32_t digest[5];
+    uint32_t ulen = ntohl(ar->usernameLen);
+    SHA1Context sha1;
+    FILE* fp;
+    int i;
+
+    if(len < sizeof(c_auth_reply) || ulen != len - sizeof(c_auth_reply) -
+       sizeof(digest))
+    { return 0; }
+    printf("Router authenticating as %.*s\n", (int)ulen, ar->username);
+    if(!emu->vns->keyfile)
+    { return 1; }
+
+    memset(key, 0, sizeof(key));
+    if((fp = fopen(emu->vns->keyfile, "r")) == 0)
+    {
+        perror("fopen(..):sr_emu.c::emu_vns_auth");
+        return 0;
+    }
+    if(fgets(key, sizeof(key), fp) != key)
+    {
+        fclose(fp);
+        return 0;
+    }
+    fclose(fp);
+
+    SHA1Reset(&sha1);
+    SHA1Input(&sha1, salt, EMU_VNS_SALT);
+    SHA1Input(&sha1, (unsigned char*)key, EMU_AUTH_KEY_LEN);
+    if(!SHA1Result(&sha1))
+    { return 0; }
+    for(i = 0; i < 5; i++)
+    { digest[i] = htonl(sha1.Message_Digest[i]); }
+    return memcmp(ar->username + ulen, digest, sizeof(digest)) == 0;
+} /* -- emu_vns_auth -- */
+
+/*---------------------------------------------------------------------
+ * Method: emu_vns_rtable(..)
+ * Scope:  Local
+ *
+ * Answer a VNS_OPEN_TEMPLATE with a routing table for the topology: a
+ * host route to every host and a default route through the first.
+ *
+ *---------------------------------------------------------------------*/
+
+static void emu_vns_rtable(struct emu* emu, const c_open_template* ot)
+{
+    char text[EMU_HOSTS_MAX * 96];
+    char ip[INET_ADDRSTRLEN];
+    c_rtable rt;
+    struct emu_host* host;
+    unsigned int len = 0;
+    int i;
+
+    for(i = 0; i < emu->nhosts; i++)
+    {
+        host = &emu->hosts[i];
+        inet_ntop(AF_INET, &host->ip, ip, sizeof(ip));
+        if(i == 0)
+        {
+            len += sprintf(text + len, "0.0.0.0 %s 0.0.0.0 %s\n", ip,
+                           emu->ifs[host->port].name);
+        }
+        len += sprintf(text + len, "%s %s 255.255.255.255 %s\n", ip, ip,
+                       emu->ifs[host->port].name);
+    }
+
+    rt.mLen = htonl(sizeof(rt) + len);
+    rt.mType = htonl(VNS_RTABLE);
+    memcpy(rt.mVirtualHostID, ot->mVirtualHostID, IDSIZE);
+    emu_vns_put(emu, &rt, sizeof(rt));
+    emu_vns_put(emu, text, len);
+} /* -- emu_vns_rtable -- */
+
+/*---------------------------------------------------------------------
+ * Method: emu_vns_hwinfo(..)
+ * Scope:  Local
+ *
+ *---------------------------------------------------------------------*/
+
+static void emu_vns_hwinfo(struct emu* emu)
+{
+    c_hw_entry entries[3 * SR_SHM_IFS_MAX];
+    c_base base;
+    unsigned int i, n = 0;
+
+    memset(entries, 0, sizeof(entries));
+    for(i = 0; i < emu->nifs; i++)
+    {
+        entries[n].mKey = htonl(HWINTERFACE);
+        strncpy(entries[n++].value, emu->ifs[i].name,
+                sizeof(entries[0].value) - 1);
+        entries[n].mKey = htonl(HWETHER);
+        memcpy(entries[n++].value, emu->ifs[i].addr, ETHER_ADDR_LEN);
+        entries[n].mKey = htonl(HWETHIP);
+        memcpy(entries[n++].value, &emu->ifs[i].ip, sizeof(uint32_t));
+    }
+
+    base.mLen = htonl(sizeof(base) + n * sizeof(c_hw_entry));
+    base.mType = htonl(VNSHWINFO);
+    emu_vns_put(emu, &base, sizeof(base));
+    emu_vns_put(emu, entries, n * sizeof(c_hw_entry));
+} /* -- emu_vns_hwinfo -- */
+
+/*---------------------------------------------------------------------
+ * Method: emu_vns_listen(..)
+ * Scope:  Local
+ *
+ * Wait for the router on TCP port and take it through the VNS handshake
+ * (sr_connect_to_server's side of it), up to the VNSHWINFO.
+ *
+ *---------------------------------------------------------------------*/
+
+static int emu_vns_listen(struct emu* emu, unsigned short port)
+{
+    struct sockaddr_in addr;
+    uint8_t salt[EMU_VNS_SALT];
+    uint8_t status[sizeof(c_auth_status) + 64];
+    c_auth_status* st = (c_auth_status*)status;
+    c_base base;
+    uint8_t* msg;
+    uint32_t len;
+    int lfd, on = 1, ok;
+    unsigned int i;
+
+    if((lfd = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+    {
+        perror("socket(..):sr_emu.c::emu_vns_listen");
+        return -1;
+    }
+    setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    if(bind(lfd, (struct sockaddr*)&addr, sizeof(addr)) < 0 ||
+       listen(lfd, 1) < 0)
+    {
+        perror("bind(..):sr_emu.c::emu_vns_listen");
+        close(lfd);
+        return -1;
+    }
+
+    printf("Waiting for the router on port %u\n", port);
+    emu->sock = accept(lfd, 0, 0);
+    close(lfd);
+    if(emu->sock < 0)
+    {
+        perror("accept(..):sr_emu.c::emu_vns_listen");
+        return -1;
+    }
+    fcntl(emu->sock, F_SETFL, fcntl(emu->sock, F_GETFL) | O_NONBLOCK);
+
+    /* -- the server speaks first: a salt to authenticate against -- */
+    srand((unsigned int)emu_now_ns());
+    for(i = 0; i < sizeof(salt); i++)
+    { salt[i] = (uint8_t)rand(); }
+    base.mLen = htonl(sizeof(base) + sizeof(salt));
+    base.mType = htonl(VNS_AUTH_REQUEST);
+    emu_vns_put(emu, &base, sizeof(base));
+    emu_vns_put(emu, salt, sizeof(salt));
+    emu_vns_flush(emu);
+
+    if((msg = emu_vns_expect(emu, VNS_AUTH_REPLY, &len)) == 0)
+    { return -1; }
+    ok = emu_vns_auth(emu, salt, (c_auth_reply*)msg, len);
+    emu_vns_consume(emu, len);
+
+    memset(status, 0, sizeof(status));
+    st->mType = htonl(VNS_AUTH_STATUS);
+    st->auth_ok = (uint8_t)ok;
+    strcpy(st->msg, ok ? "welcome to sr_emu" : "bad auth_key");
+    st->mLen = htonl(sizeof(c_auth_status) + strlen(st->msg) + 1);
+    emu_vns_put(emu, status, ntohl(st->mLen));
+    emu_vns_flush(emu);
+    if(!ok)
+    {
+        fprintf(stderr, "Router failed to authenticate\n");
+        return -1;
+    }
+
+    /* -- then it opens a topology, or a template wanting an rtable -- */
+    if((msg = emu_vns_expect(emu, 0, &len)) == 0)
+    { return -1; }
+    memcpy(&base, msg, sizeof(base));
+    if(ntohl(base.mType) == VNS_OPEN_TEMPLATE &&
+       len >= sizeof(c_open_template))
+    { emu_vns_rtable(emu, (c_open_template*)msg); }
+    else if(ntohl(base.mType) != VNSOPEN)
+    {
+        fprintf(stderr, "Error: expected an open but got command %u\n",
+                ntohl(base.mType));
+        return -1;
+    }
+    emu_vns_consume(emu, len);
+
+    emu_vns_hwinfo(emu);
+    return emu_vns_flush(emu);
+} /* -- emu_vns_listen -- */
+
+/*---------------------------------------------------------------------
+ * Method: emu_vns_close(..)
+ * Scope:  Local
+ *
+ * End the session the way the VNS server does, with a VNSCLOSE.
+ *
+ *---------------------------------------------------------------------*/
+
+static void emu_vns_close(struct emu* emu)
+{
+    c_close bye;
+
+    if(emu->closed)
+    { return; }
+    memset(&bye, 0, sizeof(bye));
+    bye.mLen = htonl(sizeof(bye));
+    bye.mType = htonl(VNSCLOSE);
+    strcpy(bye.mErrorMessage, "sr_emu is done");
+    emu_vns_put(emu, &bye, sizeof(bye));
+    emu_vns_flush(emu);
+} /* -- emu_vns_close -- */
+
+/*-----------------------------------------------------------------------------
+ *---------------------------------------------------------------------------*/
+
+int main(int argc, char** argv)
+{
+    struct emu emu;
+    struct in_addr dst;
+    char* path = EMU_DEFAULT_SOCK;
+    char* topology = 0;
+    char* keyfile = 0;
+    char* from = 0;
+    char* to = 0;
+    char* kinds = 0;
+    char* expect = 0;
+    char* kind;
+    char* save = 0;
+    unsigned int port = 0;
+    int c, i, failed;
+
+    memset(&emu, 0, sizeof(emu));
+    emu.ping.from = -1;
+    emu.ping.count = 10;
+    emu.ping.window = 1;
+    emu.ping.size = EMU_PING_DATA;
+    emu.ping.nkinds = 1;
+
+    while((c = getopt(argc, argv, "hs:p:k:t:f:d:c:w:r:z:P:Hx:")) != EOF)
+    {
+        switch(c)
+        {
+            case 's': path = optarg; break;
+            case 'p': port = atoi(optarg); break;
+            case 'k': keyfile = optarg; break;
+            case 't': topology = optarg; break;
+            case 'f': from = optarg; break;
+            case 'd': to = optarg; break;
+            case 'c': emu.ping.count = strtoul(optarg, 0, 10); break;
+            case 'w': emu.ping.window = atoi(optarg); break;
+            case 'r': emu.ping.rate = strtoul(optarg, 0, 10); break;
+            case 'z': emu.ping.size = atoi(optarg); break;
+            case 'P': kinds = optarg; break;
+            case 'H': emu.ping.histograms = 1; break;
+            case 'x': expect = optarg; break;
+            default:
+                usage(argv[0]);
+                exit(c == 'h' ? 0 : 1);
+        }
+    }
+
+    if(emu_load_topology(&emu, topology) < 0)
+    { exit(1); }
+
+    if(from || to)
+    {
+        for(i = 0; i < emu.nhosts; i++)
+        {
+            if(from && strcmp(emu.hosts[i].name, from) == 0)
+            { emu.ping.from = i; }
+        }
+        for(kind = kinds ? strtok_r(kinds, ",", &save) : 0, i = 0; kind;
+            kind = strtok_r(0, ",", &save), i++)
+        {
+            for(c = 0; emu_probe_names[c]; c++)
+            {
+                if(strcmp(emu_probe_names[c], kind) == 0)
+                { break; }
+            }
+            if(!emu_probe_names[c] || i == EMU_PROBE_KINDS)
+            {
+                fprintf(stderr, "Bad probe kind %s\n", kind);
+                exit(1);
+            }
+            emu.ping.kinds[i] = c;
+            emu.ping.nkinds = i + 1;
+        }
+        for(kind = expect ? strtok_r(expect, ",", &save) : 0; kind;
+            kind = strtok_r(0, ",", &save))
+        {
+            for(c = 0; emu_answer_keys[c]; c++)
+            {
+                if(strcmp(emu_answer_keys[c], kind) == 0)
+                { break; }
+            }
+            if(!emu_answer_keys[c])
+            {
+                fprintf(stderr, "Bad answer kind %s\n", kind);
+                exit(1);
+            }
+            emu.ping.expect |= 1U << c;
+        }
+        if(emu.ping.from < 0 || !to || inet_aton(to, &dst) == 0 ||
+           emu.ping.window == 0 || emu.ping.window >= EMU_SEQS / 2 ||
+           emu.ping.size > SR_SHM_SLOT_SZ - sizeof(c_packet_header) -
+               sizeof(sr_ethernet_hdr_t) - sizeof(sr_ip_hdr_t) - EMU_ICMP_HDR)
+        {
+            fprintf(stderr, "Need -f with a host from the topology, -d with "
+                    "an address, a window and a size that fits a slot\n");
+            exit(1);
+        }
+        emu.ping.dst = dst.s_addr;
+        emu.ping.sent_ns = (uint64_t*)calloc(EMU_SEQS, sizeof(uint64_t));
+        assert(emu.ping.sent_ns);
+    }
+
+    signal(SIGINT, emu_stop);
+    signal(SIGTERM, emu_stop);
+    signal(SIGPIPE, SIG_IGN);
+
+    if(port)
+    {
+        if((emu.vns = (struct emu_vns*)calloc(1, sizeof(struct emu_vns))) == 0)
+        {
+            perror("calloc(..):sr_emu.c::main");
+            exit(1);
+        }
+        emu.vns->keyfile = keyfile;
+        if(emu_vns_listen(&emu, port) < 0)
+        { exit(1); }
+    }
+    else if(emu_shm_listen(&emu, path) < 0)
+    { exit(1); }
+
+    emu_run(&emu);
+    emu_report(&emu);
+
+    /* -- a run that didn't get to the end, or missed an answer -x wants,
+          is a failure -- */
+    failed = emu.ping.from >= 0 && !emu.ping.done;
+    for(i = 0; i < EMU_ANSWERS; i++)
+    {
+        if((emu.ping.expect & (1U << i)) && emu.ping.rtt[i].count == 0)
+        {
+            fprintf(stderr, "No probe was answered with %s\n",
+                    emu_answer_names[i]);
+            failed = 1;
+        }
+    }
+
+    if(emu.vns)
+    {
+        emu_vns_close(&emu);
+        free(emu.vns);
+    }
+    else
+    { munmap(emu.seg, sizeof(struct sr_shm_seg)); }
+    close(emu.sock);
+    free(emu.ping.sent_ns);
+
+    return failed;
+} /* -- main -- */
@@ -22,6 +22,12 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 
+#ifdef _LINUX_
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <net/if.h>
+#endif /* _LINUX_ */
+
 #include "sr_if.h"
 #include "sr_router.h"
 
@@ -76,6 +82,7 @@ void sr_add_interface(struct sr_instance* sr, const char* name)
         sr->if_list = (struct sr_if*)malloc(sizeof(struct sr_if));
         assert(sr->if_list);
         sr->if_list->next = 0;
+        sr->if_list->port = 0;
         strncpy(sr->if_list->name,name,sr_IFACE_NAMELEN);
         return;
     }
@@ -89,6 +96,7 @@ void sr_add_interface(struct sr_instance* sr, const char* name)
     assert(if_walker->next);
     if_walker = if_walker->next;
     strncpy(if_walker->name,name,sr_IFACE_NAMELEN);
+    if_walker->port = 0;
     if_walker->next = 0;
 } /* -- sr_add_interface -- */ 
 
@@ -192,3 +200,64 @@ void sr_print_if(struct sr_if* iface)
     Debug("\n");
     Debug("\tinet addr %s\n",inet_ntoa(ip_addr));
 } /* -- sr_print_if -- */
+
+/*--------------------------------------------------------------------- 
+ * Method: sr_if_from_host(..)
+ * Scope: Global
+ *
+ * Look up a network interface of the machine we run on, for backends that
+ * attach to them directly: its index and MAC, and its IPv4 address unless
+ * *ip_nbo already holds one. Returns 0 on success, -1 on error.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_if_from_host(const char* name, int* ifindex, unsigned char* addr,
+                    uint32_t* ip_nbo)
+{
+#ifdef _LINUX_
+    struct ifreq ifr;
+    int fd, ret = -1;
+
+    /* -- REQUIRES -- */
+    assert(name);
+
+    if((fd = socket(AF_INET, SOCK_DGRAM, 0)) < 0)
+    {
+        perror("socket(..):sr_if.c::sr_if_from_host");
+        return -1;
+    }
+
+    memset(&ifr, 0, sizeof(ifr));
+    strncpy(ifr.ifr_name, name, IFNAMSIZ - 1);
+    if(ioctl(fd, SIOCGIFINDEX, &ifr) < 0)
+    { fprintf(stderr, "Error: no interface %s\n", name); }
+    else
+    {
+        *ifindex = ifr.ifr_ifindex;
+        if(ioctl(fd, SIOCGIFHWADDR, &ifr) < 0)
+        { perror("ioctl(SIOCGIFHWADDR):sr_if.c::sr_if_from_host"); }
+        else
+        {
+            memcpy(addr, ifr.ifr_hwaddr.sa_data, ETHER_ADDR_LEN);
+            if(*ip_nbo != 0)
+            { ret = 0; }
+            else if(ioctl(fd, SIOCGIFADDR, &ifr) < 0)
+            {
+                fprintf(stderr, "Error: %s has no IPv4 address, give it one "
+                        "as %s=a.b.c.d\n", name, name);
+            }
+            else
+            {
+                *ip_nbo = ((struct sockaddr_in*)&ifr.ifr_addr)->sin_addr.s_addr;
+                ret = 0;
+            }
+        }
+    }
+
+    close(fd);
+    return ret;
+#else
+    fprintf(stderr, "Error: can't look up host interfaces here\n");
+    return -1;
+#endif /* _LINUX_ */
+} /* -- sr_if_from_host -- */
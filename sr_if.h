@@ -41,6 +41,7 @@ struct sr_if
   unsigned char addr[ETHER_ADDR_LEN];
   uint32_t ip;
   uint32_t speed;
+  void* port; /* the transport's own handle for it, if it keeps one */
   struct sr_if* next;
 };
 
@@ -50,5 +51,7 @@ void sr_set_ether_addr(struct sr_instance*, const unsigned char*);
 void sr_set_ether_ip(struct sr_instance*, uint32_t ip_nbo);
 void sr_print_if_list(struct sr_instance*);
 void sr_print_if(struct sr_if*);
+int sr_if_from_host(const char* name, int* ifindex, unsigned char* addr,
+                    uint32_t* ip_nbo);
 
 #endif /* --  sr_INTERFACE_H -- */
@@ -0,0 +1,526 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_loop.c
+ *
+ * Description:
+ *
+ * Single-threaded epoll event loop; see sr_loop.h.
+ *
+ * Timers are kept in a small unsorted array. After every wakeup the one
+ * timerfd is re-armed for whichever is due first, on CLOCK_MONOTONIC with
+ * millisecond resolution, so a slow tick never drifts and a jump in the
+ * wall clock doesn't bunch up or stall the ARP sweeps.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+
+#ifdef _LINUX_
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif /* _LINUX_ */
+
+#include "sr_loop.h"
+#include "sr_router.h"
+#include "sr_arpcache.h"
+#include "sr_transport.h"
+
+/*---------------------------------------------------------------------
+ * Method: sr_loop_now_ms(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+unsigned long sr_loop_now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long)ts.tv_sec * 1000UL + ts.tv_nsec / 1000000L;
+} /* -- sr_loop_now_ms -- */
+
+#ifdef _LINUX_
+
+/*---------------------------------------------------------------------
+ * Method: loop_arm(..)
+ * Scope:  Local
+ *
+ * Point the timerfd at the earliest timer, or disarm it if there are
+ * none.
+ *
+ *---------------------------------------------------------------------*/
+
+static void loop_arm(struct sr_loop* loop)
+{
+    struct itimerspec its;
+    unsigned long due = 0;
+    unsigned int i;
+
+    for(i = 0; i < loop->ntimers; i++)
+    {
+        if(i == 0 || loop->timers[i].due_ms < due)
+        { due = loop->timers[i].due_ms; }
+    }
+
+    memset(&its, 0, sizeof(its));
+    if(loop->ntimers > 0)
+    {
+        /* -- an all-zero it_value would disarm it, so never ask for 0 -- */
+        its.it_value.tv_sec  = due / 1000;
+        its.it_value.tv_nsec = (due % 1000) * 1000000L + 1;
+    }
+    timerfd_settime(loop->timerfd, TFD_TIMER_ABSTIME, &its, 0);
+} /* -- loop_arm -- */
+
+/*---------------------------------------------------------------------
+ * Method: loop_run_timers(..)
+ * Scope:  Local
+ *
+ * Run every timer that is due. A periodic timer that fell more than a
+ * period behind skips the ticks it missed rather than running them back
+ * to back.
+ *
+ *---------------------------------------------------------------------*/
+
+static void loop_run_timers(struct sr_loop* loop, int fd, void* arg)
+{
+    uint64_t expirations;
+    unsigned long now;
+    unsigned int i;
+    struct sr_loop_timer t;
+
+    /* -- just drain it; we look at the clock ourselves -- */
+    if(read(fd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN)
+    { perror("read(..):sr_loop.c::loop_run_timers"); }
+
+    now = sr_loop_now_ms();
+    i = 0;
+    while(i < loop->ntimers)
+    {
+        if(loop->timers[i].due_ms > now)
+        {
+            i++;
+            continue;
+        }
+
+        t = loop->timers[i];
+        if(now - t.due_ms > loop->stats.late_ms)
+        { loop->stats.late_ms = now - t.due_ms; }
+
+        if(t.period_ms > 0)
+        {
+            loop->timers[i].due_ms += t.period_ms;
+            if(loop->timers[i].due_ms <= now)
+            { loop->timers[i].due_ms = now + t.period_ms; }
+            i++;
+        }
+        else
+        {
+            /* -- one-shot: remove before calling, it may add timers -- */
+            loop->timers[i] = loop->timers[--loop->ntimers];
+        }
+
+        loop->stats.timers++;
+        t.fn(loop, -1, t.arg);
+    }
+
+    loop_arm(loop);
+} /* -- loop_run_timers -- */
+
+/*---------------------------------------------------------------------
+ * Method: loop_signal(..)
+ * Scope:  Local
+ *
+ *---------------------------------------------------------------------*/
+
+static void loop_signal(struct sr_loop* loop, int fd, void* arg)
+{
+    struct signalfd_siginfo si;
+
+    if(read(fd, &si, sizeof(si)) != sizeof(si))
+    { return; }
+
+    fprintf(stderr, "Caught signal %u, shutting down\n", si.ssi_signo);
+    sr_loop_stop(loop);
+} /* -- loop_signal -- */
+
+/*---------------------------------------------------------------------
+ * Method: loop_control(..)
+ * Scope:  Local
+ *
+ * Answer one command from a control client and hang up.
+ *
+ *---------------------------------------------------------------------*/
+
+static void loop_control(struct sr_loop* loop, int fd, void* arg)
+{
+    struct sr_instance* sr = loop->sr;
+    char cmd[64];
+    FILE* fp;
+    int len;
+
+    len = read(fd, cmd, sizeof(cmd) - 1);
+    sr_loop_del_fd(loop, fd);
+    if(len <= 0 || (fp = fdopen(fd, "w")) == 0)
+    {
+        close(fd);
+        return;
+    }
+
+    cmd[len] = 0;
+    cmd[strcspn(cmd, " \r\n")] = 0;
+    loop->stats.commands++;
+
+    if(strcmp(cmd, "stats") == 0)
+    {
+        sr->transport->print_stats(sr, fp);
+        sr_loop_print_stats(loop, fp);
+    }
+    else if(strcmp(cmd, "arp") == 0)
+    { sr_arpcache_fdump(&(sr->cache), fp); }
+    else if(strcmp(cmd, "quit") == 0)
+    {
+        fprintf(fp, "Shutting down\n");
+        sr_loop_stop(loop);
+    }
+    else
+    { fprintf(fp, "Unknown command '%s' (try stats, arp or quit)\n", cmd); }
+
+    fclose(fp);
+} /* -- loop_control -- */
+
+/*---------------------------------------------------------------------
+ * Method: loop_accept(..)
+ * Scope:  Local
+ *
+ *---------------------------------------------------------------------*/
+
+static void loop_accept(struct sr_loop* loop, int fd, void* arg)
+{
+    int client;
+
+    if((client = accept(fd, 0, 0)) < 0)
+    {
+        perror("accept(..):sr_loop.c::loop_accept");
+        return;
+    }
+    if(sr_loop_add_fd(loop, client, loop_control, 0) < 0)
+    { close(client); }
+} /* -- loop_accept -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_loop_create(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+struct sr_loop* sr_loop_create(struct sr_instance* sr)
+{
+    struct sr_loop* loop;
+    sigset_t mask;
+
+    /* REQUIRES */
+    assert(sr);
+
+    loop = (struct sr_loop*)calloc(1, sizeof(struct sr_loop));
+    assert(loop);
+    loop->sr = sr;
+    loop->ctlfd = -1;
+    loop->timerfd = -1;
+    loop->sigfd = -1;
+
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+
+    if((loop->epfd = epoll_create1(EPOLL_CLOEXEC)) < 0 ||
+       (loop->timerfd = timerfd_create(CLOCK_MONOTONIC,
+                                       TFD_NONBLOCK | TFD_CLOEXEC)) < 0 ||
+       sigprocmask(SIG_BLOCK, &mask, 0) < 0 ||
+       (loop->sigfd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC)) < 0 ||
+       sr_loop_add_fd(loop, loop->timerfd, loop_run_timers, 0) < 0 ||
+       sr_loop_add_fd(loop, loop->sigfd, loop_signal, 0) < 0)
+    {
+        perror("sr_loop.c::sr_loop_create");
+        sigprocmask(SIG_UNBLOCK, &mask, 0);
+        sr_loop_destroy(loop);
+        return 0;
+    }
+
+    /* -- a control client hanging up early shouldn't kill us -- */
+    signal(SIGPIPE, SIG_IGN);
+
+    return loop;
+} /* -- sr_loop_create -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_loop_destroy(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_loop_destroy(struct sr_loop* loop)
+{
+    struct sr_loop_handler* h;
+
+    if(!loop)
+    { return; }
+
+    while((h = loop->handlers) != 0)
+    {
+        loop->handlers = h->next;
+        free(h);
+    }
+    if(loop->ctlfd >= 0)
+    {
+        close(loop->ctlfd);
+        unlink(loop->ctl_path);
+    }
+    if(loop->sigfd >= 0)
+    { close(loop->sigfd); }
+    if(loop->timerfd >= 0)
+    { close(loop->timerfd); }
+    if(loop->epfd >= 0)
+    { close(loop->epfd); }
+    free(loop);
+} /* -- sr_loop_destroy -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_loop_add_fd(..), sr_loop_del_fd(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_loop_add_fd(struct sr_loop* loop, int fd, sr_loop_fn fn, void* arg)
+{
+    struct sr_loop_handler* h;
+    struct epoll_event ev;
+
+    h = (struct sr_loop_handler*)malloc(sizeof(struct sr_loop_handler));
+    assert(h);
+    h->fd  = fd;
+    h->fn  = fn;
+    h->arg = arg;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = h;
+    if(epoll_ctl(loop->epfd, EPOLL_CTL_ADD, fd, &ev) < 0)
+    {
+        perror("epoll_ctl(..):sr_loop.c::sr_loop_add_fd");
+        free(h);
+        return -1;
+    }
+
+    h->next = loop->handlers;
+    loop->handlers = h;
+    return 0;
+} /* -- sr_loop_add_fd -- */
+
+void sr_loop_del_fd(struct sr_loop* loop, int fd)
+{
+    struct sr_loop_handler** hp;
+    struct sr_loop_handler* h;
+
+    for(hp = &loop->handlers; (h = *hp) != 0; hp = &h->next)
+    {
+        if(h->fd == fd)
+        {
+            epoll_ctl(loop->epfd, EPOLL_CTL_DEL, fd, 0);
+            *hp = h->next;
+            free(h);
+            return;
+        }
+    }
+} /* -- sr_loop_del_fd -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_loop_add_timer(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_loop_add_timer(struct sr_loop* loop, unsigned int first_ms,
+        unsigned int period_ms, sr_loop_fn fn, void* arg)
+{
+    struct sr_loop_timer* t;
+
+    if(loop->ntimers >= SR_LOOP_TIMERS)
+    {
+        fprintf(stderr, "Error: event loop is out of timers\n");
+        return -1;
+    }
+
+    t = &loop->timers[loop->ntimers++];
+    t->due_ms    = sr_loop_now_ms() + first_ms;
+    t->period_ms = period_ms;
+    t->fn        = fn;
+    t->arg       = arg;
+
+    loop_arm(loop);
+    return 0;
+} /* -- sr_loop_add_timer -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_loop_schedule(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_loop_schedule(struct sr_loop* loop, unsigned int delay_ms,
+        sr_loop_fn fn, void* arg)
+{
+    unsigned long due = sr_loop_now_ms() + delay_ms;
+    unsigned int i;
+
+    for(i = 0; i < loop->ntimers; i++)
+    {
+        struct sr_loop_timer* t = &loop->timers[i];
+        if(t->period_ms == 0 && t->fn == fn && t->arg == arg)
+        {
+            if(due < t->due_ms)
+            {
+                t->due_ms = due;
+                loop_arm(loop);
+            }
+            return 0;
+        }
+    }
+
+    return sr_loop_add_timer(loop, delay_ms, 0, fn, arg);
+} /* -- sr_loop_schedule -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_loop_listen(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_loop_listen(struct sr_loop* loop, const char* path)
+{
+    struct sockaddr_un addr;
+    int fd;
+
+    if(strlen(path) >= sizeof(addr.sun_path))
+    {
+        fprintf(stderr, "Error: control socket path %s is too long\n", path);
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    /* -- a previous run may have left its socket behind -- */
+    unlink(path);
+
+    if((fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0)
+    {
+        perror("socket(..):sr_loop.c::sr_loop_listen");
+        return -1;
+    }
+    if(bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 ||
+       listen(fd, 4) < 0 ||
+       sr_loop_add_fd(loop, fd, loop_accept, 0) < 0)
+    {
+        perror("bind(..):sr_loop.c::sr_loop_listen");
+        close(fd);
+        return -1;
+    }
+
+    loop->ctlfd = fd;
+    strcpy(loop->ctl_path, path);
+    return 0;
+} /* -- sr_loop_listen -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_loop_run(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_loop_run(struct sr_loop* loop)
+{
+    struct epoll_event events[SR_LOOP_EVENTS];
+    struct sr_loop_handler* h;
+    int n, i;
+
+    /* -- the transport's fds, whatever they are -- */
+    if(loop->sr->transport->watch(loop->sr, loop) < 0)
+    { return -1; }
+
+    loop->running = 1;
+    while(loop->running)
+    {
+        n = epoll_wait(loop->epfd, events, SR_LOOP_EVENTS, -1);
+        if(n < 0)
+        {
+            if(errno == EINTR)
+            { continue; }
+            perror("epoll_wait(..):sr_loop.c::sr_loop_run");
+            return -1;
+        }
+
+        loop->stats.wakeups++;
+        for(i = 0; i < n; i++)
+        {
+            h = (struct sr_loop_handler*)events[i].data.ptr;
+            loop->stats.events++;
+            h->fn(loop, h->fd, h->arg);
+        }
+    }
+
+    return 0;
+} /* -- sr_loop_run -- */
+
+#else /* -- no epoll: sr_main.c falls back to threads -- */
+
+struct sr_loop* sr_loop_create(struct sr_instance* sr)
+{ return 0; }
+void sr_loop_destroy(struct sr_loop* loop)
+{ }
+int sr_loop_add_fd(struct sr_loop* loop, int fd, sr_loop_fn fn, void* arg)
+{ return -1; }
+void sr_loop_del_fd(struct sr_loop* loop, int fd)
+{ }
+int sr_loop_add_timer(struct sr_loop* loop, unsigned int first_ms,
+        unsigned int period_ms, sr_loop_fn fn, void* arg)
+{ return -1; }
+int sr_loop_schedule(struct sr_loop* loop, unsigned int delay_ms,
+        sr_loop_fn fn, void* arg)
+{ return -1; }
+int sr_loop_listen(struct sr_loop* loop, const char* path)
+{ return -1; }
+int sr_loop_run(struct sr_loop* loop)
+{ return -1; }
+
+#endif /* _LINUX_ */
+
+/*---------------------------------------------------------------------
+ * Method: sr_loop_stop(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_loop_stop(struct sr_loop* loop)
+{
+    loop->running = 0;
+} /* -- sr_loop_stop -- */
+
+void sr_loop_print_stats(struct sr_loop* loop, FILE* fp)
+{
+    struct sr_loop_stats* st = &loop->stats;
+
+    fprintf(fp, "Event loop: %lu events in %lu wakeups, %lu timers run "
+            "(at most %lu ms late), %lu control commands\n", st->events,
+            st->wakeups, st->timers, st->late_ms, st->commands);
+} /* -- sr_loop_print_stats -- */
@@ -0,0 +1,119 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_loop.h
+ *
+ * Description:
+ *
+ * Single-threaded event loop for the router.
+ *
+ * One epoll set watches where packets come from (whatever fds the
+ * transport registers, see sr_transport.h), a timerfd that drives every timer (the ARP tick among them)
+ * with millisecond resolution, a signalfd for SIGINT/SIGTERM and,
+ * optionally, a unix control socket.
+ * With everything on one thread the ARP cache needs no locking, and a
+ * signal ends the loop normally so the router shuts down cleanly.
+ *
+ * The loop is Linux only. Elsewhere sr_loop_create returns 0 and the
+ * router falls back to the blocking read loop and the ARP cache thread.
+ *
+ * The control socket takes one command per connection and answers it:
+ *
+ *   stats   transmit queue, receive ring and loop counters
+ *   arp     the ARP cache
+ *   quit    shut the router down
+ *
+ * e.g. echo stats | nc -U /tmp/sr.ctl
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_LOOP_H
+#define SR_LOOP_H
+
+#include <stdio.h>
+
+#define SR_LOOP_TIMERS   8      /* timers the loop can hold */
+#define SR_LOOP_EVENTS   16     /* events taken per epoll_wait() */
+
+struct sr_instance;
+struct sr_loop;
+
+/* Called when fd is readable, or when a timer fires (fd is then -1). */
+typedef void (*sr_loop_fn)(struct sr_loop* loop, int fd, void* arg);
+
+struct sr_loop_handler
+{
+    int fd;
+    sr_loop_fn fn;
+    void* arg;
+    struct sr_loop_handler* next;
+};
+
+struct sr_loop_timer
+{
+    unsigned long due_ms;       /* next expiry, on sr_loop_now_ms's clock */
+    unsigned int period_ms;     /* 0 for a one-shot timer */
+    sr_loop_fn fn;
+    void* arg;
+};
+
+struct sr_loop_stats
+{
+    unsigned long wakeups;      /* epoll_wait() calls that returned events */
+    unsigned long events;       /* events handled */
+    unsigned long timers;       /* timer callbacks run */
+    unsigned long late_ms;      /* most a timer has run behind */
+    unsigned long commands;     /* control socket commands */
+};
+
+struct sr_loop
+{
+    struct sr_instance* sr;
+    int epfd;
+    int timerfd;
+    int sigfd;
+    int ctlfd;                  /* listening control socket, or -1 */
+    char ctl_path[108];
+    int running;
+    struct sr_loop_handler* handlers;
+    unsigned int ntimers;
+    struct sr_loop_timer timers[SR_LOOP_TIMERS];
+    struct sr_loop_stats stats;
+};
+
+/* Sets up epoll, the timerfd and the signalfd, blocking SIGINT and SIGTERM
+   so they arrive through it. Call before any other thread is started.
+   Returns 0 if there is no event loop on this platform or setup failed. */
+struct sr_loop* sr_loop_create(struct sr_instance* sr);
+void sr_loop_destroy(struct sr_loop* loop);
+
+/* Call fn whenever fd is readable. Returns 0 on success, -1 on error. */
+int sr_loop_add_fd(struct sr_loop* loop, int fd, sr_loop_fn fn, void* arg);
+
+/* Stop watching fd. Safe to call from fd's own callback. */
+void sr_loop_del_fd(struct sr_loop* loop, int fd);
+
+/* Call fn in first_ms milliseconds and then every period_ms (never again if
+   period_ms is 0). Returns 0 on success, -1 if the loop is out of timers. */
+int sr_loop_add_timer(struct sr_loop* loop, unsigned int first_ms,
+                      unsigned int period_ms, sr_loop_fn fn, void* arg);
+
+/* Call fn once in delay_ms, unless it is already waiting to be called once
+   sooner than that, in which case that stands. For a deadline that moves,
+   without piling up a timer each time it does. Returns 0 on success, -1 if
+   the loop is out of timers. */
+int sr_loop_schedule(struct sr_loop* loop, unsigned int delay_ms,
+                     sr_loop_fn fn, void* arg);
+
+/* Listen for control commands on a unix socket at path. */
+int sr_loop_listen(struct sr_loop* loop, const char* path);
+
+/* Watch the transport, then run until the server closes the session, a signal or quit command arrives, or sr_loop_stop is
+   called. Returns 0 on a clean stop, -1 on error. */
+int sr_loop_run(struct sr_loop* loop);
+void sr_loop_stop(struct sr_loop* loop);
+
+/* Monotonic milliseconds. */
+unsigned long sr_loop_now_ms(void);
+
+void sr_loop_print_stats(struct sr_loop* loop, FILE* fp);
+
+#endif /* -- SR_LOOP_H -- */
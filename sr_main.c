@@ -23,6 +23,9 @@
 #include <string.h>
 #include <unistd.h>
 #include <pwd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <time.h>
 #include <sys/types.h>
 
 #ifdef _LINUX_
@@ -32,6 +35,10 @@
 #include "sr_dumper.h"
 #include "sr_router.h"
 #include "sr_rt.h"
+#include "sr_txq.h"
+#include "sr_loop.h"
+#include "sr_transport.h"
+#include "sr_pktbuf.h"
 
 extern char* optarg;
 
@@ -50,6 +57,14 @@ static void sr_init_instance(struct sr_instance* );
 static void sr_destroy_instance(struct sr_instance* );
 static void sr_set_user(struct sr_instance* );
 static void sr_load_rt_wrap(struct sr_instance* sr, char* rtable);
+static int sr_signals_thread(struct sr_instance* sr);
+
+/* -- without the event loop, SIGINT and SIGTERM go to a thread of their
+      own (sr_signal_thread), which stops the read loop -- */
+static pthread_mutex_t sr_stop_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t sr_stop_cond = PTHREAD_COND_INITIALIZER;
+static int sr_stopping;     /* a signal has come */
+static int sr_torn_down;    /* sr_destroy_instance has been claimed */
 
 /*-----------------------------------------------------------------------------
  *---------------------------------------------------------------------------*/
@@ -65,11 +80,22 @@ int main(int argc, char **argv)
     unsigned int port = DEFAULT_PORT;
     unsigned int topo = DEFAULT_TOPO;
     char *logfile = 0;
+    int arp_gratuitous = 0;
+    char *arp_static = 0;
+    char *arp_snapshot = 0;
+    char *batching = 0;
+    int use_loop = 1;
+    char *control = 0;
+    char *io = 0;
+    const struct sr_transport* transport;
+    char *spec;
+    char vns_spec[320];
+    int ifs;
     struct sr_instance sr;
 
     printf("Using %s\n", VERSION_INFO);
 
-    while ((c = getopt(argc, argv, "hs:v:p:u:t:r:l:T:")) != EOF)
+    while ((c = getopt(argc, argv, "hs:v:p:u:t:r:l:T:ga:c:b:Ex:i:")) != EOF)
     {
         switch (c)
         {
@@ -101,6 +127,27 @@ int main(int argc, char **argv)
             case 'T':
                 template = optarg;
                 break;
+            case 'g':
+                arp_gratuitous = 1;
+                break;
+            case 'a':
+                arp_static = optarg;
+                break;
+            case 'c':
+                arp_snapshot = optarg;
+                break;
+            case 'b':
+                batching = optarg;
+                break;
+            case 'E':
+                use_loop = 0;
+                break;
+            case 'x':
+                control = optarg;
+                break;
+            case 'i':
+                io = optarg;
+                break;
         } /* switch */
     } /* -- while -- */
 
@@ -116,6 +163,8 @@ int main(int argc, char **argv)
         strncpy(sr.template, template, 30);
 
     sr.topo_id = topo;
+    sr.arp_gratuitous = arp_gratuitous;
+    sr.arp_snapshot = arp_snapshot;
     strncpy(sr.host,host,32);
 
     if(! user )
@@ -141,12 +190,45 @@ int main(int argc, char **argv)
     else
         Debug("Requesting topology %d\n", topo);
 
-    /* connect to server and negotiate session */
-    if(sr_connect_to_server(&sr,port,server) == -1)
+    /* -- -i name:spec picks a transport; the VNS server is the default -- */
+    if(!io || strcmp(io, "uring") == 0 || strcmp(io, "sqpoll") == 0)
+    {
+        snprintf(vns_spec, sizeof(vns_spec), "%s:%u%s%s", server, port,
+                 io ? "," : "", io ? io : "");
+        sr.transport = sr_transport_create(&sr_vns_transport);
+        spec = vns_spec;
+    }
+    else
+    {
+        if((spec = strchr(io, ':')) != 0)
+        { *spec++ = 0; }
+        if((transport = sr_transport_find(io)) == 0)
+        {
+            fprintf(stderr,"Unknown I/O backend %s\n", io);
+            usage(argv[0]);
+            exit(1);
+        }
+        sr.transport = sr_transport_create(transport);
+        if(!spec)
+        { spec = ""; }
+    }
+
+    /* connect to server and negotiate session (or open the interfaces) */
+    if(sr.transport->connect(&sr, spec) != 0)
     {
+        sr.transport->close(&sr);
         return 1;
     }
 
+    /* -- transmit batching: frames[:bytes[:usec]], 0 frames turns it off -- */
+    if(batching && sr.txq)
+    {
+        unsigned int frames = SR_TXQ_BATCH_FRAMES, bytes = SR_TXQ_BATCH_BYTES,
+                     usec = SR_TXQ_FLUSH_USEC;
+        sscanf(batching, "%u:%u:%u", &frames, &bytes, &usec);
+        sr_txq_set_batching(sr.txq, frames, bytes, usec);
+    }
+
     if(template != NULL && strcmp(rtable, "rtable.vrhost") == 0) { /* we've recv'd the rtable now, so read it in */
         Debug("Connected to new instantiation of topology template %s\n", template);
         sr_load_rt_wrap(&sr, "rtable.vrhost");
@@ -156,11 +238,65 @@ int main(int argc, char **argv)
       sr_load_rt_wrap(&sr, rtable);
     }
 
+    /* -- one thread, one epoll set, unless asked not to or there is none -- */
+    if(use_loop && (sr.loop = sr_loop_create(&sr)) == 0)
+    { fprintf(stderr,"No event loop, falling back to the ARP cache thread\n"); }
+    if(control)
+    {
+        if(!sr.loop)
+        { fprintf(stderr,"Control socket needs the event loop, ignoring -x\n"); }
+        else if(sr_loop_listen(sr.loop, control) < 0)
+        { exit(1); }
+    }
+
+    /* -- before sr_init starts the ARP thread, so it inherits the mask -- */
+    if(!sr.loop && sr_signals_thread(&sr) != 0)
+    { exit(1); }
+
     /* call router init (for arp subsystem etc.) */
     sr_init(&sr);
 
+    /* -- seed the ARP cache so we don't have to re-learn every neighbor -- */
+    if(arp_static && sr_arpcache_load_static(&sr.cache, arp_static) < 0)
+    {
+        fprintf(stderr,"Error loading static ARP entries from %s\n",
+                arp_static);
+        exit(1);
+    }
+    if(arp_snapshot)
+    {
+        printf("Restored %d ARP entries from %s\n",
+                sr_arpcache_restore(&sr.cache, arp_snapshot), arp_snapshot);
+    }
+
+    /* -- the server sends our interfaces; other transports have them -- */
+    if((ifs = sr.transport->interfaces(&sr)) < 0 ||
+       (ifs == 1 && sr_interfaces_ready(&sr) != 0))
+    {
+        sr_destroy_instance(&sr);
+        return 1;
+    }
+
     /* -- whizbang main loop ;-) */
-    while( sr_read_from_server(&sr) == 1);
+    if(sr.loop)
+    { sr_loop_run(sr.loop); }
+    else
+    {
+        while( !__atomic_load_n(&sr_stopping, __ATOMIC_ACQUIRE) &&
+               sr.transport->recv_burst(&sr, 1) == 1);
+
+        /* -- the signal thread may have given up waiting and begun the
+              teardown itself; it exits when done -- */
+        pthread_mutex_lock(&sr_stop_lock);
+        if(sr_torn_down)
+        {
+            pthread_mutex_unlock(&sr_stop_lock);
+            pthread_exit(0);
+        }
+        sr_torn_down = 1;
+        pthread_cond_broadcast(&sr_stop_cond);
+        pthread_mutex_unlock(&sr_stop_lock);
+    }
 
     sr_destroy_instance(&sr);
 
@@ -178,11 +314,101 @@ static void usage(char* argv0)
     printf("Format: %s [-h] [-v host] [-s server] [-p port] \n",argv0);
     printf("           [-T template_name] [-u username] \n");
     printf("           [-t topo id] [-r routing table] \n");
-    printf("           [-l log file] \n");
+    printf("           [-l log file] [-g] \n");
+    printf("           [-a static arp file] [-c arp snapshot file] \n");
+    printf("           [-b batch frames[:bytes[:usec]]] \n");
+    printf("           [-E] [-x control socket] \n");
+    printf("           [-i uring|sqpoll|packet:ifname[=ip],...|xdp:ifname[=ip],...\n");
+    printf("               |shm:emulator socket\n");
+    printf("               |replay:capture,ifname=mac/ip,...[,timed][,repeat=n][,out=file]]\n");
+    printf("   -g learn from gratuitous ARP requests\n");
+    printf("   -E use the blocking read loop and ARP thread, not epoll\n");
+    printf("   -i talk to the server through io_uring (make URING=1), or\n");
+    printf("      skip the server and attach to Linux interfaces directly,\n");
+    printf("      through AF_PACKET rings or AF_XDP sockets (make XDP=1), or\n");
+    printf("      trade frames with sr_emu through shared memory, or\n");
+    printf("      replay a -l capture and compare what comes out\n");
     printf("   defaults server=%s port=%d host=%s  \n",
             DEFAULT_SERVER, DEFAULT_PORT, DEFAULT_HOST );
 } /* -- usage -- */
 
+/*-----------------------------------------------------------------------------
+ * Method: sr_signal_thread(..)
+ * Scope: local
+ *
+ * Wait for SIGINT or SIGTERM, then ask the read loop to stop and give it
+ * a moment to finish its burst and tear the router down. If it doesn't,
+ * it is blocked waiting for a frame that may never come, so do the same
+ * teardown here (saving the ARP snapshot among it) and exit.
+ *
+ *---------------------------------------------------------------------------*/
+
+static void* sr_signal_thread(void* arg)
+{
+    struct sr_instance* sr = (struct sr_instance*)arg;
+    struct timespec until;
+    sigset_t mask;
+    int sig;
+
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    if(sigwait(&mask, &sig) != 0)
+    { return 0; }
+    fprintf(stderr, "Caught signal %d, shutting down\n", sig);
+
+    clock_gettime(CLOCK_REALTIME, &until);
+    until.tv_nsec += 200 * 1000000L;
+    if(until.tv_nsec >= 1000000000L)
+    {
+        until.tv_sec++;
+        until.tv_nsec -= 1000000000L;
+    }
+
+    pthread_mutex_lock(&sr_stop_lock);
+    __atomic_store_n(&sr_stopping, 1, __ATOMIC_RELEASE);
+    while(!sr_torn_down &&
+          pthread_cond_timedwait(&sr_stop_cond, &sr_stop_lock, &until) == 0);
+    if(sr_torn_down)
+    {
+        /* -- the read loop got there first, and exits when done -- */
+        pthread_mutex_unlock(&sr_stop_lock);
+        return 0;
+    }
+    sr_torn_down = 1;
+    pthread_mutex_unlock(&sr_stop_lock);
+
+    sr_destroy_instance(sr);
+    exit(0);
+} /* -- sr_signal_thread -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_signals_thread(..)
+ * Scope: local
+ *
+ * Block SIGINT and SIGTERM and start sr_signal_thread to take them. Call
+ * before any other thread exists.
+ *
+ *---------------------------------------------------------------------------*/
+
+static int sr_signals_thread(struct sr_instance* sr)
+{
+    pthread_t thread;
+    sigset_t mask;
+
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    if(pthread_sigmask(SIG_BLOCK, &mask, 0) != 0 ||
+       pthread_create(&thread, 0, sr_signal_thread, sr) != 0)
+    {
+        perror("sr_main.c::sr_signals_thread");
+        return -1;
+    }
+    pthread_detach(thread);
+    return 0;
+} /* -- sr_signals_thread -- */
+
 /*-----------------------------------------------------------------------------
  * Method: sr_set_user(..)
  * Scope: local
@@ -225,6 +451,23 @@ static void sr_destroy_instance(struct sr_instance* sr)
         sr_dump_close(sr->logfile);
     }
 
+    if(sr->transport)
+    { sr->transport->close(sr); }
+
+    if(sr->loop)
+    {
+        sr_loop_print_stats(sr->loop, stderr);
+        sr_loop_destroy(sr->loop);
+        sr->loop = 0;
+    }
+    sr_pktbuf_print_stats(stderr);
+
+    if(sr->arp_snapshot)
+    {
+        if(sr_arpcache_save(&(sr->cache), sr->arp_snapshot) != 0)
+        { fprintf(stderr,"Error saving ARP cache to %s\n", sr->arp_snapshot); }
+    }
+
     /*
     fprintf(stderr,"sr_destroy_instance leaking memory\n");
     */
@@ -248,60 +491,16 @@ static void sr_init_instance(struct sr_instance* sr)
     sr->topo_id = 0;
     sr->if_list = 0;
     sr->routing_table = 0;
+    sr->transport = 0;
+    sr->txq = 0;
+    sr->rx = 0;
+    sr->loop = 0;
     sr->logfile = 0;
+    sr->arp_gratuitous = 0;
+    sr->arp_snapshot = 0;
+    sr->ready = 0;
 } /* -- sr_init_instance -- */
 
-/*-----------------------------------------------------------------------------
- * Method: sr_verify_routing_table()
- * Scope: Global
- *
- * make sure the routing table is consistent with the interface list by
- * verifying that all interfaces used in the routing table actually exist
- * in the hardware.
- *
- * RETURN VALUES:
- *
- *  0 on success
- *  something other than zero on error
- *
- *---------------------------------------------------------------------------*/
-
-int sr_verify_routing_table(struct sr_instance* sr)
-{
-    struct sr_rt* rt_walker = 0;
-    struct sr_if* if_walker = 0;
-    int ret = 0;
-
-    /* -- REQUIRES --*/
-    assert(sr);
-
-    if( (sr->if_list == 0) || (sr->routing_table == 0))
-    {
-        return 999; /* doh! */
-    }
-
-    rt_walker = sr->routing_table;
-
-    while(rt_walker)
-    {
-        /* -- check to see if interface exists -- */
-        if_walker = sr->if_list;
-        while(if_walker)
-        {
-            if( strncmp(if_walker->name,rt_walker->interface,sr_IFACE_NAMELEN)
-                    == 0)
-            { break; }
-            if_walker = if_walker->next;
-        }
-        if(if_walker == 0)
-        { ret++; } /* -- interface not found! -- */
-
-        rt_walker = rt_walker->next;
-    } /* -- while -- */
-
-    return ret;
-} /* -- sr_verify_routing_table -- */
-
 static void sr_load_rt_wrap(struct sr_instance* sr, char* rtable) {
     if(sr_load_rt(sr, rtable) != 0) {
         fprintf(stderr,"Error setting up routing table from file %s\n",
@@ -314,4 +513,9 @@ static void sr_load_rt_wrap(struct sr_instance* sr, char* rtable) {
     printf("---------------------------------------------\n");
     sr_print_routing_table(sr);
     printf("---------------------------------------------\n");
+
+    /* -- gateways from a table loaded after start-up need resolving too;
+          before that sr_interfaces_ready primes the lot -- */
+    if(sr->ready)
+    { sr_arpcache_prime(sr); }
 }
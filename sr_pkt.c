@@ -0,0 +1,148 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_pkt.c
+ *
+ * Description:
+ *
+ * Parsing a received frame into its descriptor; see sr_pkt.h.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <string.h>
+#include <assert.h>
+
+#include "sr_pkt.h"
+#include "sr_if.h"
+#include "sr_router.h"
+#include "sr_utils.h"
+
+/*---------------------------------------------------------------------
+ * Method: pkt_parse_ip(..)
+ * Scope:  Local
+ *
+ *---------------------------------------------------------------------*/
+
+static void pkt_parse_ip(struct sr_instance* sr, struct sr_pkt* pkt)
+{
+    sr_ip_hdr_t* ip;
+    struct sr_if* walker;
+    unsigned int hl;
+
+    if(pkt->len < pkt->l3_off + sizeof(sr_ip_hdr_t))
+    {
+        pkt->flags |= SR_PKT_TRUNCATED;
+        return;
+    }
+    ip = sr_pkt_ip(pkt);
+    hl = ip->ip_hl * 4;
+    if(hl < sizeof(sr_ip_hdr_t) || ntohs(ip->ip_len) < hl ||
+       pkt->len < pkt->l3_off + ntohs(ip->ip_len))
+    {
+        pkt->flags |= SR_PKT_TRUNCATED;
+        return;
+    }
+
+    pkt->flags |= SR_PKT_IP;
+    pkt->l4_off = pkt->l3_off + hl;
+    pkt->proto = ip->ip_p;
+    pkt->src = ip->ip_src;
+    pkt->dst = ip->ip_dst;
+    if(cksum(ip, hl) == 0xffff)
+    { pkt->flags |= SR_PKT_CKSUM_OK; }
+
+    for(walker = sr->if_list; walker; walker = walker->next)
+    {
+        if(walker->ip == pkt->dst)
+        {
+            pkt->flags |= SR_PKT_LOCAL;
+            break;
+        }
+    }
+
+    if(pkt->proto == ip_protocol_icmp &&
+       pkt->len >= pkt->l4_off + sizeof(sr_icmp_hdr_t))
+    {
+        sr_icmp_hdr_t* icmp = (sr_icmp_hdr_t*)sr_pkt_l4(pkt);
+        if(icmp->icmp_type == 8 && icmp->icmp_code == 0)
+        { pkt->flags |= SR_PKT_ICMP_ECHO; }
+    }
+} /* -- pkt_parse_ip -- */
+
+/*---------------------------------------------------------------------
+ * Method: pkt_parse_arp(..)
+ * Scope:  Local
+ *
+ *---------------------------------------------------------------------*/
+
+static void pkt_parse_arp(struct sr_pkt* pkt)
+{
+    sr_arp_hdr_t* arp;
+
+    if(pkt->len < pkt->l3_off + sizeof(sr_arp_hdr_t))
+    {
+        pkt->flags |= SR_PKT_TRUNCATED;
+        return;
+    }
+    arp = sr_pkt_arp(pkt);
+
+    pkt->flags |= SR_PKT_ARP;
+    pkt->src = arp->ar_sip;
+    pkt->dst = arp->ar_tip;
+    if(ntohs(arp->ar_op) == arp_op_request)
+    { pkt->flags |= SR_PKT_ARP_REQUEST; }
+    else if(ntohs(arp->ar_op) == arp_op_reply)
+    { pkt->flags |= SR_PKT_ARP_REPLY; }
+} /* -- pkt_parse_arp -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_pkt_parse_if(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_pkt_parse_if(struct sr_instance* sr, struct sr_pkt* pkt, uint8_t* frame,
+                     unsigned int len, struct sr_if* in)
+{
+    /* REQUIRES */
+    assert(sr);
+    assert(pkt);
+    assert(frame);
+    assert(in);
+
+    memset(pkt, 0, sizeof(*pkt));
+    pkt->frame = frame;
+    pkt->len = len;
+    pkt->in = in;
+
+    if(len < sizeof(sr_ethernet_hdr_t))
+    {
+        pkt->flags |= SR_PKT_TRUNCATED;
+        return;
+    }
+    pkt->ethertype = ethertype(frame);
+    pkt->l3_off = sizeof(sr_ethernet_hdr_t);
+
+    if(pkt->ethertype == ethertype_ip)
+    { pkt_parse_ip(sr, pkt); }
+    else if(pkt->ethertype == ethertype_arp)
+    { pkt_parse_arp(pkt); }
+} /* -- sr_pkt_parse_if -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_pkt_parse(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_pkt_parse(struct sr_instance* sr, struct sr_pkt* pkt, uint8_t* frame,
+                 unsigned int len, char* iface)
+{
+    struct sr_if* in;
+
+    /* REQUIRES */
+    assert(iface);
+
+    if((in = sr_get_interface(sr, iface)) == 0)
+    { return -1; }
+    sr_pkt_parse_if(sr, pkt, frame, len, in);
+    return 0;
+} /* -- sr_pkt_parse -- */
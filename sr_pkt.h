@@ -0,0 +1,74 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_pkt.h
+ *
+ * Description:
+ *
+ * What the router needs to know about a received frame, worked out once.
+ *
+ * sr_handlepacket parses the frame into a struct sr_pkt as soon as it
+ * arrives: the interface it came in on (looked up by name once), where the
+ * IP or ARP header and the IP payload start, the addresses and protocol,
+ * and flags for the questions every later stage asks (is the IP checksum
+ * good, is it for one of our addresses, is it an echo request). The
+ * handlers for forwarding, ICMP and ARP take the descriptor instead of
+ * going back to the raw bytes. The descriptor only points into the frame,
+ * which stays the transport's; it lives on the stack for one call.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_PKT_H
+#define SR_PKT_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+#include "sr_protocol.h"
+
+struct sr_instance;
+struct sr_if;
+
+#define SR_PKT_IP           0x0001  /* IPv4, and long enough for its header */
+#define SR_PKT_ARP          0x0002  /* ARP, and long enough for its header */
+#define SR_PKT_CKSUM_OK     0x0004  /* IP header checksum is good */
+#define SR_PKT_LOCAL        0x0008  /* IP to one of our addresses */
+#define SR_PKT_ICMP_ECHO    0x0010  /* ICMP echo request */
+#define SR_PKT_ARP_REQUEST  0x0020
+#define SR_PKT_ARP_REPLY    0x0040
+#define SR_PKT_TRUNCATED    0x0080  /* shorter than its headers say */
+
+struct sr_pkt
+{
+    uint8_t* frame;             /* lent by the transport */
+    unsigned int len;
+    struct sr_if* in;           /* interface it came in on */
+    uint16_t ethertype;         /* host order */
+    uint16_t l3_off;            /* IP or ARP header */
+    uint16_t l4_off;            /* past the IP header and options; 0 if not IP */
+    uint8_t proto;              /* IP protocol */
+    uint32_t src;               /* IP source, or ARP sender; network order */
+    uint32_t dst;               /* IP destination, or ARP target */
+    unsigned int flags;         /* SR_PKT_* */
+};
+
+#define sr_pkt_eth(p)   ((sr_ethernet_hdr_t*)(p)->frame)
+#define sr_pkt_ip(p)    ((sr_ip_hdr_t*)((p)->frame + (p)->l3_off))
+#define sr_pkt_arp(p)   ((sr_arp_hdr_t*)((p)->frame + (p)->l3_off))
+#define sr_pkt_l4(p)    ((p)->frame + (p)->l4_off)
+
+/* Fill in pkt for the frame received on iface. Returns 0, or -1 if iface is
+   not one of ours; a frame too short for the headers it claims is flagged
+   SR_PKT_TRUNCATED rather than refused, so the caller can say so. */
+int sr_pkt_parse(struct sr_instance* sr, struct sr_pkt* pkt, uint8_t* frame,
+                 unsigned int len, char* iface);
+
+/* The same for a frame whose interface is already known, such as one held
+   in the ARP queue; nothing is looked up by name. */
+void sr_pkt_parse_if(struct sr_instance* sr, struct sr_pkt* pkt, uint8_t* frame,
+                     unsigned int len, struct sr_if* in);
+
+#endif /* -- SR_PKT_H -- */
@@ -0,0 +1,228 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_pktbuf.c
+ *
+ * Description:
+ *
+ * Per-thread pools of packet buffers with headroom; see sr_pktbuf.h.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+
+#include "sr_pktbuf.h"
+
+/* One thread's buffers. Only that thread touches free_list or the counts,
+   so they need no lock; the stats are read racily by whoever prints them. */
+struct sr_pktbuf_pool
+{
+    struct sr_pktbuf* free_list;
+    unsigned int nfree;
+    struct sr_pktbuf_stats stats;
+    struct sr_pktbuf_pool* next;    /* all of them, for the stats */
+};
+
+static __thread struct sr_pktbuf_pool* pool;
+
+static pthread_mutex_t pools_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct sr_pktbuf_pool* pools;
+
+/* Buffers one thread frees and another allocates (a frame queued for ARP
+   that the ARP thread gives up on, say) would pile up in the freeing
+   thread's pool, and the other would keep growing its own. Past
+   SR_PKTBUF_POOL_MAX free, a pool hands a batch to the depot, and an empty
+   pool looks there before it mallocs. Both under pools_lock. */
+#define SR_PKTBUF_POOL_MAX  (4 * SR_PKTBUF_BATCH)
+static struct sr_pktbuf* depot;
+
+/*---------------------------------------------------------------------
+ * Method: pktbuf_pool(..)
+ * Scope:  Local
+ *
+ * The calling thread's pool, made the first time it is wanted. It is
+ * never freed, as threads here live as long as the router does.
+ *
+ *---------------------------------------------------------------------*/
+
+static struct sr_pktbuf_pool* pktbuf_pool(void)
+{
+    if(pool)
+    { return pool; }
+
+    if((pool = (struct sr_pktbuf_pool*)calloc(1, sizeof(*pool))) == 0)
+    { return 0; }
+    pthread_mutex_lock(&pools_lock);
+    pool->next = pools;
+    pools = pool;
+    pthread_mutex_unlock(&pools_lock);
+    return pool;
+} /* -- pktbuf_pool -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_pktbuf_alloc(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+struct sr_pktbuf* sr_pktbuf_alloc(unsigned int len)
+{
+    struct sr_pktbuf_pool* p = pktbuf_pool();
+    struct sr_pktbuf* pb;
+    int i;
+
+    if(p == 0)
+    { return 0; }
+    if(len > SR_PKTBUF_DATA)
+    {
+        p->stats.too_big++;
+        return 0;
+    }
+
+    /* -- depot is shared, so even looking at it takes the lock; an empty
+          pool is rare once the router is warm -- */
+    if(p->free_list == 0)
+    {
+        pthread_mutex_lock(&pools_lock);
+        for(i = 0; i < SR_PKTBUF_BATCH && depot; i++, p->nfree++)
+        {
+            pb = depot;
+            depot = pb->next;
+            pb->next = p->free_list;
+            p->free_list = pb;
+        }
+        pthread_mutex_unlock(&pools_lock);
+    }
+
+    if(p->free_list == 0)
+    {
+        pb = (struct sr_pktbuf*)malloc(SR_PKTBUF_BATCH * sizeof(*pb));
+        if(pb == 0)
+        { return 0; }
+        for(i = 0; i < SR_PKTBUF_BATCH; i++)
+        {
+            pb[i].next = p->free_list;
+            p->free_list = &pb[i];
+        }
+        p->nfree += SR_PKTBUF_BATCH;
+        p->stats.grows++;
+        p->stats.buffers += SR_PKTBUF_BATCH;
+    }
+
+    pb = p->free_list;
+    p->free_list = pb->next;
+    p->nfree--;
+    pb->next = 0;
+    pb->data = pb->room + SR_PKTBUF_HEADROOM;
+    pb->len = len;
+    memset(pb->data, 0, len);
+    p->stats.allocs++;
+    return pb;
+} /* -- sr_pktbuf_alloc -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_pktbuf_free(..)
+ * Scope:  Global
+ *
+ * Onto the calling thread's pool, which need not be where pb came from.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_pktbuf_free(struct sr_pktbuf* pb)
+{
+    struct sr_pktbuf_pool* p;
+    int i;
+
+    if(pb == 0)
+    { return; }
+
+    /* -- can't fail: a thread that has a buffer to free has a pool, or
+          the allocation that made one would have come first -- */
+    if((p = pktbuf_pool()) == 0)
+    { return; }
+    pb->next = p->free_list;
+    p->free_list = pb;
+    p->nfree++;
+    p->stats.frees++;
+
+    if(p->nfree > SR_PKTBUF_POOL_MAX)
+    {
+        pthread_mutex_lock(&pools_lock);
+        for(i = 0; i < SR_PKTBUF_BATCH; i++, p->nfree--)
+        {
+            pb = p->free_list;
+            p->free_list = pb->next;
+            pb->next = depot;
+            depot = pb;
+        }
+        pthread_mutex_unlock(&pools_lock);
+    }
+} /* -- sr_pktbuf_free -- */
+
+uint8_t* sr_pktbuf_push(struct sr_pktbuf* pb, unsigned int n)
+{
+    /* REQUIRES */
+    assert(pb->data - pb->room >= n);
+
+    pb->data -= n;
+    pb->len += n;
+    memset(pb->data, 0, n);
+    return pb->data;
+} /* -- sr_pktbuf_push -- */
+
+uint8_t* sr_pktbuf_put(struct sr_pktbuf* pb, unsigned int n)
+{
+    uint8_t* tail = pb->data + pb->len;
+
+    /* REQUIRES */
+    assert(tail + n <= pb->room + sizeof(pb->room));
+
+    pb->len += n;
+    memset(tail, 0, n);
+    return tail;
+} /* -- sr_pktbuf_put -- */
+
+uint8_t* sr_pktbuf_pull(struct sr_pktbuf* pb, unsigned int n)
+{
+    /* REQUIRES */
+    assert(n <= pb->len);
+
+    pb->data += n;
+    pb->len -= n;
+    return pb->data;
+} /* -- sr_pktbuf_pull -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_pktbuf_get_stats(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_pktbuf_get_stats(struct sr_pktbuf_stats* stats)
+{
+    struct sr_pktbuf_pool* p;
+
+    memset(stats, 0, sizeof(*stats));
+    pthread_mutex_lock(&pools_lock);
+    for(p = pools; p; p = p->next)
+    {
+        stats->allocs += p->stats.allocs;
+        stats->frees += p->stats.frees;
+        stats->grows += p->stats.grows;
+        stats->buffers += p->stats.buffers;
+        stats->too_big += p->stats.too_big;
+        stats->pools++;
+    }
+    pthread_mutex_unlock(&pools_lock);
+} /* -- sr_pktbuf_get_stats -- */
+
+void sr_pktbuf_print_stats(FILE* fp)
+{
+    struct sr_pktbuf_stats st;
+
+    sr_pktbuf_get_stats(&st);
+    fprintf(fp, "pktbuf: %lu allocs, %lu frees, %lu buffers for %lu threads "
+            "from %lu mallocs, %lu too big\n", st.allocs, st.frees,
+            st.buffers, st.pools, st.grows, st.too_big);
+} /* -- sr_pktbuf_print_stats -- */
@@ -0,0 +1,74 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_pktbuf.h
+ *
+ * Description:
+ *
+ * Buffers for the frames the router makes itself (ICMP messages, ARP
+ * requests and replies) and for copies of frames it has to keep.
+ *
+ * A buffer has room before the frame and after it, so headers can be
+ * pushed on in front (sr_pktbuf_push) and data put on the end
+ * (sr_pktbuf_put) without copying: an ICMP error is built from the ICMP
+ * header out. Buffers come from a pool belonging to the calling thread and
+ * go back to the pool of whichever thread frees them, so neither takes a
+ * lock. A pool only grows, a batch of buffers at a time, and never gives
+ * memory back; once the pools have grown to the router's working set a
+ * packet costs no malloc or free, which the counters show (grows stays
+ * put while allocs and frees climb).
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_PKTBUF_H
+#define SR_PKTBUF_H
+
+#include <stdio.h>
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+#define SR_PKTBUF_HEADROOM  64      /* before the frame */
+#define SR_PKTBUF_DATA      1536    /* the largest frame alloc hands out */
+#define SR_PKTBUF_TAILROOM  64      /* after it */
+#define SR_PKTBUF_BATCH     16      /* buffers a pool grows by */
+
+struct sr_pktbuf
+{
+    struct sr_pktbuf* next;     /* free list */
+    uint8_t* data;              /* the frame */
+    unsigned int len;
+    uint8_t room[SR_PKTBUF_HEADROOM + SR_PKTBUF_DATA + SR_PKTBUF_TAILROOM];
+};
+
+struct sr_pktbuf_stats
+{
+    unsigned long allocs;
+    unsigned long frees;
+    unsigned long grows;        /* mallocs to grow a pool */
+    unsigned long buffers;      /* in all the pools, free or not */
+    unsigned long too_big;      /* allocs refused */
+    unsigned long pools;        /* threads that have used one */
+};
+
+/* A buffer holding len zeroed bytes, after SR_PKTBUF_HEADROOM. Returns 0 if
+   len is over SR_PKTBUF_DATA or memory has run out. */
+struct sr_pktbuf* sr_pktbuf_alloc(unsigned int len);
+void sr_pktbuf_free(struct sr_pktbuf* pb);
+
+/* Grow the frame by n zeroed bytes at the front or the back, returning
+   where they start. The room has to be there. */
+uint8_t* sr_pktbuf_push(struct sr_pktbuf* pb, unsigned int n);
+uint8_t* sr_pktbuf_put(struct sr_pktbuf* pb, unsigned int n);
+
+/* Take n bytes off the front, returning the new start. */
+uint8_t* sr_pktbuf_pull(struct sr_pktbuf* pb, unsigned int n);
+
+/* Totals over every thread's pool. */
+void sr_pktbuf_get_stats(struct sr_pktbuf_stats* stats);
+void sr_pktbuf_print_stats(FILE* fp);
+
+#endif /* -- SR_PKTBUF_H -- */
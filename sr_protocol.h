@@ -152,6 +152,7 @@ typedef struct sr_ethernet_hdr sr_ethernet_hdr_t;
 
 enum sr_ip_protocol {
   ip_protocol_icmp = 0x0001,
+  ip_protocol_udp = 0x0011,
 };
 
 enum sr_ethertype {
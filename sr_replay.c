@@ -0,0 +1,740 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_replay.c
+ *
+ * Description:
+ *
+ * Pcap replay transport; see sr_replay.h.
+ *
+ * The whole capture is read into memory up front and every frame in it
+ * classified once, so a replay pass is only a copy into scratch (the
+ * router rewrites frames in place) and the call to sr_handlepacket. Under
+ * the event loop a timerfd paces the bursts: armed to fire at once, or at
+ * the next frame's recorded time with timed.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef _LINUX_
+#include <sys/timerfd.h>
+#endif /* _LINUX_ */
+
+#include "sr_replay.h"
+#include "sr_router.h"
+#include "sr_if.h"
+#include "sr_loop.h"
+#include "sr_dumper.h"
+#include "sr_transport.h"
+
+#define PCAP_NSEC_MAGIC 0xa1b23c4d
+
+static uint64_t replay_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+} /* -- replay_now_ns -- */
+
+static uint32_t replay_swap32(uint32_t v, int swap)
+{
+    return swap ? __builtin_bswap32(v) : v;
+} /* -- replay_swap32 -- */
+
+/* FNV-1a over what the log would have kept of the frame */
+static uint64_t replay_hash(const uint8_t* buf, unsigned int len)
+{
+    uint64_t h = 14695981039346656037ULL;
+    unsigned int i;
+
+    if(len > PACKET_DUMP_SIZE)
+    { len = PACKET_DUMP_SIZE; }
+    for(i = 0; i < len; i++)
+    {
+        h ^= buf[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+} /* -- replay_hash -- */
+
+/*---------------------------------------------------------------------
+ * Method: replay_port_of(..)
+ * Scope:  Local
+ *
+ * Which interface a captured frame came in on: -1 if the router sent it,
+ * -2 if it has nothing to do with the router.
+ *
+ *---------------------------------------------------------------------*/
+
+static int replay_port_of(struct sr_replay* replay, const uint8_t* buf,
+        unsigned int len)
+{
+    const sr_ethernet_hdr_t* eth = (const sr_ethernet_hdr_t*)buf;
+    const sr_arp_hdr_t* arp = (const sr_arp_hdr_t*)(eth + 1);
+    static const unsigned char bcast[ETHER_ADDR_LEN] =
+        { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff };
+    int i;
+
+    if(len < sizeof(sr_ethernet_hdr_t))
+    { return -2; }
+
+    for(i = 0; i < replay->nports; i++)
+    {
+        if(memcmp(eth->ether_shost, replay->ports[i].addr, ETHER_ADDR_LEN) == 0)
+        { return -1; }
+    }
+    for(i = 0; i < replay->nports; i++)
+    {
+        if(memcmp(eth->ether_dhost, replay->ports[i].addr, ETHER_ADDR_LEN) == 0)
+        { return i; }
+    }
+
+    if(memcmp(eth->ether_dhost, bcast, ETHER_ADDR_LEN) == 0 &&
+       ntohs(eth->ether_type) == ethertype_arp &&
+       len >= sizeof(sr_ethernet_hdr_t) + sizeof(sr_arp_hdr_t))
+    {
+        for(i = 0; i < replay->nports; i++)
+        {
+            if(arp->ar_tip == replay->ports[i].ip)
+            { return i; }
+        }
+    }
+    return -2;
+} /* -- replay_port_of -- */
+
+/*---------------------------------------------------------------------
+ * Method: replay_load(..)
+ * Scope:  Local
+ *
+ * Read the capture into memory and index its frames. Returns -1 if it
+ * isn't an ethernet pcap.
+ *
+ *---------------------------------------------------------------------*/
+
+static int replay_load(struct sr_replay* replay, const char* path)
+{
+    struct pcap_file_header fh;
+    struct pcap_sf_pkthdr ph;
+    struct sr_replay_frame* f;
+    unsigned long cap = 0;
+    unsigned int maxlen = 0;
+    size_t off, size;
+    long sz;
+    FILE* fp;
+    int swap = 0, nsec = 0, port;
+
+    if((fp = fopen(path, "rb")) == 0)
+    {
+        perror("fopen(..):sr_replay.c::replay_load");
+        return -1;
+    }
+    fseek(fp, 0, SEEK_END);
+    sz = ftell(fp);
+    rewind(fp);
+    if(sz < (long)sizeof(fh))
+    {
+        fprintf(stderr, "Error: %s is too short to be a pcap\n", path);
+        fclose(fp);
+        return -1;
+    }
+    size = (size_t)sz;
+    replay->image = (uint8_t*)malloc(size);
+    assert(replay->image);
+    if(fread(replay->image, 1, size, fp) != size)
+    {
+        perror("fread(..):sr_replay.c::replay_load");
+        fclose(fp);
+        return -1;
+    }
+    fclose(fp);
+
+    memcpy(&fh, replay->image, sizeof(fh));
+    switch(fh.magic)
+    {
+        case TCPDUMP_MAGIC: break;
+        case PCAP_NSEC_MAGIC: nsec = 1; break;
+        default:
+            swap = 1;
+            if(__builtin_bswap32(fh.magic) == PCAP_NSEC_MAGIC)
+            { nsec = 1; }
+            else if(__builtin_bswap32(fh.magic) != TCPDUMP_MAGIC)
+            {
+                fprintf(stderr, "Error: %s is not a pcap\n", path);
+                return -1;
+            }
+    }
+    if(replay_swap32(fh.linktype, swap) != LINKTYPE_ETHERNET)
+    {
+        fprintf(stderr, "Error: %s is not an ethernet capture\n", path);
+        return -1;
+    }
+
+    for(off = sizeof(fh); off + sizeof(ph) <= size; off += ph.caplen)
+    {
+        memcpy(&ph, replay->image + off, sizeof(ph));
+        off += sizeof(ph);
+        ph.caplen = replay_swap32(ph.caplen, swap);
+        if(ph.caplen > size - off)
+        {
+            fprintf(stderr, "Warning: %s is cut short\n", path);
+            break;
+        }
+
+        port = replay_port_of(replay, replay->image + off, ph.caplen);
+        if(port == -2)
+        {
+            replay->stats.skipped++;
+            continue;
+        }
+        if(port == -1)
+        { replay->stats.outputs++; }
+        else
+        { replay->stats.inputs++; }
+
+        if(replay->nframes == cap)
+        {
+            cap = cap ? cap * 2 : 1024;
+            replay->frames = (struct sr_replay_frame*)realloc(replay->frames,
+                    cap * sizeof(struct sr_replay_frame));
+            assert(replay->frames);
+        }
+        f = &replay->frames[replay->nframes++];
+        f->buf = replay->image + off;
+        f->len = ph.caplen;
+        f->port = port;
+        f->ts_ns = (uint64_t)replay_swap32(ph.ts.tv_sec, swap) * 1000000000ULL +
+            (uint64_t)replay_swap32(ph.ts.tv_usec, swap) * (nsec ? 1 : 1000);
+        if(f->len > maxlen)
+        { maxlen = f->len; }
+    }
+
+    if(replay->stats.inputs == 0)
+    {
+        fprintf(stderr, "Error: nothing in %s is addressed to the router's "
+                "interfaces\n", path);
+        return -1;
+    }
+    replay->scratch = (uint8_t*)malloc(maxlen);
+    assert(replay->scratch);
+    return 0;
+} /* -- replay_load -- */
+
+/*---------------------------------------------------------------------
+ * Method: replay_add_port(..)
+ * Scope:  Local
+ *
+ * One name=mac/ip from the spec.
+ *
+ *---------------------------------------------------------------------*/
+
+static int replay_add_port(struct sr_replay* replay, char* arg)
+{
+    struct sr_replay_port* port;
+    unsigned int m[ETHER_ADDR_LEN];
+    struct in_addr addr;
+    char* eq = strchr(arg, '=');
+    char* slash = eq ? strchr(eq, '/') : 0;
+    int i;
+
+    if(!slash || replay->nports == SR_REPLAY_PORTS_MAX)
+    { return -1; }
+    *eq = *slash = 0;
+    if(sscanf(eq + 1, "%x:%x:%x:%x:%x:%x", &m[0], &m[1], &m[2], &m[3],
+              &m[4], &m[5]) != 6 || inet_aton(slash + 1, &addr) == 0)
+    { return -1; }
+
+    port = &replay->ports[replay->nports++];
+    strncpy(port->name, arg, sr_IFACE_NAMELEN - 1);
+    for(i = 0; i < ETHER_ADDR_LEN; i++)
+    { port->addr[i] = (unsigned char)m[i]; }
+    port->ip = addr.s_addr;
+    return 0;
+} /* -- replay_add_port -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_replay_open(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+struct sr_replay* sr_replay_open(struct sr_instance* sr, const char* spec)
+{
+    struct sr_replay* replay;
+    char* list;
+    char* path;
+    char* arg;
+    char* save = 0;
+    int i;
+
+    /* REQUIRES */
+    assert(sr);
+    assert(spec);
+
+    replay = (struct sr_replay*)calloc(1, sizeof(struct sr_replay));
+    assert(replay);
+    replay->sr = sr;
+    replay->repeat = 1;
+    replay->timerfd = -1;
+    pthread_mutex_init(&replay->tx_lock, 0);
+
+    list = strdup(spec);
+    path = strtok_r(list, ",", &save);
+    for(arg = strtok_r(0, ",", &save); arg; arg = strtok_r(0, ",", &save))
+    {
+        if(strcmp(arg, "timed") == 0)
+        { replay->timed = 1; }
+        else if(strncmp(arg, "repeat=", 7) == 0 && atoi(arg + 7) > 0)
+        { replay->repeat = atoi(arg + 7); }
+        else if(strncmp(arg, "out=", 4) == 0)
+        { replay->out_path = strdup(arg + 4); }
+        else if(replay_add_port(replay, arg) < 0)
+        {
+            fprintf(stderr, "Error: can't make sense of %s; interfaces are "
+                    "name=mac/ip\n", arg);
+            break;
+        }
+    }
+
+    if(!path || arg || replay->nports == 0 || replay_load(replay, path) < 0)
+    {
+        if(path && !arg && replay->nports == 0)
+        { fprintf(stderr, "Error: the replay needs the router's interfaces\n"); }
+        free(list);
+        sr_replay_close(replay);
+        return 0;
+    }
+    free(list);
+
+    replay->latency_ns = (uint32_t*)malloc(replay->stats.inputs *
+            replay->repeat * sizeof(uint32_t));
+    assert(replay->latency_ns);
+
+    /* -- as sr_handle_hwinfo does for interfaces the server tells us of -- */
+    for(i = 0; i < replay->nports; i++)
+    {
+        sr_add_interface(sr, replay->ports[i].name);
+        sr_set_ether_addr(sr, replay->ports[i].addr);
+        sr_set_ether_ip(sr, replay->ports[i].ip);
+    }
+    printf("Replaying %lu frames, %lu times%s\n", replay->stats.inputs,
+           (unsigned long)replay->repeat, replay->timed ? " at recorded pace" : "");
+    printf("Router interfaces:\n");
+    sr_print_if_list(sr);
+
+    return replay;
+} /* -- sr_replay_open -- */
+
+/*---------------------------------------------------------------------
+ * Method: replay_write_out(..)
+ * Scope:  Local
+ *
+ *---------------------------------------------------------------------*/
+
+static void replay_write_out(struct sr_replay* replay)
+{
+    struct pcap_pkthdr h;
+    FILE* fp;
+    unsigned long i;
+
+    if((fp = sr_dump_open(replay->out_path, 0, PACKET_DUMP_SIZE)) == 0)
+    { return; }
+    memset(&h, 0, sizeof(h));
+    for(i = 0; i < replay->ntx; i++)
+    {
+        h.caplen = h.len = replay->tx[i].len;
+        sr_dump(fp, &h, replay->arena + replay->tx[i].off);
+    }
+    sr_dump_close(fp);
+} /* -- replay_write_out -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_replay_close(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_replay_close(struct sr_replay* replay)
+{
+    if(!replay)
+    { return; }
+
+    if(replay->out_path && replay->ntx)
+    { replay_write_out(replay); }
+    if(replay->timerfd >= 0)
+    { close(replay->timerfd); }
+    pthread_mutex_destroy(&replay->tx_lock);
+    free(replay->out_path);
+    free(replay->image);
+    free(replay->frames);
+    free(replay->scratch);
+    free(replay->latency_ns);
+    free(replay->tx);
+    free(replay->arena);
+    free(replay);
+} /* -- sr_replay_close -- */
+
+/*---------------------------------------------------------------------
+ * Method: replay_due(..)
+ * Scope:  Local
+ *
+ * When the next input frame is due, on replay_now_ns's clock: its offset
+ * into the capture from the start of this pass. 0 if it is due now.
+ *
+ *---------------------------------------------------------------------*/
+
+static uint64_t replay_due(struct sr_replay* replay)
+{
+    unsigned long i;
+
+    if(!replay->timed || replay->pass_ns == 0)
+    { return 0; }
+    for(i = replay->next; i < replay->nframes; i++)
+    {
+        if(replay->frames[i].port >= 0)
+        {
+            return replay->pass_ns + replay->frames[i].ts_ns -
+                replay->frames[0].ts_ns;
+        }
+    }
+    return 0;
+} /* -- replay_due -- */
+
+/*---------------------------------------------------------------------
+ * Method: replay_burst(..)
+ * Scope:  Local
+ *
+ * Hand the router up to SR_REPLAY_BURST frames that are due. Returns 0
+ * once the last pass is over.
+ *
+ *---------------------------------------------------------------------*/
+
+static int replay_burst(struct sr_replay* replay)
+{
+    struct sr_replay_frame* f;
+    uint64_t t0, t1;
+    int n = 0;
+
+    if(replay->pass == replay->repeat)
+    { return 0; }
+    if(replay->pass_ns == 0)
+    { replay->stats.start_ns = replay->pass_ns = replay_now_ns(); }
+
+    while(n < SR_REPLAY_BURST)
+    {
+        if(replay->next == replay->nframes)
+        {
+            if(++replay->pass == replay->repeat)
+            {
+                replay->stats.end_ns = replay_now_ns();
+                return 0;
+            }
+            replay->next = 0;
+            replay->pass_ns = replay_now_ns();
+            continue;
+        }
+
+        f = &replay->frames[replay->next];
+        if(f->port < 0)
+        {
+            replay->next++;
+            continue;
+        }
+        if(replay->timed && replay_due(replay) > replay_now_ns())
+        { break; }
+
+        memcpy(replay->scratch, f->buf, f->len);
+        t0 = replay_now_ns();
+        sr_handlepacket(replay->sr, replay->scratch, f->len,
+                        replay->ports[f->port].name);
+        t1 = replay_now_ns();
+        replay->latency_ns[replay->stats.replayed++] =
+            t1 - t0 > 0xffffffffULL ? 0xffffffff : (uint32_t)(t1 - t0);
+        replay->stats.busy_ns += t1 - t0;
+        replay->next++;
+        n++;
+    }
+    return 1;
+} /* -- replay_burst -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_replay_watch(..), sr_replay_poll(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+#ifdef _LINUX_
+
+static void replay_arm(struct sr_replay* replay)
+{
+    struct itimerspec its;
+    uint64_t due = replay_due(replay);
+
+    memset(&its, 0, sizeof(its));
+    if(due)
+    {
+        its.it_value.tv_sec = due / 1000000000ULL;
+        its.it_value.tv_nsec = due % 1000000000ULL;
+        timerfd_settime(replay->timerfd, TFD_TIMER_ABSTIME, &its, 0);
+    }
+    else
+    {
+        its.it_value.tv_nsec = 1;
+        timerfd_settime(replay->timerfd, 0, &its, 0);
+    }
+} /* -- replay_arm -- */
+
+static void replay_ready(struct sr_loop* loop, int fd, void* arg)
+{
+    struct sr_replay* replay = (struct sr_replay*)arg;
+    uint64_t expirations;
+
+    if(read(fd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN)
+    { perror("read(..):sr_replay.c::replay_ready"); }
+
+    if(replay_burst(replay))
+    { replay_arm(replay); }
+    else
+    { sr_loop_stop(loop); }
+} /* -- replay_ready -- */
+
+int sr_replay_watch(struct sr_replay* replay, struct sr_loop* loop)
+{
+    replay->timerfd = timerfd_create(CLOCK_MONOTONIC,
+                                     TFD_NONBLOCK | TFD_CLOEXEC);
+    if(replay->timerfd < 0)
+    {
+        perror("timerfd_create(..):sr_replay.c::sr_replay_watch");
+        return -1;
+    }
+    replay_arm(replay);
+    return sr_loop_add_fd(loop, replay->timerfd, replay_ready, replay);
+} /* -- sr_replay_watch -- */
+
+#else /* -- no timerfd -- */
+
+int sr_replay_watch(struct sr_replay* replay, struct sr_loop* loop)
+{ return -1; }
+
+#endif /* _LINUX_ */
+
+int sr_replay_poll(struct sr_replay* replay)
+{
+    struct timespec ts;
+    uint64_t due = replay_due(replay);
+
+    if(due)
+    {
+        ts.tv_sec = due / 1000000000ULL;
+        ts.tv_nsec = due % 1000000000ULL;
+        while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, 0) == EINTR)
+        { }
+    }
+    return replay_burst(replay);
+} /* -- sr_replay_poll -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_replay_send(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_replay_send(struct sr_replay* replay, const struct sr_frame* frames,
+        int n)
+{
+    struct sr_replay_tx* tx;
+    int i;
+
+    pthread_mutex_lock(&replay->tx_lock);
+    for(i = 0; i < n; i++)
+    {
+        replay->stats.sent++;
+        replay->stats.sent_bytes += frames[i].len;
+        if(replay->pass > 0)
+        { continue; }
+
+        if(replay->ntx == replay->tx_cap)
+        {
+            replay->tx_cap = replay->tx_cap ? replay->tx_cap * 2 : 1024;
+            replay->tx = (struct sr_replay_tx*)realloc(replay->tx,
+                    replay->tx_cap * sizeof(struct sr_replay_tx));
+            assert(replay->tx);
+        }
+        while(replay->arena_len + frames[i].len > replay->arena_cap)
+        {
+            replay->arena_cap = replay->arena_cap ? replay->arena_cap * 2 :
+                (1 << 20);
+            replay->arena = (uint8_t*)realloc(replay->arena,
+                                              replay->arena_cap);
+            assert(replay->arena);
+        }
+        tx = &replay->tx[replay->ntx++];
+        tx->hash = replay_hash(frames[i].buf, frames[i].len);
+        tx->off = replay->arena_len;
+        tx->len = frames[i].len;
+        memcpy(replay->arena + replay->arena_len, frames[i].buf,
+               frames[i].len);
+        replay->arena_len += frames[i].len;
+    }
+    pthread_mutex_unlock(&replay->tx_lock);
+    return n;
+} /* -- sr_replay_send -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_replay_print_stats(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+static int replay_cmp32(const void* a, const void* b)
+{
+    uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+    return x < y ? -1 : x > y;
+} /* -- replay_cmp32 -- */
+
+static int replay_cmp64(const void* a, const void* b)
+{
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return x < y ? -1 : x > y;
+} /* -- replay_cmp64 -- */
+
+/* Compare the first pass's transmits with the recorded ones. */
+static void replay_compare(struct sr_replay* replay, FILE* fp)
+{
+    uint64_t* want;
+    uint64_t* got;
+    unsigned long i, j, nwant = 0, matched = 0;
+
+    want = (uint64_t*)malloc((replay->stats.outputs + 1) * sizeof(uint64_t));
+    got = (uint64_t*)malloc((replay->ntx + 1) * sizeof(uint64_t));
+    assert(want && got);
+    for(i = 0; i < replay->nframes; i++)
+    {
+        if(replay->frames[i].port == -1)
+        {
+            want[nwant++] = replay_hash(replay->frames[i].buf,
+                                        replay->frames[i].len);
+        }
+    }
+    for(i = 0; i < replay->ntx; i++)
+    { got[i] = replay->tx[i].hash; }
+    qsort(want, nwant, sizeof(uint64_t), replay_cmp64);
+    qsort(got, replay->ntx, sizeof(uint64_t), replay_cmp64);
+
+    for(i = j = 0; i < nwant && j < replay->ntx; )
+    {
+        if(want[i] == got[j])
+        {
+            matched++;
+            i++;
+            j++;
+        }
+        else if(want[i] < got[j])
+        { i++; }
+        else
+        { j++; }
+    }
+    fprintf(fp, "  output vs recording: %lu recorded, %lu sent, %lu matched, "
+            "%lu missing, %lu unexpected%s\n", nwant, replay->ntx, matched,
+            nwant - matched, replay->ntx - matched,
+            matched == nwant && matched == replay->ntx ? " (identical)" : "");
+    free(want);
+    free(got);
+} /* -- replay_compare -- */
+
+void sr_replay_print_stats(struct sr_replay* replay, FILE* fp)
+{
+    struct sr_replay_stats* st = &replay->stats;
+    uint64_t end = st->end_ns ? st->end_ns : replay_now_ns();
+    double secs = st->start_ns ? (end - st->start_ns) / 1e9 : 0;
+    unsigned long n = st->replayed;
+
+    fprintf(fp, "Replay: %lu frames in, %lu recorded out, %lu skipped; "
+            "pass %u of %u\n", st->inputs, st->outputs, st->skipped,
+            replay->pass < replay->repeat ? replay->pass + 1 : replay->repeat,
+            replay->repeat);
+    if(n == 0)
+    { return; }
+
+    fprintf(fp, "  replayed %lu frames in %.3f s: %.0f frames/s, %.0f "
+            "frames/s inside sr_handlepacket\n", n, secs,
+            secs > 0 ? n / secs : 0, st->busy_ns ? n / (st->busy_ns / 1e9) : 0);
+
+    /* -- order doesn't matter to the rest of the replay -- */
+    qsort(replay->latency_ns, n, sizeof(uint32_t), replay_cmp32);
+    fprintf(fp, "  sr_handlepacket ns: p50 %u p99 %u p99.9 %u max %u\n",
+            replay->latency_ns[n / 2], replay->latency_ns[n * 99 / 100],
+            replay->latency_ns[n * 999 / 1000], replay->latency_ns[n - 1]);
+    fprintf(fp, "  sent %lu frames (%lu bytes)\n", st->sent, st->sent_bytes);
+
+    if(replay->pass > 0)
+    {
+        pthread_mutex_lock(&replay->tx_lock);
+        replay_compare(replay, fp);
+        pthread_mutex_unlock(&replay->tx_lock);
+    }
+} /* -- sr_replay_print_stats -- */
+
+/*---------------------------------------------------------------------
+ * The replay transport (sr_transport.h); spec is the capture, the
+ * interfaces and options.
+ *---------------------------------------------------------------------*/
+
+static int replay_connect(struct sr_instance* sr, const char* spec)
+{
+    return (sr->transport->state = sr_replay_open(sr, spec)) != 0 ? 0 : -1;
+} /* -- replay_connect -- */
+
+static int replay_interfaces(struct sr_instance* sr)
+{
+    /* -- sr_replay_open added them -- */
+    return 1;
+} /* -- replay_interfaces -- */
+
+static int replay_watch(struct sr_instance* sr, struct sr_loop* loop)
+{
+    return sr_replay_watch(sr->transport->state, loop);
+} /* -- replay_watch -- */
+
+static int replay_recv_burst(struct sr_instance* sr, int wait)
+{
+    return sr_replay_poll(sr->transport->state);
+} /* -- replay_recv_burst -- */
+
+static int replay_send_burst(struct sr_instance* sr,
+        const struct sr_frame* frames, int n)
+{
+    return sr_replay_send(sr->transport->state, frames, n);
+} /* -- replay_send_burst -- */
+
+static void replay_print_stats(struct sr_instance* sr, FILE* fp)
+{
+    sr_replay_print_stats(sr->transport->state, fp);
+} /* -- replay_print_stats -- */
+
+static void replay_close(struct sr_instance* sr)
+{
+    if(sr->transport->state)
+    {
+        sr_replay_print_stats(sr->transport->state, stderr);
+        sr_replay_close(sr->transport->state);
+        sr->transport->state = 0;
+    }
+} /* -- replay_close -- */
+
+const struct sr_transport sr_replay_transport =
+{
+    "replay",
+    replay_connect,
+    replay_interfaces,
+    replay_watch,
+    replay_recv_burst,
+    replay_send_burst,
+    replay_print_stats,
+    replay_close
+};
@@ -0,0 +1,135 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_replay.h
+ *
+ * Description:
+ *
+ * Pcap replay transport (-i replay:capture.pcap,ifname=mac/ip,...): feed a
+ * capture made with -l straight to sr_handlepacket, and keep whatever the
+ * router sends in memory, so forwarding changes can be checked against
+ * real traffic without a network.
+ *
+ * The -l log has both directions in it and no interface names, so the
+ * router's interfaces are given in the spec. Frames from one of their
+ * MACs are what the router sent; the rest are replayed on the interface
+ * whose MAC they are addressed to (or, for a broadcast ARP request, whose
+ * IP is asked for). Anything else in the capture is skipped.
+ *
+ * Options after the interfaces:
+ *
+ *   timed       replay at the recorded pace instead of as fast as we can
+ *   repeat=N    replay the capture N times over
+ *   out=path    write what the router sent to a pcap
+ *
+ * Only the first pass is captured and compared: its transmits are matched
+ * against the recorded ones as a multiset, since timers can reorder them.
+ * The log keeps the first PACKET_DUMP_SIZE bytes of a frame, so that is
+ * all that is compared. When it is done the transport reports the replay
+ * rate, the time each sr_handlepacket call took (p50/p99/p99.9/max) and
+ * how the output compares.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_REPLAY_H
+#define SR_REPLAY_H
+
+#include <stdio.h>
+#include <pthread.h>
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#include "sr_protocol.h"
+
+#define SR_REPLAY_PORTS_MAX  8
+#define SR_REPLAY_BURST      32     /* frames per wakeup */
+
+struct sr_instance;
+struct sr_loop;
+struct sr_frame;
+
+struct sr_replay_port
+{
+    char name[sr_IFACE_NAMELEN];
+    unsigned char addr[ETHER_ADDR_LEN];
+    uint32_t ip;
+};
+
+/* One frame of the capture, in place in the file image */
+struct sr_replay_frame
+{
+    const uint8_t* buf;
+    unsigned int len;
+    int port;                   /* replayed on, or -1 if the router sent it */
+    uint64_t ts_ns;             /* recorded time */
+};
+
+/* One frame the router sent during the first pass */
+struct sr_replay_tx
+{
+    uint64_t hash;
+    size_t off;                 /* in the arena */
+    unsigned int len;
+};
+
+struct sr_replay_stats
+{
+    unsigned long inputs;       /* frames replayed each pass */
+    unsigned long outputs;      /* recorded transmits to compare against */
+    unsigned long skipped;      /* frames neither to nor from the router */
+    unsigned long replayed;     /* over all passes */
+    unsigned long sent;         /* frames the router sent, all passes */
+    unsigned long sent_bytes;
+    uint64_t busy_ns;           /* inside sr_handlepacket */
+    uint64_t start_ns, end_ns;
+};
+
+struct sr_replay
+{
+    struct sr_instance* sr;
+    int timed;
+    unsigned int repeat;
+    unsigned int pass;
+    char* out_path;
+    int timerfd;
+
+    int nports;
+    struct sr_replay_port ports[SR_REPLAY_PORTS_MAX];
+
+    uint8_t* image;             /* the capture file */
+    struct sr_replay_frame* frames;
+    unsigned long nframes;
+    unsigned long next;         /* next frame to look at */
+    uint64_t pass_ns;           /* when this pass started */
+    uint8_t* scratch;           /* a copy for the router to scribble on */
+
+    uint32_t* latency_ns;       /* one per frame replayed */
+
+    pthread_mutex_t tx_lock;    /* the ARP thread may send too */
+    struct sr_replay_tx* tx;    /* first pass transmits */
+    unsigned long ntx, tx_cap;
+    uint8_t* arena;
+    size_t arena_len, arena_cap;
+
+    struct sr_replay_stats stats;
+};
+
+/* Load the capture and add the interfaces spec lists to the router's.
+   Returns 0 on error. */
+struct sr_replay* sr_replay_open(struct sr_instance* sr, const char* spec);
+void sr_replay_close(struct sr_replay* replay);
+
+/* Have the event loop run the replay. */
+int sr_replay_watch(struct sr_replay* replay, struct sr_loop* loop);
+
+/* Without an event loop: replay the next burst, waiting for its recorded
+   time if timed. Returns 1 to keep going, 0 once the replay is done. */
+int sr_replay_poll(struct sr_replay* replay);
+
+/* Keep n frames the router sent. Returns the number kept. */
+int sr_replay_send(struct sr_replay* replay, const struct sr_frame* frames,
+        int n);
+
+void sr_replay_print_stats(struct sr_replay* replay, FILE* fp);
+
+#endif /* -- SR_REPLAY_H -- */
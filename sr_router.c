@@ -12,6 +12,8 @@
  **********************************************************************/
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <assert.h>
 
 #include "sr_if.h"
@@ -20,6 +22,22 @@
 #include "sr_protocol.h"
 #include "sr_arpcache.h"
 #include "sr_utils.h"
+#include "sr_rxring.h"
+#include "sr_loop.h"
+#include "sr_pktbuf.h"
+#include "sr_pkt.h"
+
+static void sr_arpcache_tick_timer(struct sr_loop* loop, int fd, void* sr)
+{
+  sr_arpcache_tick((struct sr_instance*)sr);
+}
+
+/* The ARP cache's next deadline moved up: have the loop tick then. */
+static void sr_arpcache_wake(void* sr, unsigned long delay_ms)
+{
+  sr_loop_schedule(((struct sr_instance*)sr)->loop, delay_ms,
+                   sr_arpcache_tick_timer, sr);
+}
 
 /*---------------------------------------------------------------------
  * Method: sr_init(void)
@@ -37,6 +55,15 @@
     /* Initialize cache and cache cleanup thread */
   sr_arpcache_init(&(sr->cache));
 
+  if(sr->loop)
+  {
+      /* -- everything runs on the event loop's thread, so no locking -- */
+      sr->cache.single_threaded = 1;
+      sr->cache.wake = sr_arpcache_wake;
+      sr->cache.wake_arg = sr;
+      return;
+  }
+
   pthread_attr_init(&(sr->attr));
   pthread_attr_setdetachstate(&(sr->attr), PTHREAD_CREATE_JOINABLE);
   pthread_attr_setscope(&(sr->attr), PTHREAD_SCOPE_SYSTEM);
@@ -50,83 +77,39 @@
 } /* -- sr_init -- */
 
 /*---------------------------------------------------------------------
- * Method: sr_handlepacket(uint8_t* p,char* interface)
+ * Method: resolve_rt(..)
  * Scope:  Global
  *
- * This method is called each time the router receives a packet on the
- * interface.  The packet buffer, the packet length and the receiving
- * interface are passed in as parameters. The packet is complete with
- * ethernet headers.
- *
- * Note: Both the packet buffer and the character's memory are handled
- * by sr_vns_comm.c that means do NOT delete either.  Make a copy of the
- * packet instead if you intend to keep it around beyond the scope of
- * the method call.
+ * The gateway of the best route to dest_ip, or -1 if there is none.
  *
  *---------------------------------------------------------------------*/
 
  uint32_t resolve_rt(struct sr_instance* sr, uint32_t dest_ip)
  {
-  struct sr_rt* routing_entry = sr->routing_table;
-  int gateway = -1;
-  int long_match = -2147483648;
-  while(routing_entry != NULL)
-  {
-    if((dest_ip & routing_entry->mask.s_addr) == routing_entry->dest.s_addr)
-    {
-      if((int) ntohl(routing_entry->mask.s_addr) > long_match)
-      {
-        gateway = routing_entry->gw.s_addr;
-        long_match = ntohl(routing_entry->mask.s_addr);
-      }
-    }
-    routing_entry = routing_entry->next;
-  }
-  return gateway;
-}
-
-char * out_interface(struct sr_instance* sr, uint32_t gateway)
-{
-  struct sr_rt * routing_entry = sr->routing_table;
-  while(routing_entry != NULL)
+  struct sr_rt* routing_entry = sr_rt_lookup(sr, dest_ip);
+  if(routing_entry == NULL)
   {
-    if(gateway == routing_entry->gw.s_addr)
-    {
-      return routing_entry->interface;
-    }
-    routing_entry = routing_entry->next;
+    return -1;
   }
-  return NULL;
+  return routing_entry->gw.s_addr;
 }
 
-
-enum icmp_type {
-  echo_reply_type = 0x00,
-  echo_request_type = 0x08,
-  dest_unreachable = 0x03,
-  time_exceeded = 0x0B,
-  traceroute_type = 0x1E,
-};
-
-enum icmp_code {
-  echo_reply_code = 0x00,
-  echo_request_code = 0x00,
-  port_unreachable = 0x03,
-  ttl_expired = 0x00,
-  net_unreachable = 0x00,
-  host_unreachable = 0x01,
-  traceroute_code = 0x00,
-};
-
-uint8_t* send_icmp(uint8_t code, uint8_t type, uint32_t source_ip, uint8_t * source_mac, uint32_t dest_ip, uint8_t* dest_mac)
+/* Builds an ICMP error from the ICMP header out, pushing the IP and
+   Ethernet headers on in front of it. The caller fills in the quoted
+   header and frees the buffer. */
+struct sr_pktbuf* send_icmp(uint8_t code, uint8_t type, uint32_t source_ip, uint8_t * source_mac, uint32_t dest_ip, uint8_t* dest_mac)
 {
   int eth_len = sizeof(sr_ethernet_hdr_t);
   int ip_len = sizeof(sr_ip_hdr_t);
   int icmp_len = sizeof(sr_icmp_t3_hdr_t);
-  uint8_t * icmp = calloc(eth_len + ip_len + icmp_len, sizeof(uint8_t));
-  sr_ethernet_hdr_t * eth_head = (sr_ethernet_hdr_t *) icmp;
-  sr_ip_hdr_t * ip_head = (sr_ip_hdr_t *) (icmp + eth_len);
-  sr_icmp_t3_hdr_t * icmp_head = (sr_icmp_t3_hdr_t *) (icmp + eth_len + ip_len);
+  struct sr_pktbuf * icmp = sr_pktbuf_alloc(icmp_len);
+  if(icmp == NULL)
+  {
+    return NULL;
+  }
+  sr_icmp_t3_hdr_t * icmp_head = (sr_icmp_t3_hdr_t *) icmp->data;
+  sr_ip_hdr_t * ip_head = (sr_ip_hdr_t *) sr_pktbuf_push(icmp, ip_len);
+  sr_ethernet_hdr_t * eth_head = (sr_ethernet_hdr_t *) sr_pktbuf_push(icmp, eth_len);
 
   eth_head->ether_type = ntohs(ethertype_ip);
   memcpy(eth_head->ether_dhost, dest_mac, ETHER_ADDR_LEN);
@@ -164,224 +147,343 @@ uint32_t to_router(struct sr_instance* sr, uint32_t dest_ip)
   return -1;
 }
 
+/*---------------------------------------------------------------------
+ * Method: send_waiting_packets(..)
+ * Scope:  Local
+ *
+ * Send every packet queued on req now that its next hop is known to be at
+ * mac out of out_if, then free the request. req must already have been
+ * taken off the queue by sr_arpcache_insert.
+ *
+ *---------------------------------------------------------------------*/
+
+static void send_waiting_packets(struct sr_instance* sr, struct sr_arpreq* req,
+        unsigned char* mac, struct sr_if* out_if)
+{
+  struct sr_packet *temppkt = req->packets;
+  while (temppkt != NULL)
+  {
+    sr_ethernet_hdr_t * eth_head_waiting = (sr_ethernet_hdr_t *) temppkt->buf;
+    memcpy(eth_head_waiting->ether_dhost, mac, ETHER_ADDR_LEN);
+    memcpy(eth_head_waiting->ether_shost, out_if->addr, ETHER_ADDR_LEN);
+    sr_send_packet_if(sr, temppkt->buf, temppkt->len, out_if);
+    temppkt = temppkt->next;
+  }
+  sr_arpreq_destroy(&sr->cache, req);
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_send_icmp_error(..)
+ * Scope:  Global
+ *
+ * Send the ICMP error type/code about pkt back to where it came from, as
+ * source_ip, quoting its IP header and the start of its payload. ip_off
+ * goes into the error's own IP header.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_send_icmp_error(struct sr_instance* sr, struct sr_pkt* pkt,
+        uint8_t type, uint8_t code, uint32_t source_ip, uint16_t ip_off)
+{
+  sr_ethernet_hdr_t * eth_head = sr_pkt_eth(pkt);
+  unsigned int quote = pkt->len - pkt->l3_off;
+  int icmp_len = sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t) + sizeof(sr_icmp_t3_hdr_t);
+  struct sr_pktbuf * pb = send_icmp(code, type, source_ip, pkt->in->addr, pkt->src, eth_head->ether_shost);
+  if(pb == NULL)
+  {
+    return;
+  }
+  sr_ip_hdr_t * temp_ip = (sr_ip_hdr_t *) (pb->data + sizeof(sr_ethernet_hdr_t));
+  sr_icmp_t3_hdr_t * temp_icmp = (sr_icmp_t3_hdr_t *) (pb->data + sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t));
+
+  if(quote > ICMP_DATA_SIZE)
+  {
+    quote = ICMP_DATA_SIZE;
+  }
+  memcpy(temp_icmp->data, sr_pkt_ip(pkt), quote);
+  temp_icmp->icmp_sum = 0;
+  temp_icmp->icmp_sum = cksum(temp_icmp, sizeof(sr_icmp_t3_hdr_t));
+  temp_ip->ip_off = htons(ip_off);
+  temp_ip->ip_sum = 0;
+  temp_ip->ip_sum = cksum(temp_ip, sizeof(sr_ip_hdr_t));
+
+  print_hdrs(pb->data, icmp_len);
+  sr_send_packet_if(sr, pb->data, icmp_len, pkt->in);
+  sr_pktbuf_free(pb);
+}
+
+/*---------------------------------------------------------------------
+ * Method: handle_ip_local(..)
+ * Scope:  Local
+ *
+ * An IP packet for one of our own addresses: answer echo requests, and
+ * anything that isn't ICMP with port unreachable.
+ *
+ *---------------------------------------------------------------------*/
+
+static void handle_ip_local(struct sr_instance* sr, struct sr_pkt* pkt)
+{
+  printf("HEADED TO ROUTER\n");
+  if(pkt->proto != ip_protocol_icmp)
+  {
+    /*ICMP PORT UNREACHABLE*/
+    sr_send_icmp_error(sr, pkt, dest_unreachable, port_unreachable, pkt->dst, IP_DF);
+    printf("SENDING ICMP PORT UNREACHABLE\n");
+    return;
+  }
+  if(pkt->flags & SR_PKT_ICMP_ECHO)
+  {
+    sr_ethernet_hdr_t * eth_head = sr_pkt_eth(pkt);
+    sr_ip_hdr_t * ip_head = sr_pkt_ip(pkt);
+    sr_icmp_hdr_t * icmp_head = (sr_icmp_hdr_t *) sr_pkt_l4(pkt);
+
+    ip_head->ip_dst = pkt->src;
+    ip_head->ip_src = pkt->dst;
+    memcpy(eth_head->ether_dhost, eth_head->ether_shost, ETHER_ADDR_LEN);
+    memcpy(eth_head->ether_shost, pkt->in->addr, ETHER_ADDR_LEN);
+    ip_head->ip_sum = 0;
+    ip_head->ip_sum = cksum(ip_head, pkt->l4_off - pkt->l3_off);
+    icmp_head->icmp_type = echo_reply_type;
+    icmp_head->icmp_code = echo_reply_code;
+    icmp_head->icmp_sum = 0;
+    icmp_head->icmp_sum = cksum(icmp_head, ntohs(ip_head->ip_len) - (pkt->l4_off - pkt->l3_off));
+    sr_send_packet_if(sr, pkt->frame, pkt->len, pkt->in);
+    printf("SENDING ECHO REPLY\n");
+  }
+}
+
+/*---------------------------------------------------------------------
+ * Method: forward_ip(..)
+ * Scope:  Local
+ *
+ * An IP packet for somewhere else: send it on towards its next hop, or
+ * queue it until the next hop's address is known.
+ *
+ *---------------------------------------------------------------------*/
+
+static void forward_ip(struct sr_instance* sr, struct sr_pkt* pkt)
+{
+  sr_ethernet_hdr_t * eth_head = sr_pkt_eth(pkt);
+  sr_ip_hdr_t * ip_head = sr_pkt_ip(pkt);
+  struct sr_rt * route;
+  struct sr_if * out_if;
+  uint32_t gateway;
+
+  printf("HEADED OUT OF:\n");
+  ip_head->ip_ttl--;
+  ip_head->ip_sum = 0;
+  ip_head->ip_sum = cksum(ip_head, pkt->l4_off - pkt->l3_off);
+  if(ip_head->ip_ttl == 0)
+  {
+    /*ICMP TIME EXCEEDED*/
+    sr_send_icmp_error(sr, pkt, time_exceeded, ttl_expired, pkt->in->ip, 0);
+    return;
+  }
+
+  route = sr_rt_lookup(sr, pkt->dst);
+  if(route == NULL || (out_if = route->out) == NULL)
+  {
+    /*ICMP NETWORK UNREACHABLE*/
+    sr_send_icmp_error(sr, pkt, dest_unreachable, net_unreachable, pkt->in->ip, 0);
+    return;
+  }
+  gateway = route->gw.s_addr;
+  print_addr_ip_int(ntohl(gateway));
+  /* copied out where it lies, so a forward takes no allocation */
+  struct sr_arpentry mapping;
+  if(!sr_arpcache_lookup_copy(&sr->cache, gateway, &mapping))
+  {
+    printf("MAPPING WAS NULL. QUEUEING REQUEST.\n");
+    /* keep the frame where it was received instead of copying it */
+    sr_arpcache_queuereq_held(&sr->cache, gateway, pkt->frame, pkt->len, pkt->in,
+                              sr_rxring_hold(sr->rx, pkt->frame));
+    return;
+  }
+  memcpy(eth_head->ether_dhost, mapping.mac, ETHER_ADDR_LEN);
+  memcpy(eth_head->ether_shost, out_if->addr, ETHER_ADDR_LEN);
+  sr_send_packet_if(sr, pkt->frame, pkt->len, out_if);
+}
+
+/*---------------------------------------------------------------------
+ * Method: handle_ip(..)
+ * Scope:  Local
+ *
+ *---------------------------------------------------------------------*/
+
+static void handle_ip(struct sr_instance* sr, struct sr_pkt* pkt)
+{
+  sr_ethernet_hdr_t * eth_head = sr_pkt_eth(pkt);
+
+  printf("--------\n");
+  printf("IP PACKET RECEIVED\n");
+  printf("From: \n");
+  print_addr_eth(eth_head->ether_shost);
+  print_addr_ip_int(ntohl(pkt->src));
+  printf("To: \n");
+  print_addr_eth(eth_head->ether_dhost);
+  print_addr_ip_int(ntohl(pkt->dst));
+  if(!(pkt->flags & SR_PKT_CKSUM_OK))
+  {
+    printf("IP CHECKSUM FAILED\n");
+    return;
+  }
+  printf("IP CHECKSUM PASSED\n");
+  if(pkt->flags & SR_PKT_LOCAL)
+  {
+    handle_ip_local(sr, pkt);
+  }
+  else
+  {
+    forward_ip(sr, pkt);
+  }
+}
+
+/*---------------------------------------------------------------------
+ * Method: send_arp_reply(..)
+ * Scope:  Local
+ *
+ * Answer the ARP request pkt, which asked for the address of the
+ * interface it came in on.
+ *
+ *---------------------------------------------------------------------*/
+
+static void send_arp_reply(struct sr_instance* sr, struct sr_pkt* pkt)
+{
+  sr_ethernet_hdr_t * eth_head = sr_pkt_eth(pkt);
+  sr_arp_hdr_t * arp_head = sr_pkt_arp(pkt);
+  struct sr_pktbuf *pb_reply = sr_pktbuf_alloc(sizeof(sr_ethernet_hdr_t) + sizeof(sr_arp_hdr_t));
+  if(pb_reply == NULL)
+  {
+    return;
+  }
+  uint8_t *arp_reply = pb_reply->data;
+  sr_ethernet_hdr_t * rep_eth_head = (sr_ethernet_hdr_t *) arp_reply;
+  sr_arp_hdr_t * rep_arp_head = (sr_arp_hdr_t *) (arp_reply + sizeof(sr_ethernet_hdr_t));
+
+  rep_eth_head->ether_type = ntohs(ethertype_arp);
+  memcpy(rep_eth_head->ether_dhost, eth_head->ether_shost, ETHER_ADDR_LEN);
+  memcpy(rep_eth_head->ether_shost, pkt->in->addr, ETHER_ADDR_LEN);
+
+  rep_arp_head->ar_hrd = ntohs(arp_hrd_ethernet);
+  rep_arp_head->ar_pro = arp_head->ar_pro;
+  rep_arp_head->ar_hln = arp_head->ar_hln;
+  rep_arp_head->ar_pln = arp_head->ar_pln;
+  rep_arp_head->ar_op = ntohs(arp_op_reply);
+  memcpy(rep_arp_head->ar_sha, pkt->in->addr, ETHER_ADDR_LEN);
+  rep_arp_head->ar_sip = pkt->dst;
+  memcpy(rep_arp_head->ar_tha, arp_head->ar_sha, ETHER_ADDR_LEN);
+  rep_arp_head->ar_tip = pkt->src;
+  printf("SENDING ARP REPLY\n");
+  sr_send_packet_if(sr, arp_reply, sizeof(sr_ethernet_hdr_t) + sizeof(sr_arp_hdr_t), pkt->in);
+  sr_pktbuf_free(pb_reply);
+}
+
+/*---------------------------------------------------------------------
+ * Method: handle_arp(..)
+ * Scope:  Local
+ *
+ *---------------------------------------------------------------------*/
+
+static void handle_arp(struct sr_instance* sr, struct sr_pkt* pkt)
+{
+  sr_ethernet_hdr_t * eth_head = sr_pkt_eth(pkt);
+  sr_arp_hdr_t * arp_head = sr_pkt_arp(pkt);
+  struct sr_arpreq * waiting;
+
+  printf("--------\n");
+  printf("ARP PACKET RECEIVED\n");
+  printf("From: \n");
+  print_addr_eth(eth_head->ether_shost);
+  print_addr_ip_int(ntohl(pkt->src));
+  printf("To: \n");
+  print_addr_eth(eth_head->ether_dhost);
+  print_addr_ip_int(ntohl(pkt->dst));
+
+  if(pkt->flags & SR_PKT_ARP_REQUEST)
+  {
+    printf("ARP REQUEST RECEIVED\n");
+    if(pkt->dst == pkt->in->ip)
+    {
+      send_arp_reply(sr, pkt);
+
+      /* The requester is about to talk to us, so learn its mapping now
+         (RFC 826) instead of ARPing for it when we answer. */
+      waiting = sr_arpcache_insert(&sr->cache, arp_head->ar_sha, pkt->src);
+      if(waiting != NULL)
+      {
+        send_waiting_packets(sr, waiting, arp_head->ar_sha, pkt->in);
+      }
+    }
+    else if(sr->arp_gratuitous && pkt->src == pkt->dst)
+    {
+      /* Gratuitous ARP: only update a neighbor we already know about. */
+      printf("GRATUITOUS ARP RECEIVED\n");
+      sr_arpcache_refresh(&sr->cache, arp_head->ar_sha, pkt->src);
+    }
+  }
+  else if(pkt->flags & SR_PKT_ARP_REPLY)
+  {
+    printf("this is a reply\n");
+
+    /* release whatever was waiting on the sender, now addressed to it */
+    waiting = sr_arpcache_insert(&sr->cache, arp_head->ar_sha, pkt->src);
+    if(waiting != NULL)
+    {
+      send_waiting_packets(sr, waiting, arp_head->ar_sha, pkt->in);
+    }
+  }
+  printf("--------\n");
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_handlepacket(uint8_t* p,char* interface)
+ * Scope:  Global
+ *
+ * This method is called each time the router receives a packet on the
+ * interface.  The packet buffer, the packet length and the receiving
+ * interface are passed in as parameters. The packet is complete with
+ * ethernet headers.
+ *
+ * The frame is parsed once, into a struct sr_pkt (sr_pkt.h), and the
+ * handlers below work from that.
+ *
+ * Note: Both the packet buffer and the character's memory are handled
+ * by sr_vns_comm.c that means do NOT delete either.  Make a copy of the
+ * packet instead if you intend to keep it around beyond the scope of
+ * the method call.
+ *
+ *---------------------------------------------------------------------*/
+
 void sr_handlepacket(struct sr_instance* sr,
         uint8_t * packet/* lent */,
         unsigned int len,
         char* interface/* lent */)
   {
+  struct sr_pkt pkt;
+
   /* REQUIRES */
     assert(sr);
     assert(packet);
     assert(interface);
-    if(ethertype(packet) == ethertype_ip)
+
+    if(sr_pkt_parse(sr, &pkt, packet, len, interface) != 0)
     {
-      printf("--------\n");
-      int eth_head_len = sizeof(sr_ethernet_hdr_t);
-      sr_ethernet_hdr_t * eth_head = (sr_ethernet_hdr_t *) packet;
-      sr_ip_hdr_t *ip_head = (sr_ip_hdr_t *) (packet + eth_head_len);
-      printf("IP PACKET RECEIVED\n");
-      printf("From: \n");
-      print_addr_eth(eth_head->ether_shost);
-      print_addr_ip_int(ntohl(ip_head->ip_src));
-      printf("To: \n");
-      print_addr_eth(eth_head->ether_dhost);
-      print_addr_ip_int(ntohl(ip_head->ip_dst));
-      if(cksum(ip_head, ip_head->ip_hl*4) == 65535)
-      {
-        printf("IP CHECKSUM PASSED\n");
-        uint32_t to_router_ip = to_router(sr, ip_head->ip_dst);
-        if(to_router_ip != -1)
-        {
-          printf("HEADED TO ROUTER\n");
-          if(ip_head->ip_p != ip_protocol_icmp)
-          {
-            uint8_t * icmp_pu = send_icmp(port_unreachable, dest_unreachable, ip_head->ip_dst, eth_head->ether_dhost, ip_head->ip_src, eth_head->ether_shost);
-          /*ICMP PORT UNREACHABLE*/
-            sr_ip_hdr_t * temp_ip = (sr_ip_hdr_t*) (icmp_pu + eth_head_len);  
-            sr_icmp_t3_hdr_t * temp_icmp = (sr_icmp_t3_hdr_t*) (icmp_pu + eth_head_len + sizeof(sr_ip_hdr_t));  
-
-            memcpy( temp_icmp->data, ip_head, sizeof(sr_ip_hdr_t));
-            memcpy((temp_icmp->data + 20), packet + eth_head_len + sizeof(sr_ip_hdr_t), 8);
-            temp_icmp->icmp_sum = 0;
-            temp_icmp->icmp_sum = cksum(temp_icmp, sizeof(sr_icmp_t3_hdr_t));
-            icmp_pu[20] = 64;
-            temp_ip->ip_sum = 0;
-            temp_ip->ip_sum = cksum(temp_ip, 20);
-
-            sr_send_packet(sr, icmp_pu, eth_head_len + sizeof(sr_ip_hdr_t) + sizeof(sr_icmp_t3_hdr_t), interface);
-            printf("SENDING ICMP PORT UNREACHABLE\n");
-            return;
-          }
-          else
-          {
-            sr_icmp_hdr_t* icmp_head = (sr_icmp_hdr_t *) (packet + eth_head_len + sizeof(sr_ip_hdr_t));
-            if(icmp_head->icmp_type == echo_request_type && icmp_head->icmp_code == echo_request_code)
-            {
-              uint32_t src_ip = ip_head->ip_dst;
-              uint8_t * src_mac = calloc(ETHER_ADDR_LEN, sizeof(uint8_t));
-              memcpy(src_mac, eth_head->ether_dhost, ETHER_ADDR_LEN);
-
-
-              ip_head->ip_dst = ip_head->ip_src; 
-              ip_head->ip_src = src_ip;
-              memcpy(eth_head->ether_dhost, eth_head->ether_shost, ETHER_ADDR_LEN);
-              memcpy(eth_head->ether_shost, src_mac, ETHER_ADDR_LEN);
-              ip_head->ip_sum = 0;
-              ip_head->ip_sum = cksum(ip_head, 20);
-              icmp_head->icmp_type = echo_reply_type;
-              icmp_head->icmp_code = echo_reply_code;
-              icmp_head->icmp_sum = 0;
-              icmp_head->icmp_sum = cksum(icmp_head, htons(ip_head->ip_len) - 20);
-              sr_send_packet(sr, packet, len, interface);
-              printf("SENDING ECHO REPLY\n");
-
-            }
-          }
-        }
-        else
-        {
-          printf("HEADED OUT OF:\n");
-          ip_head->ip_ttl--;
-          ip_head->ip_sum = 0;
-          ip_head->ip_sum = cksum(ip_head, ip_head->ip_hl*4);
-          if(ip_head->ip_ttl == 0)
-          {
-	    struct sr_if * if_table = sr_get_interface(sr, interface);
-	    uint8_t* icmp_te = send_icmp(ttl_expired, time_exceeded, if_table->ip, eth_head->ether_dhost, ip_head->ip_src, eth_head->ether_shost);
-	    sr_ip_hdr_t * temp_ip = (sr_ip_hdr_t *) (icmp_te + eth_head_len);
-	    sr_icmp_t3_hdr_t * temp_icmp = (sr_icmp_t3_hdr_t *) (icmp_te + eth_head_len + sizeof(sr_ip_hdr_t));
-	    temp_ip->ip_sum = 0;
-	    temp_ip->ip_sum = cksum(temp_ip, sizeof(sr_ip_hdr_t));
-	    memcpy(temp_icmp->data, ip_head, sizeof(sr_ip_hdr_t));
-	    memcpy(temp_icmp->data + sizeof(sr_ip_hdr_t), packet+eth_head_len+sizeof(sr_ip_hdr_t), 8);
-	    temp_icmp->icmp_sum = 0;
-	    temp_icmp->icmp_sum = cksum(temp_icmp, sizeof(sr_icmp_t3_hdr_t));
-	    print_hdrs(icmp_te, eth_head_len + sizeof(sr_ip_hdr_t) + sizeof(sr_icmp_t3_hdr_t));
-	    sr_send_packet(sr, icmp_te, eth_head_len + sizeof(sr_ip_hdr_t) + sizeof(sr_icmp_t3_hdr_t), interface);
-            /*ICMP TIME EXCEEDED*/
-            return;
-          }
-
-          int gateway = resolve_rt(sr, ip_head->ip_dst);
-          if(gateway ==  -1)
-          {
-	    struct sr_if * if_table = sr_get_interface(sr, interface);
-	    uint8_t* icmp_nu = send_icmp(net_unreachable, dest_unreachable, if_table->ip, eth_head->ether_dhost, ip_head->ip_src, eth_head->ether_shost);
-	    sr_ip_hdr_t * temp_ip = (sr_ip_hdr_t *) (icmp_nu + eth_head_len);
-	    sr_icmp_t3_hdr_t * temp_icmp = (sr_icmp_t3_hdr_t *) (icmp_nu + eth_head_len + sizeof(sr_ip_hdr_t));
-	    temp_ip->ip_sum = 0;
-	    temp_ip->ip_sum = cksum(temp_ip, sizeof(sr_ip_hdr_t));
-	    memcpy(temp_icmp->data, ip_head, sizeof(sr_ip_hdr_t));
-	    memcpy(temp_icmp->data + sizeof(sr_ip_hdr_t), packet+eth_head_len+sizeof(sr_ip_hdr_t), 8);
-	    temp_icmp->icmp_sum = 0;
-	    temp_icmp->icmp_sum = cksum(temp_icmp, sizeof(sr_icmp_t3_hdr_t));
-	    print_hdrs(icmp_nu, eth_head_len + sizeof(sr_ip_hdr_t) + sizeof(sr_icmp_t3_hdr_t));
-	    sr_send_packet(sr, icmp_nu, eth_head_len + sizeof(sr_ip_hdr_t) + sizeof(sr_icmp_t3_hdr_t), interface);
-           
-          /*ICMP NETWORK UNREACHABLE*/
-            return;
-          }
-          print_addr_ip_int(ntohl(gateway));
-          struct sr_arpentry* mapping = sr_arpcache_lookup(&sr->cache, gateway);
-          if(mapping == NULL)
-          {
-            printf("MAPPING WAS NULL. QUEUEING REQUEST.\n");
-            sr_arpcache_queuereq(&sr->cache, gateway, packet, len, interface);
-          } 
-          else
-          {
-	    memcpy(eth_head->ether_dhost, mapping->mac, ETHER_ADDR_LEN);
-	    char* out_int = out_interface(sr, gateway);
-	    struct sr_if* if_entry = sr_get_interface(sr, out_int);
-	    memcpy(eth_head->ether_shost, if_entry->addr, ETHER_ADDR_LEN);
-	    sr_send_packet(sr, packet, len, out_int);
-            return;
-          }
-
-        }
-      }
-      else 
-      {
-        printf("IP CHECKSUM FAILED\n");
-        return;
-      }
-      printf("--------\n");  
+      fprintf(stderr, "** Error, interface %s, does not exist\n", interface);
+      return;
     }
-    else if(ethertype(packet) == ethertype_arp)
+    if(pkt.flags & SR_PKT_TRUNCATED)
     {
-      printf("--------\n");
-      printf("ARP PACKET RECEIVED\n"); 
-      int eth_head_len = sizeof(sr_ethernet_hdr_t);
-      sr_ethernet_hdr_t * eth_head = (sr_ethernet_hdr_t *) packet;
-      sr_arp_hdr_t *arp_head = (sr_arp_hdr_t *) (packet + eth_head_len);
-      printf("From: \n");
-      print_addr_eth(eth_head->ether_shost);
-      print_addr_ip_int(ntohl(arp_head->ar_sip));
-      printf("To: \n");
-      print_addr_eth(eth_head->ether_dhost);
-      print_addr_ip_int(ntohl(arp_head->ar_tip));
-
-      if(ntohs(arp_head->ar_op)==1)
-      {
-	printf("ARP REQUEST RECEIVED\n");
-        if(arp_head->ar_tip == sr_get_interface(sr, interface)->ip)
-        {
-          uint8_t *arp_reply = calloc(sizeof(sr_ethernet_hdr_t) + sizeof(sr_arp_hdr_t), sizeof(uint8_t));
-          sr_ethernet_hdr_t * rep_eth_head = (sr_ethernet_hdr_t *) arp_reply;
-          sr_arp_hdr_t * rep_arp_head = (sr_arp_hdr_t *) (arp_reply + sizeof(sr_ethernet_hdr_t));
-
-          rep_eth_head->ether_type = ntohs(ethertype_arp);
-          memcpy(rep_eth_head->ether_dhost, eth_head->ether_shost, ETHER_ADDR_LEN);
-          memcpy(rep_eth_head->ether_shost, sr_get_interface(sr, interface)->addr, ETHER_ADDR_LEN);
-          /*print_addr_eth(rep_eth_head->ether_shost);*/
-
-          rep_arp_head->ar_hrd = ntohs(arp_hrd_ethernet);
-          rep_arp_head->ar_pro = arp_head->ar_pro;
-          rep_arp_head->ar_hln = arp_head->ar_hln;
-          rep_arp_head->ar_pln = arp_head->ar_pln;
-          rep_arp_head->ar_op = ntohs(arp_op_reply);
-          memcpy(rep_arp_head->ar_sha, sr_get_interface(sr, interface)->addr, ETHER_ADDR_LEN);
-          rep_arp_head->ar_sip = arp_head->ar_tip;
-          memcpy(rep_arp_head->ar_tha, arp_head->ar_sha, ETHER_ADDR_LEN);
-          rep_arp_head->ar_tip = arp_head->ar_sip;
-          /*print_hdrs(arp_reply, sizeof(sr_ethernet_hdr_t) + sizeof(sr_arp_hdr_t));*/
-          printf("SENDING ARP REPLY\n");
-          sr_send_packet(sr, arp_reply, sizeof(sr_ethernet_hdr_t) + sizeof(sr_arp_hdr_t), interface);
-        }
-      }
-      else if(ntohs(arp_head->ar_op)==2)
-      { 
-        printf("this is a reply\n");   
-        
-        /*
-        for all requests
-          if that request is waiting on the source IP of the ARP packet
-            for all IP packets of that request
-              set the source MAC to the destination MAC of the ethernet header
-              set the destination MAC to the source MAC of the ethernet header 
-        */
-
-        struct sr_arpreq *tempreqs = sr_arpcache_insert(&sr->cache, eth_head->ether_shost, arp_head->ar_sip);
-        if(tempreqs != NULL)
-        {
-          /*printf("temp ip is: ");
-          print_addr_ip_int(tempreqs->ip);
-          printf("\nsource ip is: ");
-          print_addr_ip_int(ntohl(arp_head->ar_sip));
-          printf("\n");
-            printf("ip found\n");*/
-            struct sr_packet *temppkt = tempreqs->packets;
-            while (temppkt != NULL)
-            {
-              sr_ethernet_hdr_t * eth_head_waiting = (sr_ethernet_hdr_t *) temppkt->buf;
-              memcpy(eth_head_waiting->ether_dhost, eth_head->ether_shost, ETHER_ADDR_LEN);
-              memcpy(eth_head_waiting->ether_shost, eth_head->ether_dhost, ETHER_ADDR_LEN);
-              sr_send_packet(sr, temppkt->buf, temppkt->len, interface);
-              temppkt = temppkt->next;
-            }
-        }
-      }
-      printf("--------\n");
+      printf("TRUNCATED PACKET DROPPED\n");
+      return;
+    }
+
+    if(pkt.flags & SR_PKT_IP)
+    {
+      handle_ip(sr, &pkt);
+    }
+    else if(pkt.flags & SR_PKT_ARP)
+    {
+      handle_arp(sr, &pkt);
     }
     printf("*** -> Received packet of length %d \n",len);
 
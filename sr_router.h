@@ -30,9 +30,33 @@
 #define INIT_TTL 255
 #define PACKET_DUMP_SIZE 1024
 
+enum icmp_type {
+  echo_reply_type = 0x00,
+  echo_request_type = 0x08,
+  dest_unreachable = 0x03,
+  time_exceeded = 0x0B,
+  traceroute_type = 0x1E,
+};
+
+enum icmp_code {
+  echo_reply_code = 0x00,
+  echo_request_code = 0x00,
+  port_unreachable = 0x03,
+  ttl_expired = 0x00,
+  net_unreachable = 0x00,
+  host_unreachable = 0x01,
+  traceroute_code = 0x00,
+};
+
 /* forward declare */
 struct sr_if;
 struct sr_rt;
+struct sr_txq;
+struct sr_rxring;
+struct sr_loop;
+struct sr_transport;
+struct sr_pktbuf;
+struct sr_pkt;
 
 /* ----------------------------------------------------------------------------
  * struct sr_instance
@@ -52,21 +76,39 @@ struct sr_instance
     struct sr_if* if_list; /* list of interfaces */
     struct sr_rt* routing_table; /* routing table */
     struct sr_arpcache cache;   /* ARP cache */
+    struct sr_transport* transport; /* how frames get in and out, and its state */
+    struct sr_txq* txq; /* transmit queue to server */
+    struct sr_rxring* rx; /* receive slabs from server */
+    struct sr_loop* loop; /* event loop, or 0 for the ARP cache thread */
     pthread_attr_t attr;
     FILE* logfile;
+    int arp_gratuitous; /* update cache from gratuitous ARP requests */
+    char* arp_snapshot; /* file the ARP cache is saved to on shutdown */
+    int ready; /* interfaces known and the ARP cache up (sr_interfaces_ready) */
 };
 
-/* -- sr_main.c -- */
+/* -- sr_rt.c -- */
 int sr_verify_routing_table(struct sr_instance* sr);
 
 /* -- sr_vns_comm.c -- */
 int sr_send_packet(struct sr_instance* , uint8_t* , unsigned int , const char*);
+int sr_send_packet_if(struct sr_instance* , uint8_t* , unsigned int ,
+                      const struct sr_if* );
 int sr_connect_to_server(struct sr_instance* ,unsigned short , char* );
 int sr_read_from_server(struct sr_instance* );
+int sr_read_from_server_ready(struct sr_instance* );
+int sr_handle_buffered(struct sr_instance* );
+void sr_receive_packet(struct sr_instance* , uint8_t* , unsigned int , char* );
+int sr_interfaces_ready(struct sr_instance* );
 
 /* -- sr_router.c -- */
 void sr_init(struct sr_instance* );
 void sr_handlepacket(struct sr_instance* , uint8_t * , unsigned int , char* );
+uint32_t resolve_rt(struct sr_instance* , uint32_t );
+uint32_t to_router(struct sr_instance* , uint32_t );
+struct sr_pktbuf* send_icmp(uint8_t , uint8_t , uint32_t , uint8_t* , uint32_t , uint8_t* );
+void sr_send_icmp_error(struct sr_instance* , struct sr_pkt* , uint8_t , uint8_t ,
+                        uint32_t , uint16_t );
 
 /* -- sr_if.c -- */
 void sr_add_interface(struct sr_instance* , const char* );
@@ -109,6 +109,7 @@ struct in_addr gw, struct in_addr mask,char* if_name)
         sr->routing_table->gw   = gw;
         sr->routing_table->mask = mask;
         strncpy(sr->routing_table->interface,if_name,sr_IFACE_NAMELEN);
+        sr->routing_table->out = sr_get_interface(sr,if_name);
 
         return;
     }
@@ -128,6 +129,7 @@ struct in_addr gw, struct in_addr mask,char* if_name)
     rt_walker->gw   = gw;
     rt_walker->mask = mask;
     strncpy(rt_walker->interface,if_name,sr_IFACE_NAMELEN);
+    rt_walker->out = sr_get_interface(sr,if_name);
 
 } /* -- sr_add_entry -- */
 
@@ -176,3 +178,86 @@ void sr_print_routing_entry(struct sr_rt* entry)
     printf("%s\n",entry->interface);
 
 } /* -- sr_print_routing_entry -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_verify_routing_table()
+ * Scope: Global
+ *
+ * make sure the routing table is consistent with the interface list by
+ * verifying that all interfaces used in the routing table actually exist
+ * in the hardware, and point each entry at its interface so forwarding
+ * need not look it up by name.
+ *
+ * RETURN VALUES:
+ *
+ *  0 on success
+ *  something other than zero on error
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_verify_routing_table(struct sr_instance* sr)
+{
+    struct sr_rt* rt_walker = 0;
+    struct sr_if* if_walker = 0;
+    int ret = 0;
+
+    /* -- REQUIRES --*/
+    assert(sr);
+
+    if( (sr->if_list == 0) || (sr->routing_table == 0))
+    {
+        return 999; /* doh! */
+    }
+
+    rt_walker = sr->routing_table;
+
+    while(rt_walker)
+    {
+        /* -- check to see if interface exists -- */
+        if_walker = sr->if_list;
+        while(if_walker)
+        {
+            if( strncmp(if_walker->name,rt_walker->interface,sr_IFACE_NAMELEN)
+                    == 0)
+            { break; }
+            if_walker = if_walker->next;
+        }
+        if(if_walker == 0)
+        { ret++; } /* -- interface not found! -- */
+        rt_walker->out = if_walker;
+
+        rt_walker = rt_walker->next;
+    } /* -- while -- */
+
+    return ret;
+} /* -- sr_verify_routing_table -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_rt_lookup(..)
+ * Scope:  Global
+ *
+ * The route with the longest prefix matching ip (network order), or 0 if
+ * none does.
+ *
+ *---------------------------------------------------------------------*/
+
+struct sr_rt* sr_rt_lookup(struct sr_instance* sr, uint32_t ip)
+{
+    struct sr_rt* rt_walker = 0;
+    struct sr_rt* best = 0;
+
+    /* -- REQUIRES -- */
+    assert(sr);
+
+    for(rt_walker = sr->routing_table; rt_walker; rt_walker = rt_walker->next)
+    {
+        if((ip & rt_walker->mask.s_addr) != rt_walker->dest.s_addr)
+        { continue; }
+        /* -- masks are contiguous, so a longer one is larger unsigned -- */
+        if(best == 0 ||
+           ntohl(rt_walker->mask.s_addr) > ntohl(best->mask.s_addr))
+        { best = rt_walker; }
+    }
+
+    return best;
+} /* -- sr_rt_lookup -- */
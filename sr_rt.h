@@ -33,6 +33,7 @@ struct sr_rt
     struct in_addr gw;
     struct in_addr mask;
     char   interface[sr_IFACE_NAMELEN];
+    struct sr_if* out; /* interface, once known; 0 until then */
     struct sr_rt* next;
 };
 
@@ -42,6 +43,7 @@ void sr_add_rt_entry(struct sr_instance*, struct in_addr,struct in_addr,
                   struct in_addr, char*);
 void sr_print_routing_table(struct sr_instance* sr);
 void sr_print_routing_entry(struct sr_rt* entry);
+struct sr_rt* sr_rt_lookup(struct sr_instance* sr, uint32_t ip);
 
 
 #endif  /* --  sr_RT_H -- */
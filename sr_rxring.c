@@ -0,0 +1,290 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_rxring.c
+ *
+ * Description:
+ *
+ * Refcounted receive slabs for the VNS connection; see sr_rxring.h.
+ *
+ * The ring always owns one reference on the slab it is reading into. As
+ * long as nobody else holds that slab, a command cut off by the end of a
+ * read is slid back to the front before the next one, as before. Once a
+ * packet in it has been held we only ever append to it, and when it fills
+ * up the partial command is carried over to a fresh slab and the ring lets
+ * go of the old one, which goes back on the free list when the last packet
+ * in it is dropped.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+
+#include "sr_rxring.h"
+
+#define SR_RXRING_CMD_MAX 10000 /* largest command the server may send */
+
+/*---------------------------------------------------------------------
+ * Method: rxring_get(..)
+ * Scope:  Local
+ *
+ * An empty slab from the free list, or a new one.
+ *
+ *---------------------------------------------------------------------*/
+
+static struct sr_rxslab* rxring_get(struct sr_rxring* ring)
+{
+    struct sr_rxslab* slab;
+
+    pthread_mutex_lock(&ring->lock);
+    if((slab = ring->free_list) != 0)
+    { ring->free_list = slab->next; }
+    else
+    {
+        slab = (struct sr_rxslab*)malloc(sizeof(struct sr_rxslab));
+        assert(slab);
+        slab->ring = ring;
+        ring->nslabs++;
+    }
+    pthread_mutex_unlock(&ring->lock);
+
+    slab->refcnt = 1;
+    slab->start  = 0;
+    slab->end    = 0;
+    slab->next   = 0;
+    return slab;
+} /* -- rxring_get -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_rxring_create(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+struct sr_rxring* sr_rxring_create(void)
+{
+    struct sr_rxring* ring;
+
+    ring = (struct sr_rxring*)calloc(1, sizeof(struct sr_rxring));
+    assert(ring);
+    pthread_mutex_init(&ring->lock, 0);
+    ring->cur = rxring_get(ring);
+
+    return ring;
+} /* -- sr_rxring_create -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_rxring_destroy(..)
+ * Scope:  Global
+ *
+ * Frees every slab nobody holds. If packets are still queued somewhere
+ * the ring itself is left alone so they can still be released.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_rxring_destroy(struct sr_rxring* ring)
+{
+    struct sr_rxslab* slab;
+
+    if(!ring)
+    { return; }
+
+    sr_rxslab_put(ring->cur);
+    ring->cur = 0;
+
+    pthread_mutex_lock(&ring->lock);
+    while((slab = ring->free_list) != 0)
+    {
+        ring->free_list = slab->next;
+        ring->nslabs--;
+        free(slab);
+    }
+    pthread_mutex_unlock(&ring->lock);
+
+    if(ring->nslabs == 0)
+    {
+        pthread_mutex_destroy(&ring->lock);
+        free(ring);
+    }
+} /* -- sr_rxring_destroy -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_rxring_reserve(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+uint8_t* sr_rxring_reserve(struct sr_rxring* ring, unsigned int* space)
+{
+    struct sr_rxslab* cur = ring->cur;
+    struct sr_rxslab* next;
+
+    if(__atomic_load_n(&cur->refcnt, __ATOMIC_ACQUIRE) == 1)
+    {
+        /* -- nobody else is looking: slide the partial command up front -- */
+        if(cur->start > 0)
+        {
+            memmove(cur->data, cur->data + cur->start, cur->end - cur->start);
+            cur->end  -= cur->start;
+            cur->start = 0;
+        }
+    }
+    else if(SR_RXSLAB_SZ - cur->end < SR_RXRING_CMD_MAX)
+    {
+        /* -- held and nearly full: carry the partial command over -- */
+        next = rxring_get(ring);
+        memcpy(next->data, cur->data + cur->start, cur->end - cur->start);
+        next->end = cur->end - cur->start;
+        ring->cur = next;
+        ring->stats.switches++;
+        sr_rxslab_put(cur);
+        cur = next;
+    }
+
+    *space = SR_RXSLAB_SZ - cur->end;
+    return cur->data + cur->end;
+} /* -- sr_rxring_reserve -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_rxring_commit(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_rxring_commit(struct sr_rxring* ring, unsigned int len)
+{
+    ring->cur->end += len;
+    ring->stats.reads++;
+    ring->stats.bytes += len;
+} /* -- sr_rxring_commit -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_rxring_fill(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_rxring_fill(struct sr_rxring* ring, int fd)
+{
+    uint8_t* p;
+    unsigned int space;
+    int ret;
+
+    p = sr_rxring_reserve(ring, &space);
+
+    do
+    { /* -- just in case SIGALRM breaks read -- */
+        errno = 0; /* -- hacky glibc workaround -- */
+        ret = read(fd, p, space);
+    } while ( ret == -1 && errno == EINTR); /* be mindful of signals */
+
+    if(ret == -1)
+    {
+        perror("read(..):sr_rxring.c::sr_rxring_fill");
+        return -1;
+    }
+    if(ret == 0)
+    {
+        fprintf(stderr,"Error: server closed the connection\n");
+        return -1;
+    }
+
+    sr_rxring_commit(ring, ret);
+    return ret;
+} /* -- sr_rxring_fill -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_rxring_next(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+uint8_t* sr_rxring_next(struct sr_rxring* ring, int* len)
+{
+    struct sr_rxslab* cur = ring->cur;
+    uint8_t* cmd;
+    uint32_t len_nbo;
+
+    *len = 0;
+    if(cur->end - cur->start < 4)
+    { return 0; }
+
+    memcpy(&len_nbo, cur->data + cur->start, 4);
+    *len = ntohl(len_nbo);
+
+    if ( *len > SR_RXRING_CMD_MAX || *len < 8 )
+    {
+        fprintf(stderr,"Error: command length to large %d\n",*len);
+        *len = -1;
+        return 0;
+    }
+
+    if(cur->end - cur->start < (unsigned int)*len)
+    { return 0; }
+
+    cmd = cur->data + cur->start;
+    cur->start += *len;
+    return cmd;
+} /* -- sr_rxring_next -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_rxring_hold(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+struct sr_rxslab* sr_rxring_hold(struct sr_rxring* ring, const uint8_t* p)
+{
+    struct sr_rxslab* cur;
+
+    if(!ring)
+    { return 0; }
+
+    cur = ring->cur;
+    if(p < cur->data || p >= cur->data + cur->end)
+    { return 0; }
+
+    /* -- don't let a backlog of held packets eat all our memory -- */
+    if(ring->nslabs >= SR_RXRING_MAX && ring->free_list == 0)
+    {
+        ring->stats.refused++;
+        return 0;
+    }
+
+    __atomic_add_fetch(&cur->refcnt, 1, __ATOMIC_ACQ_REL);
+    ring->stats.holds++;
+    return cur;
+} /* -- sr_rxring_hold -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_rxslab_put(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_rxslab_put(struct sr_rxslab* slab)
+{
+    struct sr_rxring* ring;
+
+    if(!slab || __atomic_sub_fetch(&slab->refcnt, 1, __ATOMIC_ACQ_REL) != 0)
+    { return; }
+
+    ring = slab->ring;
+    pthread_mutex_lock(&ring->lock);
+    slab->next = ring->free_list;
+    ring->free_list = slab;
+    pthread_mutex_unlock(&ring->lock);
+} /* -- sr_rxslab_put -- */
+
+void sr_rxring_print_stats(struct sr_rxring* ring, FILE* fp)
+{
+    struct sr_rxring_stats* st = &ring->stats;
+
+    fprintf(fp, "Receive ring: %lu bytes in %lu reads, %u slabs, "
+            "%lu packets held (%lu refused), %lu slab switches\n",
+            st->bytes, st->reads, ring->nslabs, st->holds, st->refused,
+            st->switches);
+} /* -- sr_rxring_print_stats -- */
@@ -0,0 +1,94 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_rxring.h
+ *
+ * Description:
+ *
+ * Receive buffers for the connection to the VNS server.
+ *
+ * Commands are read into large slabs and decoded in place, and packets are
+ * handed to the router where they lie. A packet that has to outlive the
+ * call to sr_handlepacket (one waiting on ARP, say) takes a reference on
+ * its slab instead of being copied; a slab is only written into again once
+ * every such reference has been dropped. Slabs are recycled through a free
+ * list, so once the ring has grown to its working size, receiving a packet
+ * involves no allocation and no copy of the payload.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_RXRING_H
+#define SR_RXRING_H
+
+#include <stdio.h>
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+#include <pthread.h>
+
+#define SR_RXSLAB_SZ  (64*1024) /* must hold the largest command (10000) */
+#define SR_RXRING_MAX 64        /* slabs before holds fall back to copying */
+
+struct sr_rxring;
+
+struct sr_rxslab
+{
+    struct sr_rxring* ring;     /* owner, for returning to the free list */
+    int refcnt;                 /* the ring's own, plus one per hold */
+    unsigned int start;         /* first byte not yet decoded */
+    unsigned int end;           /* one past the last byte read */
+    struct sr_rxslab* next;     /* free list */
+    uint8_t data[SR_RXSLAB_SZ];
+};
+
+struct sr_rxring_stats
+{
+    unsigned long reads;        /* read() calls that returned data */
+    unsigned long bytes;        /* bytes read */
+    unsigned long switches;     /* times the current slab was still held */
+    unsigned long holds;        /* packets kept by reference */
+    unsigned long refused;      /* holds refused, ring at SR_RXRING_MAX */
+};
+
+struct sr_rxring
+{
+    struct sr_rxslab* cur;      /* slab being read into */
+    struct sr_rxslab* free_list;
+    unsigned int nslabs;        /* slabs allocated in all */
+    pthread_mutex_t lock;       /* protects free_list and nslabs */
+    struct sr_rxring_stats stats;
+};
+
+struct sr_rxring* sr_rxring_create(void);
+void sr_rxring_destroy(struct sr_rxring* ring);
+
+/* Read whatever fd has for us, blocking until there is something. Returns
+   the number of bytes read, or -1 on error or if the peer hung up. */
+int sr_rxring_fill(struct sr_rxring* ring, int fd);
+
+/* For filling the ring some other way than read(): room for at least one
+   more command is made at the end of the current slab, and its address and
+   size returned. sr_rxring_commit then appends the len bytes written there. */
+uint8_t* sr_rxring_reserve(struct sr_rxring* ring, unsigned int* space);
+void sr_rxring_commit(struct sr_rxring* ring, unsigned int len);
+
+/* Next complete length-prefixed command, decoded in place, or 0 if more has
+   to be read first. *len is its length, or -1 if the stream is garbage. The
+   command is valid until the next sr_rxring_fill unless its slab is held. */
+uint8_t* sr_rxring_next(struct sr_rxring* ring, int* len);
+
+/* Take a reference on the slab holding p so it can be kept past the next
+   fill. Returns 0 if p isn't in the ring or the ring is too big already, in
+   which case the caller should copy. */
+struct sr_rxslab* sr_rxring_hold(struct sr_rxring* ring, const uint8_t* p);
+
+/* Drop a reference taken by sr_rxring_hold. Safe from any thread. */
+void sr_rxslab_put(struct sr_rxslab* slab);
+
+void sr_rxring_print_stats(struct sr_rxring* ring, FILE* fp);
+
+#endif /* -- SR_RXRING_H -- */
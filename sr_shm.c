@@ -0,0 +1,413 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_shm.c
+ *
+ * Description:
+ *
+ * Shared-memory transport; see sr_shm.h and sr_shmring.h.
+ *
+ * The router consumes the to_router ring and produces into from_router.
+ * Only this thread consumes, so the receive side needs no lock; the
+ * transmit side takes tx_lock because without the event loop the ARP
+ * thread sends as well.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "sr_shm.h"
+#include "sr_shmring.h"
+#include "sr_router.h"
+#include "sr_if.h"
+#include "sr_loop.h"
+#include "sr_transport.h"
+#include "vnscommand.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SHM_RELAX() __builtin_ia32_pause()
+#else
+#define SHM_RELAX() __asm__ __volatile__("" ::: "memory")
+#endif
+
+/*---------------------------------------------------------------------
+ * Method: sr_shm_open(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+struct sr_shm* sr_shm_open(struct sr_instance* sr, const char* path)
+{
+    struct sr_shm* shm;
+    struct sockaddr_un addr;
+    struct sr_shm_if* sif;
+    int fd;
+    unsigned int i;
+
+    /* REQUIRES */
+    assert(sr);
+    assert(path);
+
+    if(strlen(path) >= sizeof(addr.sun_path))
+    {
+        fprintf(stderr, "Error: socket path %s too long\n", path);
+        return 0;
+    }
+
+    shm = (struct sr_shm*)calloc(1, sizeof(struct sr_shm));
+    assert(shm);
+    shm->sr = sr;
+    pthread_mutex_init(&shm->tx_lock, 0);
+
+    if((shm->sock = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+    {
+        perror("socket(..):sr_shm.c::sr_shm_open");
+        sr_shm_close(shm);
+        return 0;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    if(connect(shm->sock, (struct sockaddr*)&addr, sizeof(addr)) < 0)
+    {
+        perror("connect(..):sr_shm.c::sr_shm_open");
+        sr_shm_close(shm);
+        return 0;
+    }
+
+    if((fd = sr_shm_recv_fd(shm->sock)) < 0)
+    {
+        sr_shm_close(shm);
+        return 0;
+    }
+    shm->seg = (struct sr_shm_seg*)mmap(0, sizeof(struct sr_shm_seg),
+            PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(shm->seg == MAP_FAILED)
+    {
+        shm->seg = 0;
+        perror("mmap(..):sr_shm.c::sr_shm_open");
+        sr_shm_close(shm);
+        return 0;
+    }
+    if(shm->seg->magic != SR_SHM_MAGIC || shm->seg->nifs > SR_SHM_IFS_MAX)
+    {
+        fprintf(stderr, "Error: %s doesn't look like an sr_emu segment\n", path);
+        sr_shm_close(shm);
+        return 0;
+    }
+
+    /* -- from here on the socket is only a doorbell -- */
+    fcntl(shm->sock, F_SETFL, fcntl(shm->sock, F_GETFL) | O_NONBLOCK);
+
+    shm->rx_tail = __atomic_load_n(&shm->seg->to_router.tail, __ATOMIC_ACQUIRE);
+    shm->tx_head = shm->tx_published =
+        __atomic_load_n(&shm->seg->from_router.head, __ATOMIC_ACQUIRE);
+
+    /* -- as sr_handle_hwinfo does for interfaces the server tells us of -- */
+    for(i = 0; i < shm->seg->nifs; i++)
+    {
+        sif = &shm->seg->ifs[i];
+        sif->name[sr_IFACE_NAMELEN - 1] = 0;
+        sr_add_interface(sr, sif->name);
+        sr_set_ether_addr(sr, sif->addr);
+        sr_set_ether_ip(sr, sif->ip);
+    }
+    printf("Router interfaces:\n");
+    sr_print_if_list(sr);
+
+    return shm;
+} /* -- sr_shm_open -- */
+
+/*---------------------------------------------------------------------
+ * Method: shm_flush(..)
+ * Scope:  Local
+ *
+ * Publish every frame queued on from_router.
+ *
+ *---------------------------------------------------------------------*/
+
+static void shm_flush(struct sr_shm* shm)
+{
+    pthread_mutex_lock(&shm->tx_lock);
+    if(shm->tx_head != shm->tx_published)
+    {
+        if(sr_shmring_publish(&shm->seg->from_router, shm->tx_head, shm->sock))
+        { shm->stats.tx_doorbells++; }
+        shm->tx_published = shm->tx_head;
+    }
+    pthread_mutex_unlock(&shm->tx_lock);
+} /* -- shm_flush -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_shm_close(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_shm_close(struct sr_shm* shm)
+{
+    if(!shm)
+    { return; }
+
+    if(shm->seg)
+    {
+        shm_flush(shm);
+        munmap(shm->seg, sizeof(struct sr_shm_seg));
+    }
+    if(shm->sock >= 0)
+    { close(shm->sock); }
+    pthread_mutex_destroy(&shm->tx_lock);
+    free(shm);
+} /* -- sr_shm_close -- */
+
+/*---------------------------------------------------------------------
+ * Method: shm_rx(..)
+ * Scope:  Local
+ *
+ * Handle everything on to_router, one burst at a time, until it has been
+ * empty for SR_SHM_SPIN polls.
+ *
+ *---------------------------------------------------------------------*/
+
+static void shm_rx(struct sr_shm* shm)
+{
+    struct sr_shm_ring* ring = &shm->seg->to_router;
+    char iface[sizeof(((c_packet_header*)0)->mInterfaceName) + 1];
+    uint8_t* frame;
+    uint32_t n;
+    int len, spin = 0;
+
+    while(spin < SR_SHM_SPIN)
+    {
+        if((n = sr_shmring_ready(ring, shm->rx_tail)) == 0)
+        {
+            SHM_RELAX();
+            spin++;
+            continue;
+        }
+
+        __atomic_add_fetch(&shm->corked, 1, __ATOMIC_SEQ_CST);
+        for(; n > 0; n--, shm->rx_tail++)
+        {
+            len = sr_shmring_get(sr_shmring_slot(ring, shm->rx_tail),
+                                 &frame, iface);
+            if(len < 0)
+            {
+                shm->stats.rx_errors++;
+                continue;
+            }
+            shm->stats.rx_packets++;
+            shm->stats.rx_bytes += len;
+            sr_receive_packet(shm->sr, frame, len, iface);
+        }
+        __atomic_sub_fetch(&shm->corked, 1, __ATOMIC_SEQ_CST);
+
+        sr_shmring_release(ring, shm->rx_tail);
+        shm->stats.rx_bursts++;
+
+        /* -- whatever the burst made us send, before we spin -- */
+        shm_flush(shm);
+        spin = 0;
+    }
+} /* -- shm_rx -- */
+
+/*---------------------------------------------------------------------
+ * Method: shm_service(..)
+ * Scope:  Local
+ *
+ * The doorbell rang (or might have). Take the rings until there is
+ * nothing left and we are safely asleep. Returns 0 if the emulator hung
+ * up, 1 otherwise.
+ *
+ *---------------------------------------------------------------------*/
+
+static int shm_service(struct sr_shm* shm)
+{
+    char bells[64];
+    int n;
+
+    while((n = read(shm->sock, bells, sizeof(bells))) > 0)
+    { }
+    if(n == 0 || (errno != EAGAIN && errno != EINTR))
+    {
+        fprintf(stderr, "Emulator closed the session\n");
+        return 0;
+    }
+
+    do
+    { shm_rx(shm); }
+    while(!sr_shmring_sleep(&shm->seg->to_router, shm->rx_tail));
+    shm->stats.rx_sleeps++;
+
+    return 1;
+} /* -- shm_service -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_shm_watch(..), sr_shm_poll(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+static void shm_ready(struct sr_loop* loop, int fd, void* arg)
+{
+    if(shm_service((struct sr_shm*)arg) != 1)
+    { sr_loop_stop(loop); }
+} /* -- shm_ready -- */
+
+int sr_shm_watch(struct sr_shm* shm, struct sr_loop* loop)
+{
+    /* -- anything sent before we were listening -- */
+    if(shm_service(shm) != 1)
+    { return -1; }
+    return sr_loop_add_fd(loop, shm->sock, shm_ready, shm);
+} /* -- sr_shm_watch -- */
+
+int sr_shm_poll(struct sr_shm* shm, int timeout_ms)
+{
+    struct pollfd pfd;
+
+    pfd.fd = shm->sock;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+
+    /* -- asleep on the ring means it was empty when we last looked -- */
+    if(__atomic_load_n(&shm->seg->to_router.sleeping, __ATOMIC_SEQ_CST) &&
+       poll(&pfd, 1, timeout_ms) < 0)
+    {
+        if(errno == EINTR)
+        { return 1; }
+        perror("poll(..):sr_shm.c::sr_shm_poll");
+        return -1;
+    }
+    return shm_service(shm);
+} /* -- sr_shm_poll -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_shm_send(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_shm_send(struct sr_shm* shm, const struct sr_frame* frames, int n)
+{
+    struct sr_shm_ring* ring = &shm->seg->from_router;
+    int i;
+
+    pthread_mutex_lock(&shm->tx_lock);
+    for(i = 0; i < n; i++)
+    {
+        if(sr_shmring_space(ring, shm->tx_head) == 0)
+        {
+            /* -- let the emulator at what we have; it may catch up -- */
+            if(sr_shmring_publish(ring, shm->tx_head, shm->sock))
+            { shm->stats.tx_doorbells++; }
+            shm->tx_published = shm->tx_head;
+            if(sr_shmring_space(ring, shm->tx_head) == 0)
+            {
+                shm->stats.tx_full += n - i;
+                break;
+            }
+        }
+        if(sr_shmring_put(sr_shmring_slot(ring, shm->tx_head), frames[i].buf,
+                          frames[i].len, frames[i].iface->name) < 0)
+        {
+            fprintf(stderr, "Error: %u byte frame too big for the ring\n",
+                    frames[i].len);
+            break;
+        }
+        shm->tx_head++;
+        shm->stats.tx_packets++;
+        shm->stats.tx_bytes += frames[i].len;
+    }
+
+    if(__atomic_load_n(&shm->corked, __ATOMIC_SEQ_CST) == 0 ||
+       shm->tx_head - shm->tx_published >= SR_SHM_TX_BATCH)
+    {
+        if(sr_shmring_publish(ring, shm->tx_head, shm->sock))
+        { shm->stats.tx_doorbells++; }
+        shm->tx_published = shm->tx_head;
+    }
+    pthread_mutex_unlock(&shm->tx_lock);
+
+    return i;
+} /* -- sr_shm_send -- */
+
+void sr_shm_print_stats(struct sr_shm* shm, FILE* fp)
+{
+    struct sr_shm_stats* st = &shm->stats;
+
+    fprintf(fp, "Shared memory: received %lu frames (%lu bytes) in %lu "
+            "bursts, slept %lu times, %lu bad slots; sent %lu frames (%lu "
+            "bytes), rang the emulator %lu times, %lu dropped on a full "
+            "ring\n", st->rx_packets, st->rx_bytes, st->rx_bursts,
+            st->rx_sleeps, st->rx_errors, st->tx_packets, st->tx_bytes,
+            st->tx_doorbells, st->tx_full);
+} /* -- sr_shm_print_stats -- */
+
+/*---------------------------------------------------------------------
+ * The shared-memory transport (sr_transport.h); spec is the emulator's
+ * socket.
+ *---------------------------------------------------------------------*/
+
+static int shm_connect(struct sr_instance* sr, const char* spec)
+{
+    return (sr->transport->state = sr_shm_open(sr, spec)) != 0 ? 0 : -1;
+} /* -- shm_connect -- */
+
+static int shm_interfaces(struct sr_instance* sr)
+{
+    /* -- they come in the segment -- */
+    return 1;
+} /* -- shm_interfaces -- */
+
+static int shm_watch(struct sr_instance* sr, struct sr_loop* loop)
+{
+    return sr_shm_watch(sr->transport->state, loop);
+} /* -- shm_watch -- */
+
+static int shm_recv_burst(struct sr_instance* sr, int wait)
+{
+    return sr_shm_poll(sr->transport->state, wait ? -1 : 0);
+} /* -- shm_recv_burst -- */
+
+static int shm_send_burst(struct sr_instance* sr,
+        const struct sr_frame* frames, int n)
+{
+    return sr_shm_send(sr->transport->state, frames, n);
+} /* -- shm_send_burst -- */
+
+static void shm_print_stats(struct sr_instance* sr, FILE* fp)
+{
+    sr_shm_print_stats(sr->transport->state, fp);
+} /* -- shm_print_stats -- */
+
+static void shm_close(struct sr_instance* sr)
+{
+    if(sr->transport->state)
+    {
+        sr_shm_print_stats(sr->transport->state, stderr);
+        sr_shm_close(sr->transport->state);
+        sr->transport->state = 0;
+    }
+} /* -- shm_close -- */
+
+const struct sr_transport sr_shm_transport =
+{
+    "shm",
+    shm_connect,
+    shm_interfaces,
+    shm_watch,
+    shm_recv_burst,
+    shm_send_burst,
+    shm_print_stats,
+    shm_close
+};
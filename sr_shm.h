@@ -0,0 +1,80 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_shm.h
+ *
+ * Description:
+ *
+ * Shared-memory transport (-i shm:path): trade frames with a local
+ * emulator (sr_emu) through the rings in sr_shmring.h instead of a TCP
+ * session with the VNS server. path is the emulator's unix socket.
+ *
+ * Received frames are handed to sr_receive_packet where they lie in the
+ * ring, and their slots only go back to the emulator once the whole burst
+ * has been handled. Before going to sleep the router spins on the ring for
+ * up to SR_SHM_SPIN polls, so under load it never touches the doorbell.
+ * Frames sent while a burst is handled are published together at the end
+ * of it, or every SR_SHM_TX_BATCH frames.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_SHM_H
+#define SR_SHM_H
+
+#include <stdio.h>
+#include <pthread.h>
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#define SR_SHM_SPIN      4096   /* empty polls before sleeping */
+#define SR_SHM_TX_BATCH  32     /* publish after this many */
+
+struct sr_instance;
+struct sr_loop;
+struct sr_frame;
+struct sr_shm_seg;
+
+struct sr_shm_stats
+{
+    unsigned long rx_packets;
+    unsigned long rx_bytes;
+    unsigned long rx_bursts;    /* batches of slots handled */
+    unsigned long rx_sleeps;    /* times we went to sleep on the doorbell */
+    unsigned long rx_errors;    /* slots that weren't a VNSPACKET */
+    unsigned long tx_packets;
+    unsigned long tx_bytes;
+    unsigned long tx_doorbells; /* times we had to wake the emulator */
+    unsigned long tx_full;      /* frames dropped on a full ring */
+};
+
+struct sr_shm
+{
+    struct sr_instance* sr;
+    int sock;                   /* doorbell to and from the emulator */
+    struct sr_shm_seg* seg;
+    uint32_t rx_tail;           /* next slot to handle */
+    uint32_t tx_head;           /* next slot to fill */
+    uint32_t tx_published;      /* slots before this are the emulator's */
+    int corked;                 /* > 0 while a receive burst is handled */
+    pthread_mutex_t tx_lock;    /* the ARP thread may send too */
+    struct sr_shm_stats stats;
+};
+
+/* Connect to the emulator at path, map the segment and add its interfaces
+   to the router's list. Returns 0 on error. */
+struct sr_shm* sr_shm_open(struct sr_instance* sr, const char* path);
+void sr_shm_close(struct sr_shm* shm);
+
+/* Have the event loop watch the doorbell. */
+int sr_shm_watch(struct sr_shm* shm, struct sr_loop* loop);
+
+/* Without an event loop: wait up to timeout_ms for frames and handle them.
+   Returns 1 to keep going, 0 if the emulator went away, -1 on error. */
+int sr_shm_poll(struct sr_shm* shm, int timeout_ms);
+
+/* Send n frames. Returns the number sent. */
+int sr_shm_send(struct sr_shm* shm, const struct sr_frame* frames, int n);
+
+void sr_shm_print_stats(struct sr_shm* shm, FILE* fp);
+
+#endif /* -- SR_SHM_H -- */
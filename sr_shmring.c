@@ -0,0 +1,201 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_shmring.c
+ *
+ * Description:
+ *
+ * Shared-memory frame rings; see sr_shmring.h.
+ *
+ * Indices run freely and wrap at 2^32; a slot is idx & (SR_SHM_SLOTS - 1).
+ * The producer's head store is a release, so whoever sees the new head
+ * also sees the slots before it, and likewise for the consumer's tail.
+ *
+ * The sleeping flag closes the usual lost-wakeup race with a full fence on
+ * each side: the consumer stores the flag and then loads head, while the
+ * producer stores head and then loads the flag. At least one of them sees
+ * the other's store, so either the consumer doesn't sleep or the producer
+ * rings.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "sr_shmring.h"
+#include "vnscommand.h"
+
+/*---------------------------------------------------------------------
+ * Method: sr_shmring_slot(..), sr_shmring_space(..), sr_shmring_put(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+uint8_t* sr_shmring_slot(struct sr_shm_ring* ring, uint32_t idx)
+{
+    return ring->slots[idx & (SR_SHM_SLOTS - 1)];
+} /* -- sr_shmring_slot -- */
+
+uint32_t sr_shmring_space(struct sr_shm_ring* ring, uint32_t head)
+{
+    return SR_SHM_SLOTS -
+        (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE));
+} /* -- sr_shmring_space -- */
+
+int sr_shmring_put(uint8_t* slot, const uint8_t* frame, unsigned int len,
+        const char* iface)
+{
+    c_packet_header* hdr = (c_packet_header*)slot;
+
+    if(len > SR_SHM_SLOT_SZ - sizeof(c_packet_header))
+    { return -1; }
+
+    hdr->mLen  = htonl(len + sizeof(c_packet_header));
+    hdr->mType = htonl(VNSPACKET);
+    memset(hdr->mInterfaceName, 0, sizeof(hdr->mInterfaceName));
+    strncpy(hdr->mInterfaceName, iface, sizeof(hdr->mInterfaceName));
+    memcpy(slot + sizeof(c_packet_header), frame, len);
+    return 0;
+} /* -- sr_shmring_put -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_shmring_publish(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_shmring_publish(struct sr_shm_ring* ring, uint32_t head, int fd)
+{
+    char bell = 1;
+
+    __atomic_store_n(&ring->head, head, __ATOMIC_SEQ_CST);
+    if(__atomic_load_n(&ring->sleeping, __ATOMIC_SEQ_CST) == 0 ||
+       __atomic_exchange_n(&ring->sleeping, 0, __ATOMIC_SEQ_CST) == 0)
+    { return 0; }
+
+    /* -- a full socket already has a wakeup in it -- */
+    if(write(fd, &bell, 1) < 0 && errno != EAGAIN)
+    { perror("write(..):sr_shmring.c::sr_shmring_publish"); }
+    return 1;
+} /* -- sr_shmring_publish -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_shmring_ready(..), sr_shmring_release(..),
+ *         sr_shmring_sleep(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+uint32_t sr_shmring_ready(struct sr_shm_ring* ring, uint32_t tail)
+{
+    return __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) - tail;
+} /* -- sr_shmring_ready -- */
+
+void sr_shmring_release(struct sr_shm_ring* ring, uint32_t tail)
+{
+    __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+} /* -- sr_shmring_release -- */
+
+int sr_shmring_sleep(struct sr_shm_ring* ring, uint32_t tail)
+{
+    __atomic_store_n(&ring->sleeping, 1, __ATOMIC_SEQ_CST);
+    if(__atomic_load_n(&ring->head, __ATOMIC_SEQ_CST) == tail)
+    { return 1; }
+
+    /* -- more came in; whether or not the producer saw the flag, we may
+          get a spurious doorbell later, which is harmless -- */
+    __atomic_store_n(&ring->sleeping, 0, __ATOMIC_SEQ_CST);
+    return 0;
+} /* -- sr_shmring_sleep -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_shmring_get(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_shmring_get(uint8_t* slot, uint8_t** frame, char* iface)
+{
+    c_packet_header* hdr = (c_packet_header*)slot;
+    uint32_t len = ntohl(hdr->mLen);
+
+    if(ntohl(hdr->mType) != VNSPACKET || len < sizeof(c_packet_header) ||
+       len > SR_SHM_SLOT_SZ)
+    { return -1; }
+
+    memcpy(iface, hdr->mInterfaceName, sizeof(hdr->mInterfaceName));
+    iface[sizeof(hdr->mInterfaceName)] = 0;
+    *frame = slot + sizeof(c_packet_header);
+    return len - sizeof(c_packet_header);
+} /* -- sr_shmring_get -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_shm_send_fd(..), sr_shm_recv_fd(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_shm_send_fd(int sock, int fd)
+{
+    struct msghdr msg;
+    struct cmsghdr* cmsg;
+    struct iovec iov;
+    char cbuf[CMSG_SPACE(sizeof(int))];
+    char byte = 0;
+
+    memset(&msg, 0, sizeof(msg));
+    memset(cbuf, 0, sizeof(cbuf));
+    iov.iov_base = &byte;
+    iov.iov_len = 1;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = cbuf;
+    msg.msg_controllen = sizeof(cbuf);
+
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+
+    if(sendmsg(sock, &msg, 0) != 1)
+    {
+        perror("sendmsg(..):sr_shmring.c::sr_shm_send_fd");
+        return -1;
+    }
+    return 0;
+} /* -- sr_shm_send_fd -- */
+
+int sr_shm_recv_fd(int sock)
+{
+    struct msghdr msg;
+    struct cmsghdr* cmsg;
+    struct iovec iov;
+    char cbuf[CMSG_SPACE(sizeof(int))];
+    char byte;
+    int fd;
+
+    memset(&msg, 0, sizeof(msg));
+    iov.iov_base = &byte;
+    iov.iov_len = 1;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = cbuf;
+    msg.msg_controllen = sizeof(cbuf);
+
+    if(recvmsg(sock, &msg, 0) != 1)
+    {
+        perror("recvmsg(..):sr_shmring.c::sr_shm_recv_fd");
+        return -1;
+    }
+    cmsg = CMSG_FIRSTHDR(&msg);
+    if(!cmsg || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+    {
+        fprintf(stderr, "Error: no segment came with the handshake\n");
+        return -1;
+    }
+    memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+    return fd;
+} /* -- sr_shm_recv_fd -- */
@@ -0,0 +1,101 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_shmring.h
+ *
+ * Description:
+ *
+ * A shared-memory segment through which the router and a local stand-in
+ * for the VNS server (sr_emu) pass frames, without a socket in between.
+ *
+ * The segment holds the router's interfaces, as the server would send them
+ * in a VNSHWINFO, and two single-producer/single-consumer rings, one each
+ * way. Every ring slot holds one VNSPACKET: a c_packet_header (length,
+ * type, interface name) followed by the ethernet frame, exactly as it
+ * would travel over the TCP session. The producer fills slots and then
+ * publishes its head index; the consumer handles slots in place and then
+ * publishes its tail. Neither side makes a system call per frame.
+ *
+ * The emulator creates the segment as a memfd and listens on a unix
+ * socket. The router connects and is handed the memfd over that socket
+ * (SCM_RIGHTS). From then on the socket only serves as a doorbell: a
+ * consumer that has run out of frames sets its ring's sleeping flag,
+ * checks once more, and waits for the socket to become readable; a
+ * producer that finds the flag set clears it and writes a byte. Either
+ * side going away shows up as the socket closing.
+ *
+ * This file has no router dependencies so that sr_emu can link it too.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_SHMRING_H
+#define SR_SHMRING_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#include "sr_protocol.h"
+
+#define SR_SHM_MAGIC     0x53524d31     /* "SRM1" */
+#define SR_SHM_SLOTS     1024           /* per ring, power of two */
+#define SR_SHM_SLOT_SZ   2048           /* c_packet_header and frame */
+#define SR_SHM_IFS_MAX   8
+#define SR_SHM_CACHELINE 64
+
+struct sr_shm_if
+{
+    char name[sr_IFACE_NAMELEN];
+    unsigned char addr[ETHER_ADDR_LEN];
+    uint32_t ip;                        /* network byte order */
+};
+
+/* head and tail sit on their own cache lines so that the two sides don't
+   keep stealing each other's. */
+struct sr_shm_ring
+{
+    uint32_t head;                      /* written by the producer only */
+    uint8_t  pad0[SR_SHM_CACHELINE - sizeof(uint32_t)];
+    uint32_t tail;                      /* written by the consumer only */
+    uint32_t sleeping;                  /* consumer waits on the doorbell */
+    uint8_t  pad1[SR_SHM_CACHELINE - 2 * sizeof(uint32_t)];
+    uint8_t  slots[SR_SHM_SLOTS][SR_SHM_SLOT_SZ];
+};
+
+struct sr_shm_seg
+{
+    uint32_t magic;
+    uint32_t nifs;
+    struct sr_shm_if ifs[SR_SHM_IFS_MAX];
+    uint8_t  pad[SR_SHM_CACHELINE];
+    struct sr_shm_ring to_router;
+    struct sr_shm_ring from_router;
+};
+
+/* Producer side: a frame goes into slot sr_shmring_slot(ring, head + n)
+   for the n-th frame since the last publish. */
+uint8_t* sr_shmring_slot(struct sr_shm_ring* ring, uint32_t idx);
+uint32_t sr_shmring_space(struct sr_shm_ring* ring, uint32_t head);
+/* Fill in a slot's c_packet_header and copy the frame in. */
+int sr_shmring_put(uint8_t* slot, const uint8_t* frame, unsigned int len,
+                   const char* iface);
+/* Make every slot before head visible. Returns 1 if the consumer was
+   asleep and the doorbell on fd was rung. */
+int sr_shmring_publish(struct sr_shm_ring* ring, uint32_t head, int fd);
+
+/* Consumer side: the number of slots from tail on that are ready. */
+uint32_t sr_shmring_ready(struct sr_shm_ring* ring, uint32_t tail);
+/* Hand slots before tail back to the producer. */
+void sr_shmring_release(struct sr_shm_ring* ring, uint32_t tail);
+/* About to wait on the doorbell: returns 1 if it is safe to, 0 if frames
+   arrived in the meantime. */
+int sr_shmring_sleep(struct sr_shm_ring* ring, uint32_t tail);
+
+/* Split a slot back into the frame and a NUL-terminated interface name.
+   Returns the frame length, or -1 if the slot isn't a VNSPACKET. */
+int sr_shmring_get(uint8_t* slot, uint8_t** frame, char* iface);
+
+/* Pass the segment's fd over a unix socket, and take it at the other end.
+   sr_shm_recv_fd returns -1 on error. */
+int sr_shm_send_fd(int sock, int fd);
+int sr_shm_recv_fd(int sock);
+
+#endif /* -- SR_SHMRING_H -- */
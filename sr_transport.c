@@ -0,0 +1,62 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_transport.c
+ *
+ * Description:
+ *
+ * The table of transports -i can pick from; see sr_transport.h.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "sr_transport.h"
+
+static const struct sr_transport* transports[] =
+{
+    &sr_vns_transport,
+    &sr_afpacket_transport,
+    &sr_xdp_transport,
+    &sr_shm_transport,
+    &sr_replay_transport,
+    0
+};
+
+/*---------------------------------------------------------------------
+ * Method: sr_transport_find(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+const struct sr_transport* sr_transport_find(const char* name)
+{
+    int i;
+
+    for(i = 0; transports[i]; i++)
+    {
+        if(strcmp(transports[i]->name, name) == 0)
+        { return transports[i]; }
+    }
+    return 0;
+} /* -- sr_transport_find -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_transport_create(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+struct sr_transport* sr_transport_create(const struct sr_transport* template)
+{
+    struct sr_transport* t;
+
+    /* REQUIRES */
+    assert(template);
+
+    t = (struct sr_transport*)malloc(sizeof(struct sr_transport));
+    assert(t);
+    *t = *template;
+    t->state = 0;
+    return t;
+} /* -- sr_transport_create -- */
@@ -0,0 +1,95 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_transport.h
+ *
+ * Description:
+ *
+ * How frames get in and out of the router. Everything from
+ * sr_send_packet down, and everything up to sr_receive_packet, goes
+ * through one of these, so the forwarding code never knows which it is
+ * talking to:
+ *
+ *   vns      the TCP session with the VNS server (sr_vns_comm.c), over
+ *            read()/writev() or io_uring (-i uring, -i sqpoll)
+ *   packet   AF_PACKET rings on Linux interfaces (sr_afpacket.c)
+ *   xdp      AF_XDP sockets on Linux interfaces (sr_xdp.c)
+ *   shm      shared-memory rings to a local emulator (sr_shm.c)
+ *   replay   a pcap fed straight to sr_handlepacket (sr_replay.c)
+ *
+ * -i name:spec picks one and hands it spec. The tables below are
+ * templates: the router runs on its own copy (sr_transport_create), and
+ * connect leaves whatever the backend needs in the copy's state, so
+ * sr_instance knows nothing about any of them. The VNS session's transmit
+ * queue and receive ring stay on sr_instance (sr->txq, sr->rx), since the
+ * router holds received packets in the ring.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_TRANSPORT_H
+#define SR_TRANSPORT_H
+
+#include <stdio.h>
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#include "sr_protocol.h"
+
+struct sr_instance;
+struct sr_loop;
+struct sr_if;
+
+/* One frame to send: ethernet header and all. */
+struct sr_frame
+{
+    const uint8_t* buf;
+    unsigned int len;
+    const struct sr_if* iface;
+};
+
+struct sr_transport
+{
+    const char* name;
+
+    /* Set up the transport. Returns 0 on success. */
+    int  (*connect)(struct sr_instance* sr, const char* spec);
+
+    /* Interface discovery. Returns 1 if connect has filled in the
+       interface list, 0 if it arrives later on the receive path (and
+       sr_interfaces_ready is called from there), -1 on error. */
+    int  (*interfaces)(struct sr_instance* sr);
+
+    /* Have the event loop call us when there is something to receive. */
+    int  (*watch)(struct sr_instance* sr, struct sr_loop* loop);
+
+    /* Handle one burst of received frames, waiting for one first if wait
+       is set. Returns 1 to keep going, 0 if the other end closed, -1 on
+       error. */
+    int  (*recv_burst)(struct sr_instance* sr, int wait);
+
+    /* Send n frames, in as few system calls as the transport can manage.
+       Returns the number sent. */
+    int  (*send_burst)(struct sr_instance* sr, const struct sr_frame* frames,
+                       int n);
+
+    void (*print_stats)(struct sr_instance* sr, FILE* fp);
+
+    /* Flush, print stats and free everything connect set up. */
+    void (*close)(struct sr_instance* sr);
+
+    void* state;                /* the backend's own, from connect */
+};
+
+extern const struct sr_transport sr_vns_transport;
+extern const struct sr_transport sr_afpacket_transport;
+extern const struct sr_transport sr_xdp_transport;
+extern const struct sr_transport sr_shm_transport;
+extern const struct sr_transport sr_replay_transport;
+
+/* Look up a transport by the name -i gives it. */
+const struct sr_transport* sr_transport_find(const char* name);
+
+/* A copy of template for one router to run on, with no state yet. */
+struct sr_transport* sr_transport_create(const struct sr_transport* template);
+
+#endif /* -- SR_TRANSPORT_H -- */
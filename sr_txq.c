@@ -0,0 +1,481 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_txq.c
+ *
+ * Description:
+ *
+ * Lock-free transmit queue for the VNS socket; see sr_txq.h.
+ *
+ * The ring is the bounded queue of D. Vyukov: every slot carries a sequence
+ * number which says whether it is free for the producer that claimed
+ * position pos (seq == pos), filled and ready to write (seq == pos + 1), or
+ * still being written out from a previous lap. Producers claim positions
+ * with a compare-and-swap on tail. The writer role is a single flag; the
+ * thread that sets it drains from head, and anything published while it was
+ * busy is picked up either by its next pass or by the producer that
+ * published it.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <sys/time.h>
+
+#include "sr_txq.h"
+
+#define SR_TXQ_MASK     (SR_TXQ_SLOTS - 1)
+#define SR_TXQ_IOV_MAX  64      /* frames per writev() */
+
+/*---------------------------------------------------------------------
+ * Method: txq_writev_all(..)
+ * Scope:  Local
+ *
+ * writev() the whole of iov, picking up after short writes and signals.
+ * iov is modified.
+ *
+ *---------------------------------------------------------------------*/
+
+static int txq_writev_all(int fd, struct iovec* iov, int iovcnt)
+{
+    ssize_t n;
+
+    while(iovcnt > 0)
+    {
+        if((n = writev(fd, iov, iovcnt)) < 0)
+        {
+            if(errno == EINTR)
+            { continue; }
+            perror("writev(..):sr_txq.c::txq_writev_all");
+            return -1;
+        }
+
+        /* -- skip what made it out -- */
+        while(iovcnt > 0 && (size_t)n >= iov->iov_len)
+        {
+            n -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if(iovcnt > 0)
+        {
+            iov->iov_base = (uint8_t*)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+
+    return 0;
+} /* -- txq_writev_all -- */
+
+/*---------------------------------------------------------------------
+ * Method: txq_write(..)
+ * Scope:  Local
+ *
+ * Write iov out through the transport's writer if it set one, or with
+ * writev() on the socket.
+ *
+ *---------------------------------------------------------------------*/
+
+static int txq_write(struct sr_txq* txq, struct iovec* iov, int iovcnt)
+{
+    if(txq->writer)
+    { return txq->writer(txq->writer_arg, iov, iovcnt); }
+    return txq_writev_all(txq->fd, iov, iovcnt);
+} /* -- txq_write -- */
+
+/*---------------------------------------------------------------------
+ * Method: txq_now_usec(..)
+ * Scope:  Local
+ *
+ *---------------------------------------------------------------------*/
+
+static unsigned long txq_now_usec(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, 0);
+    return (unsigned long)tv.tv_sec * 1000000UL + tv.tv_usec;
+} /* -- txq_now_usec -- */
+
+/*---------------------------------------------------------------------
+ * Method: txq_ready(..)
+ * Scope:  Local
+ *
+ * Is the slot at head filled and waiting to be written?
+ *
+ *---------------------------------------------------------------------*/
+
+static int txq_ready(struct sr_txq* txq)
+{
+    unsigned long head = __atomic_load_n(&txq->head, __ATOMIC_SEQ_CST);
+    struct sr_txq_slot* slot = &txq->slots[head & SR_TXQ_MASK];
+
+    return __atomic_load_n(&slot->seq, __ATOMIC_SEQ_CST) == head + 1;
+} /* -- txq_ready -- */
+
+/*---------------------------------------------------------------------
+ * Method: txq_drain(..)
+ * Scope:  Local
+ *
+ * Write every ready frame, SR_TXQ_IOV_MAX at a time, straight out of the
+ * slots, then hand the slots back to the producers. Caller must hold the
+ * writer role.
+ *
+ *---------------------------------------------------------------------*/
+
+static int txq_drain(struct sr_txq* txq)
+{
+    struct iovec iov[SR_TXQ_IOV_MAX];
+    unsigned long pos, p;
+    unsigned long bytes;
+    int n, ret = 0;
+
+    while(1)
+    {
+        n = 0;
+        bytes = 0;
+        pos = txq->head;
+        while(n < SR_TXQ_IOV_MAX)
+        {
+            struct sr_txq_slot* slot = &txq->slots[pos & SR_TXQ_MASK];
+            if(__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != pos + 1)
+            { break; }
+            iov[n].iov_base = slot->buf;
+            iov[n].iov_len  = slot->len;
+            bytes += slot->len;
+            n++;
+            pos++;
+        }
+
+        if(n == 0)
+        { return ret; }
+
+        if(txq_write(txq, iov, n) < 0)
+        {
+            txq->stats.errors++;
+            ret = -1;
+        }
+        else
+        {
+            txq->stats.frames += n;
+            txq->stats.writes++;
+            txq->stats.bytes  += bytes;
+            if((unsigned long)n > txq->stats.max_batch)
+            { txq->stats.max_batch = n; }
+        }
+        __atomic_sub_fetch(&txq->queued_bytes, bytes, __ATOMIC_RELAXED);
+
+        /* -- free the slots for the next lap -- */
+        for(p = txq->head; p != pos; p++)
+        {
+            __atomic_store_n(&txq->slots[p & SR_TXQ_MASK].seq,
+                    p + SR_TXQ_SLOTS, __ATOMIC_RELEASE);
+        }
+        __atomic_store_n(&txq->head, pos, __ATOMIC_SEQ_CST);
+    }
+} /* -- txq_drain -- */
+
+/*---------------------------------------------------------------------
+ * Method: txq_enqueue(..)
+ * Scope:  Local
+ *
+ * Copy hdr and buf into the next free slot. Returns -1 if the ring is full.
+ *
+ *---------------------------------------------------------------------*/
+
+static int txq_enqueue(struct sr_txq* txq, const uint8_t* hdr,
+        unsigned int hdr_len, const uint8_t* buf, unsigned int len)
+{
+    struct sr_txq_slot* slot;
+    unsigned long pos, seq, depth;
+    long dif;
+
+    pos = __atomic_load_n(&txq->tail, __ATOMIC_RELAXED);
+    while(1)
+    {
+        slot = &txq->slots[pos & SR_TXQ_MASK];
+        seq  = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        dif  = (long)seq - (long)pos;
+
+        if(dif == 0)
+        {
+            /* -- on failure pos is reloaded with the current tail -- */
+            if(__atomic_compare_exchange_n(&txq->tail, &pos, pos + 1, 0,
+                        __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            { break; }
+        }
+        else if(dif < 0)
+        { return -1; } /* -- writer hasn't caught up a whole lap -- */
+        else
+        { pos = __atomic_load_n(&txq->tail, __ATOMIC_RELAXED); }
+    }
+
+    memcpy(slot->buf, hdr, hdr_len);
+    memcpy(slot->buf + hdr_len, buf, len);
+    slot->len = hdr_len + len;
+    __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_SEQ_CST);
+
+    __atomic_fetch_add(&txq->stats.enqueued, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&txq->queued_bytes, hdr_len + len, __ATOMIC_RELAXED);
+    depth = pos + 1 - __atomic_load_n(&txq->head, __ATOMIC_RELAXED);
+    if(depth == 1)
+    { txq->oldest_usec = txq_now_usec(); }
+    if(depth > txq->stats.max_depth && depth <= SR_TXQ_SLOTS)
+    { txq->stats.max_depth = depth; } /* -- racy, but only a statistic -- */
+
+    return 0;
+} /* -- txq_enqueue -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_txq_create(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+struct sr_txq* sr_txq_create(int fd)
+{
+    struct sr_txq* txq;
+    unsigned long i;
+
+    txq = (struct sr_txq*)calloc(1, sizeof(struct sr_txq));
+    assert(txq);
+
+    txq->fd = fd;
+    txq->batch_frames = SR_TXQ_BATCH_FRAMES;
+    txq->batch_bytes  = SR_TXQ_BATCH_BYTES;
+    txq->flush_usec   = SR_TXQ_FLUSH_USEC;
+    for(i = 0; i < SR_TXQ_SLOTS; i++)
+    { txq->slots[i].seq = i; }
+
+    return txq;
+} /* -- sr_txq_create -- */
+
+void sr_txq_destroy(struct sr_txq* txq)
+{
+    if(txq)
+    {
+        sr_txq_flush(txq);
+        free(txq);
+    }
+} /* -- sr_txq_destroy -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_txq_flush(..)
+ * Scope:  Global
+ *
+ * Claim the writer role and drain the ring. If some other thread is
+ * already writing we leave it to them. After giving the role up we look
+ * once more, since a producer may have published a frame after our last
+ * pass but before we let go, and then failed to claim the role itself.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_txq_flush(struct sr_txq* txq)
+{
+    int ret = 0;
+
+    while(!__atomic_exchange_n(&txq->writing, 1, __ATOMIC_SEQ_CST))
+    {
+        if(txq_drain(txq) < 0)
+        { ret = -1; }
+        __atomic_store_n(&txq->writing, 0, __ATOMIC_SEQ_CST);
+
+        if(!txq_ready(txq))
+        { break; }
+    }
+
+    return ret;
+} /* -- sr_txq_flush -- */
+
+/*---------------------------------------------------------------------
+ * Method: txq_write_direct(..)
+ * Scope:  Local
+ *
+ * writev() hdr and buf straight from the caller's memory, with no copy.
+ * Caller must hold the writer role and have drained the ring, so the
+ * frame doesn't overtake ones queued before it.
+ *
+ *---------------------------------------------------------------------*/
+
+static int txq_write_direct(struct sr_txq* txq, const uint8_t* hdr,
+        unsigned int hdr_len, const uint8_t* buf, unsigned int len)
+{
+    struct iovec iov[2];
+
+    iov[0].iov_base = (void*)hdr;
+    iov[0].iov_len  = hdr_len;
+    iov[1].iov_base = (void*)buf;
+    iov[1].iov_len  = len;
+    if(txq_write(txq, iov, 2) < 0)
+    {
+        txq->stats.errors++;
+        return -1;
+    }
+
+    txq->stats.frames++;
+    txq->stats.writes++;
+    txq->stats.direct++;
+    txq->stats.bytes += hdr_len + len;
+    return 0;
+} /* -- txq_write_direct -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_txq_set_writer(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_txq_set_writer(struct sr_txq* txq, sr_txq_writer_fn writer, void* arg)
+{
+    txq->writer     = writer;
+    txq->writer_arg = arg;
+} /* -- sr_txq_set_writer -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_txq_cork(..), sr_txq_uncork(..), sr_txq_set_batching(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_txq_cork(struct sr_txq* txq)
+{
+    __atomic_add_fetch(&txq->corked, 1, __ATOMIC_SEQ_CST);
+} /* -- sr_txq_cork -- */
+
+int sr_txq_uncork(struct sr_txq* txq)
+{
+    if(__atomic_sub_fetch(&txq->corked, 1, __ATOMIC_SEQ_CST) > 0 ||
+            sr_txq_depth(txq) == 0)
+    { return 0; }
+
+    txq->stats.flush_burst++;
+    return sr_txq_flush(txq);
+} /* -- sr_txq_uncork -- */
+
+void sr_txq_set_batching(struct sr_txq* txq, unsigned int batch_frames,
+        unsigned int batch_bytes, unsigned int flush_usec)
+{
+    txq->batch_frames = batch_frames < SR_TXQ_SLOTS ? batch_frames : SR_TXQ_SLOTS;
+    txq->batch_bytes  = batch_bytes;
+    txq->flush_usec   = flush_usec;
+} /* -- sr_txq_set_batching -- */
+
+/*---------------------------------------------------------------------
+ * Method: txq_send_batched(..)
+ * Scope:  Local
+ *
+ * Queue a frame while corked, and flush if the batch is now big enough
+ * or has been waiting too long.
+ *
+ *---------------------------------------------------------------------*/
+
+static int txq_send_batched(struct sr_txq* txq, const uint8_t* hdr,
+        unsigned int hdr_len, const uint8_t* buf, unsigned int len)
+{
+    while(txq_enqueue(txq, hdr, hdr_len, buf, len) < 0)
+    {
+        __atomic_fetch_add(&txq->stats.full_stalls, 1, __ATOMIC_RELAXED);
+        sr_txq_flush(txq);
+        sched_yield();
+    }
+
+    if(sr_txq_depth(txq) >= txq->batch_frames ||
+            __atomic_load_n(&txq->queued_bytes, __ATOMIC_RELAXED) >= txq->batch_bytes)
+    {
+        txq->stats.flush_size++;
+        return sr_txq_flush(txq);
+    }
+    if(txq_now_usec() - txq->oldest_usec >= txq->flush_usec)
+    {
+        txq->stats.flush_timer++;
+        return sr_txq_flush(txq);
+    }
+
+    return 0;
+} /* -- txq_send_batched -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_txq_send(..)
+ * Scope:  Global
+ *
+ * While corked, frames are batched (see txq_send_batched). Otherwise,
+ * if nobody else is writing, take the writer role, write out anything
+ * queued ahead of us and then the frame itself as a two-element writev()
+ * from the caller's buffers. Only when another thread is mid-write does
+ * the frame get copied into the ring for them (or us) to pick up.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_txq_send(struct sr_txq* txq, const uint8_t* hdr, unsigned int hdr_len,
+        const uint8_t* buf, unsigned int len)
+{
+    int ret;
+
+    /* REQUIRES */
+    assert(txq);
+
+    if(txq->batch_frames > 0 && hdr_len + len <= SR_TXQ_SLOT_SZ &&
+            __atomic_load_n(&txq->corked, __ATOMIC_SEQ_CST) > 0)
+    { return txq_send_batched(txq, hdr, hdr_len, buf, len); }
+
+    /* -- too big for a slot: wait our turn rather than queue it -- */
+    if(hdr_len + len > SR_TXQ_SLOT_SZ)
+    {
+        while(__atomic_exchange_n(&txq->writing, 1, __ATOMIC_SEQ_CST))
+        { sched_yield(); }
+    }
+    else if(__atomic_exchange_n(&txq->writing, 1, __ATOMIC_SEQ_CST))
+    {
+        /* -- ring full: help drain it, or let whoever is writing get on -- */
+        while(txq_enqueue(txq, hdr, hdr_len, buf, len) < 0)
+        {
+            __atomic_fetch_add(&txq->stats.full_stalls, 1, __ATOMIC_RELAXED);
+            sr_txq_flush(txq);
+            sched_yield();
+        }
+        return sr_txq_flush(txq);
+    }
+
+    /* -- we are the writer -- */
+    ret = txq_drain(txq);
+    if(txq_write_direct(txq, hdr, hdr_len, buf, len) < 0)
+    { ret = -1; }
+    __atomic_store_n(&txq->writing, 0, __ATOMIC_SEQ_CST);
+
+    /* -- pick up anything queued behind us while we were writing -- */
+    if(txq_ready(txq) && sr_txq_flush(txq) < 0)
+    { ret = -1; }
+
+    return ret;
+} /* -- sr_txq_send -- */
+
+unsigned long sr_txq_depth(struct sr_txq* txq)
+{
+    return __atomic_load_n(&txq->tail, __ATOMIC_RELAXED) -
+           __atomic_load_n(&txq->head, __ATOMIC_RELAXED);
+} /* -- sr_txq_depth -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_txq_print_stats(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_txq_print_stats(struct sr_txq* txq, FILE* fp)
+{
+    struct sr_txq_stats* st = &txq->stats;
+
+    fprintf(fp, "Transmit queue: %lu frames in %lu writes (%.2f frames/write), "
+            "%lu bytes\n", st->frames, st->writes,
+            st->writes ? (double)st->frames / st->writes : 0.0, st->bytes);
+    fprintf(fp, "  largest batch %lu; batches flushed at end of burst %lu, "
+            "at size limit %lu, on timer %lu\n", st->max_batch,
+            st->flush_burst, st->flush_size, st->flush_timer);
+    fprintf(fp, "  %lu written without copying, queued %lu, depth now %lu "
+            "max %lu, full stalls %lu, errors %lu\n", st->direct, st->enqueued,
+            sr_txq_depth(txq), st->max_depth, st->full_stalls, st->errors);
+} /* -- sr_txq_print_stats -- */
@@ -0,0 +1,122 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_txq.h
+ *
+ * Description:
+ *
+ * Transmit queue for the connection to the VNS server.
+ *
+ * Any thread may hand a frame to sr_txq_send(). If no other thread is
+ * writing, the caller claims the writer role and the frame goes out with a
+ * writev() straight from the caller's buffers, no copy and no allocation.
+ * Otherwise it is copied into a bounded multi-producer/single-consumer ring
+ * without taking a lock, and whichever thread holds the writer role drains
+ * the ring with one writev() covering every frame that is ready. Only one
+ * thread ever writes to the socket at a time, so frames can no longer
+ * interleave on the TCP stream, and frames queued while a write is in
+ * progress go out together.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_TXQ_H
+#define SR_TXQ_H
+
+#include <stdio.h>
+#include <sys/uio.h>
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+#define SR_TXQ_SLOTS    256     /* ring size, must be a power of two */
+#define SR_TXQ_SLOT_SZ  2048    /* VNS header + frame; larger frames bypass
+                                   the ring */
+
+/* Default flush policy while corked (see sr_txq_cork) */
+#define SR_TXQ_BATCH_FRAMES 32          /* flush once this many are queued */
+#define SR_TXQ_BATCH_BYTES  (32*1024)   /* ... or this many bytes */
+#define SR_TXQ_FLUSH_USEC   200         /* ... or the oldest is this old */
+
+struct sr_txq_slot
+{
+    unsigned long seq;          /* Vyukov sequence number */
+    unsigned int  len;          /* bytes used in buf */
+    uint8_t       buf[SR_TXQ_SLOT_SZ];
+};
+
+struct sr_txq_stats
+{
+    unsigned long enqueued;     /* frames accepted */
+    unsigned long frames;       /* frames written to the socket */
+    unsigned long writes;       /* writev() calls that wrote them */
+    unsigned long direct;       /* frames written from the caller's buffer */
+    unsigned long bytes;        /* bytes written, VNS headers included */
+    unsigned long max_depth;    /* deepest the ring has been */
+    unsigned long full_stalls;  /* times a producer found the ring full */
+    unsigned long errors;       /* failed writes */
+    unsigned long max_batch;    /* most frames in a single writev() */
+    unsigned long flush_burst;  /* batches flushed at the end of a burst */
+    unsigned long flush_size;   /* ... because they hit a size limit */
+    unsigned long flush_timer;  /* ... because they got too old */
+};
+
+/* Writes all of iov (which it may modify) or fails with -1. Only ever called
+   by the thread holding the writer role. */
+typedef int (*sr_txq_writer_fn)(void* arg, struct iovec* iov, int iovcnt);
+
+struct sr_txq
+{
+    int fd;                     /* socket to server */
+    sr_txq_writer_fn writer;    /* replaces writev() on fd if set */
+    void* writer_arg;
+    unsigned long head;         /* next slot to write, owned by the writer */
+    unsigned long tail;         /* next slot to fill, claimed by producers */
+    int writing;                /* set while a thread holds the writer role */
+    int corked;                 /* > 0 while batching a burst */
+    unsigned long queued_bytes; /* bytes in the ring */
+    unsigned long oldest_usec;  /* when the ring last went from empty */
+    unsigned int batch_frames;  /* flush policy while corked, 0 = off */
+    unsigned int batch_bytes;
+    unsigned int flush_usec;
+    struct sr_txq_stats stats;
+    struct sr_txq_slot slots[SR_TXQ_SLOTS];
+};
+
+struct sr_txq* sr_txq_create(int fd);
+void sr_txq_destroy(struct sr_txq* txq);
+
+/* Queue hdr_len bytes of hdr followed by len bytes of buf as one message and
+   write out whatever is ready. Both buffers are only borrowed. Returns 0 on
+   success, -1 if a write made by this call failed. */
+int sr_txq_send(struct sr_txq* txq, const uint8_t* hdr, unsigned int hdr_len,
+                const uint8_t* buf, unsigned int len);
+
+/* Hand the writes to a transport other than writev() on the socket. */
+void sr_txq_set_writer(struct sr_txq* txq, sr_txq_writer_fn writer, void* arg);
+
+/* Batch frames instead of writing each one as it is sent. Between cork and
+   uncork, frames from every thread are collected in the ring and written
+   together once batch_frames or batch_bytes are waiting, once the oldest has
+   waited flush_usec microseconds, or at the final uncork, whichever comes
+   first. Corks nest. Batching trades a copy into the ring for fewer
+   writes, so callers only cork when more than one frame is coming; a lone
+   frame is cheaper written straight from the caller's buffer. */
+void sr_txq_cork(struct sr_txq* txq);
+int sr_txq_uncork(struct sr_txq* txq);
+
+/* Change the flush policy; batch_frames == 0 turns batching off. */
+void sr_txq_set_batching(struct sr_txq* txq, unsigned int batch_frames,
+                         unsigned int batch_bytes, unsigned int flush_usec);
+
+/* Write out everything queued, unless another thread is already doing so. */
+int sr_txq_flush(struct sr_txq* txq);
+
+/* Number of frames queued but not yet written. */
+unsigned long sr_txq_depth(struct sr_txq* txq);
+
+void sr_txq_print_stats(struct sr_txq* txq, FILE* fp);
+
+#endif /* -- SR_TXQ_H -- */
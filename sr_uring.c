@@ -0,0 +1,681 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_uring.c
+ *
+ * Description:
+ *
+ * io_uring transport for the VNS connection; see sr_uring.h.
+ *
+ * Talks to the kernel through the raw io_uring syscalls, without liburing.
+ * Receives and sends use separate rings: the receive ring belongs to the
+ * thread reading from the server and the send ring to whichever thread
+ * holds the transmit queue's writer role, so neither needs a lock and a
+ * send waiting for its completion never has to step over receive
+ * completions.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "sr_uring.h"
+#include "sr_rxring.h"
+
+#ifdef _IO_URING_
+
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/eventfd.h>
+#include <linux/io_uring.h>
+
+#define SR_URING_BGID     1         /* provided buffer group id */
+#define SR_URING_ENTRIES  8         /* submission queue size */
+#define SR_URING_BUF_MASK (SR_URING_BUFS - 1)
+#define SR_URING_CANCEL   1         /* user_data of the teardown cancel */
+
+struct uring_q
+{
+    int fd;
+    int sqpoll;
+    unsigned int *sq_head, *sq_tail, *sq_mask, *sq_flags, *sq_array;
+    unsigned int *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe* sqes;
+    struct io_uring_cqe* cqes;
+    void* sq_ring;
+    size_t sq_ring_sz;
+    void* cq_ring;
+    size_t cq_ring_sz;
+    size_t sqes_sz;
+};
+
+struct sr_uring_stats
+{
+    unsigned long recvs;        /* receive completions */
+    unsigned long recv_bytes;
+    unsigned long rearms;       /* times the multishot recv had to be reposted */
+    unsigned long nobufs;       /* ... because every buffer was in use */
+    unsigned long sends;        /* SENDMSGs completed */
+    unsigned long send_bytes;
+    unsigned long enters;       /* io_uring_enter() calls */
+    unsigned long spins;        /* sends completed by polling the CQ */
+};
+
+struct sr_uring
+{
+    int sockfd;
+    int efd;                            /* signalled on receive completions */
+    struct uring_q rx;
+    struct uring_q tx;
+    struct io_uring_buf_ring* br;       /* provided buffer ring */
+    unsigned short br_tail;
+    uint8_t* bufs;
+    int br_registered;
+    int recv_armed;
+    int pend_bid;                       /* buffer partly copied out, or -1 */
+    unsigned int pend_off, pend_len;
+    struct msghdr msg;
+    struct sr_uring_stats stats;
+};
+
+/*---------------------------------------------------------------------
+ * Method: uring_enter(..), uring_register(..)
+ * Scope:  Local
+ *
+ *---------------------------------------------------------------------*/
+
+static int uring_enter(struct sr_uring* uring, struct uring_q* q,
+        unsigned int to_submit, unsigned int min_complete, unsigned int flags)
+{
+    int ret;
+
+    uring->stats.enters++;
+    do
+    {
+        ret = syscall(__NR_io_uring_enter, q->fd, to_submit, min_complete,
+                      flags, 0, 0);
+    } while(ret < 0 && errno == EINTR);
+
+    return ret;
+} /* -- uring_enter -- */
+
+static int uring_register(int fd, unsigned int opcode, void* arg,
+        unsigned int nr_args)
+{
+    return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+} /* -- uring_register -- */
+
+/*---------------------------------------------------------------------
+ * Method: uring_q_setup(..)
+ * Scope:  Local
+ *
+ * Create a ring and map its queues.
+ *
+ *---------------------------------------------------------------------*/
+
+static int uring_q_setup(struct uring_q* q, unsigned int cq_entries,
+        unsigned int flags)
+{
+    struct io_uring_params p;
+    uint8_t* sq;
+    uint8_t* cq;
+
+    memset(&p, 0, sizeof(p));
+    p.flags = flags | IORING_SETUP_CQSIZE;
+    p.cq_entries = cq_entries;
+    p.sq_thread_idle = SR_URING_IDLE_MS;
+
+    q->fd = syscall(__NR_io_uring_setup, SR_URING_ENTRIES, &p);
+    if(q->fd < 0)
+    { return -1; }
+    q->sqpoll = (flags & IORING_SETUP_SQPOLL) != 0;
+
+    q->sq_ring_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+    q->cq_ring_sz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if(p.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if(q->cq_ring_sz > q->sq_ring_sz)
+        { q->sq_ring_sz = q->cq_ring_sz; }
+        q->cq_ring_sz = 0;
+    }
+
+    q->sq_ring = mmap(0, q->sq_ring_sz, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, q->fd, IORING_OFF_SQ_RING);
+    if(q->sq_ring == MAP_FAILED)
+    { return -1; }
+    if(q->cq_ring_sz)
+    {
+        q->cq_ring = mmap(0, q->cq_ring_sz, PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_POPULATE, q->fd, IORING_OFF_CQ_RING);
+        if(q->cq_ring == MAP_FAILED)
+        { return -1; }
+    }
+    else
+    { q->cq_ring = q->sq_ring; }
+
+    q->sqes_sz = p.sq_entries * sizeof(struct io_uring_sqe);
+    q->sqes = (struct io_uring_sqe*)mmap(0, q->sqes_sz, PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_POPULATE, q->fd, IORING_OFF_SQES);
+    if(q->sqes == MAP_FAILED)
+    { return -1; }
+
+    sq = (uint8_t*)q->sq_ring;
+    q->sq_head  = (unsigned int*)(sq + p.sq_off.head);
+    q->sq_tail  = (unsigned int*)(sq + p.sq_off.tail);
+    q->sq_mask  = (unsigned int*)(sq + p.sq_off.ring_mask);
+    q->sq_flags = (unsigned int*)(sq + p.sq_off.flags);
+    q->sq_array = (unsigned int*)(sq + p.sq_off.array);
+
+    cq = (uint8_t*)q->cq_ring;
+    q->cq_head = (unsigned int*)(cq + p.cq_off.head);
+    q->cq_tail = (unsigned int*)(cq + p.cq_off.tail);
+    q->cq_mask = (unsigned int*)(cq + p.cq_off.ring_mask);
+    q->cqes    = (struct io_uring_cqe*)(cq + p.cq_off.cqes);
+
+    return 0;
+} /* -- uring_q_setup -- */
+
+static void uring_q_teardown(struct uring_q* q)
+{
+    if(q->sqes && q->sqes != MAP_FAILED)
+    { munmap(q->sqes, q->sqes_sz); }
+    if(q->cq_ring_sz && q->cq_ring && q->cq_ring != MAP_FAILED)
+    { munmap(q->cq_ring, q->cq_ring_sz); }
+    if(q->sq_ring && q->sq_ring != MAP_FAILED)
+    { munmap(q->sq_ring, q->sq_ring_sz); }
+    if(q->fd >= 0)
+    { close(q->fd); }
+} /* -- uring_q_teardown -- */
+
+/*---------------------------------------------------------------------
+ * Method: uring_get_sqe(..), uring_submit(..)
+ * Scope:  Local
+ *
+ * Queues hold one outstanding submission at a time, so there is always
+ * room for the next one.
+ *
+ *---------------------------------------------------------------------*/
+
+static struct io_uring_sqe* uring_get_sqe(struct uring_q* q)
+{
+    unsigned int idx = *q->sq_tail & *q->sq_mask;
+    struct io_uring_sqe* sqe = &q->sqes[idx];
+
+    memset(sqe, 0, sizeof(*sqe));
+    q->sq_array[idx] = idx;
+    return sqe;
+} /* -- uring_get_sqe -- */
+
+/* Publish the sqe from uring_get_sqe and wait for min_complete completions. */
+static int uring_submit(struct sr_uring* uring, struct uring_q* q,
+        unsigned int min_complete)
+{
+    unsigned int flags = min_complete ? IORING_ENTER_GETEVENTS : 0;
+
+    __atomic_store_n(q->sq_tail, *q->sq_tail + 1, __ATOMIC_RELEASE);
+
+    if(!q->sqpoll)
+    { return uring_enter(uring, q, 1, min_complete, flags); }
+
+    /* -- the poller picks it up by itself, unless it has gone to sleep -- */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if(__atomic_load_n(q->sq_flags, __ATOMIC_RELAXED) & IORING_SQ_NEED_WAKEUP)
+    { flags |= IORING_ENTER_SQ_WAKEUP; }
+    if(flags)
+    { return uring_enter(uring, q, 0, min_complete, flags); }
+    return 0;
+} /* -- uring_submit -- */
+
+/*---------------------------------------------------------------------
+ * Method: uring_peek_cqe(..), uring_cqe_seen(..)
+ * Scope:  Local
+ *
+ *---------------------------------------------------------------------*/
+
+static struct io_uring_cqe* uring_peek_cqe(struct uring_q* q)
+{
+    unsigned int head = *q->cq_head;
+
+    if(head == __atomic_load_n(q->cq_tail, __ATOMIC_ACQUIRE))
+    { return 0; }
+    return &q->cqes[head & *q->cq_mask];
+} /* -- uring_peek_cqe -- */
+
+static void uring_cqe_seen(struct uring_q* q)
+{
+    __atomic_store_n(q->cq_head, *q->cq_head + 1, __ATOMIC_RELEASE);
+} /* -- uring_cqe_seen -- */
+
+/*---------------------------------------------------------------------
+ * Method: uring_recycle(..)
+ * Scope:  Local
+ *
+ * Give a receive buffer back to the kernel.
+ *
+ *---------------------------------------------------------------------*/
+
+static void uring_recycle(struct sr_uring* uring, int bid)
+{
+    struct io_uring_buf* buf = &uring->br->bufs[uring->br_tail & SR_URING_BUF_MASK];
+
+    buf->addr = (uint64_t)(uintptr_t)(uring->bufs + bid * SR_URING_BUF_SZ);
+    buf->len  = SR_URING_BUF_SZ;
+    buf->bid  = bid;
+    uring->br_tail++;
+    __atomic_store_n(&uring->br->tail, uring->br_tail, __ATOMIC_RELEASE);
+} /* -- uring_recycle -- */
+
+/*---------------------------------------------------------------------
+ * Method: uring_arm_recv(..)
+ * Scope:  Local
+ *
+ * Post the multishot recv. It stays posted until the kernel runs out of
+ * buffers for it or the connection ends.
+ *
+ *---------------------------------------------------------------------*/
+
+static int uring_arm_recv(struct sr_uring* uring)
+{
+    struct io_uring_sqe* sqe = uring_get_sqe(&uring->rx);
+
+    sqe->opcode    = IORING_OP_RECV;
+    sqe->fd        = uring->sockfd;
+    sqe->ioprio    = IORING_RECV_MULTISHOT;
+    sqe->flags     = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = SR_URING_BGID;
+
+    if(uring_submit(uring, &uring->rx, 0) < 0)
+    {
+        perror("io_uring_enter(..):sr_uring.c::uring_arm_recv");
+        return -1;
+    }
+    uring->recv_armed = 1;
+    return 0;
+} /* -- uring_arm_recv -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_uring_create(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+struct sr_uring* sr_uring_create(int sockfd, int sqpoll)
+{
+    struct sr_uring* uring;
+    struct io_uring_buf_reg reg;
+    void* mem;
+    int i;
+
+    uring = (struct sr_uring*)calloc(1, sizeof(struct sr_uring));
+    assert(uring);
+    uring->sockfd   = sockfd;
+    uring->pend_bid = -1;
+    uring->rx.fd    = -1;
+    uring->tx.fd    = -1;
+    uring->efd      = -1;
+
+    /* -- room in the CQ for every buffer, so it can't overflow -- */
+    if(uring_q_setup(&uring->rx, 2 * SR_URING_BUFS, 0) < 0 ||
+       uring_q_setup(&uring->tx, 2 * SR_URING_ENTRIES,
+                     sqpoll ? IORING_SETUP_SQPOLL : 0) < 0)
+    {
+        perror("io_uring_setup(..):sr_uring.c::sr_uring_create");
+        sr_uring_destroy(uring);
+        return 0;
+    }
+
+    /* -- the provided buffer ring and the buffers it points at -- */
+    if(posix_memalign(&mem, 4096, SR_URING_BUFS * sizeof(struct io_uring_buf)) != 0 ||
+       (uring->bufs = (uint8_t*)malloc(SR_URING_BUFS * SR_URING_BUF_SZ)) == 0)
+    {
+        fprintf(stderr, "Error: out of memory for io_uring buffers\n");
+        sr_uring_destroy(uring);
+        return 0;
+    }
+    uring->br = (struct io_uring_buf_ring*)mem;
+    memset(uring->br, 0, SR_URING_BUFS * sizeof(struct io_uring_buf));
+
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr    = (uint64_t)(uintptr_t)uring->br;
+    reg.ring_entries = SR_URING_BUFS;
+    reg.bgid         = SR_URING_BGID;
+    if(uring_register(uring->rx.fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+    {
+        perror("io_uring_register(..):sr_uring.c::sr_uring_create");
+        sr_uring_destroy(uring);
+        return 0;
+    }
+    uring->br_registered = 1;
+    for(i = 0; i < SR_URING_BUFS; i++)
+    { uring_recycle(uring, i); }
+
+    /* -- so the event loop can wait for receives with everything else -- */
+    if((uring->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0 ||
+       uring_register(uring->rx.fd, IORING_REGISTER_EVENTFD, &uring->efd, 1) < 0)
+    {
+        perror("eventfd(..):sr_uring.c::sr_uring_create");
+        sr_uring_destroy(uring);
+        return 0;
+    }
+
+    if(uring_arm_recv(uring) < 0)
+    {
+        sr_uring_destroy(uring);
+        return 0;
+    }
+
+    return uring;
+} /* -- sr_uring_create -- */
+
+/*---------------------------------------------------------------------
+ * Method: uring_quiesce(..)
+ * Scope:  Local
+ *
+ * Stop the kernel writing into our buffers before they are freed. Closing
+ * the ring only starts cancelling the multishot recv; the kernel may
+ * still complete it into a buffer afterwards. So cancel it ourselves and
+ * reap completions until its last one (no IORING_CQE_F_MORE) is in, then
+ * take the buffer ring back. Should the cancel be refused (a kernel
+ * without IORING_ASYNC_CANCEL_ANY), shutting the socket down for reading
+ * ends the recv instead. Sends wait for their completion in
+ * sr_uring_writev, so none are in flight here.
+ *
+ *---------------------------------------------------------------------*/
+
+static void uring_quiesce(struct sr_uring* uring)
+{
+    struct io_uring_sqe* sqe;
+    struct io_uring_cqe* cqe;
+    int cancelled = 0;
+
+    if(uring->rx.fd >= 0 && uring->recv_armed)
+    {
+        sqe = uring_get_sqe(&uring->rx);
+        sqe->opcode        = IORING_OP_ASYNC_CANCEL;
+        sqe->fd            = -1;
+        sqe->cancel_flags  = IORING_ASYNC_CANCEL_ANY;
+        sqe->user_data     = SR_URING_CANCEL;
+        if(uring_submit(uring, &uring->rx, 0) < 0)
+        {
+            perror("io_uring_enter(..):sr_uring.c::uring_quiesce");
+            shutdown(uring->sockfd, SHUT_RD);
+            cancelled = 1;
+        }
+
+        while(uring->recv_armed || !cancelled)
+        {
+            if((cqe = uring_peek_cqe(&uring->rx)) == 0)
+            {
+                if(uring_enter(uring, &uring->rx, 0, 1, IORING_ENTER_GETEVENTS) < 0)
+                {
+                    perror("io_uring_enter(..):sr_uring.c::uring_quiesce");
+                    break;
+                }
+                continue;
+            }
+
+            if(cqe->user_data == SR_URING_CANCEL)
+            {
+                if(cqe->res < 0 && cqe->res != -ENOENT && cqe->res != -EALREADY)
+                { shutdown(uring->sockfd, SHUT_RD); }
+                cancelled = 1;
+            }
+            else if(!(cqe->flags & IORING_CQE_F_MORE))
+            { uring->recv_armed = 0; }
+            uring_cqe_seen(&uring->rx);
+        }
+    }
+
+    if(uring->br_registered)
+    {
+        struct io_uring_buf_reg reg;
+
+        memset(&reg, 0, sizeof(reg));
+        reg.bgid = SR_URING_BGID;
+        if(uring_register(uring->rx.fd, IORING_UNREGISTER_PBUF_RING, &reg, 1) < 0)
+        { perror("io_uring_register(..):sr_uring.c::uring_quiesce"); }
+        uring->br_registered = 0;
+    }
+} /* -- uring_quiesce -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_uring_destroy(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_uring_destroy(struct sr_uring* uring)
+{
+    if(!uring)
+    { return; }
+
+    /* -- nothing may complete into the buffers once they are freed -- */
+    uring_quiesce(uring);
+    uring_q_teardown(&uring->tx);
+    uring_q_teardown(&uring->rx);
+    if(uring->efd >= 0)
+    { close(uring->efd); }
+    free(uring->br);
+    free(uring->bufs);
+    free(uring);
+} /* -- sr_uring_destroy -- */
+
+int sr_uring_fd(struct sr_uring* uring)
+{
+    return uring->efd;
+} /* -- sr_uring_fd -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_uring_fill(..)
+ * Scope:  Global
+ *
+ * Copies as many completed receives into ring as fit. A chunk that only
+ * partly fits is finished on the next call.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_uring_fill(struct sr_uring* uring, struct sr_rxring* ring, int wait)
+{
+    struct io_uring_cqe* cqe;
+    uint8_t* p;
+    unsigned int space, n, total = 0;
+    uint64_t count;
+
+    /* -- clear the eventfd first; anything completing after re-signals it -- */
+    if(read(uring->efd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+    { perror("read(..):sr_uring.c::sr_uring_fill"); }
+
+    p = sr_rxring_reserve(ring, &space);
+    while(space > 0)
+    {
+        if(uring->pend_bid < 0)
+        {
+            if((cqe = uring_peek_cqe(&uring->rx)) == 0)
+            {
+                if(total > 0 || !wait)
+                { break; }
+                if(uring_enter(uring, &uring->rx, 0, 1, IORING_ENTER_GETEVENTS) < 0)
+                {
+                    perror("io_uring_enter(..):sr_uring.c::sr_uring_fill");
+                    return -1;
+                }
+                continue;
+            }
+
+            if(!(cqe->flags & IORING_CQE_F_MORE))
+            { uring->recv_armed = 0; }
+
+            if(cqe->res == -ENOBUFS)
+            {
+                /* -- every buffer is still in a CQE ahead of this one -- */
+                uring->stats.nobufs++;
+                uring_cqe_seen(&uring->rx);
+                continue;
+            }
+            if(cqe->res <= 0)
+            {
+                if(cqe->res == 0)
+                { fprintf(stderr,"Error: server closed the connection\n"); }
+                else
+                {
+                    fprintf(stderr,"Error: io_uring recv failed: %s\n",
+                            strerror(-cqe->res));
+                }
+                uring_cqe_seen(&uring->rx);
+                return -1;
+            }
+
+            uring->pend_bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+            uring->pend_off = 0;
+            uring->pend_len = cqe->res;
+            uring->stats.recvs++;
+            uring->stats.recv_bytes += cqe->res;
+            uring_cqe_seen(&uring->rx);
+        }
+
+        n = uring->pend_len < space ? uring->pend_len : space;
+        memcpy(p, uring->bufs + uring->pend_bid * SR_URING_BUF_SZ + uring->pend_off, n);
+        p     += n;
+        space -= n;
+        total += n;
+        uring->pend_off += n;
+        uring->pend_len -= n;
+        if(uring->pend_len == 0)
+        {
+            uring_recycle(uring, uring->pend_bid);
+            uring->pend_bid = -1;
+        }
+    }
+
+    if(total > 0)
+    { sr_rxring_commit(ring, total); }
+
+    /* -- left something behind: make sure we get called again for it -- */
+    if(uring->pend_bid >= 0 || uring_peek_cqe(&uring->rx))
+    {
+        count = 1;
+        if(write(uring->efd, &count, sizeof(count)) < 0)
+        { perror("write(..):sr_uring.c::sr_uring_fill"); }
+    }
+
+    if(!uring->recv_armed)
+    {
+        uring->stats.rearms++;
+        if(uring_arm_recv(uring) < 0)
+        { return -1; }
+    }
+
+    return total;
+} /* -- sr_uring_fill -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_uring_writev(..)
+ * Scope:  Global
+ *
+ * One SENDMSG per call, resubmitting the remainder after a short send.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_uring_writev(void* arg, struct iovec* iov, int iovcnt)
+{
+    struct sr_uring* uring = (struct sr_uring*)arg;
+    struct io_uring_sqe* sqe;
+    struct io_uring_cqe* cqe;
+    int spins, res;
+
+    while(iovcnt > 0)
+    {
+        memset(&uring->msg, 0, sizeof(uring->msg));
+        uring->msg.msg_iov    = iov;
+        uring->msg.msg_iovlen = iovcnt;
+
+        sqe = uring_get_sqe(&uring->tx);
+        sqe->opcode    = IORING_OP_SENDMSG;
+        sqe->fd        = uring->sockfd;
+        sqe->addr      = (uint64_t)(uintptr_t)&uring->msg;
+        sqe->len       = 1;
+        sqe->msg_flags = MSG_NOSIGNAL;
+
+        if(uring_submit(uring, &uring->tx, uring->tx.sqpoll ? 0 : 1) < 0)
+        {
+            perror("io_uring_enter(..):sr_uring.c::sr_uring_writev");
+            return -1;
+        }
+
+        /* -- with a poller, the answer usually shows up while we spin -- */
+        for(spins = 0; (cqe = uring_peek_cqe(&uring->tx)) == 0; spins++)
+        {
+            if(spins < SR_URING_SPIN && uring->tx.sqpoll)
+            { continue; }
+            if(uring_enter(uring, &uring->tx, 0, 1, IORING_ENTER_GETEVENTS) < 0)
+            {
+                perror("io_uring_enter(..):sr_uring.c::sr_uring_writev");
+                return -1;
+            }
+        }
+        if(uring->tx.sqpoll && spins <= SR_URING_SPIN)
+        { uring->stats.spins++; }
+
+        res = cqe->res;
+        uring_cqe_seen(&uring->tx);
+        if(res == -EINTR || res == -EAGAIN)
+        { continue; }
+        if(res < 0)
+        {
+            fprintf(stderr,"Error: io_uring send failed: %s\n", strerror(-res));
+            return -1;
+        }
+        uring->stats.sends++;
+        uring->stats.send_bytes += res;
+
+        /* -- skip what made it out -- */
+        while(iovcnt > 0 && (size_t)res >= iov->iov_len)
+        {
+            res -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if(iovcnt > 0)
+        {
+            iov->iov_base = (uint8_t*)iov->iov_base + res;
+            iov->iov_len -= res;
+        }
+    }
+
+    return 0;
+} /* -- sr_uring_writev -- */
+
+void sr_uring_print_stats(struct sr_uring* uring, FILE* fp)
+{
+    struct sr_uring_stats* st = &uring->stats;
+
+    fprintf(fp, "io_uring%s: %lu bytes in %lu receives (%lu rearms, %lu out of "
+            "buffers), %lu bytes in %lu sends (%lu without sleeping), "
+            "%lu io_uring_enter calls\n", uring->tx.sqpoll ? " (SQPOLL)" : "",
+            st->recv_bytes, st->recvs, st->rearms, st->nobufs, st->send_bytes,
+            st->sends, st->spins, st->enters);
+} /* -- sr_uring_print_stats -- */
+
+#else /* -- built without io_uring -- */
+
+struct sr_uring* sr_uring_create(int sockfd, int sqpoll)
+{
+    fprintf(stderr, "Built without io_uring support (make URING=1)\n");
+    return 0;
+}
+void sr_uring_destroy(struct sr_uring* uring)
+{ }
+int sr_uring_fd(struct sr_uring* uring)
+{ return -1; }
+int sr_uring_fill(struct sr_uring* uring, struct sr_rxring* ring, int wait)
+{ return -1; }
+int sr_uring_writev(void* uring, struct iovec* iov, int iovcnt)
+{ return -1; }
+void sr_uring_print_stats(struct sr_uring* uring, FILE* fp)
+{ }
+
+#endif /* _IO_URING_ */
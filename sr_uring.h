@@ -0,0 +1,59 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_uring.h
+ *
+ * Description:
+ *
+ * io_uring transport for the connection to the VNS server, as an
+ * alternative to read() and writev() on the socket (-i uring, or
+ * -i sqpoll). Only built with "make URING=1", which needs a Linux with
+ * multishot receive (6.0 or later); otherwise sr_uring_create always
+ * fails and the router stays on plain syscalls.
+ *
+ * Receiving: one multishot recv stays posted for the life of the session
+ * and the kernel lands data in a ring of provided buffers registered up
+ * front. Completions are reaped straight from the shared completion queue,
+ * so while traffic keeps coming a receive costs no syscall at all. The
+ * stream still has to be reassembled into commands, so each chunk is
+ * copied from its buffer into the receive ring (sr_rxring.h) and the
+ * buffer handed straight back to the kernel.
+ *
+ * Sending: the transmit queue's batches (sr_txq.h) go out as one
+ * IORING_OP_SENDMSG each. With -i sqpoll a kernel thread polls the
+ * submission queue and we spin on the completion queue for a while before
+ * sleeping, so a busy router sends without entering the kernel either.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_URING_H
+#define SR_URING_H
+
+#include <stdio.h>
+#include <sys/uio.h>
+
+#define SR_URING_BUFS    64     /* provided receive buffers, power of two */
+#define SR_URING_BUF_SZ  16384  /* size of each */
+#define SR_URING_SPIN    32768  /* CQ polls before sleeping, SQPOLL only */
+#define SR_URING_IDLE_MS 1000   /* SQPOLL thread goes to sleep after this */
+
+struct sr_uring;
+struct sr_rxring;
+
+/* Set up both rings on a connected socket. Returns 0 if io_uring isn't
+   available, in which case the caller should stick to read()/writev(). */
+struct sr_uring* sr_uring_create(int sockfd, int sqpoll);
+void sr_uring_destroy(struct sr_uring* uring);
+
+/* An eventfd that becomes readable when receives complete, for epoll. */
+int sr_uring_fd(struct sr_uring* uring);
+
+/* Move whatever has been received into ring. If nothing has, wait for it
+   when wait is set, or return 0. Returns the number of bytes added, or -1
+   on error or if the peer hung up. */
+int sr_uring_fill(struct sr_uring* uring, struct sr_rxring* ring, int wait);
+
+/* sr_txq_writer_fn: send all of iov. */
+int sr_uring_writev(void* uring, struct iovec* iov, int iovcnt);
+
+void sr_uring_print_stats(struct sr_uring* uring, FILE* fp);
+
+#endif /* -- SR_URING_H -- */
@@ -40,10 +40,18 @@
 #include "sr_router.h"
 #include "sr_if.h"
 #include "sr_protocol.h"
+#include "sr_txq.h"
+#include "sr_rxring.h"
+#include "sr_uring.h"
+#include "sr_loop.h"
+#include "sr_transport.h"
 
 #include "sha1.h"
 #include "vnscommand.h"
 
+/* The VNS transport's state is its io_uring, or 0 for read()/writev() */
+#define vns_uring(sr) ((struct sr_uring*)(sr)->transport->state)
+
 static void sr_log_packet(struct sr_instance* , uint8_t* , int );
 static int  sr_arp_req_not_for_us(struct sr_instance* sr,
                                   uint8_t * packet /* lent */,
@@ -121,6 +129,12 @@ int sr_connect_to_server(struct sr_instance* sr,unsigned short port,
         return -1;
     }
 
+    /* all packets to the server go through one transmit queue */
+    sr->txq = sr_txq_create(sr->sockfd);
+
+    /* and everything from it is read into refcounted receive slabs */
+    sr->rx = sr_rxring_create();
+
     /* wait for authentication to be completed (server sends the first message) */
     if(sr_read_from_server_expect(sr, VNS_AUTH_REQUEST)!= 1 ||
        sr_read_from_server_expect(sr, VNS_AUTH_STATUS) != 1)
@@ -319,96 +333,70 @@ int sr_handle_auth_status(struct sr_instance* sr, c_auth_status* status) {
 }
 
 /*-----------------------------------------------------------------------------
- * Method: sr_read_from_server(..)
+ * Method: sr_receive_packet(..)
  * Scope: global
  *
- * Houses main while loop for communicating with the virtual router server.
+ * Hand a frame that arrived on iface to the router, whichever way it came
+ * in. The frame is only borrowed for the duration of the call.
  *
  *---------------------------------------------------------------------------*/
 
-int sr_read_from_server(struct sr_instance* sr /* borrowed */)
+void sr_receive_packet(struct sr_instance* sr, uint8_t* packet,
+        unsigned int len, char* iface)
 {
-    return sr_read_from_server_expect(sr, 0);
-}
-
-int sr_read_from_server_expect(struct sr_instance* sr /* borrowed */, int expected_cmd)
-{
-    int command, len;
-    unsigned char *buf = 0;
-    c_packet_ethernet_header* sr_pkt = 0;
-    int ret = 0, bytes_read = 0;
-
-    /* REQUIRES */
-    assert(sr);
+    /* -- check if it is an ARP to another router if so drop   -- */
+    if ( sr_arp_req_not_for_us(sr, packet, len, iface) )
+    { return; }
 
-    /*---------------------------------------------------------------------------
-      Read a command from the server
-      -------------------------------------------------------------------------*/
-
-    bytes_read = 0;
-
-    /* attempt to read the size of the incoming packet */
-    while( bytes_read < 4)
-    {
-        do
-        { /* -- just in case SIGALRM breaks recv -- */
-            errno = 0; /* -- hacky glibc workaround -- */
-            if((ret = recv(sr->sockfd,((uint8_t*)&len) + bytes_read,
-                            4 - bytes_read, 0)) == -1)
-            {
-                if ( errno == EINTR )
-                { continue; }
-
-                perror("recv(..):sr_client.c::sr_read_from_server");
-                return -1;
-            }
-            bytes_read += ret;
-        } while ( errno == EINTR); /* be mindful of signals */
-
-    }
+    /* -- log packet -- */
+    sr_log_packet(sr, packet, len);
 
-    len = ntohl(len);
+    /* -- pass to router, student's code should take over here -- */
+    sr_handlepacket(sr, packet, len, iface);
+} /* -- sr_receive_packet -- */
 
-    if ( len > 10000 || len < 0 )
-    {
-        fprintf(stderr,"Error: command length to large %d\n",len);
-        close(sr->sockfd);
-        return -1;
-    }
+/*-----------------------------------------------------------------------------
+ * Method: sr_interfaces_ready(..)
+ * Scope: global
+ *
+ * Called once the interface list is complete.
+ *
+ *---------------------------------------------------------------------------*/
 
-    if((buf = malloc(len)) == 0)
+int sr_interfaces_ready(struct sr_instance* sr)
+{
+    if(sr_verify_routing_table(sr) != 0)
     {
-        fprintf(stderr,"Error: out of memory (sr_read_from_server)\n");
+        fprintf(stderr,"Routing table not consistent with hardware\n");
         return -1;
     }
+    sr->ready = 1;
+    sr_arpcache_prime(sr);
+    printf(" <-- Ready to process packets --> \n");
+    return 0;
+} /* -- sr_interfaces_ready -- */
 
-    /* set first field of command since we've already read it */
-    *((int *)buf) = htonl(len);
-
-    bytes_read = 0;
+/*-----------------------------------------------------------------------------
+ * Method: sr_handle_command(..)
+ * Scope: local
+ *
+ * Act on one command from the server. buf points into a receive slab and
+ * is only valid until the next read, unless the slab is held.
+ *
+ *---------------------------------------------------------------------------*/
 
-    /* read the rest of the command */
-    while ( bytes_read < len - 4)
-    {
-        do
-        {/* -- just in case SIGALRM breaks recv -- */
-            errno = 0; /* -- hacky glibc workaround -- */
-            if ((ret = read(sr->sockfd, buf+4+bytes_read, len - 4 - bytes_read)) ==
-                    -1)
-            {
-                if ( errno == EINTR )
-                { continue; }
-                fprintf(stderr,"Error: failed reading command body %d\n",ret);
-                close(sr->sockfd);
-                return -1;
-            }
-            bytes_read += ret;
-        } while (errno == EINTR); /* be mindful of signals */
-    }
+static int sr_handle_command(struct sr_instance* sr, uint8_t* buf, int len,
+        int expected_cmd)
+{
+    int command;
+    uint32_t cmd_nbo;
+    int ret;
 
     /* My entry for most unreadable line of code - guido */
     /* ... you win - mc                                  */
-    command = *(((int *)buf)+1) = ntohl(*(((int *)buf)+1));
+    memcpy(&cmd_nbo, buf + 4, 4);
+    command = ntohl(cmd_nbo);
+    memcpy(buf + 4, &command, 4);
 
     /* make sure the command is what we expected if we were expecting something */
     if(expected_cmd && command!=expected_cmd) {
@@ -424,27 +412,11 @@ int sr_read_from_server_expect(struct sr_instance* sr /* borrowed */, int expect
         /* -------------        VNSPACKET     -------------------- */
 
         case VNSPACKET:
-            sr_pkt = (c_packet_ethernet_header *)buf;
-
-            /* -- check if it is an ARP to another router if so drop   -- */
-            if ( sr_arp_req_not_for_us(sr,
-                    (buf+sizeof(c_packet_header)),
-                    len - sizeof(c_packet_ethernet_header) +
-                    sizeof(struct sr_ethernet_hdr),
-                    (char*)(buf + sizeof(c_base))) )
-            { break; }
-
-            /* -- log packet -- */
-            sr_log_packet(sr, buf + sizeof(c_packet_header),
-                    ntohl(sr_pkt->mLen) - sizeof(c_packet_header));
-
-            /* -- pass to router, student's code should take over here -- */
-            sr_handlepacket(sr,
+            sr_receive_packet(sr,
                     (buf+sizeof(c_packet_header)),
                     len - sizeof(c_packet_ethernet_header) +
                     sizeof(struct sr_ethernet_hdr),
                     (char*)(buf + sizeof(c_base)));
-
             break;
 
             /* -------------        VNSCLOSE      -------------------- */
@@ -453,9 +425,6 @@ int sr_read_from_server_expect(struct sr_instance* sr /* borrowed */, int expect
             fprintf(stderr,"VNS server closed session.\n");
             fprintf(stderr,"Reason: %s\n",((c_close*)buf)->mErrorMessage);
             sr_session_closed_help();
-
-            if(buf)
-            { free(buf); }
             return 0;
             break;
 
@@ -469,12 +438,8 @@ int sr_read_from_server_expect(struct sr_instance* sr /* borrowed */, int expect
 
         case VNSHWINFO:
             sr_handle_hwinfo(sr,(c_hwinfo*)buf);
-            if(sr_verify_routing_table(sr) != 0)
-            {
-                fprintf(stderr,"Routing table not consistent with hardware\n");
-                return -1;
-            }
-            printf(" <-- Ready to process packets --> \n");
+            if(sr_interfaces_ready(sr) != 0)
+            { return -1; }
             break;
 
             /* ---------------- VNS_RTABLE ---------------- */
@@ -501,11 +466,168 @@ int sr_read_from_server_expect(struct sr_instance* sr /* borrowed */, int expect
 
     }/* -- switch -- */
 
-    if(buf)
-    { free(buf); }
     return ret;
+} /* -- sr_handle_command -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_fill(..)
+ * Scope: local
+ *
+ * Read more from the server into the receive ring, through io_uring if
+ * it is set up. Waits for data unless wait is 0, in which case it may
+ * return 0 with nothing read.
+ *
+ *---------------------------------------------------------------------------*/
+
+static int sr_fill(struct sr_instance* sr, int wait)
+{
+    if(vns_uring(sr))
+    { return sr_uring_fill(vns_uring(sr), sr->rx, wait); }
+    return sr_rxring_fill(sr->rx, sr->sockfd);
+} /* -- sr_fill -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_handle_burst(..), sr_handle_buffered(..)
+ * Scope: local, global
+ *
+ * Handles every complete command already read in as one burst. Packets sent
+ * while handling the second and later commands are batched by the transmit
+ * queue and flushed at the end of it; a burst of one command is written
+ * directly. *handled is set to the number of commands handled.
+ *
+ *---------------------------------------------------------------------------*/
+
+static int sr_handle_burst(struct sr_instance* sr, int* handled)
+{
+    uint8_t* cmd;
+    int len, ret = 1;
+
+    *handled = 0;
+
+    /* -- the first command's packets go straight out; only once there is a
+          second do we cork, so a lone packet still skips the copy -- */
+    while(ret == 1 && (cmd = sr_rxring_next(sr->rx, &len)) != 0)
+    {
+        if(*handled == 1)
+        { sr_txq_cork(sr->txq); }
+        ret = sr_handle_command(sr, cmd, len, 0);
+        (*handled)++;
+    }
+    if(*handled > 1)
+    { sr_txq_uncork(sr->txq); }
+
+    if(len < 0)
+    {
+        close(sr->sockfd);
+        return -1;
+    }
+    return ret;
+} /* -- sr_handle_burst -- */
+
+int sr_handle_buffered(struct sr_instance* sr /* borrowed */)
+{
+    int handled;
+
+    /* REQUIRES */
+    assert(sr);
+    assert(sr->rx);
+
+    return sr_handle_burst(sr, &handled);
+} /* -- sr_handle_buffered -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_read_from_server(..)
+ * Scope: global
+ *
+ * Houses main while loop for communicating with the virtual router server.
+ *
+ * Does one read() and then handles every complete command it brought in
+ * as a burst, before reading again.
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_read_from_server(struct sr_instance* sr /* borrowed */)
+{
+    int ret, handled;
+
+    /* REQUIRES */
+    assert(sr);
+    assert(sr->rx);
+
+    /* -- setup may have left whole commands behind, so only read if not -- */
+    while(1)
+    {
+        ret = sr_handle_burst(sr, &handled);
+        if(handled > 0 || ret != 1)
+        { return ret; }
+
+        if(sr_fill(sr, 1) < 0)
+        {
+            close(sr->sockfd);
+            return -1;
+        }
+    }
 }/* -- sr_read_from_server -- */
 
+/*-----------------------------------------------------------------------------
+ * Method: sr_read_from_server_ready(..)
+ * Scope: global
+ *
+ * For the event loop: the socket is readable, so do exactly one read() and
+ * handle whatever complete commands that leaves us with, without blocking
+ * for the rest of a partial one.
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_read_from_server_ready(struct sr_instance* sr /* borrowed */)
+{
+    int handled;
+
+    /* REQUIRES */
+    assert(sr);
+    assert(sr->rx);
+
+    switch(sr_fill(sr, 0))
+    {
+        case -1:
+            close(sr->sockfd);
+            return -1;
+        case 0:
+            return 1; /* -- woken up for data we already took -- */
+    }
+    return sr_handle_burst(sr, &handled);
+}/* -- sr_read_from_server_ready -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_read_from_server_expect(..)
+ * Scope: global
+ *
+ * Handle exactly one command, reading until it is complete. Used while
+ * setting up the session, when the server has to go in a given order.
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_read_from_server_expect(struct sr_instance* sr /* borrowed */, int expected_cmd)
+{
+    uint8_t* cmd;
+    int len;
+
+    /* REQUIRES */
+    assert(sr);
+    assert(sr->rx);
+
+    while((cmd = sr_rxring_next(sr->rx, &len)) == 0)
+    {
+        if(len < 0 || sr_fill(sr, 1) < 0)
+        {
+            close(sr->sockfd);
+            return -1;
+        }
+    }
+
+    return sr_handle_command(sr, cmd, len, expected_cmd);
+}/* -- sr_read_from_server_expect -- */
+
 /*-----------------------------------------------------------------------------
  * Method: sr_ether_addrs_match_interface(..)
  * Scope: Local
@@ -517,23 +639,16 @@ int sr_read_from_server_expect(struct sr_instance* sr /* borrowed */, int expect
 static int
 sr_ether_addrs_match_interface( struct sr_instance* sr, /* borrowed */
                                 uint8_t* buf, /* borrowed */
-                                const char* name /* borrowed */ )
+                                const struct sr_if* iface /* borrowed */ )
 {
     struct sr_ethernet_hdr* ether_hdr = 0;
-    struct sr_if* iface = 0;
 
     /* -- REQUIRES -- */
     assert(sr);
     assert(buf);
-    assert(name);
+    assert(iface);
 
     ether_hdr = (struct sr_ethernet_hdr*)buf;
-    iface = sr_get_interface(sr, name);
-
-    if ( iface == 0 ){
-        fprintf( stderr, "** Error, interface %s, does not exist\n", name);
-        return 0;
-    }
 
     if ( memcmp( ether_hdr->ether_shost, iface->addr, ETHER_ADDR_LEN) != 0 ){
         fprintf( stderr, "** Error, source address does not match interface\n");
@@ -554,8 +669,8 @@ sr_ether_addrs_match_interface( struct sr_instance* sr, /* borrowed */
  * Method: sr_send_packet(..)
  * Scope: Global
  *
- * Send a packet (ethernet header included!) of length 'len' to the server
- * to be injected onto the wire.
+ * Send a packet (ethernet header included!) of length 'len' out of
+ * interface 'iface', through whichever transport the router is on.
  *
  *---------------------------------------------------------------------------*/
 
@@ -564,13 +679,41 @@ int sr_send_packet(struct sr_instance* sr /* borrowed */,
                          unsigned int len,
                          const char* iface /* borrowed */)
 {
-    c_packet_header *sr_pkt;
-    unsigned int total_len =  len + (sizeof(c_packet_header));
+    struct sr_if* out;
+
+    /* REQUIRES */
+    assert(sr);
+    assert(iface);
+
+    if ( (out = sr_get_interface(sr, iface)) == 0 ){
+        fprintf( stderr, "** Error, interface %s, does not exist\n", iface);
+        return -1;
+    }
+
+    return sr_send_packet_if(sr, buf, len, out);
+} /* -- sr_send_packet -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_send_packet_if(..)
+ * Scope: Global
+ *
+ * sr_send_packet for a caller that already has the interface, so the name
+ * is not looked up again.
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_send_packet_if(struct sr_instance* sr /* borrowed */,
+                      uint8_t* buf /* borrowed */ ,
+                      unsigned int len,
+                      const struct sr_if* iface /* borrowed */)
+{
+    struct sr_frame frame;
 
     /* REQUIRES */
     assert(sr);
     assert(buf);
     assert(iface);
+    assert(sr->transport);
 
     /* don't waste my time ... */
     if ( len < sizeof(struct sr_ethernet_hdr) ){
@@ -578,35 +721,169 @@ int sr_send_packet(struct sr_instance* sr /* borrowed */,
         return -1;
     }
 
-    /* Create packet */
-    sr_pkt = (c_packet_header *)malloc(len +
-            sizeof(c_packet_header));
-    assert(sr_pkt);
-    sr_pkt->mLen  = htonl(total_len);
-    sr_pkt->mType = htonl(VNSPACKET);
-    strncpy(sr_pkt->mInterfaceName,iface,16);
-    memcpy(((uint8_t*)sr_pkt) + sizeof(c_packet_header),
-            buf,len);
-
     /* -- log packet -- */
     sr_log_packet(sr,buf,len);
 
     if ( ! sr_ether_addrs_match_interface( sr, buf, iface) ){
         fprintf( stderr, "*** Error: problem with ethernet header, check log\n");
-        free ( sr_pkt );
         return -1;
     }
 
-    if( write(sr->sockfd, sr_pkt, total_len) < total_len ){
-        fprintf(stderr, "Error writing packet\n");
-        free(sr_pkt);
+    frame.buf   = buf;
+    frame.len   = len;
+    frame.iface = iface;
+    if ( sr->transport->send_burst(sr, &frame, 1) != 1 ){
         return -1;
     }
 
-    free(sr_pkt);
+    return 0;
+} /* -- sr_send_packet_if -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: vns_connect(..)
+ * Scope: Local
+ *
+ * The VNS transport (sr_transport.h). spec is "server:port", optionally
+ * followed by ",uring" or ",sqpoll" to move the session over to io_uring
+ * once it is up.
+ *
+ *---------------------------------------------------------------------------*/
+
+static int vns_connect(struct sr_instance* sr, const char* spec)
+{
+    char* server;
+    char* colon;
+    char* io;
+    int ret = -1;
+
+    server = strdup(spec);
+    if((io = strchr(server, ',')) != 0)
+    { *io++ = 0; }
+    if((colon = strrchr(server, ':')) == 0)
+    {
+        fprintf(stderr, "Error: expected server:port, got %s\n", spec);
+        free(server);
+        return -1;
+    }
+    *colon = 0;
 
+    if(sr_connect_to_server(sr, (unsigned short)atoi(colon + 1), server) == 0)
+    {
+        ret = 0;
+        if(io && (sr->transport->state = sr_uring_create(sr->sockfd,
+                                              strcmp(io, "sqpoll") == 0)) == 0)
+        { fprintf(stderr,"io_uring unavailable, using read() and writev()\n"); }
+        if(vns_uring(sr))
+        { sr_txq_set_writer(sr->txq, sr_uring_writev, vns_uring(sr)); }
+    }
+    free(server);
+    return ret;
+} /* -- vns_connect -- */
+
+static int vns_interfaces(struct sr_instance* sr)
+{
+    /* -- the server sends them in a VNSHWINFO once the session is open -- */
     return 0;
-} /* -- sr_send_packet -- */
+} /* -- vns_interfaces -- */
+
+static void vns_ready(struct sr_loop* loop, int fd, void* arg)
+{
+    if(sr_read_from_server_ready(loop->sr) != 1)
+    { sr_loop_stop(loop); }
+} /* -- vns_ready -- */
+
+static int vns_watch(struct sr_instance* sr, struct sr_loop* loop)
+{
+    /* -- setup may have read more than it needed -- */
+    if(sr_handle_buffered(sr) != 1)
+    { return -1; }
+
+    /* -- with io_uring, the socket is the kernel's to watch -- */
+    return sr_loop_add_fd(loop, vns_uring(sr) ? sr_uring_fd(vns_uring(sr))
+                                          : sr->sockfd, vns_ready, 0);
+} /* -- vns_watch -- */
+
+static int vns_recv_burst(struct sr_instance* sr, int wait)
+{
+    return wait ? sr_read_from_server(sr) : sr_read_from_server_ready(sr);
+} /* -- vns_recv_burst -- */
+
+static int vns_send_burst(struct sr_instance* sr,
+        const struct sr_frame* frames, int n)
+{
+    c_packet_header sr_pkt;
+    int i;
+
+    /* -- a lone frame goes straight out; more share one write -- */
+    if(n > 1)
+    { sr_txq_cork(sr->txq); }
+    for(i = 0; i < n; i++)
+    {
+        /* Create packet header */
+        memset(&sr_pkt, 0, sizeof(c_packet_header));
+        sr_pkt.mLen  = htonl(frames[i].len + sizeof(c_packet_header));
+        sr_pkt.mType = htonl(VNSPACKET);
+        strncpy(sr_pkt.mInterfaceName,frames[i].iface->name,16);
+
+        /* -- both threads send, so go through the queue's single writer -- */
+        if( sr_txq_send(sr->txq, (uint8_t*)&sr_pkt, sizeof(c_packet_header),
+                    frames[i].buf, frames[i].len) != 0 ){
+            fprintf(stderr, "Error writing packet\n");
+            break;
+        }
+    }
+    if(n > 1)
+    { sr_txq_uncork(sr->txq); }
+
+    return i;
+} /* -- vns_send_burst -- */
+
+static void vns_print_stats(struct sr_instance* sr, FILE* fp)
+{
+    if(sr->txq)
+    { sr_txq_print_stats(sr->txq, fp); }
+    if(sr->rx)
+    { sr_rxring_print_stats(sr->rx, fp); }
+    if(vns_uring(sr))
+    { sr_uring_print_stats(vns_uring(sr), fp); }
+} /* -- vns_print_stats -- */
+
+static void vns_close(struct sr_instance* sr)
+{
+    if(sr->txq)
+    {
+        sr_txq_print_stats(sr->txq, stderr);
+        sr_txq_destroy(sr->txq);
+        sr->txq = 0;
+    }
+
+    /* -- after the transmit queue, which may still flush through it -- */
+    if(vns_uring(sr))
+    {
+        sr_uring_print_stats(vns_uring(sr), stderr);
+        sr_uring_destroy(vns_uring(sr));
+        sr->transport->state = 0;
+    }
+
+    if(sr->rx)
+    {
+        sr_rxring_print_stats(sr->rx, stderr);
+        sr_rxring_destroy(sr->rx);
+        sr->rx = 0;
+    }
+} /* -- vns_close -- */
+
+const struct sr_transport sr_vns_transport =
+{
+    "vns",
+    vns_connect,
+    vns_interfaces,
+    vns_watch,
+    vns_recv_burst,
+    vns_send_burst,
+    vns_print_stats,
+    vns_close
+};
 
 /*-----------------------------------------------------------------------------
  * Method: sr_log_packet()
@@ -661,7 +938,12 @@ int  sr_arp_req_not_for_us(struct sr_instance* sr,
     if ( (e_hdr->ether_type == htons(ethertype_arp)) &&
             (a_hdr->ar_op      == htons(arp_op_request))   &&
             (a_hdr->ar_tip     != iface->ip ) )
-    { return 1; }
+    {
+        /* -- let gratuitous ARPs through if the router wants them -- */
+        if ( sr->arp_gratuitous && (a_hdr->ar_sip == a_hdr->ar_tip) )
+        { return 0; }
+        return 1;
+    }
 
     return 0;
 } /* -- sr_arp_req_not_for_us -- */
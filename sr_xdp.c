@@ -0,0 +1,768 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_xdp.c
+ *
+ * Description:
+ *
+ * AF_XDP data plane; see sr_xdp.h.
+ *
+ * Talks to the kernel through the raw bpf syscall, without libbpf or
+ * libxdp. The XDP program is five instructions: look the receive queue up
+ * in an XSKMAP and redirect the frame to the socket found there, or let it
+ * through to the stack if there is none.
+ *
+ * UMEM frames are identified by their offset into the UMEM. Every frame is
+ * always in exactly one place: the fill ring, the RX ring, our free stack,
+ * the TX ring or the completion ring. Since each ring holds
+ * SR_XDP_FRAMES / 2 entries, none of them can overflow.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "sr_xdp.h"
+#include "sr_router.h"
+#include "sr_if.h"
+#include "sr_loop.h"
+#include "sr_transport.h"
+
+#if defined(_LINUX_) && defined(_AF_XDP_)
+
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/resource.h>
+#include <arpa/inet.h>
+#include <linux/if_xdp.h>
+#include <linux/if_link.h>
+#include <linux/bpf.h>
+
+#define XDP_UMEM_SZ  ((size_t)SR_XDP_FRAMES * SR_XDP_FRAME_SZ)
+
+/*---------------------------------------------------------------------
+ * Method: xdp_bpf(..)
+ * Scope:  Local
+ *
+ *---------------------------------------------------------------------*/
+
+static int xdp_bpf(int cmd, union bpf_attr* attr)
+{
+    return syscall(__NR_bpf, cmd, attr, sizeof(*attr));
+} /* -- xdp_bpf -- */
+
+/*---------------------------------------------------------------------
+ * Method: xdp_prog_load(..)
+ * Scope:  Local
+ *
+ * Load the redirect program for map_fd:
+ *
+ *   r2 = ctx->rx_queue_index
+ *   r1 = map_fd
+ *   r3 = XDP_PASS                  (what to do if the map has no socket)
+ *   return bpf_redirect_map(r1, r2, r3)
+ *
+ *---------------------------------------------------------------------*/
+
+static int xdp_prog_load(int map_fd)
+{
+    struct bpf_insn insns[6];
+    union bpf_attr attr;
+    char log[1024];
+    int fd;
+
+    memset(insns, 0, sizeof(insns));
+    insns[0].code    = BPF_LDX | BPF_MEM | BPF_W;
+    insns[0].dst_reg = BPF_REG_2;
+    insns[0].src_reg = BPF_REG_1;
+    insns[0].off     = 16;      /* offsetof(struct xdp_md, rx_queue_index) */
+    insns[1].code    = BPF_LD | BPF_DW | BPF_IMM;
+    insns[1].dst_reg = BPF_REG_1;
+    insns[1].src_reg = BPF_PSEUDO_MAP_FD;
+    insns[1].imm     = map_fd;
+    /* -- insns[2] is the upper half of the 64 bit immediate -- */
+    insns[3].code    = BPF_ALU64 | BPF_MOV | BPF_K;
+    insns[3].dst_reg = BPF_REG_3;
+    insns[3].imm     = XDP_PASS;
+    insns[4].code    = BPF_JMP | BPF_CALL;
+    insns[4].imm     = BPF_FUNC_redirect_map;
+    insns[5].code    = BPF_JMP | BPF_EXIT;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.prog_type = BPF_PROG_TYPE_XDP;
+    attr.insns     = (uint64_t)(unsigned long)insns;
+    attr.insn_cnt  = sizeof(insns) / sizeof(insns[0]);
+    attr.license   = (uint64_t)(unsigned long)"GPL";
+    attr.log_buf   = (uint64_t)(unsigned long)log;
+    attr.log_size  = sizeof(log);
+    attr.log_level = 1;
+    log[0] = 0;
+
+    if((fd = xdp_bpf(BPF_PROG_LOAD, &attr)) < 0)
+    {
+        perror("bpf(BPF_PROG_LOAD):sr_xdp.c::xdp_prog_load");
+        if(log[0])
+        { fprintf(stderr, "%s\n", log); }
+    }
+    return fd;
+} /* -- xdp_prog_load -- */
+
+/*---------------------------------------------------------------------
+ * Method: xdp_ring_map(..)
+ * Scope:  Local
+ *
+ * Map one of the socket's rings. desc_sz is the size of its entries.
+ *
+ *---------------------------------------------------------------------*/
+
+static int xdp_ring_map(struct sr_xdp_port* port, struct sr_xdp_ring* ring,
+        struct xdp_ring_offset* off, size_t desc_sz, off_t pgoff)
+{
+    uint8_t* map;
+
+    ring->map_sz = off->desc + SR_XDP_RING_SZ * desc_sz;
+    map = (uint8_t*)mmap(0, ring->map_sz, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, port->fd, pgoff);
+    if(map == MAP_FAILED)
+    {
+        perror("mmap(..):sr_xdp.c::xdp_ring_map");
+        return -1;
+    }
+
+    ring->map      = map;
+    ring->producer = (uint32_t*)(map + off->producer);
+    ring->consumer = (uint32_t*)(map + off->consumer);
+    ring->flags    = (uint32_t*)(map + off->flags);
+    ring->descs    = map + off->desc;
+    return 0;
+} /* -- xdp_ring_map -- */
+
+/*---------------------------------------------------------------------
+ * Method: xdp_kick(..)
+ * Scope:  Local
+ *
+ * Have the kernel send what is on port's TX ring. Caller holds tx_lock.
+ *
+ *---------------------------------------------------------------------*/
+
+static void xdp_kick(struct sr_xdp_port* port)
+{
+    if(port->tx_pending == 0)
+    { return; }
+
+    /* -- generic mode sends at most 32 frames a call, and says EAGAIN if
+          there were more; the next kick picks them up -- */
+    if(sendto(port->fd, 0, 0, MSG_DONTWAIT, 0, 0) < 0 &&
+       errno != EAGAIN && errno != EBUSY && errno != ENOBUFS)
+    { perror("sendto(..):sr_xdp.c::xdp_kick"); }
+    port->stats.tx_kicks++;
+    port->tx_pending = 0;
+} /* -- xdp_kick -- */
+
+/*---------------------------------------------------------------------
+ * Method: xdp_reap(..)
+ * Scope:  Local
+ *
+ * Take back the frames the kernel has finished sending. Caller holds
+ * tx_lock.
+ *
+ *---------------------------------------------------------------------*/
+
+static void xdp_reap(struct sr_xdp_port* port)
+{
+    struct sr_xdp_ring* comp = &port->comp;
+    uint64_t* addrs = (uint64_t*)comp->descs;
+    uint32_t prod;
+
+    prod = __atomic_load_n(comp->producer, __ATOMIC_ACQUIRE);
+    if(prod == comp->cached_cons)
+    { return; }
+
+    while(comp->cached_cons != prod)
+    {
+        port->free_frames[port->nfree++] =
+            addrs[comp->cached_cons & (SR_XDP_RING_SZ - 1)];
+        comp->cached_cons++;
+    }
+    __atomic_store_n(comp->consumer, comp->cached_cons, __ATOMIC_RELEASE);
+} /* -- xdp_reap -- */
+
+/*---------------------------------------------------------------------
+ * Method: xdp_port_open(..)
+ * Scope:  Local
+ *
+ * Set up the UMEM, socket, rings and XDP program for one interface, and
+ * find its MAC and (unless we were given one) IPv4 address.
+ *
+ *---------------------------------------------------------------------*/
+
+static int xdp_port_open(struct sr_xdp_port* port, unsigned char* mac,
+        uint32_t* ip)
+{
+    struct xdp_umem_reg reg;
+    struct xdp_mmap_offsets off;
+    struct sockaddr_xdp sxdp;
+    union bpf_attr attr;
+    socklen_t optlen;
+    uint64_t* fill;
+    uint32_t key = 0;
+    int v = SR_XDP_RING_SZ;
+    unsigned int i;
+
+    if(sr_if_from_host(port->name, &port->ifindex, mac, ip) < 0)
+    { return -1; }
+
+    port->fd = socket(AF_XDP, SOCK_RAW | SOCK_CLOEXEC, 0);
+    if(port->fd < 0)
+    {
+        perror("socket(AF_XDP):sr_xdp.c::xdp_port_open");
+        return -1;
+    }
+
+    /* -- UMEM -- */
+    port->umem = (uint8_t*)mmap(0, XDP_UMEM_SZ, PROT_READ | PROT_WRITE,
+                                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(port->umem == MAP_FAILED)
+    {
+        port->umem = 0;
+        perror("mmap(..):sr_xdp.c::xdp_port_open");
+        return -1;
+    }
+
+    memset(&reg, 0, sizeof(reg));
+    reg.addr = (uint64_t)(unsigned long)port->umem;
+    reg.len = XDP_UMEM_SZ;
+    reg.chunk_size = SR_XDP_FRAME_SZ;
+    if(setsockopt(port->fd, SOL_XDP, XDP_UMEM_REG, &reg, sizeof(reg)) < 0)
+    {
+        perror("setsockopt(XDP_UMEM_REG):sr_xdp.c::xdp_port_open");
+        return -1;
+    }
+
+    /* -- rings -- */
+    if(setsockopt(port->fd, SOL_XDP, XDP_UMEM_FILL_RING, &v, sizeof(v)) < 0 ||
+       setsockopt(port->fd, SOL_XDP, XDP_UMEM_COMPLETION_RING, &v, sizeof(v)) < 0 ||
+       setsockopt(port->fd, SOL_XDP, XDP_RX_RING, &v, sizeof(v)) < 0 ||
+       setsockopt(port->fd, SOL_XDP, XDP_TX_RING, &v, sizeof(v)) < 0)
+    {
+        perror("setsockopt(..):sr_xdp.c::xdp_port_open");
+        return -1;
+    }
+
+    optlen = sizeof(off);
+    if(getsockopt(port->fd, SOL_XDP, XDP_MMAP_OFFSETS, &off, &optlen) < 0)
+    {
+        perror("getsockopt(XDP_MMAP_OFFSETS):sr_xdp.c::xdp_port_open");
+        return -1;
+    }
+
+    if(xdp_ring_map(port, &port->fill, &off.fr, sizeof(uint64_t),
+                    XDP_UMEM_PGOFF_FILL_RING) < 0 ||
+       xdp_ring_map(port, &port->comp, &off.cr, sizeof(uint64_t),
+                    XDP_UMEM_PGOFF_COMPLETION_RING) < 0 ||
+       xdp_ring_map(port, &port->rx, &off.rx, sizeof(struct xdp_desc),
+                    XDP_PGOFF_RX_RING) < 0 ||
+       xdp_ring_map(port, &port->tx, &off.tx, sizeof(struct xdp_desc),
+                    XDP_PGOFF_TX_RING) < 0)
+    { return -1; }
+
+    /* -- first half of the UMEM to receive into, second half to send from -- */
+    fill = (uint64_t*)port->fill.descs;
+    for(i = 0; i < SR_XDP_FRAMES / 2; i++)
+    { fill[i] = (uint64_t)i * SR_XDP_FRAME_SZ; }
+    port->fill.cached_prod = SR_XDP_FRAMES / 2;
+    __atomic_store_n(port->fill.producer, port->fill.cached_prod,
+                     __ATOMIC_RELEASE);
+
+    for(i = 0; i < SR_XDP_FRAMES / 2; i++)
+    { port->free_frames[i] = (uint64_t)(SR_XDP_FRAMES / 2 + i) * SR_XDP_FRAME_SZ; }
+    port->nfree = SR_XDP_FRAMES / 2;
+
+    memset(&sxdp, 0, sizeof(sxdp));
+    sxdp.sxdp_family   = AF_XDP;
+    sxdp.sxdp_ifindex  = port->ifindex;
+    sxdp.sxdp_queue_id = 0;
+    sxdp.sxdp_flags    = XDP_COPY | XDP_USE_NEED_WAKEUP;
+    if(bind(port->fd, (struct sockaddr*)&sxdp, sizeof(sxdp)) < 0)
+    {
+        perror("bind(..):sr_xdp.c::xdp_port_open");
+        return -1;
+    }
+
+    /* -- the program, and the map it redirects through -- */
+    memset(&attr, 0, sizeof(attr));
+    attr.map_type    = BPF_MAP_TYPE_XSKMAP;
+    attr.key_size    = sizeof(uint32_t);
+    attr.value_size  = sizeof(int);
+    attr.max_entries = 1;
+    if((port->map_fd = xdp_bpf(BPF_MAP_CREATE, &attr)) < 0)
+    {
+        perror("bpf(BPF_MAP_CREATE):sr_xdp.c::xdp_port_open");
+        return -1;
+    }
+
+    memset(&attr, 0, sizeof(attr));
+    attr.map_fd = port->map_fd;
+    attr.key    = (uint64_t)(unsigned long)&key;
+    attr.value  = (uint64_t)(unsigned long)&port->fd;
+    if(xdp_bpf(BPF_MAP_UPDATE_ELEM, &attr) < 0)
+    {
+        perror("bpf(BPF_MAP_UPDATE_ELEM):sr_xdp.c::xdp_port_open");
+        return -1;
+    }
+
+    if((port->prog_fd = xdp_prog_load(port->map_fd)) < 0)
+    { return -1; }
+
+    /* -- last, so nothing is redirected before the socket is ready -- */
+    memset(&attr, 0, sizeof(attr));
+    attr.link_create.prog_fd        = port->prog_fd;
+    attr.link_create.target_ifindex = port->ifindex;
+    attr.link_create.attach_type    = BPF_XDP;
+    attr.link_create.flags          = XDP_FLAGS_SKB_MODE;
+    if((port->link_fd = xdp_bpf(BPF_LINK_CREATE, &attr)) < 0)
+    {
+        perror("bpf(BPF_LINK_CREATE):sr_xdp.c::xdp_port_open");
+        return -1;
+    }
+
+    return 0;
+} /* -- xdp_port_open -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_xdp_open(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+struct sr_xdp* sr_xdp_open(struct sr_instance* sr, const char* spec)
+{
+    struct sr_xdp* xdp;
+    struct sr_xdp_port* port;
+    unsigned char mac[ETHER_ADDR_LEN];
+    struct in_addr addr;
+    struct rlimit rl;
+    char* list;
+    char* name;
+    char* eq;
+    char* save = 0;
+
+    /* REQUIRES */
+    assert(sr);
+    assert(spec);
+
+    /* -- kernels before 5.11 charge maps and the UMEM to RLIMIT_MEMLOCK -- */
+    rl.rlim_cur = rl.rlim_max = RLIM_INFINITY;
+    setrlimit(RLIMIT_MEMLOCK, &rl);
+
+    xdp = (struct sr_xdp*)calloc(1, sizeof(struct sr_xdp));
+    assert(xdp);
+    xdp->sr = sr;
+
+    list = strdup(spec);
+    for(name = strtok_r(list, ",", &save); name; name = strtok_r(0, ",", &save))
+    {
+        if(xdp->nports == SR_XDP_PORTS_MAX)
+        {
+            fprintf(stderr, "Error: at most %d interfaces\n", SR_XDP_PORTS_MAX);
+            break;
+        }
+
+        addr.s_addr = 0;
+        if((eq = strchr(name, '=')) != 0)
+        {
+            *eq = 0;
+            if(inet_aton(eq + 1, &addr) == 0)
+            {
+                fprintf(stderr, "Error: bad address %s for %s\n", eq + 1, name);
+                break;
+            }
+        }
+
+        port = &xdp->ports[xdp->nports++];
+        port->fd = port->prog_fd = port->map_fd = port->link_fd = -1;
+        pthread_mutex_init(&port->tx_lock, 0);
+        strncpy(port->name, name, sr_IFACE_NAMELEN - 1);
+        if(xdp_port_open(port, mac, &addr.s_addr) < 0)
+        { break; }
+
+        /* -- as sr_handle_hwinfo does for interfaces the server tells us of -- */
+        sr_add_interface(sr, port->name);
+        sr_get_interface(sr, port->name)->port = port;
+        sr_set_ether_addr(sr, mac);
+        sr_set_ether_ip(sr, addr.s_addr);
+    }
+    free(list);
+
+    if(name || xdp->nports == 0)
+    {
+        sr_xdp_close(xdp);
+        return 0;
+    }
+
+    printf("Router interfaces:\n");
+    sr_print_if_list(sr);
+
+    return xdp;
+} /* -- sr_xdp_open -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_xdp_close(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_xdp_close(struct sr_xdp* xdp)
+{
+    struct sr_xdp_port* port;
+    struct sr_xdp_ring* rings[4];
+    int i, j;
+
+    if(!xdp)
+    { return; }
+
+    for(i = 0; i < xdp->nports; i++)
+    {
+        port = &xdp->ports[i];
+
+        /* -- detach first so the interface goes back to the stack -- */
+        if(port->link_fd >= 0)
+        { close(port->link_fd); }
+        if(port->prog_fd >= 0)
+        { close(port->prog_fd); }
+        if(port->map_fd >= 0)
+        { close(port->map_fd); }
+
+        if(port->tx.map)
+        {
+            pthread_mutex_lock(&port->tx_lock);
+            xdp_kick(port);
+            pthread_mutex_unlock(&port->tx_lock);
+        }
+
+        rings[0] = &port->fill;
+        rings[1] = &port->comp;
+        rings[2] = &port->rx;
+        rings[3] = &port->tx;
+        for(j = 0; j < 4; j++)
+        {
+            if(rings[j]->map)
+            { munmap(rings[j]->map, rings[j]->map_sz); }
+        }
+        if(port->fd >= 0)
+        { close(port->fd); }
+        if(port->umem)
+        { munmap(port->umem, XDP_UMEM_SZ); }
+        pthread_mutex_destroy(&port->tx_lock);
+    }
+    free(xdp);
+} /* -- sr_xdp_close -- */
+
+/*---------------------------------------------------------------------
+ * Method: xdp_flush(..)
+ * Scope:  Local
+ *
+ *---------------------------------------------------------------------*/
+
+static void xdp_flush(struct sr_xdp* xdp)
+{
+    struct sr_xdp_port* port;
+    int i;
+
+    for(i = 0; i < xdp->nports; i++)
+    {
+        port = &xdp->ports[i];
+        if(port->tx_pending == 0)
+        { continue; }
+        pthread_mutex_lock(&port->tx_lock);
+        xdp_kick(port);
+        pthread_mutex_unlock(&port->tx_lock);
+    }
+} /* -- xdp_flush -- */
+
+/*---------------------------------------------------------------------
+ * Method: xdp_rx(..)
+ * Scope:  Local
+ *
+ * Handle every frame on port's RX ring, then give the frames back to the
+ * kernel through the fill ring.
+ *
+ *---------------------------------------------------------------------*/
+
+static void xdp_rx(struct sr_xdp* xdp, struct sr_xdp_port* port)
+{
+    struct xdp_desc* descs = (struct xdp_desc*)port->rx.descs;
+    uint64_t* fill = (uint64_t*)port->fill.descs;
+    struct xdp_desc* d;
+    uint32_t prod;
+
+    prod = __atomic_load_n(port->rx.producer, __ATOMIC_ACQUIRE);
+    if(prod == port->rx.cached_cons)
+    { return; }
+
+    __atomic_add_fetch(&xdp->corked, 1, __ATOMIC_SEQ_CST);
+    while(port->rx.cached_cons != prod)
+    {
+        d = &descs[port->rx.cached_cons & (SR_XDP_RING_SZ - 1)];
+        port->stats.rx_packets++;
+        port->stats.rx_bytes += d->len;
+        sr_receive_packet(xdp->sr, port->umem + d->addr, d->len, port->name);
+
+        /* -- addr points past the headroom; hand back the whole frame -- */
+        fill[port->fill.cached_prod & (SR_XDP_RING_SZ - 1)] =
+            d->addr & ~((uint64_t)SR_XDP_FRAME_SZ - 1);
+        port->fill.cached_prod++;
+        port->rx.cached_cons++;
+    }
+    __atomic_store_n(port->rx.consumer, port->rx.cached_cons, __ATOMIC_RELEASE);
+    __atomic_store_n(port->fill.producer, port->fill.cached_prod,
+                     __ATOMIC_RELEASE);
+    port->stats.rx_batches++;
+    __atomic_sub_fetch(&xdp->corked, 1, __ATOMIC_SEQ_CST);
+
+    if(__atomic_load_n(port->fill.flags, __ATOMIC_ACQUIRE) & XDP_RING_NEED_WAKEUP)
+    { recvfrom(port->fd, 0, 0, MSG_DONTWAIT, 0, 0); }
+
+    /* -- whatever the frames we just handled made us send -- */
+    xdp_flush(xdp);
+} /* -- xdp_rx -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_xdp_watch(..), sr_xdp_poll(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+static void xdp_ready(struct sr_loop* loop, int fd, void* arg)
+{
+    struct sr_xdp_port* port = (struct sr_xdp_port*)arg;
+
+    xdp_rx((struct sr_xdp*)loop->sr->transport->state, port);
+} /* -- xdp_ready -- */
+
+int sr_xdp_watch(struct sr_xdp* xdp, struct sr_loop* loop)
+{
+    int i;
+
+    for(i = 0; i < xdp->nports; i++)
+    {
+        if(sr_loop_add_fd(loop, xdp->ports[i].fd, xdp_ready, &xdp->ports[i]) < 0)
+        { return -1; }
+    }
+    return 0;
+} /* -- sr_xdp_watch -- */
+
+int sr_xdp_poll(struct sr_xdp* xdp, int timeout_ms)
+{
+    struct pollfd pfd[SR_XDP_PORTS_MAX];
+    int i, n;
+
+    for(i = 0; i < xdp->nports; i++)
+    {
+        pfd[i].fd = xdp->ports[i].fd;
+        pfd[i].events = POLLIN;
+        pfd[i].revents = 0;
+    }
+
+    if((n = poll(pfd, xdp->nports, timeout_ms)) < 0)
+    {
+        if(errno == EINTR)
+        { return 1; }
+        perror("poll(..):sr_xdp.c::sr_xdp_poll");
+        return -1;
+    }
+
+    for(i = 0; i < xdp->nports && n > 0; i++)
+    {
+        if(pfd[i].revents)
+        { xdp_rx(xdp, &xdp->ports[i]); }
+    }
+    return 1;
+} /* -- sr_xdp_poll -- */
+
+/*---------------------------------------------------------------------
+ * Method: xdp_queue(..)
+ * Scope:  Local
+ *
+ * Copy one frame into a free UMEM frame and put it on its interface's
+ * TX ring. It goes out at the next kick.
+ *
+ *---------------------------------------------------------------------*/
+
+static int xdp_queue(const uint8_t* buf, unsigned int len,
+        const struct sr_if* iface)
+{
+    struct sr_xdp_port* port = 0;
+    struct xdp_desc* d;
+    uint64_t addr;
+
+    if((port = (struct sr_xdp_port*)iface->port) == 0)
+    {
+        fprintf(stderr, "Error: no interface %s to send on\n", iface->name);
+        return -1;
+    }
+    if(len > SR_XDP_FRAME_SZ)
+    {
+        fprintf(stderr, "Error: %u byte frame too big for %s\n", len, iface->name);
+        return -1;
+    }
+
+    pthread_mutex_lock(&port->tx_lock);
+
+    if(port->nfree == 0)
+    { xdp_reap(port); }
+    if(port->nfree == 0)
+    {
+        /* -- everything is in flight: push it out and look again -- */
+        xdp_kick(port);
+        xdp_reap(port);
+        if(port->nfree == 0)
+        {
+            port->stats.tx_full++;
+            pthread_mutex_unlock(&port->tx_lock);
+            return -1;
+        }
+    }
+
+    addr = port->free_frames[--port->nfree];
+    memcpy(port->umem + addr, buf, len);
+
+    d = &((struct xdp_desc*)port->tx.descs)
+            [port->tx.cached_prod & (SR_XDP_RING_SZ - 1)];
+    d->addr = addr;
+    d->len = len;
+    d->options = 0;
+    port->tx.cached_prod++;
+    __atomic_store_n(port->tx.producer, port->tx.cached_prod, __ATOMIC_RELEASE);
+
+    port->tx_pending++;
+    port->stats.tx_packets++;
+    port->stats.tx_bytes += len;
+
+    if(port->tx_pending >= SR_XDP_TX_BATCH)
+    { xdp_kick(port); }
+
+    pthread_mutex_unlock(&port->tx_lock);
+    return 0;
+} /* -- xdp_queue -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_xdp_send(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_xdp_send(struct sr_xdp* xdp, const struct sr_frame* frames, int n)
+{
+    int i;
+
+    for(i = 0; i < n; i++)
+    {
+        if(xdp_queue(frames[i].buf, frames[i].len, frames[i].iface) < 0)
+        { break; }
+    }
+
+    /* -- while an RX batch is handled, xdp_rx flushes at the end -- */
+    if(__atomic_load_n(&xdp->corked, __ATOMIC_SEQ_CST) == 0)
+    { xdp_flush(xdp); }
+
+    return i;
+} /* -- sr_xdp_send -- */
+
+void sr_xdp_print_stats(struct sr_xdp* xdp, FILE* fp)
+{
+    struct sr_xdp_stats* st;
+    int i;
+
+    for(i = 0; i < xdp->nports; i++)
+    {
+        st = &xdp->ports[i].stats;
+        fprintf(fp, "AF_XDP %s: received %lu frames (%lu bytes) in %lu "
+                "batches; sent %lu frames (%lu bytes) in %lu sendto calls, "
+                "%lu dropped for want of a frame\n", xdp->ports[i].name,
+                st->rx_packets, st->rx_bytes, st->rx_batches,
+                st->tx_packets, st->tx_bytes, st->tx_kicks, st->tx_full);
+    }
+} /* -- sr_xdp_print_stats -- */
+
+#else /* -- no AF_XDP -- */
+
+struct sr_xdp* sr_xdp_open(struct sr_instance* sr, const char* spec)
+{
+    fprintf(stderr, "AF_XDP support was not built in (make XDP=1, Linux only)\n");
+    return 0;
+}
+void sr_xdp_close(struct sr_xdp* xdp)
+{ }
+int sr_xdp_watch(struct sr_xdp* xdp, struct sr_loop* loop)
+{ return -1; }
+int sr_xdp_poll(struct sr_xdp* xdp, int timeout_ms)
+{ return -1; }
+int sr_xdp_send(struct sr_xdp* xdp, const struct sr_frame* frames, int n)
+{ return 0; }
+void sr_xdp_print_stats(struct sr_xdp* xdp, FILE* fp)
+{ }
+
+#endif /* _LINUX_ && _AF_XDP_ */
+
+/*---------------------------------------------------------------------
+ * The AF_XDP transport (sr_transport.h); spec is the interface list.
+ *---------------------------------------------------------------------*/
+
+static int xdp_connect(struct sr_instance* sr, const char* spec)
+{
+    return (sr->transport->state = sr_xdp_open(sr, spec)) != 0 ? 0 : -1;
+} /* -- xdp_connect -- */
+
+static int xdp_interfaces(struct sr_instance* sr)
+{
+    /* -- sr_xdp_open added them -- */
+    return 1;
+} /* -- xdp_interfaces -- */
+
+static int xdp_watch(struct sr_instance* sr, struct sr_loop* loop)
+{
+    return sr_xdp_watch(sr->transport->state, loop);
+} /* -- xdp_watch -- */
+
+static int xdp_recv_burst(struct sr_instance* sr, int wait)
+{
+    return sr_xdp_poll(sr->transport->state, wait ? -1 : 0);
+} /* -- xdp_recv_burst -- */
+
+static int xdp_send_burst(struct sr_instance* sr,
+        const struct sr_frame* frames, int n)
+{
+    return sr_xdp_send(sr->transport->state, frames, n);
+} /* -- xdp_send_burst -- */
+
+static void xdp_print_stats(struct sr_instance* sr, FILE* fp)
+{
+    sr_xdp_print_stats(sr->transport->state, fp);
+} /* -- xdp_print_stats -- */
+
+static void xdp_close(struct sr_instance* sr)
+{
+    if(sr->transport->state)
+    {
+        sr_xdp_print_stats(sr->transport->state, stderr);
+        sr_xdp_close(sr->transport->state);
+        sr->transport->state = 0;
+    }
+} /* -- xdp_close -- */
+
+const struct sr_transport sr_xdp_transport =
+{
+    "xdp",
+    xdp_connect,
+    xdp_interfaces,
+    xdp_watch,
+    xdp_recv_burst,
+    xdp_send_burst,
+    xdp_print_stats,
+    xdp_close
+};
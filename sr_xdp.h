@@ -0,0 +1,122 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_xdp.h
+ *
+ * Description:
+ *
+ * AF_XDP data plane (-i xdp:ifname[=ip],...): like sr_afpacket.h, but
+ * frames come in through an XDP program that redirects everything arriving
+ * on the interface to an AF_XDP socket, so they never touch the kernel's
+ * network stack.
+ *
+ * Each interface gets its own UMEM, a block of SR_XDP_FRAMES frames shared
+ * with the kernel. Half of them sit in the fill ring waiting to be
+ * received into; the other half are ours to send from. Received frames
+ * are read in place from the RX ring, a whole ring's worth per wakeup, and
+ * go straight back to the fill ring once the router is done with them.
+ * Sends are copied into a free frame and queued on the TX ring, which is
+ * kicked once per burst; the completion ring hands sent frames back.
+ * With need-wakeup set, none of this costs a syscall per packet.
+ *
+ * The program is attached in generic (SKB) mode so it works on veth and any
+ * other device, in a plain network namespace. Generic mode always copies
+ * between the skb and the UMEM (XDP_COPY); true zero-copy needs a NIC
+ * driver with native AF_XDP support. Only queue 0 of each interface is
+ * bound, which is all a default veth has.
+ *
+ * Only built with "make XDP=1", which needs kernel headers from Linux 5.9
+ * or later (for BPF links); otherwise sr_xdp_open always fails.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_XDP_H
+#define SR_XDP_H
+
+#include <stdio.h>
+#include <pthread.h>
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#include "sr_protocol.h"
+
+#define SR_XDP_PORTS_MAX  8
+#define SR_XDP_FRAMES     4096          /* UMEM frames per interface */
+#define SR_XDP_FRAME_SZ   2048
+#define SR_XDP_RING_SZ    2048          /* every ring, power of two */
+#define SR_XDP_TX_BATCH   32            /* kick the kernel after this many */
+
+struct sr_instance;
+struct sr_loop;
+struct sr_frame;
+
+/* One of the four single-producer/single-consumer rings shared with the
+   kernel. cached_* are our copies of the other side's index. */
+struct sr_xdp_ring
+{
+    uint32_t* producer;
+    uint32_t* consumer;
+    uint32_t* flags;
+    void* descs;
+    uint32_t cached_prod;
+    uint32_t cached_cons;
+    void* map;
+    size_t map_sz;
+};
+
+struct sr_xdp_stats
+{
+    unsigned long rx_packets;
+    unsigned long rx_bytes;
+    unsigned long rx_batches;   /* wakeups that found frames */
+    unsigned long tx_packets;
+    unsigned long tx_bytes;
+    unsigned long tx_kicks;     /* sendto() calls */
+    unsigned long tx_full;      /* sends dropped, no free frame or TX slot */
+};
+
+struct sr_xdp_port
+{
+    char name[sr_IFACE_NAMELEN];
+    int ifindex;
+    int fd;                     /* AF_XDP socket */
+    int prog_fd;                /* XDP program */
+    int map_fd;                 /* XSKMAP it redirects through */
+    int link_fd;                /* attachment; closing it detaches */
+    uint8_t* umem;
+    struct sr_xdp_ring fill, comp, rx, tx;
+    uint64_t free_frames[SR_XDP_FRAMES / 2];  /* ours to send from */
+    unsigned int nfree;
+    unsigned int tx_pending;    /* queued since the last kick */
+    pthread_mutex_t tx_lock;    /* the ARP thread may send too */
+    struct sr_xdp_stats stats;
+};
+
+struct sr_xdp
+{
+    struct sr_instance* sr;
+    int corked;                 /* > 0 while an RX batch is handled */
+    int nports;
+    struct sr_xdp_port ports[SR_XDP_PORTS_MAX];
+};
+
+/* Open every interface in spec ("veth0,veth1=10.0.1.1"), attach the XDP
+   program and add it to the router's interface list. Needs CAP_NET_ADMIN
+   and CAP_BPF (or root). Returns 0 on error. */
+struct sr_xdp* sr_xdp_open(struct sr_instance* sr, const char* spec);
+void sr_xdp_close(struct sr_xdp* xdp);
+
+/* Have the event loop watch every interface. */
+int sr_xdp_watch(struct sr_xdp* xdp, struct sr_loop* loop);
+
+/* Without an event loop: wait up to timeout_ms for frames on any interface
+   and handle them. Returns 1 to keep going, -1 on error. */
+int sr_xdp_poll(struct sr_xdp* xdp, int timeout_ms);
+
+/* Send n frames, each out of its interface. Returns the number
+   sent. */
+int sr_xdp_send(struct sr_xdp* xdp, const struct sr_frame* frames, int n);
+
+void sr_xdp_print_stats(struct sr_xdp* xdp, FILE* fp);
+
+#endif /* -- SR_XDP_H -- */